@@ -59,6 +59,7 @@ extern char **environ;
 #define CONFIG_STATIC_TEMPLATE  "config.quicksand.XXXXXX"
 #define CONFIG_DYNAMIC_TEMPLATE "pps-and-such.quicksand.XXXXXX"
 #define LOG_FILE_TEMPLATE(x) "ls-" x ".log.XXXXXX"
+#define FRONTIER_FILE_FORMAT "ls-frontier-%u-%lu.bin"
 
 char *test_name = NULL;
 char *user_trace_dir = NULL;
@@ -75,6 +76,9 @@ bool dont_xabort_retry = false;
 bool retry_sets = false;
 bool weak_atomicity = false;
 bool verif_mode = false;
+bool optimal_dpor = false;
+bool random_delays = false;
+unsigned long random_depth = 0;
 
 void set_job_options(char *arg_test_name, char *arg_trace_dir,
 		     bool arg_verbose, bool arg_leave_logs,
@@ -82,7 +86,8 @@ void set_job_options(char *arg_test_name, char *arg_trace_dir,
 		     bool arg_pure_hb, bool arg_txn, bool arg_txn_abort_codes,
 		     bool arg_txn_dont_retry, bool arg_txn_retry_sets,
 		     bool arg_txn_weak_atomicity,
-		     bool arg_verif_mode,
+		     bool arg_verif_mode, bool arg_optimal_dpor,
+		     bool arg_random_delays, unsigned long arg_random_depth,
 		     bool arg_pathos)
 {
 	test_name = XSTRDUP(arg_test_name);
@@ -100,6 +105,9 @@ void set_job_options(char *arg_test_name, char *arg_trace_dir,
 	retry_sets = arg_txn_retry_sets;
 	weak_atomicity = arg_txn_weak_atomicity;
 	verif_mode = arg_verif_mode;
+	optimal_dpor = arg_optimal_dpor;
+	random_delays = arg_random_delays;
+	random_depth = arg_random_depth;
 }
 
 bool testing_pintos() { return pintos; }
@@ -114,6 +122,7 @@ struct job *new_job(struct pp_set *config, bool should_reproduce)
 	j->generation = compute_generation(config);
 	j->status = JOB_NORMAL;
 	j->should_reproduce = should_reproduce;
+	j->random = false;
 
 	RWLOCK_INIT(&j->stats_lock);
 	j->elapsed_branches = 0;
@@ -121,10 +130,14 @@ struct job *new_job(struct pp_set *config, bool should_reproduce)
 	human_friendly_time(0.0L, &j->estimate_elapsed);
 	human_friendly_time(0.0L, &j->estimate_eta);
 	j->estimate_eta_numeric = 0.0L;
+	j->memory_kb = 0;
 	j->cancelled = false;
 	j->complete = false;
 	j->timed_out = false;
 	j->kill_job = false;
+	j->suspend_job = false;
+	j->suspended = false;
+	j->frontier_filename = NULL;
 	j->log_filename = NULL;
 	j->trace_filename = NULL;
 	j->need_rerun = false;
@@ -139,6 +152,23 @@ struct job *new_job(struct pp_set *config, bool should_reproduce)
 	return j;
 }
 
+/* Random jobs can't verify anything, so never get to mark their PPs' data races
+ * as reproduced (or to be retried in smaller state spaces). */
+struct job *new_random_job(struct pp_set *config)
+{
+	struct job *j = new_job(config, false);
+	j->random = true;
+	return j;
+}
+
+/* the file may or may not exist (landslide removes it upon resuming) */
+static void remove_frontier_file(struct job *j)
+{
+	char path[BUF_SIZE];
+	scnprintf(path, BUF_SIZE, "%s/%s", LANDSLIDE_PATH, j->frontier_filename);
+	remove(path);
+}
+
 /* job thread main */
 static void *run_job(void *arg)
 {
@@ -166,6 +196,8 @@ static void *run_job(void *arg)
 	XWRITE(&j->config_static, "ICB=%d\n", use_icb ? 1 : 0);
 	XWRITE(&j->config_static, "PREEMPT_EVERYWHERE=%d\n", preempt_everywhere ? 1 : 0);
 	XWRITE(&j->config_static, "PURE_HAPPENS_BEFORE=%d\n", pure_hb ? 1 : 0);
+	/* without which optimal DPOR can't skip what it's already explored */
+	XWRITE(&j->config_static, "SLEEP_SETS=%d\n", optimal_dpor ? 1 : 0);
 
 	// XXX(#120): TEST_CASE must be defined before PPs are specified.
 	XWRITE(&j->config_dynamic, "TEST_CASE=%s\n", test_name);
@@ -183,6 +215,12 @@ static void *run_job(void *arg)
 	FOR_EACH_PP(pp, j->config) {
 		XWRITE(&j->config_dynamic, "%s\n", pp->config_str);
 	}
+	if (j->random) {
+		XWRITE(&j->config_dynamic, "exploration_strategy %s %lu\n",
+		       random_delays ? "delay" : "pct", random_depth);
+	} else if (optimal_dpor) {
+		XWRITE(&j->config_dynamic, "exploration_strategy optimal\n");
+	}
 
 	if (pathos) {
 		XWRITE(&j->config_dynamic, "%s smemalign\n", without);
@@ -395,6 +433,22 @@ static void *run_job(void *arg)
 		}
 	}
 
+	/* in case we get suspended (see cant_swap() in work.c); or were */
+	if (j->frontier_filename == NULL) {
+		char buf[BUF_SIZE];
+		scnprintf(buf, BUF_SIZE, FRONTIER_FILE_FORMAT, j->id, timestamp());
+		j->frontier_filename = XSTRDUP(buf);
+	}
+	XWRITE(&j->config_dynamic, "suspend_file %s\n", j->frontier_filename);
+	WRITE_LOCK(&j->stats_lock);
+	bool resuming = j->suspended;
+	j->suspended = false;
+	RW_UNLOCK(&j->stats_lock);
+	if (resuming) {
+		XWRITE(&j->config_dynamic, "resume_file %s\n",
+		       j->frontier_filename);
+	}
+
 	messaging_init(&mess, &j->config_static, &j->config_dynamic, j->id);
 
 	// XXX: Need to do this here so the parent can have the path into pebsim
@@ -422,11 +476,19 @@ static void *run_job(void *arg)
 		delete_file(&j->config_dynamic, true);
 		delete_file(&j->log_stdout, true);
 		delete_file(&j->log_stderr, true);
+		if (resuming) {
+			/* the suspended exploration won't be coming back now */
+			remove_frontier_file(j);
+		}
 		if (bug_in_subspace) {
 			WRITE_LOCK(&j->stats_lock);
 			j->complete = true;
 			j->cancelled = true;
 			RW_UNLOCK(&j->stats_lock);
+		} else if (resuming) {
+			WRITE_LOCK(&j->stats_lock);
+			j->timed_out = true;
+			RW_UNLOCK(&j->stats_lock);
 		}
 		LOCK(&j->lifecycle_lock);
 		j->status = JOB_DONE;
@@ -436,6 +498,10 @@ static void *run_job(void *arg)
 	}
 
 	WRITE_LOCK(&j->stats_lock);
+	if (j->log_filename != NULL) {
+		/* kept from before being suspended */
+		FREE(j->log_filename);
+	}
 	j->log_filename = XSTRDUP(j->log_stderr.filename);
 	j->need_rerun = false;
 	RW_UNLOCK(&j->stats_lock);
@@ -502,7 +568,8 @@ static void *run_job(void *arg)
 	delete_file(&j->log_stderr, should_delete);
 
 	WRITE_LOCK(&j->stats_lock);
-	j->complete = true;
+	bool suspended = j->suspended;
+	j->complete = !suspended;
 	if (j->need_rerun) {
 		j->cancelled = true;
 	}
@@ -511,8 +578,14 @@ static void *run_job(void *arg)
 		j->log_filename = NULL;
 	}
 	RW_UNLOCK(&j->stats_lock);
+	if (!suspended) {
+		/* in case it crashed before it could resume */
+		remove_frontier_file(j);
+	}
 	LOCK(&j->lifecycle_lock);
-	j->status = JOB_DONE;
+	/* a suspended job is as good as blocked, only with nothing to wake up;
+	 * resuming it runs a new landslide instead (see resume_job()) */
+	j->status = suspended ? JOB_BLOCKED : JOB_DONE;
 	BROADCAST(&j->done_cvar);
 	UNLOCK(&j->lifecycle_lock);
 
@@ -562,11 +635,22 @@ MUST_CHECK bool wait_on_job(struct job *j)
 /* should be immediately followed by another call to wait_on */
 void resume_job(struct job *j)
 {
+	READ_LOCK(&j->stats_lock);
+	bool suspended = j->suspended;
+	RW_UNLOCK(&j->stats_lock);
+
 	LOCK(&j->lifecycle_lock);
 	assert(j->status == JOB_BLOCKED);
 	j->status = JOB_NORMAL;
-	SIGNAL(&j->blocking_cvar);
+	if (!suspended) {
+		SIGNAL(&j->blocking_cvar);
+	}
 	UNLOCK(&j->lifecycle_lock);
+
+	if (suspended) {
+		/* its old thread exited; landslide will pick up where it was */
+		start_job(j);
+	}
 }
 
 void print_job_stats(struct job *j, bool pending, bool blocked)
@@ -600,6 +684,15 @@ void print_job_stats(struct job *j, bool pending, bool blocked)
 			      j->fab_timestamp, j->fab_cputime);
 		}
 		PRINT(")\n");
+	} else if (j->random && !pending) {
+		/* no estimate to speak of; it runs until told to stop */
+		PRINT(COLOUR_BOLD "%sRANDOMIZED ", j->complete || j->timed_out ?
+		      COLOUR_YELLOW : COLOUR_MAGENTA);
+		PRINT("(%u interleaving%s tested; ", j->elapsed_branches,
+		      j->elapsed_branches == 1 ? "" : "s");
+		print_human_friendly_time(&j->estimate_elapsed);
+		PRINT(" elapsed%s)\n", j->complete || j->timed_out ?
+		      "; no bug found" : "");
 	} else if (j->timed_out) {
 		PRINT(COLOUR_BOLD COLOUR_YELLOW "TIMED OUT ");
 		PRINT("(%Lf%%; ETA ", j->estimate_proportion * 100);
@@ -623,14 +716,21 @@ void print_job_stats(struct job *j, bool pending, bool blocked)
 	} else if (j->elapsed_branches == 0) {
 		PRINT("Setting up...\n");
 	} else if (blocked) {
-		PRINT(COLOUR_DARK COLOUR_MAGENTA "Deferred... ");
+		PRINT(COLOUR_DARK COLOUR_MAGENTA "%s... ",
+		      j->suspended ? "Suspended" : "Deferred");
 		PRINT("(%Lf%%; ETA ", j->estimate_proportion * 100);
 		print_human_friendly_time(&j->estimate_eta);
+		if (j->memory_kb != 0 && !j->suspended) {
+			PRINT("; %lu MB", j->memory_kb / 1024);
+		}
 		PRINT(")\n");
 	} else {
 		PRINT(COLOUR_BOLD COLOUR_MAGENTA "Running ");
 		PRINT("(%Lf%%; ETA ", j->estimate_proportion * 100);
 		print_human_friendly_time(&j->estimate_eta);
+		if (j->memory_kb != 0) {
+			PRINT("; %lu MB", j->memory_kb / 1024);
+		}
 		if (use_icb) {
 			PRINT("; cur ICB bound %d", j->icb_current_bound);
 		}
@@ -46,6 +46,7 @@ struct job {
 	unsigned int id;
 	unsigned int generation; /* max among generations of pps + 1 */
 	bool should_reproduce;
+	bool random; /* explores randomly, never exhaustively (see option.c) */
 	/* static config should not change between jobs, and defines cpp macros
 	 * that cause landslide recompiles. dynamic config defines pps and such
 	 * and is interpreted more "at runtime" by the build glue, to avoid
@@ -63,11 +64,17 @@ struct job {
 	struct human_friendly_time estimate_elapsed;
 	struct human_friendly_time estimate_eta;
 	long double estimate_eta_numeric;
+	unsigned long memory_kb; /* held by all its processes; 0 if unknown */
 	/* job lifecycle */
 	bool cancelled;
 	bool complete;
 	bool timed_out;
 	bool kill_job;
+	/* like kill, but landslide saves its progress to disk first, to resume
+	 * from in a later run (in place of waking the blocked process) */
+	bool suspend_job;
+	bool suspended;
+	char *frontier_filename; /* relative to LANDSLIDE_PATH */
 	/* associated files */
 	char *log_filename;
 	char *trace_filename;
@@ -91,11 +98,13 @@ void set_job_options(char *test_name, char *trace_dir, bool verbose,
 		     bool preempt_everywhere, bool pure_hb,
 		     bool txn, bool txn_abort_codes, bool txn_dont_retry,
 		     bool txn_retry_sets, bool txn_weak_atomicity,
-		     bool veirf_mode, bool pathos);
+		     bool veirf_mode, bool optimal_dpor,
+		     bool random_delays, unsigned long random_depth, bool pathos);
 bool testing_pintos();
 bool testing_pathos();
 
 struct job *new_job(struct pp_set *config, bool should_reproduce);
+struct job *new_random_job(struct pp_set *config);
 void start_job(struct job *j);
 bool wait_on_job(struct job *j); /* true if job blocked, false if done */
 void resume_job(struct job *j);
@@ -70,6 +70,10 @@ int main(int argc, char **argv)
 	bool txn_retry_sets;
 	bool txn_weak_atomicity;
 	bool verif_mode;
+	bool optimal_dpor;
+	bool random_job;
+	bool random_delays;
+	unsigned long random_depth;
 	unsigned long progress_interval;
 
 	if (!get_options(argc, argv, test_name, BUF_SIZE, &max_time, &num_cpus,
@@ -79,7 +83,9 @@ int main(int argc, char **argv)
 			 &avoid_recompile,
 			 &txn, &txn_abort_codes, &txn_dont_retry,
 			 &txn_retry_sets, &txn_weak_atomicity,
-			 &verif_mode, &pathos, &progress_interval,
+			 &verif_mode, &optimal_dpor,
+			 &random_job, &random_delays, &random_depth,
+			 &pathos, &progress_interval,
 			 trace_dir, BUF_SIZE, &eta_factor, &eta_threshold)) {
 		usage(strcmp(argv[0], "./landslide-id") == 0 ? "./landslide" : argv[0]);
 		exit(ID_EXIT_USAGE);
@@ -89,7 +95,7 @@ int main(int argc, char **argv)
 
 	DBG("will run for at most %lu seconds\n", max_time);
 
-	set_job_options(test_name, trace_dir, verbose, leave_logs, pintos, use_icb, preempt_everywhere, pure_hb, txn, txn_abort_codes, txn_dont_retry, txn_retry_sets, txn_weak_atomicity, verif_mode, pathos);
+	set_job_options(test_name, trace_dir, verbose, leave_logs, pintos, use_icb, preempt_everywhere, pure_hb, txn, txn_abort_codes, txn_dont_retry, txn_retry_sets, txn_weak_atomicity, verif_mode, optimal_dpor, random_delays, random_depth, pathos);
 	init_signal_handling();
 	start_time(max_time * 1000000, num_cpus);
 
@@ -104,6 +110,9 @@ int main(int argc, char **argv)
 		}
 	}
 	add_work(new_job(create_pp_set(PRIORITY_MUTEX_LOCK | PRIORITY_MUTEX_UNLOCK | PRIORITY_CLI | PRIORITY_STI), true));
+	if (random_job) {
+		add_work(new_random_job(create_pp_set(PRIORITY_MUTEX_LOCK | PRIORITY_MUTEX_UNLOCK | PRIORITY_CLI | PRIORITY_STI)));
+	}
 	start_work(num_cpus, progress_interval);
 	wait_to_finish_work();
 	print_live_data_race_pps();
@@ -61,6 +61,7 @@ struct input_message {
 		FOUND_A_BUG = 3,
 		SHOULD_CONTINUE = 4,
 		ASSERT_FAILED = 5,
+		SUSPENDED = 6,
 	} tag;
 
 	union {
@@ -81,6 +82,7 @@ struct input_message {
 			long double total_usecs;
 			long double elapsed_usecs;
 			unsigned int icb_cur_bound;
+			unsigned long memory_kb;
 		} estimate;
 
 		struct {
@@ -100,6 +102,7 @@ struct output_message {
 		SHOULD_CONTINUE_REPLY = 0,
 		SUSPEND_TIME = 1,
 		RESUME_TIME = 2,
+		SHOULD_SUSPEND_REPLY = 3,
 	} tag;
 	bool value;
 };
@@ -236,7 +239,7 @@ extern unsigned long eta_threshold;
 static void handle_estimate(struct messaging_state *state, struct job *j,
 			    long double proportion, unsigned int elapsed_branches,
 			    long double total_usecs, long double elapsed_usecs,
-			    unsigned int icb_bound)
+			    unsigned int icb_bound, unsigned long memory_kb)
 {
 	unsigned int total_branches =
 	    (unsigned int)((long double)elapsed_branches / proportion);
@@ -248,6 +251,7 @@ static void handle_estimate(struct messaging_state *state, struct job *j,
 	human_friendly_time(elapsed_usecs, &j->estimate_elapsed);
 	j->estimate_eta_numeric = remaining_usecs;
 	human_friendly_time(remaining_usecs, &j->estimate_eta);
+	j->memory_kb = memory_kb;
 	DBG("[JOB %d] progress: %u/%u brs (%Lf%%), ", j->id,
 	    elapsed_branches, total_branches, proportion * 100);
 	if (use_icb) {
@@ -270,7 +274,9 @@ static void handle_estimate(struct messaging_state *state, struct job *j,
 	reply.tag = SUSPEND_TIME;
 
 	assert(eta_factor >= 1);
-	if (elapsed_branches >= eta_threshold && time_left > HOMESTRETCH &&
+	/* (Randomized jobs have no ETA to speak of, and so never block.) */
+	if (!j->random &&
+	    elapsed_branches >= eta_threshold && time_left > HOMESTRETCH &&
 	    (eta_overflow || time_left * eta_factor < eta) &&
 	    should_work_block(j)) {
 		WARN("[JOB %d] State space too big (%u brs elapsed, "
@@ -299,8 +305,10 @@ extern bool logging_active;
 extern bool avoid_recompile;
 #include <immintrin.h>
 
-static bool handle_should_continue(struct job *j)
+/* if returning false, *suspend says whether to save progress to disk first */
+static bool handle_should_continue(struct job *j, bool *suspend)
 {
+	*suspend = false;
 	if (hot_status == 0) {
 		/* reached end of 1st branch before a progress report was issued
 		 * so probably on a "hot start"; this may race with the other
@@ -335,6 +343,9 @@ static bool handle_should_continue(struct job *j)
 		j->timed_out = true;
 		RW_UNLOCK(&j->stats_lock);
 		return false;
+	} else if (j->random && only_random_work_left()) {
+		DBG("Stopping -- only randomized jobs left.\n");
+		return false;
 	} else if (verif_mode && j->config->size < pp_population()) {
 		WARN("Abandoning this job for greener pastures.\n");
 		WRITE_LOCK(&j->stats_lock);
@@ -344,12 +355,16 @@ static bool handle_should_continue(struct job *j)
 	} else {
 		READ_LOCK(&j->stats_lock);
 		bool should_kill_job = j->kill_job;
+		bool should_suspend_job = j->suspend_job;
 		RW_UNLOCK(&j->stats_lock);
-		if (should_kill_job) {
-			DBG("Aborting -- can't swap!\n");
+		if (should_kill_job || should_suspend_job) {
+			DBG("%s -- can't swap!\n",
+			    should_kill_job ? "Aborting" : "Suspending");
+			/* until it says it suspended successfully, anyway */
 			WRITE_LOCK(&j->stats_lock);
 			j->cancelled = true;
 			RW_UNLOCK(&j->stats_lock);
+			*suspend = !should_kill_job;
 			return false;
 		} else {
 			return true;
@@ -357,6 +372,17 @@ static bool handle_should_continue(struct job *j)
 	}
 }
 
+static void handle_suspended(struct job *j)
+{
+	DBG("[JOB %d] Suspended to %s.\n", j->id, j->frontier_filename);
+	WRITE_LOCK(&j->stats_lock);
+	assert(j->suspend_job && "suspended without being asked to");
+	j->suspend_job = false;
+	j->suspended = true;
+	j->cancelled = false;
+	RW_UNLOCK(&j->stats_lock);
+}
+
 static void handle_crash(struct job *j, struct input_message *m)
 {
 	WRITE_LOCK(&j->stats_lock);
@@ -465,7 +491,8 @@ void talk_to_child(struct messaging_state *state, struct job *j)
 					m.content.estimate.elapsed_branches,
 					m.content.estimate.total_usecs,
 					m.content.estimate.elapsed_usecs,
-					m.content.estimate.icb_cur_bound);
+					m.content.estimate.icb_cur_bound,
+					m.content.estimate.memory_kb);
 		} else if (m.tag == FOUND_A_BUG) {
 			move_trace_file(m.content.bug.trace_filename);
 			// NB. Harmless if/then/else race; could cause simply
@@ -512,9 +539,13 @@ void talk_to_child(struct messaging_state *state, struct job *j)
 			}
 		} else if (m.tag == SHOULD_CONTINUE) {
 			struct output_message reply;
-			reply.tag = SHOULD_CONTINUE_REPLY;
-			reply.value = !handle_should_continue(j);
+			bool suspend;
+			reply.value = !handle_should_continue(j, &suspend);
+			reply.tag = suspend ?
+				SHOULD_SUSPEND_REPLY : SHOULD_CONTINUE_REPLY;
 			send(state->output_pipe.fd, &reply);
+		} else if (m.tag == SUSPENDED) {
+			handle_suspended(j);
 		} else if (m.tag == ASSERT_FAILED) {
 			handle_crash(j, &m);
 			break;
@@ -61,6 +61,11 @@
  * to stabilize somewhat, before applying the above heuristic. */
 #define DEFAULT_ETA_STABILITY_THRESHOLD "32"
 
+/* A randomized job finds any bug of this depth (i.e., needing this many
+ * priority changes/delays) with probability inversely polynomial in the number
+ * of threads and steps. Most concurrency bugs are very shallow. */
+#define DEFAULT_RANDOM_DEPTH "3"
+
 struct cmdline_option {
 	char flag;
 	bool requires_arg;
@@ -151,7 +156,8 @@ bool get_options(int argc, char **argv, char *test_name, unsigned int test_name_
 		 bool *avoid_recompile,
 		 bool *txn, bool *txn_abort_codes, bool *txn_dont_retry,
 		 bool *txn_retry_sets, bool *txn_weak_atomicity,
-		 bool *verif_mode,
+		 bool *verif_mode, bool *optimal_dpor,
+		 bool *random_job, bool *random_delays, unsigned long *random_depth,
 		 bool *pathos, unsigned long *progress_report_interval,
 		 char *trace_dir, unsigned int trace_dir_len,
 		 unsigned long *eta_factor, unsigned long *eta_thresh)
@@ -209,6 +215,7 @@ bool get_options(int argc, char **argv, char *test_name, unsigned int test_name_
 	DEF_CMDLINE_FLAG('R', true, txn_retry_sets, "Retry set reduction (incompatible with -A/-S)");
 	DEF_CMDLINE_FLAG('W', true, txn_weak_atomicity, "Weak atomicity (non-txn can preempt txn) (requires -S)");
 	DEF_CMDLINE_FLAG('M', false, verif_mode, "Optimize for faster verification (maximal state space only)");
+	DEF_CMDLINE_FLAG('D', true, optimal_dpor, "Use optimal DPOR (source sets & wakeup trees) instead of classic");
 #undef DEF_CMDLINE_FLAG
 
 #define DEF_CMDLINE_OPTION(flagname, secret, varname, descr, value)	\
@@ -242,6 +249,10 @@ bool get_options(int argc, char **argv, char *test_name, unsigned int test_name_
 	 * Used by wrapper file to tie together which bug traces go where, etc.,
 	 * for purpose of snapshotting. */
 	DEF_CMDLINE_OPTION('L', true, log_name, "Log filename", NULL);
+	/* Randomized exploration (see pct.h in landslide) can't verify anything,
+	 * but can find deep bugs in state spaces too big to finish. */
+	DEF_CMDLINE_OPTION('r', true, random_mode, "Also run a randomized job (\"pct\" or \"delay\") on all PPs", "");
+	DEF_CMDLINE_OPTION('b', true, random_depth, "Bug depth for -r (priority changes or delays)", DEFAULT_RANDOM_DEPTH);
 #undef DEF_CMDLINE_OPTION
 
 	ready = true;
@@ -339,6 +350,22 @@ bool get_options(int argc, char **argv, char *test_name, unsigned int test_name_
 		options_valid = false;
 	}
 
+	*random_depth = strtol(arg_random_depth, NULL, 0);
+	if (errno != 0) {
+		ERR("Random bug depth must be a number (got '%s')\n", arg_random_depth);
+		options_valid = false;
+	} else if (*random_depth == 0) {
+		ERR("Random bug depth must be >= 1\n");
+		options_valid = false;
+	}
+
+	*random_job = arg_random_mode[0] != '\0';
+	*random_delays = strcmp(arg_random_mode, "delay") == 0;
+	if (*random_job && !*random_delays && strcmp(arg_random_mode, "pct") != 0) {
+		ERR("Randomized job must be \"pct\" or \"delay\" (got '%s')\n", arg_random_mode);
+		options_valid = false;
+	}
+
 	if (arg_icb && !arg_control_experiment && !arg_verif_mode) {
 		ERR("Iterative Deepening & ICB not supported at same time.\n");
 		WARN("Perhaps either '-C -I' or '-M -I' may suit your needs?\n");
@@ -352,6 +379,14 @@ bool get_options(int argc, char **argv, char *test_name, unsigned int test_name_
 		ERR("Verification mode not supported without iterative deepening.\n");
 		options_valid = false;
 	}
+	if (arg_optimal_dpor && (arg_icb || arg_txn)) {
+		ERR("-D (optimal DPOR) incompatible with -I (ICB) and -X (txn)\n");
+		options_valid = false;
+	}
+	if (*random_job && (arg_icb || arg_txn)) {
+		ERR("-r (randomized job) incompatible with -I (ICB) and -X (txn)\n");
+		options_valid = false;
+	}
 	if (arg_pintos && arg_pathos) {
 		ERR("Make up your mind (pintos/pathos)!\n");
 		options_valid = false;
@@ -454,6 +489,8 @@ bool get_options(int argc, char **argv, char *test_name, unsigned int test_name_
 	*txn_retry_sets = arg_txn_retry_sets;
 	*txn_weak_atomicity = arg_txn_weak_atomicity;
 	*verif_mode = arg_verif_mode;
+	*optimal_dpor = arg_optimal_dpor;
+	/* random_job, random_delays, random_depth set above */
 
 	return options_valid;
 }
@@ -42,7 +42,8 @@ bool get_options(int argc, char **argv, char *test_name, unsigned int test_name_
 		 bool *avoid_recompile,
 		 bool *txn, bool *txn_abort_codes, bool *txn_dont_retry,
 		 bool *txn_retry_sets, bool *txn_weak_atomicity,
-		 bool *verif_mode,
+		 bool *verif_mode, bool *optimal_dpor,
+		 bool *random_job, bool *random_delays, unsigned long *random_depth,
 		 bool *pathos, unsigned long *progress_report_interval,
 		 char *trace_dir, unsigned int trace_dir_len,
 		 unsigned long *eta_factor, unsigned long *eta_thresh);
@@ -164,6 +164,42 @@ bool work_already_exists(struct pp_set *new_set)
 	return result;
 }
 
+static bool any_exhaustive_work_on(job_list_t *q, bool running)
+{
+	struct job **j;
+	unsigned int i;
+	ARRAY_LIST_FOREACH(q, i, j) {
+		if ((*j)->random) {
+			continue;
+		} else if (!running) {
+			return true;
+		}
+		/* the running list also holds finished jobs */
+		READ_LOCK(&(*j)->stats_lock);
+		bool done = (*j)->complete || (*j)->cancelled || (*j)->timed_out;
+		RW_UNLOCK(&(*j)->stats_lock);
+		if (!done) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Randomized jobs never finish on their own, so they stop once no exhaustive
+ * job is left to keep quicksand running (or else would spend all the time). */
+bool only_random_work_left()
+{
+	bool result = true;
+
+	LOCK(&workqueue_lock);
+	if (result) result = !any_exhaustive_work_on(&workqueue, false);
+	if (result) result = !any_exhaustive_work_on(&running_or_done_jobs, true);
+	if (result) result = !any_exhaustive_work_on(&blocked_jobs, false);
+	UNLOCK(&workqueue_lock);
+
+	return result;
+}
+
 /* returns NULL if no work is available */
 static struct job *get_work(unsigned long wq_id, bool *was_blocked)
 {
@@ -318,7 +354,8 @@ static void process_work(struct job *j, bool was_blocked)
 			if (need_rerun) {
 				WARN("[JOB %d] failed on branch 1, needs rerun\n",
 				     j->id);
-				add_work(new_job(j->config, j->should_reproduce));
+				add_work(j->random ? new_random_job(j->config) :
+					 new_job(j->config, j->should_reproduce));
 			} else
 			/* Job ran to completion. */
 			/* Don't let "small" jobs mark DRs as verified: they're
@@ -410,12 +447,49 @@ static bool get_ram_usage(unsigned long *totalram, unsigned long *availram)
 }
 
 #define RAM_USAGE_DANGERZONE 90 /* percent */
-#define KILL_DEFERRED_JOBS   50 /* percent */
+#define RAM_USAGE_TARGET 80 /* percent; what suspending jobs aims to get under */
+#define SUSPEND_DEFERRED_JOBS 50 /* percent, of those whose memory is unknown */
+
+static bool job_is_suspended(struct job *j)
+{
+	READ_LOCK(&j->stats_lock);
+	bool suspended = j->suspended;
+	RW_UNLOCK(&j->stats_lock);
+	return suspended;
+}
+
+/* Returns the index in blocked_jobs of the deferred job still in memory which
+ * holds the most of it, or if none has reported that yet, the first one, whose
+ * ETA is the worst (we're least likely to ever resume those ngrmadly). Returns
+ * the queue's size if there are none. Call with workqueue lock held. */
+static unsigned int pick_suspend_victim(unsigned long *victim_kb)
+{
+	struct job **j;
+	unsigned int i;
+	unsigned int victim = ARRAY_LIST_SIZE(&blocked_jobs);
+	*victim_kb = 0;
+	ARRAY_LIST_FOREACH(&blocked_jobs, i, j) {
+		READ_LOCK(&(*j)->stats_lock);
+		bool suspended = (*j)->suspended;
+		unsigned long kb = (*j)->memory_kb;
+		RW_UNLOCK(&(*j)->stats_lock);
+		if (!suspended && (victim == ARRAY_LIST_SIZE(&blocked_jobs) ||
+				   kb > *victim_kb)) {
+			victim = i;
+			*victim_kb = kb;
+		}
+	}
+	return victim;
+}
 
 static void cant_swap() /* called with workqueue lock held */
 {
 	/* Too many suspended deferred jobs can hog memory. If the machine is in
-	 * danger of swapping, kill off half the */
+	 * danger of swapping, suspend the biggest of the ones still in memory to
+	 * disk, until enough is freed (or, not knowing how big they are, half
+	 * of them); they'll pick up from there (in a fresh process) if ever
+	 * rescheduled. Each job's size is as of its last progress report, which
+	 * for a deferred one is up to date, it having stopped since. */
 	unsigned long totalram, availram;
 	if (!get_ram_usage(&totalram, &availram)) {
 		WARN("can't swap, making bad decisions\n");
@@ -426,34 +500,58 @@ static void cant_swap() /* called with workqueue lock held */
 	if (availram > totalram * (100 - RAM_USAGE_DANGERZONE) / 100) {
 		return;
 	}
+	unsigned long need_kb =
+		(totalram * (100 - RAM_USAGE_TARGET) / 100 - availram) / 1024;
 
-	WARN("Killing %d%% of deferred jobs to avoid swapping...\n",
-	     KILL_DEFERRED_JOBS);
+	WARN("Suspending deferred jobs to disk to free %lu MB and avoid "
+	     "swapping...\n", need_kb / 1024);
 
-	unsigned int num_to_kill =
-		ARRAY_LIST_SIZE(&blocked_jobs) * KILL_DEFERRED_JOBS / 100;
+	struct job **j;
+	unsigned int i;
+	unsigned int num_in_memory = 0;
+	ARRAY_LIST_FOREACH(&blocked_jobs, i, j) {
+		if (!job_is_suspended(*j)) {
+			num_in_memory++;
+		}
+	}
+	unsigned int max_blind = num_in_memory * SUSPEND_DEFERRED_JOBS / 100;
+	unsigned int num_blind = 0;
+	unsigned long freed_kb = 0;
 
-	for (unsigned int i = 0; i < num_to_kill; i++) {
+	while (freed_kb < need_kb) {
+		unsigned long victim_kb;
+		i = pick_suspend_victim(&victim_kb);
 		/* check for race with all blocked jobs waking */
-		if (ARRAY_LIST_SIZE(&blocked_jobs) == 0) {
+		if (i == ARRAY_LIST_SIZE(&blocked_jobs)) {
 			break;
+		} else if (victim_kb == 0) {
+			if (num_blind == max_blind) {
+				break;
+			}
+			num_blind++;
 		}
-		/* jobs with the worst ETAs live at the front of the queue;
-		 * we're least likely to ever resume those ngrmadly. */
-		struct job *victim = *ARRAY_LIST_GET(&blocked_jobs, 0);
-		ARRAY_LIST_REMOVE(&blocked_jobs, 0);
+		freed_kb += victim_kb;
+
+		struct job *victim = *ARRAY_LIST_GET(&blocked_jobs, i);
+		ARRAY_LIST_REMOVE(&blocked_jobs, i);
 		ARRAY_LIST_APPEND(&running_or_done_jobs, victim);
+		DBG("[JOB %d] suspending to free %lu MB\n", victim->id,
+		    victim_kb / 1024);
 
 		UNLOCK(&workqueue_lock);
 
-		/* wake the job but set its kill flag so its next should_abort
+		/* wake the job but set its suspend flag so its next should_abort
 		 * message returns true before any more branches execute. */
 		WRITE_LOCK(&victim->stats_lock);
-		victim->kill_job = true;
+		victim->suspend_job = true;
 		RW_UNLOCK(&victim->stats_lock);
 		resume_job(victim);
 		if (wait_on_job(victim)) {
-			assert(0 && "can't swap, eating stuff you make me chew");
+			/* saved to disk and exited; back in line it goes. If it
+			 * couldn't be (no room on disk?), it died like in the
+			 * olden days. */
+			assert(job_is_suspended(victim));
+			move_job_to_blocked_queue(victim);
 		}
 
 		LOCK(&workqueue_lock);
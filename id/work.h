@@ -39,6 +39,7 @@ void add_work(struct job *j);
 void signal_work();
 bool should_work_block(struct job *j);
 bool work_already_exists(struct pp_set *new_set);
+bool only_random_work_left();
 void start_work(unsigned long num_cpus, unsigned long progress_report_interval);
 void wait_to_finish_work();
 
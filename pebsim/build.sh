@@ -266,7 +266,7 @@ if [ ! -z "$QUICKSAND_CONFIG_DYNAMIC" ]; then
 	# ./landslide defines QUICKSAND_CONFIG_TEMP as a temp file to use here
 	[ ! -z "$QUICKSAND_CONFIG_TEMP" ] || die "failed make temp file for PP config"
 
-	# commands are K, U, DR, I, and O.
+	# commands are K, U, DR, I, O, S, R, and E.
 	function within_function {
 		echo "K 0x`get_func $1` 0x`get_func_end $1` 1" >> "$QUICKSAND_CONFIG_TEMP" || die "couldn't write to $QUICKSAND_CONFIG_TEMP"
 	}
@@ -291,6 +291,15 @@ if [ ! -z "$QUICKSAND_CONFIG_DYNAMIC" ]; then
 	function output_pipe {
 		echo "O $1" >> "$QUICKSAND_CONFIG_TEMP" || die "couldn't write to $QUICKSAND_CONFIG_TEMP"
 	}
+	function suspend_file {
+		echo "S $1" >> "$QUICKSAND_CONFIG_TEMP" || die "couldn't write to $QUICKSAND_CONFIG_TEMP"
+	}
+	function resume_file {
+		echo "R $1" >> "$QUICKSAND_CONFIG_TEMP" || die "couldn't write to $QUICKSAND_CONFIG_TEMP"
+	}
+	function exploration_strategy {
+		echo "E $*" >> "$QUICKSAND_CONFIG_TEMP" || die "couldn't write to $QUICKSAND_CONFIG_TEMP"
+	}
 	msg "Processing dynamic quicksand PPs..."
 	source "$QUICKSAND_CONFIG_DYNAMIC"
 fi
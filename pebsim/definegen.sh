@@ -106,6 +106,7 @@ function disk_io_func {
 		die "disk_io_func needs an arg: got \"$1\""
 	fi
 	DISK_IO_FNS="${DISK_IO_FNS} { 0x`get_func $1`, 0x`get_func_end $1` },"
+	ANNOTATED_EIPS="${ANNOTATED_EIPS} `get_func $1` `get_func_end $1`"
 }
 
 STARTING_THREADS=
@@ -118,6 +119,17 @@ function starting_threads {
 	STARTING_THREADS="${STARTING_THREADS} add_thread(s, $1, $2);"
 }
 
+# Every address kernel_specifics.c or user_specifics.c compares the eip against
+# (exactly; not ranges). landslide's annotations.c turns these into a table so
+# the state machines can skip the whole predicate chain for unannotated eips.
+ANNOTATED_EIPS=
+function define_eip {
+	echo "#define $1 0x$2"
+	if [ ! -z "$2" ]; then
+		ANNOTATED_EIPS="${ANNOTATED_EIPS} $2"
+	fi
+}
+
 #############################
 #### Reading user config ####
 #############################
@@ -152,6 +164,9 @@ TABULAR_TRACE=0
 ALLOW_LOCK_HANDOFF=0
 ICB=0
 ICB_START_BOUND=1
+TIMETRAVEL_CHECKPOINT_INTERVAL=1
+TIMETRAVEL_PARALLEL_LINES=1
+TIMETRAVEL_SNAPSHOTS=0
 OBFUSCATED_KERNEL=0
 BUG_ON_THREADS_WEDGED=1
 PINTOS_KERNEL=
@@ -163,6 +178,9 @@ TESTING_MUTEXES=0
 DR_PPS_RESPECT_WITHIN_FUNCTIONS=0
 PREEMPT_EVERYWHERE=0
 PURE_HAPPENS_BEFORE=0
+SLEEP_SETS=0
+STATE_FINGERPRINTS=0
+STATE_FINGERPRINTS_UNSAFE=0
 HTM=0
 HTM_ABORT_CODES=0
 HTM_DONT_RETRY=0
@@ -282,37 +300,37 @@ else
 	fi
 fi
 
-echo "#define GUEST_TIMER_WRAP_ENTER     0x`get_func $TIMER_WRAPPER`"
-echo "#define GUEST_TIMER_WRAP_EXIT      0x$TIMER_WRAP_EXIT"
+define_eip GUEST_TIMER_WRAP_ENTER     "`get_func $TIMER_WRAPPER`"
+define_eip GUEST_TIMER_WRAP_EXIT      "$TIMER_WRAP_EXIT"
 
 # XXX: this is not as general as it should be..
-echo "#define GUEST_CONTEXT_SWITCH_ENTER 0x`get_func $CONTEXT_SWITCH`"
-echo "#define GUEST_CONTEXT_SWITCH_EXIT  0x`get_func_ret $CONTEXT_SWITCH`"
+define_eip GUEST_CONTEXT_SWITCH_ENTER "`get_func $CONTEXT_SWITCH`"
+define_eip GUEST_CONTEXT_SWITCH_EXIT  "`get_func_ret $CONTEXT_SWITCH`"
 if [ ! -z "$CONTEXT_SWITCH_RETURN" ]; then
-	echo "#define GUEST_CONTEXT_SWITCH_EXIT0 0x`get_func_ret $CONTEXT_SWITCH_RETURN`"
+	define_eip GUEST_CONTEXT_SWITCH_EXIT0 "`get_func_ret $CONTEXT_SWITCH_RETURN`"
 fi
 
 if [ ! -z "$CONTEXT_SWITCH_2" ]; then
-	echo "#define GUEST_CONTEXT_SWITCH_ENTER2 0x`get_func $CONTEXT_SWITCH2`"
-	echo "#define GUEST_CONTEXT_SWITCH_EXIT2  0x`get_func_ret $CONTEXT_SWITCH2`"
+	define_eip GUEST_CONTEXT_SWITCH_ENTER2 "`get_func $CONTEXT_SWITCH2`"
+	define_eip GUEST_CONTEXT_SWITCH_EXIT2  "`get_func_ret $CONTEXT_SWITCH2`"
 fi
 
 echo
 
 # Readline
 if [ -z "$PINTOS_KERNEL" ]; then
-	echo "#define GUEST_READLINE_WINDOW_ENTER 0x`get_func $READLINE`"
-	echo "#define GUEST_READLINE_WINDOW_EXIT 0x`get_func_ret $READLINE`"
+	define_eip GUEST_READLINE_WINDOW_ENTER "`get_func $READLINE`"
+	define_eip GUEST_READLINE_WINDOW_EXIT "`get_func_ret $READLINE`"
 fi
 
 # Exec, only required if testing userspace
 if [ ! -z "$EXEC" ]; then
-	echo "#define GUEST_EXEC_ENTER 0x`get_func $EXEC`"
+	define_eip GUEST_EXEC_ENTER "`get_func $EXEC`"
 fi
 
 if [ ! -z "$YIELD" ]; then
-	echo "#define GUEST_YIELD_ENTER 0x`get_func $YIELD`"
-	echo "#define GUEST_YIELD_EXIT  0x`get_func_ret $YIELD`"
+	define_eip GUEST_YIELD_ENTER "`get_func $YIELD`"
+	define_eip GUEST_YIELD_EXIT  "`get_func_ret $YIELD`"
 fi
 
 # Don't poison freed blocks
@@ -320,7 +338,7 @@ if [ ! -z "$SFREE" ]; then
 	if [ ! -z "$MEMSET" ]; then
 		POISON_FREE_CALL_ADDR=`objdump -d "$KERNEL_IMG" | grep -A10000 "<$SFREE>:" | grep -m 1 -B10000 "^$" | grep -m 1 "call.*<$MEMSET>" | cut -d":" -f1 | sed 's/ //g'`
 		if [ ! -z "$POISON_FREE_CALL_ADDR" ]; then
-			echo "#define POISON_FREE_CALL_ADDR 0x$POISON_FREE_CALL_ADDR"
+			define_eip POISON_FREE_CALL_ADDR "$POISON_FREE_CALL_ADDR"
 		fi
 	fi
 fi
@@ -356,19 +374,19 @@ fi
 #### Dynamic memory allocation ####
 ###################################
 
-echo "#define GUEST_LMM_ALLOC_ENTER      0x`get_func $LMM_ALLOC`"
-echo "#define GUEST_LMM_ALLOC_EXIT       0x`get_func_ret $LMM_ALLOC`"
+define_eip GUEST_LMM_ALLOC_ENTER      "`get_func $LMM_ALLOC`"
+define_eip GUEST_LMM_ALLOC_EXIT       "`get_func_ret $LMM_ALLOC`"
 echo "#define GUEST_LMM_ALLOC_SIZE_ARGNUM $LMM_ALLOC_SIZE_ARGNUM"
 if [ ! -z "$LMM_ALLOC_GEN" ]; then
-	echo "#define GUEST_LMM_ALLOC_GEN_ENTER  0x`get_func $LMM_ALLOC_GEN`"
-	echo "#define GUEST_LMM_ALLOC_GEN_EXIT   0x`get_func_ret $LMM_ALLOC_GEN`"
+	define_eip GUEST_LMM_ALLOC_GEN_ENTER  "`get_func $LMM_ALLOC_GEN`"
+	define_eip GUEST_LMM_ALLOC_GEN_EXIT   "`get_func_ret $LMM_ALLOC_GEN`"
 	echo "#define GUEST_LMM_ALLOC_GEN_SIZE_ARGNUM $LMM_ALLOC_GEN_SIZE_ARGNUM"
 fi
-echo "#define GUEST_LMM_FREE_ENTER       0x`get_func $LMM_FREE`"
-echo "#define GUEST_LMM_FREE_EXIT        0x`get_func_ret $LMM_FREE`"
+define_eip GUEST_LMM_FREE_ENTER       "`get_func $LMM_FREE`"
+define_eip GUEST_LMM_FREE_EXIT        "`get_func_ret $LMM_FREE`"
 echo "#define GUEST_LMM_FREE_BASE_ARGNUM $LMM_FREE_BASE_ARGNUM"
-echo "#define GUEST_LMM_INIT_ENTER 0x`get_func $LMM_INIT`"
-echo "#define GUEST_LMM_INIT_EXIT 0x`get_func_ret $LMM_INIT`"
+define_eip GUEST_LMM_INIT_ENTER "`get_func $LMM_INIT`"
+define_eip GUEST_LMM_INIT_EXIT "`get_func_ret $LMM_INIT`"
 
 # There's another allocator in pintos. We gotta model both of em.
 if [ ! -z "$PINTOS_KERNEL" ]; then
@@ -378,14 +396,14 @@ if [ ! -z "$PINTOS_KERNEL" ]; then
 	# echo "#define GUEST_PALLOC_INIT_EXIT 0x`get_func_ret palloc_init`"
 
 	# palloc_get_page just wraps palloc_get_multiple
-	echo "#define GUEST_PALLOC_ALLOC_ENTER 0x`get_func palloc_get_multiple`"
-	echo "#define GUEST_PALLOC_ALLOC_EXIT 0x`get_func_ret palloc_get_multiple`"
+	define_eip GUEST_PALLOC_ALLOC_ENTER "`get_func palloc_get_multiple`"
+	define_eip GUEST_PALLOC_ALLOC_EXIT "`get_func_ret palloc_get_multiple`"
 	echo "#define GUEST_PALLOC_ALLOC_SIZE_ARGNUM 2"
 	echo "#define GUEST_PALLOC_ALLOC_SIZE_FACTOR 4096"
 
 	# palloc_free_page just wraps palloc_free_multiple
-	echo "#define GUEST_PALLOC_FREE_ENTER 0x`get_func palloc_free_multiple`"
-	echo "#define GUEST_PALLOC_FREE_EXIT 0x`get_func_ret palloc_free_multiple`"
+	define_eip GUEST_PALLOC_FREE_ENTER "`get_func palloc_free_multiple`"
+	define_eip GUEST_PALLOC_FREE_EXIT "`get_func_ret palloc_free_multiple`"
 	echo "#define GUEST_PALLOC_FREE_BASE_ARGNUM 1"
 fi
 
@@ -422,17 +440,36 @@ if [ "$PURE_HAPPENS_BEFORE" = "1" ]; then
 	echo "#define PURE_HAPPENS_BEFORE"
 fi
 
+if [ "$SLEEP_SETS" = "1" ]; then
+	if [ "$ICB" = "1" -o "$HTM_ABORT_SETS" = "1" ]; then
+		die "SLEEP_SETS is incompatible with ICB and HTM_ABORT_SETS"
+	fi
+	echo "#define SLEEP_SETS"
+fi
+
+if [ "$STATE_FINGERPRINTS" = "1" ]; then
+	if [ "$ICB" = "1" -o "$HTM_ABORT_SETS" = "1" ]; then
+		die "STATE_FINGERPRINTS is incompatible with ICB and HTM_ABORT_SETS"
+	fi
+	if [ "$STATE_FINGERPRINTS_UNSAFE" = "1" ]; then
+		echo "#define STATE_FINGERPRINTS_UNSAFE"
+	elif [ "$SLEEP_SETS" != "1" ]; then
+		die "STATE_FINGERPRINTS needs SLEEP_SETS (or STATE_FINGERPRINTS_UNSAFE)"
+	fi
+	echo "#define STATE_FINGERPRINTS"
+fi
+
 if [ "$TRUSTED_THR_JOIN" = "1" ]; then
 	echo "#define TRUSTED_THR_JOIN"
 fi
 
 if [ "$HTM" = "1" ]; then
 	echo "#define HTM"
-	echo "#define HTM_XBEGIN     0x`get_user_func     _xbegin`"
-	echo "#define HTM_XBEGIN_END 0x`get_user_func_end _xbegin`"
-	echo "#define HTM_XEND       0x`get_user_func     _xend`"
-	echo "#define HTM_XABORT     0x`get_user_func     _xabort`"
-	echo "#define HTM_XTEST_END  0x`get_user_func_end _xtest`"
+	define_eip HTM_XBEGIN     "`get_user_func     _xbegin`"
+	define_eip HTM_XBEGIN_END "`get_user_func_end _xbegin`"
+	define_eip HTM_XEND       "`get_user_func     _xend`"
+	define_eip HTM_XABORT     "`get_user_func     _xabort`"
+	define_eip HTM_XTEST_END  "`get_user_func_end _xtest`"
 	if [ "$HTM_ABORT_CODES" = "1" ]; then
 		echo "#define HTM_ABORT_CODES"
 		if [ "$HTM_DONT_RETRY" = "1" ]; then
@@ -459,36 +496,36 @@ echo "#define GUEST_DATA_END 0x`get_sym .bss`"
 echo "#define GUEST_BSS_START 0x`get_sym .bss`"
 echo "#define GUEST_BSS_END GUEST_IMG_END"
 
-echo "#define GUEST_PANIC 0x`get_func $KERN_PANIC`"
-echo "#define GUEST_KERNEL_MAIN 0x`get_func $KERN_MAIN`"
+define_eip GUEST_PANIC "`get_func $KERN_PANIC`"
+define_eip GUEST_KERNEL_MAIN "`get_func $KERN_MAIN`"
 echo "#define GUEST_START 0x`get_func $KERN_START`"
 
 if [ ! -z "$KERN_HLT" ]; then
 	# Potentially pathos-only...
-	echo "#define GUEST_HLT_EXIT 0x`get_func_ret $KERN_HLT`"
+	define_eip GUEST_HLT_EXIT "`get_func_ret $KERN_HLT`"
 fi
 
 if [ ! -z "$PAGE_FAULT_WRAPPER" ];  then
-	echo "#define GUEST_PF_HANDLER 0x`get_sym $PAGE_FAULT_WRAPPER`"
+	define_eip GUEST_PF_HANDLER "`get_sym $PAGE_FAULT_WRAPPER`"
 fi
 
 if [ ! -z "$SPURIOUS_INTERRUPT_WRAPPER" ]; then
-	echo "#define GUEST_SPURIOUS_HANDLER 0x`get_sym $SPURIOUS_INTERRUPT_WRAPPER`"
+	define_eip GUEST_SPURIOUS_HANDLER "`get_sym $SPURIOUS_INTERRUPT_WRAPPER`"
 fi
 
 if [ ! -z "$THREAD_KILLED_FUNC" ]; then
-	echo "#define GUEST_THREAD_KILLED 0x`get_func $THREAD_KILLED_FUNC`"
+	define_eip GUEST_THREAD_KILLED "`get_func $THREAD_KILLED_FUNC`"
 	if [ ! -z "$THREAD_KILLED_ARG_VAL" ]; then
 		echo "#define GUEST_THREAD_KILLED_ARG $THREAD_KILLED_ARG_VAL"
 	fi
 fi
 
 if [ ! -z "$VM_USER_COPY" ];  then
-	echo "#define GUEST_VM_USER_COPY_ENTER 0x`get_func $VM_USER_COPY`"
+	define_eip GUEST_VM_USER_COPY_ENTER "`get_func $VM_USER_COPY`"
 	if [ ! -z "$VM_USER_COPY_TAIL" ]; then
-		echo "#define GUEST_VM_USER_COPY_EXIT  0x`get_func_end $VM_USER_COPY_TAIL`"
+		define_eip GUEST_VM_USER_COPY_EXIT  "`get_func_end $VM_USER_COPY_TAIL`"
 	else
-		echo "#define GUEST_VM_USER_COPY_EXIT  0x`get_func_end $VM_USER_COPY`"
+		define_eip GUEST_VM_USER_COPY_EXIT  "`get_func_end $VM_USER_COPY`"
 	fi
 fi
 
@@ -503,19 +540,19 @@ fi
 if [ ! -z "$PINTOS_KERNEL" ]; then
 	# The pintos boot sequence contains a very... shall we say...
 	# landslide-unfriendly way of calibrating the timer. We'll skip dis.
-	echo "#define GUEST_TIMER_CALIBRATE 0x`get_func timer_calibrate`"
+	define_eip GUEST_TIMER_CALIBRATE "`get_func timer_calibrate`"
 	echo "#define GUEST_TIMER_CALIBRATE_END 0x`get_func_end timer_calibrate`"
 	echo "#define GUEST_TIMER_CALIBRATE_RESULT 0x`get_sym loops_per_tick`"
 	# Obtained via experiment. Independent of landslide or host CPU rate.
 	echo "#define GUEST_TIMER_CALIBRATE_VALUE 39270400"
 	# For speeding up ide_init and uhci_init.
-	echo "#define GUEST_TIMER_MSLEEP 0x`get_func timer_msleep`"
+	define_eip GUEST_TIMER_MSLEEP "`get_func timer_msleep`"
 	# Debug/logging.
-	echo "#define GUEST_PRINTF 0x`get_func printf`"
-	echo "#define GUEST_DBG_PANIC 0x`get_func debug_panic`"
+	define_eip GUEST_PRINTF "`get_func printf`"
+	define_eip GUEST_DBG_PANIC "`get_func debug_panic`"
 	# For test lifecycle.
-	echo "#define GUEST_RUN_TASK_ENTER 0x`get_func run_task`"
-	echo "#define GUEST_RUN_TASK_EXIT 0x`get_func_end run_task`"
+	define_eip GUEST_RUN_TASK_ENTER "`get_func run_task`"
+	define_eip GUEST_RUN_TASK_EXIT "`get_func_end run_task`"
 	# In pebbles, CONSOLE_MEM_BASE is below .text. In pintos, it's above.
 	echo "#define GUEST_VGA_CONSOLE_BASE 0xc00b8000"
 	echo "#define GUEST_VGA_CONSOLE_END (0xc00b8000 + (80*25*2))"
@@ -523,9 +560,9 @@ if [ ! -z "$PINTOS_KERNEL" ]; then
 	echo "#define GUEST_CLI_EXIT  0x`get_func_end intr_disable`"
 	echo "#define GUEST_STI_ENTER 0x`get_func intr_enable`" # intr_set_level calls intr_enable
 	echo "#define GUEST_STI_EXIT  0x`get_func_end intr_enable`" # intr_set_level calls intr_enable
-	echo "#define GUEST_TIMER_SPLEEP_ENTER 0x`get_func timer_sleep`"
-	echo "#define GUEST_TIMER_SPLEEP_EXIT  0x`get_func_end timer_sleep`"
-	echo "#define GUEST_LIST_INSERT_ORDERED_EXIT 0x`get_func_end list_insert_ordered`"
+	define_eip GUEST_TIMER_SPLEEP_ENTER "`get_func timer_sleep`"
+	define_eip GUEST_TIMER_SPLEEP_EXIT  "`get_func_end timer_sleep`"
+	define_eip GUEST_LIST_INSERT_ORDERED_EXIT "`get_func_end list_insert_ordered`"
 fi
 
 echo
@@ -539,12 +576,12 @@ function define_user_addr {
 	# not present in the user binary.
 	ADDR=`get_user_func $2`
 	if [ ! -z "$ADDR" ]; then
-		echo "#define ${1}_ENTER 0x$ADDR"
+		define_eip ${1}_ENTER $ADDR
 	fi
 	# some functions e.g. panic() don't return; don't emit their ret addr.
 	ADDR=`get_user_func_ret $2`
 	if [ ! -z "$ADDR" ]; then
-		echo "#define ${1}_EXIT 0x$ADDR"
+		define_eip ${1}_EXIT $ADDR
 	fi
 }
 function define_user_sym {
@@ -622,43 +659,43 @@ echo
 #### In-kernel annotations ####
 ###############################
 
-echo "#define TELL_LANDSLIDE_DECIDE 0x`get_func $TL_DECIDE`"
-echo "#define TELL_LANDSLIDE_THREAD_SWITCH 0x`get_func $TL_SWITCH`"
-echo "#define TELL_LANDSLIDE_SCHED_INIT_DONE 0x`get_func $TL_INIT_DONE`"
-echo "#define TELL_LANDSLIDE_FORKING 0x`get_func $TL_FORKING`"
-echo "#define TELL_LANDSLIDE_VANISHING 0x`get_func $TL_VANISH`"
-echo "#define TELL_LANDSLIDE_SLEEPING 0x`get_func $TL_SLEEP`"
-echo "#define TELL_LANDSLIDE_THREAD_RUNNABLE 0x`get_func $TL_ON_RQ`"
-echo "#define TELL_LANDSLIDE_THREAD_DESCHEDULING 0x`get_func $TL_OFF_RQ`"
-echo "#define TELL_LANDSLIDE_MUTEX_LOCKING 0x`get_func $TL_MX_LOCK`"
-echo "#define TELL_LANDSLIDE_MUTEX_BLOCKING 0x`get_func $TL_MX_BLOCK`"
-echo "#define TELL_LANDSLIDE_MUTEX_LOCKING_DONE 0x`get_func $TL_MX_LOCK_DONE`"
-echo "#define TELL_LANDSLIDE_MUTEX_UNLOCKING 0x`get_func $TL_MX_UNLOCK`"
-echo "#define TELL_LANDSLIDE_MUTEX_UNLOCKING_DONE 0x`get_func $TL_MX_UNLOCK_DONE`"
-echo "#define TELL_LANDSLIDE_MUTEX_TRYLOCKING 0x`get_func $TL_MX_TRYLOCK`"
-echo "#define TELL_LANDSLIDE_MUTEX_TRYLOCKING_DONE 0x`get_func $TL_MX_TRYLOCK_DONE`"
-echo "#define TELL_LANDSLIDE_DUMP_STACK 0x`get_func $TL_STACK`"
+define_eip TELL_LANDSLIDE_DECIDE "`get_func $TL_DECIDE`"
+define_eip TELL_LANDSLIDE_THREAD_SWITCH "`get_func $TL_SWITCH`"
+define_eip TELL_LANDSLIDE_SCHED_INIT_DONE "`get_func $TL_INIT_DONE`"
+define_eip TELL_LANDSLIDE_FORKING "`get_func $TL_FORKING`"
+define_eip TELL_LANDSLIDE_VANISHING "`get_func $TL_VANISH`"
+define_eip TELL_LANDSLIDE_SLEEPING "`get_func $TL_SLEEP`"
+define_eip TELL_LANDSLIDE_THREAD_RUNNABLE "`get_func $TL_ON_RQ`"
+define_eip TELL_LANDSLIDE_THREAD_DESCHEDULING "`get_func $TL_OFF_RQ`"
+define_eip TELL_LANDSLIDE_MUTEX_LOCKING "`get_func $TL_MX_LOCK`"
+define_eip TELL_LANDSLIDE_MUTEX_BLOCKING "`get_func $TL_MX_BLOCK`"
+define_eip TELL_LANDSLIDE_MUTEX_LOCKING_DONE "`get_func $TL_MX_LOCK_DONE`"
+define_eip TELL_LANDSLIDE_MUTEX_UNLOCKING "`get_func $TL_MX_UNLOCK`"
+define_eip TELL_LANDSLIDE_MUTEX_UNLOCKING_DONE "`get_func $TL_MX_UNLOCK_DONE`"
+define_eip TELL_LANDSLIDE_MUTEX_TRYLOCKING "`get_func $TL_MX_TRYLOCK`"
+define_eip TELL_LANDSLIDE_MUTEX_TRYLOCKING_DONE "`get_func $TL_MX_TRYLOCK_DONE`"
+define_eip TELL_LANDSLIDE_DUMP_STACK "`get_func $TL_STACK`"
 
 if [ ! -z "$PINTOS_KERNEL" ]; then
 	# For pintos we'll hook the mutex implementation by name rather than
 	# relying on annotations. There's too much conflict across student
 	# implementations for any set of annotations to patch cleanly.
 	# mutex_init -- check for value!=1 to omit lockset checking.
-	echo "#define GUEST_SEMA_INIT_ENTER 0x`get_func sema_init`"
+	define_eip GUEST_SEMA_INIT_ENTER "`get_func sema_init`"
 	echo "#define GUEST_SEMA_INIT_SEMA_ARGNUM 1"
 	echo "#define GUEST_SEMA_INIT_VALUE_ARGNUM 2"
 	# mutex_lock
-	echo "#define GUEST_SEMA_DOWN_ENTER 0x`get_func sema_down`"
-	echo "#define GUEST_SEMA_DOWN_EXIT 0x`get_func_end sema_down`"
+	define_eip GUEST_SEMA_DOWN_ENTER "`get_func sema_down`"
+	define_eip GUEST_SEMA_DOWN_EXIT "`get_func_end sema_down`"
 	echo "#define GUEST_SEMA_DOWN_ARGNUM 1"
 	# mutex_trylock
-	echo "#define GUEST_SEMA_TRY_DOWN_ENTER 0x`get_func sema_try_down`"
-	echo "#define GUEST_SEMA_TRY_DOWN_EXIT 0x`get_func_end sema_try_down`"
+	define_eip GUEST_SEMA_TRY_DOWN_ENTER "`get_func sema_try_down`"
+	define_eip GUEST_SEMA_TRY_DOWN_EXIT "`get_func_end sema_try_down`"
 	echo "#define GUEST_SEMA_TRY_DOWN_ARGNUM 1"
 	echo "#define GUEST_SEMA_TRY_DOWN_FAILURE 0" # false
 	# mutex_unlock
-	echo "#define GUEST_SEMA_UP_ENTER 0x`get_func sema_up`"
-	echo "#define GUEST_SEMA_UP_EXIT 0x`get_func_end sema_up`"
+	define_eip GUEST_SEMA_UP_ENTER "`get_func sema_up`"
+	define_eip GUEST_SEMA_UP_EXIT "`get_func_end sema_up`"
 	echo "#define GUEST_SEMA_UP_ARGNUM 1"
 fi
 
@@ -724,6 +761,10 @@ echo -e "#define IGNORE_THRLIB_FUNCTIONS { $IGNORE_THRLIB_FUNCTIONS }"
 echo "#define DATA_RACE_INFO { $DATA_RACE_INFO }"
 echo "#define DISK_IO_FNS { $DISK_IO_FNS }"
 
+# sorted and deduplicated, as annotations.c binary-searches it
+ANNOTATED_EIPS=`for ADDR in $ANNOTATED_EIPS; do printf "0x%08x,\n" 0x$ADDR; done | sort -u | tr -d '\n'`
+echo "#define ANNOTATED_EIPS { $ANNOTATED_EIPS }"
+
 if [ "$BUG_ON_THREADS_WEDGED" = "0" -a ! -z "$DISK_IO_FNS" ]; then
 	msg "Warning: disk_io_fn has no effect when BUG_ON_THREADS_WEDGED=0."
 fi
@@ -743,6 +784,23 @@ if [ "$ICB" = 1 ]; then
 	echo "#define ICB_START_BOUND $ICB_START_BOUND"
 fi
 
+if ! [ "$TIMETRAVEL_CHECKPOINT_INTERVAL" -gt 0 ] 2>/dev/null; then
+	die "TIMETRAVEL_CHECKPOINT_INTERVAL must be a positive number"
+fi
+echo "#define TIMETRAVEL_CHECKPOINT_INTERVAL $TIMETRAVEL_CHECKPOINT_INTERVAL"
+
+if ! [ "$TIMETRAVEL_PARALLEL_LINES" -gt 0 ] 2>/dev/null; then
+	die "TIMETRAVEL_PARALLEL_LINES must be a positive number"
+fi
+echo "#define TIMETRAVEL_PARALLEL_LINES $TIMETRAVEL_PARALLEL_LINES"
+
+if [ "$TIMETRAVEL_SNAPSHOTS" = 1 ]; then
+	if [ "$TIMETRAVEL_CHECKPOINT_INTERVAL" != 1 -o "$TIMETRAVEL_PARALLEL_LINES" != 1 ]; then
+		die "TIMETRAVEL_SNAPSHOTS is incompatible with checkpoint intervals and parallel lines"
+	fi
+	echo "#define TIMETRAVEL_SNAPSHOTS"
+fi
+
 if [ ! -z "$ID_WRAPPER_MAGIC" ]; then
 	echo "#define ID_WRAPPER_MAGIC $ID_WRAPPER_MAGIC"
 fi
@@ -0,0 +1,99 @@
+/**
+ * @file annotations.c
+ * @brief fast lookup of guest addresses the state machines care about
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define MODULE_NAME "ANNOTATIONS"
+
+#include <string.h>
+
+#include "annotations.h"
+#include "common.h"
+#include "compiler.h"
+#include "student_specifics.h"
+
+/* Generated by definegen.sh, already sorted and deduplicated. */
+static const unsigned int annotated_eips[] = ANNOTATED_EIPS;
+
+uint64_t annotation_filter[ANNOTATION_FILTER_BITS / 64];
+uint64_t interesting_pages[INTERESTING_PAGES / 64];
+
+void mark_interesting_page(unsigned int eip)
+{
+	unsigned int page = eip >> INTERESTING_PAGE_SHIFT;
+	interesting_pages[page / 64] |= 1ULL << (page % 64);
+}
+
+#if defined(PURE_HAPPENS_BEFORE) && defined(PINTOS_KERNEL)
+static void mark_interesting_range(unsigned int start, unsigned int end)
+{
+	for (unsigned int page = start >> INTERESTING_PAGE_SHIFT;
+	     page <= end >> INTERESTING_PAGE_SHIFT; page++) {
+		mark_interesting_page(page << INTERESTING_PAGE_SHIFT);
+	}
+}
+#endif
+
+void annotations_init()
+{
+	STATIC_ASSERT_POWER_OF_2(ANNOTATION_FILTER_BITS);
+	memset(annotation_filter, 0, sizeof(annotation_filter));
+	memset(interesting_pages, 0, sizeof(interesting_pages));
+	for (unsigned int i = 0; i < ARRAY_SIZE(annotated_eips); i++) {
+		unsigned int bit = ANNOTATION_FILTER_HASH(annotated_eips[i]);
+		assert(i == 0 || annotated_eips[i - 1] < annotated_eips[i]);
+		annotation_filter[bit / 64] |= 1ULL << (bit % 64);
+		mark_interesting_page(annotated_eips[i]);
+	}
+#if defined(PURE_HAPPENS_BEFORE) && defined(PINTOS_KERNEL)
+	/* the cli/sti handoff rules match anywhere in these functions */
+	mark_interesting_range(GUEST_CLI_ENTER, GUEST_CLI_EXIT);
+	mark_interesting_range(GUEST_STI_ENTER, GUEST_STI_EXIT);
+#endif
+	lsprintf(DEV, "%u annotated eips\n", (unsigned int)ARRAY_SIZE(annotated_eips));
+}
+
+bool annotated_eip_search(unsigned int eip)
+{
+	unsigned int lo = 0;
+	unsigned int hi = ARRAY_SIZE(annotated_eips);
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+		if (annotated_eips[mid] == eip) {
+			return true;
+		} else if (annotated_eips[mid] < eip) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return false;
+}
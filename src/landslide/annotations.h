@@ -0,0 +1,83 @@
+/**
+ * @file annotations.h
+ * @brief fast lookup of guest addresses the state machines care about
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LS_ANNOTATIONS_H
+#define __LS_ANNOTATIONS_H
+
+#include <stdint.h>
+
+/* The kern_* and user_* predicates each compare the eip against one address
+ * from student_specifics.h. Most instructions match none of them, so before
+ * running through the whole chain, check the sorted table of every such
+ * address that definegen.sh emits (ANNOTATED_EIPS). A bitmap indexed by a
+ * hash of the eip rejects almost all unannotated eips with a single load;
+ * only the rest fall through to a binary search of the table. */
+
+#define ANNOTATION_FILTER_BITS 16384 /* 2 KiB, small enough to stay in cache */
+#define ANNOTATION_FILTER_HASH(eip) \
+	(((eip) ^ ((eip) >> 14)) & (ANNOTATION_FILTER_BITS - 1))
+
+extern uint64_t annotation_filter[ANNOTATION_FILTER_BITS / 64];
+
+void annotations_init(void);
+bool annotated_eip_search(unsigned int eip);
+
+/* Could any kern_* or user_* eip predicate possibly be true here? */
+static inline bool annotated_eip(unsigned int eip)
+{
+	unsigned int bit = ANNOTATION_FILTER_HASH(eip);
+	if ((annotation_filter[bit / 64] & (1ULL << (bit % 64))) == 0) {
+		return false;
+	}
+	return annotated_eip_search(eip);
+}
+
+/* Coarser, but cheap enough to test before even calling into landslide: one
+ * bit per 4 KiB page of the address space, set for each page containing an
+ * annotated eip or a data race PP. Instructions on other pages can't match
+ * any eip-keyed check, so when no scheduler operation is in flight, bochs
+ * need not dispatch them to landslide at all (see instrument.cc). */
+
+#define INTERESTING_PAGE_SHIFT 12
+#define INTERESTING_PAGES (1ULL << (32 - INTERESTING_PAGE_SHIFT))
+
+extern uint64_t interesting_pages[INTERESTING_PAGES / 64];
+
+void mark_interesting_page(unsigned int eip);
+
+static inline bool interesting_page(unsigned int eip)
+{
+	unsigned int page = eip >> INTERESTING_PAGE_SHIFT;
+	return (interesting_pages[page / 64] & (1ULL << (page % 64))) != 0;
+}
+
+#endif
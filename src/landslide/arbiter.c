@@ -41,12 +41,15 @@
 #include "kspec.h"
 #include "landslide.h"
 #include "mem.h"
+#include "pct.h"
 #include "pp.h"
 #include "rand.h"
 #include "schedule.h"
+#include "sleep_set.h"
 #include "tsx.h"
 #include "user_specifics.h"
 #include "user_sync.h"
+#include "wakeup_tree.h"
 #include "x86.h"
 
 void arbiter_init(struct arbiter_state *r)
@@ -422,6 +425,19 @@ static bool try_avoid_fp_deadlock(struct ls_state *ls, bool voluntary,
  * of it affecting SS size with only 2 threads either way though. */
 #define CONSIDER_ONLY_MOST_RECENT_DPOR_PREFERRED_TID
 
+/* Could the given thread run next, as far as the scheduler is concerned? And,
+ * with sleep sets (see sleep_set.h), is it awake, if that's to be checked? */
+static bool may_choose(struct ls_state *ls, struct agent *a, bool voluntary,
+		       const struct footprint *sleep_fp)
+{
+	return !BLOCKED(a) && !IS_IDLE(ls, a) &&
+		!HTM_BLOCKED(&ls->sched, a) &&
+		!ABORT_SET_BLOCKED(&ls->sched.upcoming_aborts, a->tid) &&
+		!ICB_BLOCKED(&ls->sched, ls->icb_bound, voluntary, a) &&
+		(sleep_fp == NULL ||
+		 !sleep_set_upcoming_contains(ls, sleep_fp, a->tid));
+}
+
 /* Returns true if a thread was chosen. If true, sets 'target' (to either the
  * current thread or any other thread), and sets 'our_choice' to false if
  * somebody else already made this choice for us, true otherwise. */
@@ -434,24 +450,58 @@ bool arbiter_choose(struct ls_state *ls, struct agent *current, bool voluntary,
 	bool dpor_preferred_is_legal_choice = false;
 	unsigned int dpor_preferred_count;
 	unsigned int dpor_preference = 0;
+	unsigned int wakeup_tid = wakeup_tree_upcoming(ls);
+	unsigned int wakeup_count = 0;
+	bool randomly = pct_exploring(ls);
+	ARRAY_LIST(unsigned int) random_tids;
 
 	/* We shouldn't be asked to choose if somebody else already did. */
 	assert(Q_GET_SIZE(&ls->arbiter.choices) == 0);
 
+	/* Don't choose threads asleep at the upcoming PP, unless they're the
+	 * only ones; then nothing new can happen on this branch, so end it
+	 * (after just enough of a transition to make a PP to end it at). */
+	struct footprint fp;
+	const struct footprint *sleep_fp = NULL;
+	if (sleep_set_upcoming(ls, &fp)) {
+		bool any_awake = false;
+		bool any_asleep = false;
+		FOR_EACH_RUNNABLE_AGENT(a, &ls->sched,
+			if (may_choose(ls, a, voluntary, &fp)) {
+				any_awake = true;
+			} else if (may_choose(ls, a, voluntary, NULL)) {
+				any_asleep = true;
+			}
+		);
+		if (any_awake) {
+			sleep_fp = &fp;
+		} else if (any_asleep) {
+			lsprintf(CHOICE, "All runnable threads are asleep; "
+				 "ending branch early.\n");
+			ls->end_branch_early = true;
+		}
+	}
+
 	lsprintf(DEV, "Available choices: ");
+	if (randomly) {
+		ARRAY_LIST_INIT(&random_tids, 8);
+	}
 
 	/* Count the number of available threads. */
 	FOR_EACH_RUNNABLE_AGENT(a, &ls->sched,
-		if (!BLOCKED(a) && !IS_IDLE(ls, a) &&
-		    !HTM_BLOCKED(&ls->sched, a) &&
-		    !ABORT_SET_BLOCKED(&ls->sched.upcoming_aborts, a->tid) &&
-		    !ICB_BLOCKED(&ls->sched, ls->icb_bound, voluntary, a)) {
+		if (may_choose(ls, a, voluntary, sleep_fp)) {
 			print_agent(DEV, a);
 			printf(DEV, " ");
 			count++;
 			if (a == current) {
 				current_is_legal_choice = true;
 			}
+			if (a->tid == wakeup_tid) {
+				wakeup_count = count;
+			}
+			if (randomly) {
+				ARRAY_LIST_APPEND(&random_tids, a->tid);
+			}
 #ifdef KEEP_RUNNING_DPORS_CHOSEN_TID
 			/* i don't remember which test case it was that made me
 			 * keep a stack of preferred tids instead of just the
@@ -487,7 +537,6 @@ bool arbiter_choose(struct ls_state *ls, struct agent *current, bool voluntary,
 #ifdef ICB
 	STATIC_ASSERT(false && "ICB and CHOOSE_RANDOMLY are incompatible");
 #endif
-	STATIC_ASSERT(false && "TODO: find a bsd random number generator");
 	// with given odds, will make the "forwards" choice.
 	const int numerator   = 19;
 	const int denominator = 20;
@@ -510,6 +559,25 @@ bool arbiter_choose(struct ls_state *ls, struct agent *current, bool voluntary,
 		 * the preempted evil ancestor before the child gets to run */
 		count = dpor_preferred_count;
 	}
+	if (wakeup_count != 0) {
+		/* optimal DPOR wants the race it's reversing to go this way */
+		printf(DEV, "- Following wakeup sequence to TID %d\n",
+		       wakeup_tid);
+		count = wakeup_count;
+	} else if (wakeup_tid != TID_NONE) {
+		printf(DEV, "- Wakeup sequence wanted TID %d, but it can't "
+		       "run here\n", wakeup_tid);
+	}
+	if (randomly) {
+		/* not CHOOSE_RANDOMLY's coin flips, but a schedule (see pct.h) */
+		if (count > 0) {
+			count = 1 + pct_choose(ls, current->tid, random_tids.array,
+					       ARRAY_LIST_SIZE(&random_tids));
+			printf(DEV, "- Randomly chose TID %d\n",
+			       *ARRAY_LIST_GET(&random_tids, count - 1));
+		}
+		ARRAY_LIST_FREE(&random_tids);
+	}
 
 	if (agent_has_yielded(&current->user_yield) ||
 	    agent_has_xchged(&ls->user_sync)) {
@@ -535,11 +603,7 @@ bool arbiter_choose(struct ls_state *ls, struct agent *current, bool voluntary,
 	/* Find the count-th thread. */
 	unsigned int i = 0;
 	FOR_EACH_RUNNABLE_AGENT(a, &ls->sched,
-		if (!BLOCKED(a) && !IS_IDLE(ls, a) &&
-		    !HTM_BLOCKED(&ls->sched, a) &&
-		    !ABORT_SET_BLOCKED(&ls->sched.upcoming_aborts, a->tid) &&
-		    !ICB_BLOCKED(&ls->sched, ls->icb_bound, voluntary, a) &&
-		    ++i == count) {
+		if (may_choose(ls, a, voluntary, sleep_fp) && ++i == count) {
 			printf(DEV, "- Figured I'd look at TID %d next.\n",
 			       a->tid);
 			*result = a;
@@ -0,0 +1,81 @@
+/**
+ * @file arena.c
+ * @brief bump-pointer allocation for objects that are all freed together
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define MODULE_NAME "ARENA"
+
+#include "arena.h"
+#include "common.h"
+#include "simulator.h"
+
+/* Blocks start small, since most arenas (one per transition) hold only a few
+ * objects, and double up to a limit for the ones that hold many. */
+#define ARENA_FIRST_BLOCK_SIZE 1024
+#define ARENA_MAX_BLOCK_SIZE (64 * 1024)
+
+struct arena_block {
+	struct arena_block *next;
+	/* keep the data suitably aligned */
+	char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+void arena_init(struct arena *a)
+{
+	a->blocks = NULL;
+	a->next = NULL;
+	a->end = NULL;
+	a->next_block_size = ARENA_FIRST_BLOCK_SIZE;
+}
+
+void arena_grow(struct arena *a, size_t size)
+{
+	size_t block_size = MAX(size, (size_t)a->next_block_size);
+	struct arena_block *b = (struct arena_block *)
+		MM_XMALLOC(sizeof(struct arena_block) + block_size, char);
+
+	b->next = a->blocks;
+	a->blocks = b;
+	a->next = b->data;
+	a->end = b->data + block_size;
+	if (a->next_block_size < ARENA_MAX_BLOCK_SIZE) {
+		a->next_block_size *= 2;
+	}
+}
+
+void arena_free(struct arena *a)
+{
+	while (a->blocks != NULL) {
+		struct arena_block *b = a->blocks;
+		a->blocks = b->next;
+		MM_FREE(b);
+	}
+	arena_init(a);
+}
@@ -0,0 +1,69 @@
+/**
+ * @file arena.h
+ * @brief bump-pointer allocation for objects that are all freed together
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LS_ARENA_H
+#define __LS_ARENA_H
+
+#include <stddef.h>
+
+#include "compiler.h"
+
+#define ARENA_ALIGN 8
+
+struct arena_block;
+
+struct arena {
+	struct arena_block *blocks; /* most recently allocated first */
+	char *next;
+	char *end;
+	unsigned int next_block_size;
+};
+
+void arena_init(struct arena *a);
+void arena_grow(struct arena *a, size_t size);
+void arena_free(struct arena *a);
+
+static inline void *arena_alloc(struct arena *a, size_t size)
+{
+	void *result;
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if ((size_t)(a->end - a->next) < size) {
+		arena_grow(a, size);
+	}
+	result = a->next;
+	a->next += size;
+	return result;
+}
+
+#define ARENA_XMALLOC(a, x, t) ((t *)arena_alloc((a), (x) * sizeof(t)))
+
+#endif
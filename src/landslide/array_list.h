@@ -41,13 +41,17 @@
 		T *array;		\
 	}
 
-#define ARRAY_LIST_INIT(a, initial_capacity) do {				\
+/* The allocator-taking versions of these are for lists whose storage must
+ * come from somewhere special (see shared_arena.h); use them consistently. */
+#define __ARRAY_LIST_INIT(a, initial_capacity, xmalloc) do {			\
 		typeof(a) __a = (a);						\
 		__a->size = 0;							\
 		__a->capacity = (initial_capacity);				\
 		/* NB avoid side effects in initial capacity */			\
-		__a->array = MM_XMALLOC(__a->capacity, typeof(*__a->array));	\
+		__a->array = xmalloc(__a->capacity, typeof(*__a->array));	\
 	} while (0)
+#define ARRAY_LIST_INIT(a, initial_capacity) \
+	__ARRAY_LIST_INIT(a, initial_capacity, MM_XMALLOC)
 
 #define ARRAY_LIST_FREE(a) MM_FREE((a)->array)
 
@@ -78,7 +82,7 @@
 #define ARRAY_LIST_SIZE(a) ((a)->size)
 
 /* O(1) */
-#define ARRAY_LIST_APPEND(a, val) do {					\
+#define __ARRAY_LIST_APPEND(a, val, xmalloc, xfree) do {		\
 		typeof(a) __a = (a);					\
 		assert(__a->size <= __a->capacity);			\
 		/* grow array if necessary */				\
@@ -87,15 +91,17 @@
 			assert(__a->capacity < UINT_MAX / 2);		\
 			__a->capacity++; /* in case of 0 */		\
 			__a->capacity *= 2;				\
-			__a->array = MM_XMALLOC(__a->capacity,		\
-						typeof(*__a->array));	\
+			__a->array = xmalloc(__a->capacity,		\
+					     typeof(*__a->array));	\
 			memcpy(__a->array, old_array,			\
 			       __a->size * sizeof(*__a->array));	\
-			MM_FREE(old_array);				\
+			xfree(old_array);				\
 		}							\
 		__a->array[__a->size] = (val);				\
 		__a->size++;						\
 	} while (0)
+#define ARRAY_LIST_APPEND(a, val) \
+	__ARRAY_LIST_APPEND(a, val, MM_XMALLOC, MM_FREE)
 	
 /* swap elements at two places */
 #define ARRAY_LIST_SWAP(a, i, j) do {					\
@@ -0,0 +1,76 @@
+/**
+ * @file bitset.h
+ * @brief packed bitsets of 64-bit words
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LS_BITSET_H
+#define __LS_BITSET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Bitsets are plain uint64_t arrays; the caller tracks how many bits each one
+ * holds. Bits past the end of the last word must be kept zero, so that whole
+ * words can be combined without masking. */
+#define BITSET_WORD_BITS 64
+#define BITSET_WORDS(nbits) (((nbits) + BITSET_WORD_BITS - 1) / BITSET_WORD_BITS)
+
+static inline bool bitset_get(const uint64_t *b, unsigned int i)
+{
+	return (b[i / BITSET_WORD_BITS] >> (i % BITSET_WORD_BITS)) & 1;
+}
+
+static inline void bitset_set(uint64_t *b, unsigned int i, bool val)
+{
+	uint64_t mask = (uint64_t)1 << (i % BITSET_WORD_BITS);
+	if (val) {
+		b[i / BITSET_WORD_BITS] |= mask;
+	} else {
+		b[i / BITSET_WORD_BITS] &= ~mask;
+	}
+}
+
+static inline void bitset_clear(uint64_t *b, unsigned int nbits)
+{
+	for (unsigned int i = 0; i < BITSET_WORDS(nbits); i++) {
+		b[i] = 0;
+	}
+}
+
+/* dest |= src, for the first nbits bits (dest must be at least as long). */
+static inline void bitset_or(uint64_t *dest, const uint64_t *src,
+			     unsigned int nbits)
+{
+	for (unsigned int i = 0; i < BITSET_WORDS(nbits); i++) {
+		dest[i] |= src[i];
+	}
+}
+
+#endif
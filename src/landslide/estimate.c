@@ -322,7 +322,10 @@ void update_pp_yield_block_tid(struct nobe *h, unsigned int *tid)
 	struct agent *a;
 	FOR_EACH_RUNNABLE_AGENT(a, mutable_oldsched(h),
 		if (a->tid == *tid) {
-			a->user_yield.blocked = true;
+			if (!a->user_yield.blocked) {
+				mutable_saved_agent(mutable_oldsched(h), a)
+					->user_yield.blocked = true;
+			}
 			return;
 		}
 	);
@@ -334,7 +337,8 @@ static void update_pp_untag_tid(struct nobe *h, unsigned int *tid)
 	struct agent *a;
 	FOR_EACH_RUNNABLE_AGENT(a, mutable_oldsched(h),
 		if (a->tid == *tid) {
-			a->do_explore = false;
+			mutable_saved_agent(mutable_oldsched(h), a)
+				->do_explore = false;
 			assert(h->marked_children > 1);
 			h->marked_children--;
 			return;
@@ -518,6 +522,7 @@ void print_estimates(struct ls_state *ls)
 	uint64_t time_asleep =
 		message_estimate(&ls->mess, proportion, branches,
 				 usecs, ls->save.stats.total_usecs,
-				 ls->sched.icb_preemption_count, ls->icb_bound);
+				 ls->sched.icb_preemption_count, ls->icb_bound,
+				 timetravel_memory_kb());
 	fudge_time(&ls->save.stats.last_save_time, time_asleep);
 }
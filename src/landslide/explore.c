@@ -34,9 +34,11 @@
 
 #include "common.h"
 #include "estimate.h"
+#include "fingerprint.h"
 #include "landslide.h"
 #include "save.h"
 #include "schedule.h"
+#include "shared_arena.h"
 #include "tree.h"
 #include "tsx.h"
 #include "user_sync.h"
@@ -64,7 +66,8 @@ static bool is_child_searched(const struct nobe *h, unsigned int child_tid) {
 		    child->all_explored)
 			return true;
 	}
-	return false;
+	/* or as good as, in an earlier sibling's subtree (see sleep_set.h) */
+	return sleep_set_contains(h, child_tid);
 }
 
 static void branch_sanity(const struct nobe *root, const struct nobe *current)
@@ -92,7 +95,7 @@ static void branch_sanity(const struct nobe *root, const struct nobe *current)
 
 static bool is_evil_ancestor(const struct nobe *h0, const struct nobe *h)
 {
-	return !h0->happens_before[h->depth] && h0->conflicts[h->depth];
+	return !get_happens_before(h0, h) && get_conflicts(h0, h->depth);
 }
 
 /* identifies redundant interleavings that can arise as described in issue #4.
@@ -111,7 +114,7 @@ static bool equiv_already_explored(const struct nobe *h0, const struct nobe *h)
 		} else if (is_evil_ancestor(h0, h2)) {
 			/* independent preceding transition chain ends here */
 			return false;
-		} else if (h0->happens_before[h2->depth]) {
+		} else if (get_happens_before(h0, h2)) {
 			/* h0 can't be reordered past here so stop looking */
 			return false;
 		} else if (is_child_searched(h2->parent, h0->chosen_thread)) {
@@ -293,8 +296,8 @@ static void update_pp_abort_set(struct nobe *h, struct abort_set *src)
 	}
 	/* can skip if was duplicate *and* already saturated */
 	if (saturate_tid == TID_NONE || needs_success || needs_retry) {
-		ARRAY_LIST_APPEND(mutable_abort_sets_ever(h), *src);
-		ARRAY_LIST_APPEND(mutable_abort_sets_todo(h), *src);
+		SHARED_ARRAY_LIST_APPEND(mutable_abort_sets_ever(h), *src);
+		SHARED_ARRAY_LIST_APPEND(mutable_abort_sets_todo(h), *src);
 	}
 }
 
@@ -305,6 +308,21 @@ static void update_pp_pop_abort_set(struct nobe *h, unsigned int *index)
 
 #endif
 
+/* Spawned lines don't get passed abort sets, so leave those tids to us. */
+static bool has_abort_set(const struct nobe *h, unsigned int tid)
+{
+#ifdef HTM_ABORT_SETS
+	const struct abort_set *src;
+	unsigned int i;
+	ARRAY_LIST_FOREACH(&h->abort_sets_todo, i, src) {
+		if (src->reordered_subtree_child.tid == tid) {
+			return true;
+		}
+	}
+#endif
+	return false;
+}
+
 static void get_abort_set(const struct nobe *h, unsigned int tid,
 			  struct abort_set *dest)
 {
@@ -358,27 +376,39 @@ static void update_pp_tag_tid(struct nobe *h, unsigned int *tid)
 	struct agent *a;
 	FOR_EACH_RUNNABLE_AGENT(a, mutable_oldsched(h),
 		if (a->tid == *tid) {
-			a->do_explore = true;
+			if (!a->do_explore) {
+				mutable_saved_agent(mutable_oldsched(h), a)
+					->do_explore = true;
+			}
 			return;
 		}
 	);
 	assert(0 && "couldn't find tid in oldsched to tag");
 }
 
-static bool tag_good_sibling(const struct nobe *h0, const struct nobe *ancestor,
-			     unsigned int icb_bound, bool *need_bpor,
-			     struct abort_set *aborts)
+/* Usually 'tid' is h0's own thread, but see fingerprint_dpor(). */
+static bool tag_good_sibling(const struct nobe *h0, unsigned int tid,
+			     const struct nobe *ancestor, unsigned int icb_bound,
+			     bool *need_bpor, struct abort_set *aborts)
 {
-	unsigned int tid = h0->chosen_thread;
 	const struct nobe *grandparent = pp_parent(ancestor);
 	assert(need_bpor == NULL || !*need_bpor);
 
 	const struct agent *a;
 	CONST_FOR_EACH_RUNNABLE_AGENT(a, grandparent->oldsched,
 		if (a->tid == tid) {
-			if (BLOCKED(a) || HTM_BLOCKED(grandparent->oldsched, a) ||
-			    ABORT_SET_BLOCKED(&grandparent->oldsched->upcoming_aborts, a->tid) ||
-			    is_child_searched(grandparent, a->tid)) {
+			if (sleep_set_contains(grandparent, tid)) {
+				/* the reordering is covered already; unlike
+				 * other reasons not to tag, no need for more */
+				lsprintf(DEV, "from #%d/tid%d, TID %d asleep "
+					 "at sibling of #%d/tid%d\n", h0->depth,
+					 h0->chosen_thread, tid, ancestor->depth,
+					 ancestor->chosen_thread);
+				return true;
+			} else if (BLOCKED(a) ||
+				   HTM_BLOCKED(grandparent->oldsched, a) ||
+				   ABORT_SET_BLOCKED(&grandparent->oldsched->upcoming_aborts, a->tid) ||
+				   is_child_searched(grandparent, a->tid)) {
 				return false;
 			} else if (ICB_BLOCKED(grandparent->oldsched, icb_bound,
 					       grandparent->voluntary, a)) {
@@ -466,7 +496,8 @@ static bool tag_sibling(const struct nobe *h0, const struct nobe *ancestor,
 			unsigned int icb_bound, struct abort_set *aborts)
 {
 	bool need_bpor = false;
-	if (!tag_good_sibling(h0, ancestor, icb_bound, &need_bpor, aborts)) {
+	if (!tag_good_sibling(h0, h0->chosen_thread, ancestor, icb_bound,
+			      &need_bpor, aborts)) {
 		/* FIXME: can't use abort sets when a 3rd thread is involved
 		 * (future work?  should can at least do the ancestor, maybe?)
 		 * is this sound, anyway? (should it make future dpors never
@@ -510,7 +541,8 @@ static void tag_reachable_aunts(const struct nobe *h0, const struct nobe *ancest
 	     ancestor2 = ancestor2->parent) {
 		/* May need to tag multiple times for same reason as not
 		 * using "break" in the main dpor loop below. */
-		if (tag_good_sibling(h0, ancestor2, icb_bound, NULL, NULL)) {
+		if (tag_good_sibling(h0, h0->chosen_thread, ancestor2,
+				     icb_bound, NULL, NULL)) {
 			lsprintf(DEV, "BPOR can run #%d/tid%d after reachable "
 				 "aunt #%d/tid%d\n", h0->depth, h0->chosen_thread,
 				 ancestor2->depth, ancestor2->chosen_thread);
@@ -601,6 +633,11 @@ static void update_pp_set_all_explored(struct nobe *h, int *unused)
 	h->all_explored = true;
 }
 
+static void update_pp_set_dpor_analyzed(struct nobe *h, int *unused)
+{
+	h->dpor_analyzed = true;
+}
+
 static void update_pp_set_child_all_explored(struct nobe *h, int chosen_thread,
 					      bool xabort, unsigned int xabort_code)
 {
@@ -624,6 +661,7 @@ static void update_pp_preempt_all_explored(struct nobe *h, int *chosen_thread)
 
 static void set_all_explored(const struct nobe *h)
 {
+	fingerprint_explored(h);
 	modify_pp(update_pp_set_all_explored, h, 0);
 	if (h->parent != NULL) {
 		if (h->xaborted) {
@@ -638,26 +676,17 @@ static void set_all_explored(const struct nobe *h)
 }
 
 /******************************************************************************
- * main
+ * classic dpor
  ******************************************************************************/
 
-const struct nobe *explore(struct ls_state *ls, unsigned int *new_tid, bool *txn,
-			  unsigned int *xabort_code, struct abort_set *aborts)
+static void classic_dpor(struct ls_state *ls, const struct nobe *current)
 {
-	struct save_state *ss = &ls->save;
-	const struct nobe *current = ss->current;
-
-	set_all_explored(current);
-	branch_sanity(ss->root, ss->current);
-
-	/* this cannot happen in-line with walking the branch, below, since it
-	 * needs to be computed for all ancestors and be ready for checking
-	 * against descendants in advance. */
-	update_user_yield_blocked_transitions(current);
-
 	/* Compare each transition along this branch against each of its
-	 * ancestors. */
-	for (const struct nobe *h = current; h != NULL; h = h->parent) {
+	 * ancestors. Those above where this branch diverged from the last were
+	 * compared already, when that one (or an earlier) ended; the tags they
+	 * asked for are still there, or explored by now, so go no further. */
+	for (const struct nobe *h = current; h != NULL && !h->dpor_analyzed;
+	     h = h->parent) {
 		/* remember whether there were any intervening transitions that
 		 * also conflicted with this one; abort sets may only be used
 		 * for reduction if no such transition exists */
@@ -759,13 +788,244 @@ const struct nobe *explore(struct ls_state *ls, unsigned int *new_tid, bool *txn
 			/* instead, just remember (for abort sets) */
 			closest_conflict = false;
 		}
+
+		modify_pp(update_pp_set_dpor_analyzed, h, 0);
+	}
+}
+
+/******************************************************************************
+ * stateful pruning
+ ******************************************************************************/
+
+#if defined(STATE_FINGERPRINTS) && !defined(STATE_FINGERPRINTS_UNSAFE)
+/* Where a branch was cut short at an already-explored state, DPOR never saw
+ * the transitions that would have come next. In their stead, each thread that
+ * ran in the explored subtree gets compared to the whole branch, and wherever
+ * it might have conflicted, is tagged to run before (see fingerprint.h). */
+static void fingerprint_dpor(struct ls_state *ls, const struct nobe *current)
+{
+	const struct fingerprint_thread *t;
+	unsigned int i;
+
+	for (const struct nobe *h = current; h != NULL && !h->dpor_analyzed;
+	     h = h->parent) {
+		if (!h->fingerprint.cut) {
+			continue;
+		}
+		ARRAY_LIST_FOREACH(&h->fingerprint.summary, i, t) {
+			/* as in classic_dpor(), but conservatively, not knowing
+			 * what happens-before the transitions it summarises */
+			for (const struct nobe *ancestor = h;
+			     ancestor->parent != NULL; ancestor = ancestor->parent) {
+				if (is_user_yield_blocked(ancestor) ||
+				    !fingerprint_may_conflict(t, ancestor)) {
+					continue;
+				}
+				bool need_bpor = false;
+				lsprintf(DEV, "from cut #%d/tid%d, TID %d might "
+					 "conflict with #%d/tid%d\n", h->depth,
+					 h->chosen_thread, t->tid, ancestor->depth,
+					 ancestor->chosen_thread);
+				if (!tag_good_sibling(h, t->tid, ancestor,
+						      ls->icb_bound, &need_bpor,
+						      NULL)) {
+					tag_all_siblings(h, ancestor, ls->icb_bound,
+							 &need_bpor);
+				}
+				assert(!need_bpor);
+			}
+		}
+	}
+}
+#else
+#define fingerprint_dpor(ls, current) do { } while (0)
+#endif
+
+/******************************************************************************
+ * optimal dpor
+ ******************************************************************************/
+
+static bool has_child(const struct nobe *h, unsigned int tid)
+{
+	const struct nobe_child *child;
+	unsigned int i;
+	ARRAY_LIST_FOREACH(&h->children, i, child) {
+		if (child->chosen_thread == (int)tid && !child->xabort) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Do the transitions at depths i < d race? That is, do they conflict, with
+ * nothing in between ordered after the one and before the other? */
+static bool is_race(const struct nobe **branch, const uint64_t **hb,
+		    unsigned int i, unsigned int d)
+{
+	if (!get_conflicts(branch[d], i)) {
+		return false;
+	}
+	for (unsigned int k = i + 1; k < d; k++) {
+		if (bitset_get(hb[k], i) && bitset_get(hb[d], k)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Reverses the race between the transitions at depths i < d, if no already
+ * explored (or planned) interleaving does, by a wakeup sequence from the PP
+ * before the earlier one: each transition since which didn't depend on it,
+ * then the later one (see wakeup_tree.h). 'seq' and 'depths' are scratch
+ * space for d - i entries. */
+static void reverse_race(struct ls_state *ls, const struct nobe **branch,
+			 const uint64_t **hb, unsigned int i, unsigned int d,
+			 unsigned int *seq, unsigned int *depths)
+{
+	const struct nobe *h0 = branch[d];
+	const struct nobe *ancestor = branch[i];
+	const struct nobe *grandparent = pp_parent(ancestor);
+	unsigned int len = 0;
+
+	for (unsigned int k = i + 1; k <= d; k++) {
+		if (k < d && (bitset_get(hb[k], i) ||
+			      !is_choice_point(branch[k]->parent))) {
+			continue;
+		}
+		/* anything that could go first instead was already tried, if
+		 * its thread ran (or runs, or sleeps) from there before? */
+		bool initial = true;
+		for (unsigned int j = 0; j < len && initial; j++) {
+			initial = !bitset_get(hb[k], depths[j]);
+		}
+		unsigned int tid = branch[k]->chosen_thread;
+		if (initial && (has_child(grandparent, tid) ||
+				sleep_set_contains(grandparent, tid))) {
+			lsprintf(DEV, "from #%d/tid%d, race with #%d/tid%d is "
+				 "covered by TID %d at #%d/tid%d\n", h0->depth,
+				 h0->chosen_thread, ancestor->depth,
+				 ancestor->chosen_thread, tid,
+				 grandparent->depth, grandparent->chosen_thread);
+			return;
+		}
+		seq[len] = tid;
+		depths[len] = k;
+		len++;
+	}
+	assert(len > 0 && seq[len - 1] == (unsigned int)h0->chosen_thread);
+
+	/* the sequence ought to be able to start where the ancestor did;
+	 * if PPs weren't placed to let it, fall back to tagging everybody */
+	const struct agent *a;
+	bool runnable = false;
+	CONST_FOR_EACH_RUNNABLE_AGENT(a, grandparent->oldsched,
+		if (a->tid == seq[0] && !BLOCKED(a) &&
+		    !HTM_BLOCKED(grandparent->oldsched, a)) {
+			runnable = true;
+		}
+	);
+	if (!runnable) {
+		lsprintf(DEV, "from #%d/tid%d, can't start wakeup sequence "
+			 "with TID %d at #%d/tid%d\n", h0->depth,
+			 h0->chosen_thread, seq[0], grandparent->depth,
+			 grandparent->chosen_thread);
+		tag_all_siblings(h0, ancestor, ls->icb_bound, NULL);
+	} else if (wakeup_tree_insert(grandparent, seq, len)) {
+		modify_pp(update_pp_tag_tid, grandparent, seq[0]);
+		lsprintf(DEV, "from #%d/tid%d, reversing race with #%d/tid%d "
+			 "by %u-long wakeup sequence from #%d/tid%d, starting "
+			 "with TID %d\n", h0->depth, h0->chosen_thread,
+			 ancestor->depth, ancestor->chosen_thread, len,
+			 grandparent->depth, grandparent->chosen_thread, seq[0]);
+	}
+}
+
+static void optimal_dpor(struct ls_state *ls, const struct nobe *current)
+{
+	unsigned int len = current->depth + 1;
+	const struct nobe **branch = MM_XMALLOC(len, const struct nobe *);
+	/* which ancestors happen-before each, counting conflicts (see tree.h) */
+	const uint64_t **hb = MM_XMALLOC(len, const uint64_t *);
+	for (const struct nobe *h = current; h != NULL; h = h->parent) {
+		branch[h->depth] = h;
+		hb[h->depth] = h->branch_hb;
+		assert(h->depth == 0 || h->branch_hb != NULL);
+	}
+	unsigned int *seq = MM_XMALLOC(len, unsigned int);
+	unsigned int *depths = MM_XMALLOC(len, unsigned int);
+
+	/* as in classic_dpor(), only transitions new since the last branch */
+	for (unsigned int d = current->depth;
+	     d > 0 && !branch[d]->dpor_analyzed; d--) {
+		for (unsigned int i = d - 1; i > 0; i--) {
+			/* see the inner loop in classic_dpor() */
+			if (!is_user_yield_blocked(branch[i]) &&
+			    is_race(branch, hb, i, d)) {
+				reverse_race(ls, branch, hb, i, d, seq, depths);
+			}
+		}
+		modify_pp(update_pp_set_dpor_analyzed, branch[d], 0);
+	}
+
+	MM_FREE(hb);
+	MM_FREE(seq);
+	MM_FREE(depths);
+	MM_FREE(branch);
+}
+
+/******************************************************************************
+ * main
+ ******************************************************************************/
+
+/* Hands other tagged siblings, at or above the one just chosen, to idle
+ * parallel world lines (see timetravel.h), claiming each so this line will
+ * not choose it later. Transaction failure injections are left to us. */
+static void spawn_spare_siblings(struct ls_state *ls, const struct nobe *h)
+{
+	const struct agent *a;
+
+	for (; h != NULL && timetravel_may_explore(h); h = h->parent) {
+		if (!h->is_preemption_point || h->xbegin) {
+			continue;
+		}
+		CONST_FOR_EACH_RUNNABLE_AGENT(a, h->oldsched,
+			if (a->do_explore && !is_child_searched(h, a->tid) &&
+			    !has_abort_set(h, a->tid) && timetravel_can_spawn(h)) {
+				save_claim_child(h, a->tid);
+				timetravel_spawn(ls, h, a->tid);
+			}
+		);
+	}
+}
+
+const struct nobe *explore(struct ls_state *ls, unsigned int *new_tid, bool *txn,
+			  unsigned int *xabort_code, struct abort_set *aborts)
+{
+	struct save_state *ss = &ls->save;
+	const struct nobe *current = ss->current;
+
+	set_all_explored(current);
+	branch_sanity(ss->root, ss->current);
+
+	/* this cannot happen in-line with walking the branch, below, since it
+	 * needs to be computed for all ancestors and be ready for checking
+	 * against descendants in advance. */
+	update_user_yield_blocked_transitions(current);
+
+	fingerprint_dpor(ls, current);
+	if (ls->pps.optimal_dpor) {
+		optimal_dpor(ls, current);
+	} else {
+		classic_dpor(ls, current);
 	}
 
 	/* We will choose a tagged sibling that's deepest, to maintain a
 	 * depth-first ordering. This allows us to avoid having tagged siblings
 	 * outside of the current branch of the tree. A trail of "all_explored"
 	 * flags gets left behind. */
-	for (const struct nobe *h = current->parent; h != NULL; h = h->parent) {
+	for (const struct nobe *h = current->parent;
+	     h != NULL && timetravel_may_explore(h); h = h->parent) {
+		timetravel_await_spawns(ls, h);
 		if (any_tagged_child(h, new_tid, txn, xabort_code, aborts)) {
 			assert(h->is_preemption_point);
 			lsprintf(BRANCH, "from #%d/tid%d, chose tid %d%s, "
@@ -773,6 +1033,10 @@ const struct nobe *explore(struct ls_state *ls, unsigned int *new_tid, bool *txn
 				 current->chosen_thread, *new_tid,
 				 *txn ? " (xbegin failure injection)" : "",
 				 h->depth, h->chosen_thread);
+			if (TIMETRAVEL_PARALLEL_LINES > 1 && !*txn) {
+				save_claim_child(h, *new_tid);
+				spawn_spare_siblings(ls, h);
+			}
 			return h;
 		} else {
 			if (h->is_preemption_point) {
@@ -787,6 +1051,8 @@ const struct nobe *explore(struct ls_state *ls, unsigned int *new_tid, bool *txn
 		}
 	}
 
-	lsprintf(ALWAYS, "found no tagged siblings on current branch!\n");
+	if (timetravel_may_explore(ss->root)) {
+		lsprintf(ALWAYS, "found no tagged siblings on current branch!\n");
+	}
 	return NULL;
 }
@@ -0,0 +1,505 @@
+/**
+ * @file arena.c
+ * @brief stateful pruning, by fingerprints of the guest state at each PP
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#define MODULE_NAME "FINGERPRINT"
+#define MODULE_COLOUR COLOUR_DARK COLOUR_CYAN
+
+#include "array_list.h"
+#include "bitset.h"
+#include "common.h"
+#include "fingerprint.h"
+#include "landslide.h"
+#include "schedule.h"
+#include "shared_arena.h"
+#include "sleep_set.h"
+#include "timetravel.h"
+#include "tree.h"
+#include "x86.h"
+
+#ifdef STATE_FINGERPRINTS
+
+/* murmur3's finalizer */
+static uint64_t mix(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+static uint64_t combine(uint64_t h, uint64_t x)
+{
+	return mix(h ^ (x + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2)));
+}
+
+/******************************************************************************
+ * guest RAM
+ ******************************************************************************/
+
+/* Per world line, in ordinary memory: a fork (or a snapshot restore, which
+ * dirties what it rewinds) leaves it consistent with the RAM it goes with. */
+static struct {
+	bool inited;
+	unsigned int num_pages;
+	uint64_t *page_hashes; /* as of when each was last hashed */
+	uint64_t ram_hash; /* the sum of all of the above */
+	uint64_t *dirty; /* bitset: pages written since then */
+	ARRAY_LIST(unsigned int) dirty_list; /* same, for iterating */
+} ram;
+
+static void note_dirty_page(unsigned int page)
+{
+	if (page < ram.num_pages && !bitset_get(ram.dirty, page)) {
+		bitset_set(ram.dirty, page, true);
+		ARRAY_LIST_APPEND(&ram.dirty_list, page);
+	}
+}
+
+void fingerprint_note_write(uint64_t pa, unsigned int len)
+{
+	if (!ram.inited || len == 0) {
+		return;
+	}
+	note_dirty_page(pa / PAGE_SIZE);
+	if ((pa + len - 1) / PAGE_SIZE != pa / PAGE_SIZE) {
+		note_dirty_page((pa + len - 1) / PAGE_SIZE);
+	}
+}
+
+static void ram_init()
+{
+	Bit64u ram_len = BX_MEM(0)->get_memory_len();
+	assert(ram_len % PAGE_SIZE == 0);
+	ram.num_pages = ram_len / PAGE_SIZE;
+	ram.page_hashes = MM_XMALLOC(ram.num_pages, uint64_t);
+	ram.dirty = MM_XMALLOC(BITSET_WORDS(ram.num_pages), uint64_t);
+	bitset_clear(ram.dirty, ram.num_pages);
+	ARRAY_LIST_INIT(&ram.dirty_list, 1024);
+	ram.ram_hash = 0;
+
+	/* the first fingerprint will hash every page, once */
+	for (unsigned int page = 0; page < ram.num_pages; page++) {
+		ram.page_hashes[page] = 0;
+		bitset_set(ram.dirty, page, true);
+		ARRAY_LIST_APPEND(&ram.dirty_list, page);
+	}
+	ram.inited = true;
+}
+
+/* includes the page number, so that swapping two pages' contents shows */
+static uint64_t hash_page(unsigned int page)
+{
+	const uint64_t *words = (const uint64_t *)
+		BX_MEM(0)->get_vector((bx_phy_address)page * PAGE_SIZE);
+	uint64_t h = mix(page + 1);
+	for (unsigned int i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+		h = (((h << 31) | (h >> 33)) ^ words[i]) * 0x9e3779b97f4a7c15ULL;
+	}
+	return mix(h);
+}
+
+static uint64_t ram_hash()
+{
+	unsigned int i;
+	unsigned int *page;
+	ARRAY_LIST_FOREACH(&ram.dirty_list, i, page) {
+		ram.ram_hash -= ram.page_hashes[*page];
+		ram.page_hashes[*page] = hash_page(*page);
+		ram.ram_hash += ram.page_hashes[*page];
+		bitset_set(ram.dirty, *page, false);
+	}
+	lsprintf(INFO, "rehashed %u pages\n", ARRAY_LIST_SIZE(&ram.dirty_list));
+	ram.dirty_list.size = 0;
+	return ram.ram_hash;
+}
+
+/******************************************************************************
+ * the rest of the state
+ ******************************************************************************/
+
+static uint64_t cpu_hash(cpu_t *cpu)
+{
+	uint64_t h = 0;
+	h = combine(h, GET_CPU_ATTR(cpu, eax));
+	h = combine(h, GET_CPU_ATTR(cpu, ebx));
+	h = combine(h, GET_CPU_ATTR(cpu, ecx));
+	h = combine(h, GET_CPU_ATTR(cpu, edx));
+	h = combine(h, GET_CPU_ATTR(cpu, esi));
+	h = combine(h, GET_CPU_ATTR(cpu, edi));
+	h = combine(h, GET_CPU_ATTR(cpu, ebp));
+	h = combine(h, GET_CPU_ATTR(cpu, esp));
+	h = combine(h, GET_CPU_ATTR(cpu, eip));
+	h = combine(h, cpu->read_eflags());
+	h = combine(h, GET_CR0(cpu));
+	h = combine(h, GET_CR3(cpu));
+	return h;
+}
+
+static uint64_t agent_hash(uint64_t h, const struct agent *a, unsigned int q)
+{
+	h = combine(h, ((uint64_t)q << 32) | a->tid);
+	/* all bools, so no padding to worry about */
+	const unsigned char *action = (const unsigned char *)&a->action;
+	for (unsigned int i = 0; i < sizeof(a->action); i++) {
+		h = combine(h, action[i]);
+	}
+	return h;
+}
+
+/* landslide's own view of the threads, which decides what can run next */
+static uint64_t sched_hash(const struct sched_state *s)
+{
+	const struct agent *a;
+	uint64_t h = combine(0, s->cur_agent == NULL ? TID_NONE : s->cur_agent->tid);
+	h = combine(h, s->current_extra_runnable);
+	Q_FOREACH(a, &s->rq, nobe) { h = agent_hash(h, a, 0); }
+	Q_FOREACH(a, &s->sq, nobe) { h = agent_hash(h, a, 1); }
+	Q_FOREACH(a, &s->dq, nobe) { h = agent_hash(h, a, 2); }
+	return h;
+}
+
+/******************************************************************************
+ * summaries
+ ******************************************************************************/
+
+typedef ARRAY_LIST(struct fingerprint_thread) mutable_summary_t;
+static inline mutable_summary_t *mutable_summary(struct nobe *h)
+	{ return (mutable_summary_t *)&h->fingerprint.summary; }
+
+/* (only kept in safe mode; the unsafe one has no use for them) */
+#ifndef STATE_FINGERPRINTS_UNSAFE
+
+/* union of all the thread's transitions' accesses */
+static void merge_thread(mutable_summary_t *summary,
+			 const struct fingerprint_thread *t)
+{
+	struct fingerprint_thread *t2;
+	unsigned int i;
+	ARRAY_LIST_FOREACH(summary, i, t2) {
+		if (t2->tid == t->tid) {
+			footprint_merge(&t2->footprint, &t->footprint);
+			return;
+		}
+	}
+	SHARED_ARRAY_LIST_APPEND(summary, *t);
+}
+
+static void merge_summary(mutable_summary_t *dest, const mutable_summary_t *src)
+{
+	const struct fingerprint_thread *t;
+	unsigned int i;
+	ARRAY_LIST_FOREACH(src, i, t) {
+		merge_thread(dest, t);
+	}
+}
+
+/* of the transition which led to h, as its parent recorded it */
+static void transition_footprint(const struct nobe *h, struct footprint *fp)
+{
+	const struct nobe_child *c;
+	unsigned int i;
+	footprint_init(fp);
+	if (h->xaborted) {
+		/* unknown; conflicts with everything, as it should */
+		return;
+	}
+	ARRAY_LIST_FOREACH(&h->parent->children, i, c) {
+		if (c->chosen_thread == h->chosen_thread && !c->xabort) {
+			*fp = c->footprint;
+			return;
+		}
+	}
+}
+
+bool fingerprint_may_conflict(const struct fingerprint_thread *t,
+			      const struct nobe *h)
+{
+	struct footprint fp;
+	if (t->tid == (unsigned int)h->chosen_thread) {
+		/* its own transitions come after in any interleaving */
+		return false;
+	}
+	transition_footprint(h, &fp);
+	return !footprints_independent(&t->footprint, t->tid,
+				       &fp, h->chosen_thread);
+}
+
+static void update_pp_merge_summary(struct nobe *h, const struct nobe **child)
+{
+	const struct nobe *h2 = *child;
+	struct fingerprint_thread t;
+	t.tid = h2->chosen_thread;
+	transition_footprint(h2, &t.footprint);
+	merge_thread(mutable_summary(h), &t);
+	merge_summary(mutable_summary(h),
+		      (const mutable_summary_t *)&h2->fingerprint.summary);
+}
+
+#else
+
+#define merge_summary(dest, src) do { } while (0)
+
+#endif
+
+static void update_pp_set_summarized(struct nobe *h, int *unused)
+{
+	h->fingerprint.summarized = true;
+}
+
+/******************************************************************************
+ * visited set
+ ******************************************************************************/
+
+struct visited_state {
+	uint64_t value;
+	/* whose transitions from here weren't explored, and whose need not be
+	 * from any PP with this fingerprint that has them all asleep too */
+	ARRAY_LIST(unsigned int) sleepers;
+	mutable_summary_t summary;
+};
+
+/* In the shared arena, like the tree, and protected by the same lock. An open
+ * addressing hash table of pointers, which doubles once half full. */
+static struct visited_set {
+	struct visited_state **table;
+	unsigned int capacity; /* a power of 2 */
+	unsigned int size;
+	unsigned long cuts; /* for the report at the end */
+} *visited = NULL;
+
+#define VISITED_INITIAL_CAPACITY 1024
+
+void fingerprint_init()
+{
+	visited = SHARED_XMALLOC(1, struct visited_set);
+	visited->capacity = VISITED_INITIAL_CAPACITY;
+	visited->table = SHARED_XMALLOC(visited->capacity, struct visited_state *);
+	memset(visited->table, 0, visited->capacity * sizeof(*visited->table));
+	visited->size = 0;
+	visited->cuts = 0;
+	ram.inited = false; /* until the guest is set up */
+}
+
+static struct visited_state **visited_slot(struct visited_state **table,
+					   unsigned int capacity, uint64_t value)
+{
+	unsigned int i = (unsigned int)value & (capacity - 1);
+	while (table[i] != NULL && table[i]->value != value) {
+		i = (i + 1) & (capacity - 1);
+	}
+	return &table[i];
+}
+
+static struct visited_state *visited_find(uint64_t value)
+{
+	return *visited_slot(visited->table, visited->capacity, value);
+}
+
+static void visited_grow()
+{
+	unsigned int capacity = visited->capacity * 2;
+	struct visited_state **table =
+		SHARED_XMALLOC(capacity, struct visited_state *);
+	memset(table, 0, capacity * sizeof(*table));
+	for (unsigned int i = 0; i < visited->capacity; i++) {
+		if (visited->table[i] != NULL) {
+			*visited_slot(table, capacity, visited->table[i]->value) =
+				visited->table[i];
+		}
+	}
+	SHARED_FREE(visited->table);
+	visited->table = table;
+	visited->capacity = capacity;
+}
+
+static bool sleeper_listed(const struct visited_state *v, unsigned int tid)
+{
+	const unsigned int *tid2;
+	unsigned int i;
+	ARRAY_LIST_FOREACH(&v->sleepers, i, tid2) {
+		if (*tid2 == tid) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Visiting the same state again, with other threads asleep, explores it with
+ * only those asleep both times not run. */
+static void visited_add(const struct nobe *h)
+{
+	struct visited_state *v = visited_find(h->fingerprint.value);
+	unsigned int i;
+
+	if (v == NULL) {
+		if (2 * (visited->size + 1) > visited->capacity) {
+			visited_grow();
+		}
+		v = SHARED_XMALLOC(1, struct visited_state);
+		v->value = h->fingerprint.value;
+		SHARED_ARRAY_LIST_INIT(&v->sleepers, 4);
+#ifdef SLEEP_SETS
+		const struct sleeper *z;
+		ARRAY_LIST_FOREACH(&h->sleep_set, i, z) {
+			SHARED_ARRAY_LIST_APPEND(&v->sleepers, z->tid);
+		}
+#endif
+		SHARED_ARRAY_LIST_INIT(&v->summary, 8);
+		*visited_slot(visited->table, visited->capacity, v->value) = v;
+		visited->size++;
+	} else {
+		i = 0;
+		while (i < ARRAY_LIST_SIZE(&v->sleepers)) {
+			if (sleep_set_contains(h, *ARRAY_LIST_GET(&v->sleepers, i))) {
+				i++;
+			} else {
+				ARRAY_LIST_REMOVE_SWAP(&v->sleepers, i);
+			}
+		}
+	}
+	merge_summary(&v->summary,
+		      (const mutable_summary_t *)&h->fingerprint.summary);
+}
+
+/* Would exploring from the visited state, with h's sleepers, do anything its
+ * subtree didn't already? */
+static bool visited_covers(const struct visited_state *v, const struct nobe *h)
+{
+#ifndef STATE_FINGERPRINTS_UNSAFE
+	const unsigned int *tid;
+	unsigned int i;
+	ARRAY_LIST_FOREACH(&v->sleepers, i, tid) {
+		if (!sleep_set_contains(h, *tid)) {
+			return false;
+		}
+	}
+#endif
+	return true;
+}
+
+/******************************************************************************
+ * interface
+ ******************************************************************************/
+
+void fingerprint_pp_init(struct nobe *h)
+{
+	h->fingerprint.known = false;
+	h->fingerprint.cut = false;
+	h->fingerprint.summarized = false;
+	h->fingerprint.value = 0;
+	SHARED_ARRAY_LIST_INIT(&h->fingerprint.summary, 4);
+}
+
+void fingerprint_pp_free(struct nobe *h)
+{
+	SHARED_ARRAY_LIST_FREE(mutable_summary(h));
+}
+
+static void update_pp_cut(struct nobe *h, const struct visited_state **v)
+{
+	h->fingerprint.cut = true;
+	/* so that whoever visits here in turn knows what's below */
+	merge_summary(mutable_summary(h), &(*v)->summary);
+}
+
+void fingerprint_pp(struct ls_state *ls, struct nobe *h)
+{
+	if (!ls->sched.guest_init_done) {
+		/* bochs's RAM may yet be getting set up */
+		return;
+	} else if (!ram.inited) {
+		ram_init();
+	}
+
+	h->fingerprint.value = combine(combine(ram_hash(), cpu_hash(ls->cpu0)),
+				       sched_hash(&ls->sched));
+	h->fingerprint.known = true;
+	lsprintf(INFO, "#%d/tid%d: fingerprint 0x%" PRIx64 "\n", h->depth,
+		 h->chosen_thread, h->fingerprint.value);
+
+	if (h->parent == NULL || !h->is_preemption_point || h->xbegin) {
+		return;
+	}
+
+	/* other world lines may be adding to it */
+	timetravel_lock();
+	const struct visited_state *v = visited_find(h->fingerprint.value);
+	if (v != NULL && visited_covers(v, h)) {
+		modify_pp(update_pp_cut, h, v);
+		visited->cuts++;
+		lsprintf(DEV, "#%d/tid%d: state 0x%" PRIx64 " already explored; "
+			 "ending branch early\n", h->depth, h->chosen_thread,
+			 h->fingerprint.value);
+		ls->end_branch_early = true;
+	} else if (v != NULL) {
+		lsprintf(DEV, "#%d/tid%d: state 0x%" PRIx64 " explored, but with "
+			 "other threads awake\n", h->depth, h->chosen_thread,
+			 h->fingerprint.value);
+	}
+	timetravel_unlock();
+}
+
+void fingerprint_explored(const struct nobe *h)
+{
+	if (h->fingerprint.summarized) {
+		return;
+	}
+	modify_pp(update_pp_set_summarized, h, 0);
+#ifndef STATE_FINGERPRINTS_UNSAFE
+	if (h->parent != NULL) {
+		modify_pp(update_pp_merge_summary, h->parent, h);
+	}
+#endif
+	if (h->fingerprint.known && h->is_preemption_point && !h->xbegin) {
+		visited_add(h);
+	}
+}
+
+void fingerprint_report()
+{
+	lsprintf(ALWAYS, "Pruned %lu subtree%s at already-explored states "
+		 "(of %u visited; %s mode).\n", visited->cuts,
+		 visited->cuts == 1 ? "" : "s", visited->size,
+#ifdef STATE_FINGERPRINTS_UNSAFE
+		 "unsafe"
+#else
+		 "safe"
+#endif
+		 );
+}
+
+#endif
@@ -0,0 +1,148 @@
+/**
+ * @file fingerprint.h
+ * @brief stateful pruning, by fingerprints of the guest state at each PP
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LS_FINGERPRINT_H
+#define __LS_FINGERPRINT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "array_list.h"
+#include "sleep_set.h" /* for struct footprint */
+#include "student_specifics.h" /* for STATE_FINGERPRINTS */
+
+struct ls_state;
+struct nobe;
+
+/* Stateful pruning. DPOR alone is stateless: two interleavings which reach the
+ * very same state, without being equivalent, each get the subtree below it
+ * explored in full. Instead, each PP gets a fingerprint of the guest state --
+ * a hash of all of RAM, the CPU's registers, and landslide's view of the
+ * threads -- and once a PP's subtree is all explored, its fingerprint goes in
+ * a visited set (in the shared arena, so it glows green). Reaching a visited
+ * state again ends the branch then and there, as if all runnable threads were
+ * asleep. The RAM part is kept up to date incrementally: it's a sum of each
+ * page's hash, and only pages written since the last PP (noted through the
+ * same hooks as snapshot_note_write()) get rehashed. Devices' state isn't
+ * included, nor landslide's other bookkeeping (heap tracking, etc.), which is
+ * assumed to follow from the rest; a hash collision could prune wrongly too,
+ * though with 64 bits, that's the least of it.
+ *
+ * Cutting a branch short like that is not sound with DPOR by itself, which
+ * only tags the alternatives to races it sees on the branch, so in the "safe"
+ * mode (the default), two things are done about it [cf. Yang et al., "Efficient
+ * Stateful Dynamic Partial Order Reduction", SPIN 2008]:
+ *  - The visited state's subtree was explored with some threads asleep at its
+ *    root (see sleep_set.h), which it then didn't run there. The branch is cut
+ *    only if those are all asleep now too [Godefroid, 1996, ch. 6].
+ *  - Each explored subtree is summarised by a footprint per thread, merging
+ *    those of all that thread's transitions below (and of any cut-off
+ *    subtrees' summaries in turn). Where a branch is cut, each thread in the
+ *    summary is compared to every transition on the branch as DPOR would its
+ *    transitions below, if it had run them; any that might conflict get the
+ *    thread tagged as a sibling. That over-approximates the races DPOR would
+ *    have found there (more tags, never fewer).
+ * Neither does anything for data race detection, though (see memory.c), which
+ * also compares transitions pairwise along a branch: races between what comes
+ * before a cut and what would have come after it go unreported, from this
+ * branch anyway, and with them the data-race PPs that Quicksand would have
+ * gone on to try. Cutting is still on under Quicksand, since stopping data
+ * race discovery would mean never cutting at all; where new PPs matter more
+ * than finishing, leave STATE_FINGERPRINTS off.
+ * Footprints are those of sleep sets, so safe mode needs SLEEP_SETS. The
+ * STATE_FINGERPRINTS_UNSAFE mode skips both, pruning at any visited state;
+ * it can miss bugs DPOR would find, but prunes much more, which can be worth
+ * it for bug-finding in state spaces too big to finish either way. Neither
+ * can work with ICB, whose preemption count is part of what comes next, nor
+ * with abort sets; randomized exploration (see pct.h) keeps no tree to prune.
+ * The visited set doesn't survive suspending (see suspend.h). */
+#ifdef STATE_FINGERPRINTS
+
+#if defined(ICB) || defined(HTM_ABORT_SETS)
+#error "stateful pruning is incompatible with ICB and HTM abort sets"
+#endif
+#if !defined(STATE_FINGERPRINTS_UNSAFE) && !defined(SLEEP_SETS)
+#error "safe stateful pruning needs SLEEP_SETS (or STATE_FINGERPRINTS_UNSAFE)"
+#endif
+#ifndef BOCHS
+#error "stateful pruning needs bochs, to hash guest RAM"
+#endif
+
+/* what one thread did in an explored subtree (see above) */
+struct fingerprint_thread {
+	unsigned int tid;
+	struct footprint footprint;
+};
+
+struct fingerprint_pp {
+	bool known; /* computed here; not for the last PP on a branch, e.g. */
+	bool cut; /* the state was explored already, and the branch ended here */
+	bool summarized; /* into the parent's summary, once all explored */
+	uint64_t value;
+	/* of the subtree so far; in the shared arena, like the nobe */
+	ARRAY_LIST(const struct fingerprint_thread) summary;
+};
+
+void fingerprint_init(void);
+/* called for every guest memory write, so it's cheap */
+void fingerprint_note_write(uint64_t pa, unsigned int len);
+void fingerprint_pp_init(struct nobe *h);
+void fingerprint_pp_free(struct nobe *h);
+/* for a new PP, once its sleep set is known: computes its fingerprint, and if
+ * that state was already explored, ends the branch early */
+void fingerprint_pp(struct ls_state *ls, struct nobe *h);
+/* for a PP whose subtree is now all explored, before abandoning it: passes
+ * its summary up to its parent, and adds its state to the visited set */
+void fingerprint_explored(const struct nobe *h);
+void fingerprint_report(void);
+#ifndef STATE_FINGERPRINTS_UNSAFE
+/* for DPOR at a cut PP: might any of the thread's summarised transitions
+ * conflict with the one that led to h? */
+bool fingerprint_may_conflict(const struct fingerprint_thread *t,
+			      const struct nobe *h);
+#endif
+
+#else
+
+struct fingerprint_pp { };
+
+#define fingerprint_init() do { } while (0)
+#define fingerprint_note_write(pa, len) do { } while (0)
+#define fingerprint_pp_init(h) do { } while (0)
+#define fingerprint_pp_free(h) do { } while (0)
+#define fingerprint_pp(ls, h) do { } while (0)
+#define fingerprint_explored(h) do { } while (0)
+#define fingerprint_report() do { } while (0)
+
+#endif
+
+#endif /* __LS_FINGERPRINT_H */
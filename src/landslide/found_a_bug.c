@@ -44,9 +44,11 @@
 #include "kernel_specifics.h"
 #include "landslide.h"
 #include "messaging.h"
+#include "pct.h"
 #include "schedule.h"
 #include "simulator.h"
 #include "stack.h"
+#include "timetravel.h"
 #include "tree.h"
 #include "tsx.h"
 
@@ -350,7 +352,7 @@ void _found_a_bug(struct ls_state *ls, bool bug_found, bool verbose,
 			 "These were the preemption points (no bug was found):\n");
 	}
 
-	struct stack_trace *stack = stack_trace(ls);
+	const struct stack_trace *stack = stack_trace(ls);
 	struct fab_html_env env;
 	table_column_map_t map;
 
@@ -460,7 +462,24 @@ void _found_a_bug(struct ls_state *ls, bool bug_found, bool verbose,
 					    ls->icb_bound);
 		}
 	}
-	MM_FREE(stack);
+	free_stack_trace(stack);
+
+	if (bug_found && ls->schedule_file != NULL &&
+	    timetravel_save_schedule(ls, ls->schedule_file)) {
+		lsprintf(BUG, bug_found, COLOUR_BOLD COLOUR_GREEN
+			 "Schedule to reproduce it (set LANDSLIDE_REPLAY_SCHEDULE"
+			 " to replay) output to %s.\n" COLOUR_DEFAULT,
+			 ls->schedule_file);
+	}
+	if (bug_found && pct_exploring(ls)) {
+		/* that alone won't do; the arbiter's own choices were random */
+		char buf[BUF_SIZE];
+		pct_describe_branch(ls, buf, BUF_SIZE);
+		lsprintf(BUG, bug_found, COLOUR_BOLD COLOUR_GREEN
+			 "Randomized branch's seed: '%s' (give it as the "
+			 "exploration strategy to reproduce).\n" COLOUR_DEFAULT,
+			 buf);
+	}
 
 	if (BREAK_ON_BUG) {
 		lsprintf(ALWAYS, bug_found, COLOUR_BOLD COLOUR_YELLOW "%s", bug_found ?
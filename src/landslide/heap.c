@@ -0,0 +1,308 @@
+/**
+ * @file heap.c
+ * @brief persistent trees of heap chunks, for cheap snapshots
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define MODULE_NAME "HEAP"
+
+#include "common.h"
+#include "heap.h"
+#include "mem.h"
+#include "simulator.h"
+#include "stack.h"
+
+/* An AVL tree nobe. Each one holds a reference to its children and to its
+ * chunk, since path copying makes several versions of a nobe that share the
+ * same chunk. */
+struct heap_nobe {
+	const struct chunk *chunk;
+	const struct heap_nobe *left;
+	const struct heap_nobe *right;
+	int height;
+	unsigned int refcount;
+};
+
+/******************************************************************************
+ * reference counting
+ ******************************************************************************/
+
+static const struct chunk *chunk_get(const struct chunk *c)
+{
+	((struct chunk *)c)->refcount++;
+	return c;
+}
+
+static void chunk_put(const struct chunk *c)
+{
+	struct chunk *c_mut = (struct chunk *)c;
+	assert(c_mut->refcount > 0);
+	if (--c_mut->refcount == 0) {
+		if (c->malloc_trace != NULL) free_stack_trace(c->malloc_trace);
+		if (c->free_trace   != NULL) free_stack_trace(c->free_trace);
+		MM_FREE(c_mut);
+	}
+}
+
+static const struct heap_nobe *nobe_get(const struct heap_nobe *n)
+{
+	if (n != NULL) {
+		((struct heap_nobe *)n)->refcount++;
+	}
+	return n;
+}
+
+static void nobe_put(const struct heap_nobe *n)
+{
+	if (n == NULL) {
+		return;
+	}
+	struct heap_nobe *n_mut = (struct heap_nobe *)n;
+	assert(n_mut->refcount > 0);
+	if (--n_mut->refcount == 0) {
+		nobe_put(n->left);
+		nobe_put(n->right);
+		chunk_put(n->chunk);
+		MM_FREE(n_mut);
+	}
+}
+
+/******************************************************************************
+ * path copying
+ ******************************************************************************/
+
+/* In the following, every nobe or chunk passed as an argument to be linked into
+ * a result is a reference which the callee consumes, and every returned nobe
+ * is a new reference. Nobes passed only to be examined are borrowed. */
+
+static int height(const struct heap_nobe *n)
+{
+	return n == NULL ? 0 : n->height;
+}
+
+static const struct heap_nobe *make_nobe(const struct chunk *c,
+					 const struct heap_nobe *left,
+					 const struct heap_nobe *right)
+{
+	struct heap_nobe *n = MM_XMALLOC(1, struct heap_nobe);
+	n->chunk = c;
+	n->left = left;
+	n->right = right;
+	n->height = MAX(height(left), height(right)) + 1;
+	n->refcount = 1;
+	return n;
+}
+
+/* Builds a nobe from subtrees whose heights differ by at most 2, rotating it
+ * back into AVL balance if needed. */
+static const struct heap_nobe *rebalance(const struct chunk *c,
+					 const struct heap_nobe *left,
+					 const struct heap_nobe *right)
+{
+	const struct heap_nobe *result;
+
+	if (height(left) > height(right) + 1) {
+		const struct heap_nobe *l = left;
+		if (height(l->left) >= height(l->right)) {
+			result = make_nobe(chunk_get(l->chunk), nobe_get(l->left),
+					   make_nobe(c, nobe_get(l->right), right));
+		} else {
+			const struct heap_nobe *lr = l->right;
+			result = make_nobe(chunk_get(lr->chunk),
+					   make_nobe(chunk_get(l->chunk),
+						     nobe_get(l->left),
+						     nobe_get(lr->left)),
+					   make_nobe(c, nobe_get(lr->right), right));
+		}
+		nobe_put(left);
+	} else if (height(right) > height(left) + 1) {
+		const struct heap_nobe *r = right;
+		if (height(r->right) >= height(r->left)) {
+			result = make_nobe(chunk_get(r->chunk),
+					   make_nobe(c, left, nobe_get(r->left)),
+					   nobe_get(r->right));
+		} else {
+			const struct heap_nobe *rl = r->left;
+			result = make_nobe(chunk_get(rl->chunk),
+					   make_nobe(c, left, nobe_get(rl->left)),
+					   make_nobe(chunk_get(r->chunk),
+						     nobe_get(rl->right),
+						     nobe_get(r->right)));
+		}
+		nobe_put(right);
+	} else {
+		result = make_nobe(c, left, right);
+	}
+	return result;
+}
+
+static const struct heap_nobe *insert_nobe(const struct heap_nobe *n,
+					   const struct chunk *c)
+{
+	if (n == NULL) {
+		return make_nobe(c, NULL, NULL);
+	} else if (c->base < n->chunk->base) {
+		return rebalance(chunk_get(n->chunk), insert_nobe(n->left, c),
+				 nobe_get(n->right));
+	} else {
+		return rebalance(chunk_get(n->chunk), nobe_get(n->left),
+				 insert_nobe(n->right, c));
+	}
+}
+
+static const struct heap_nobe *remove_min(const struct heap_nobe *n,
+					  const struct chunk **min)
+{
+	if (n->left == NULL) {
+		*min = chunk_get(n->chunk);
+		return nobe_get(n->right);
+	} else {
+		return rebalance(chunk_get(n->chunk), remove_min(n->left, min),
+				 nobe_get(n->right));
+	}
+}
+
+/* Removes the chunk containing addr, which must exist. */
+static const struct heap_nobe *remove_nobe(const struct heap_nobe *n,
+					   unsigned int addr)
+{
+	assert(n != NULL);
+	if (addr < n->chunk->base) {
+		return rebalance(chunk_get(n->chunk), remove_nobe(n->left, addr),
+				 nobe_get(n->right));
+	} else if (addr >= n->chunk->base + n->chunk->len) {
+		return rebalance(chunk_get(n->chunk), nobe_get(n->left),
+				 remove_nobe(n->right, addr));
+	} else if (n->left == NULL) {
+		return nobe_get(n->right);
+	} else if (n->right == NULL) {
+		return nobe_get(n->left);
+	} else {
+		const struct chunk *successor;
+		const struct heap_nobe *right = remove_min(n->right, &successor);
+		return rebalance(successor, nobe_get(n->left), right);
+	}
+}
+
+/******************************************************************************
+ * interface
+ ******************************************************************************/
+
+void heap_init(struct heap *h)
+{
+	h->root = NULL;
+}
+
+/* O(1); the copy shares all nobes with src. */
+void heap_copy(struct heap *dest, const struct heap *src)
+{
+	dest->root = nobe_get(src->root);
+}
+
+void heap_free(struct heap *h)
+{
+	nobe_put(h->root);
+	h->root = NULL;
+}
+
+/* Finds the chunk containing addr (i.e., base <= addr && addr < base + len),
+ * or returns NULL. */
+const struct chunk *heap_find(const struct heap *h, unsigned int addr)
+{
+	const struct heap_nobe *n = h->root;
+	while (n != NULL) {
+		if (addr < n->chunk->base) {
+			n = n->left;
+		} else if (addr < n->chunk->base + n->chunk->len) {
+			return n->chunk;
+		} else {
+			n = n->right;
+		}
+	}
+	return NULL;
+}
+
+/* Takes ownership of c, which must be freshly allocated. */
+void heap_insert(struct heap *h, struct chunk *c)
+{
+	// XXX: If inserting [x|y] into a heap that has [z|w] with x<z<x+y,
+	// this will have no clue. I can't imagine that this would cause any
+	// sort of bug, though...
+	assert(heap_find(h, c->base) == NULL &&
+	       "allocated a block already contained in the heap?");
+	c->refcount = 1;
+	const struct heap_nobe *old_root = h->root;
+	h->root = insert_nobe(old_root, c);
+	nobe_put(old_root);
+}
+
+/* Removes the chunk containing addr, if any. Other snapshots of the heap may
+ * still share it, so returns a private copy, which the caller must free. */
+struct chunk *heap_remove(struct heap *h, unsigned int addr)
+{
+	const struct chunk *c = heap_find(h, addr);
+	if (c == NULL) {
+		return NULL;
+	}
+
+	struct chunk *copy = MM_XMALLOC(1, struct chunk);
+	*copy = *c;
+	copy->refcount = 1;
+	if (c->malloc_trace != NULL) {
+		copy->malloc_trace = copy_stack_trace(c->malloc_trace);
+	}
+	if (c->free_trace != NULL) {
+		copy->free_trace = copy_stack_trace(c->free_trace);
+	}
+
+	const struct heap_nobe *old_root = h->root;
+	h->root = remove_nobe(old_root, addr);
+	nobe_put(old_root);
+	return copy;
+}
+
+static void print_nobe(verbosity v, const struct heap_nobe *n, bool *first)
+{
+	if (n == NULL) {
+		return;
+	}
+	print_nobe(v, n->left, first);
+	if (!*first) {
+		printf(v, ", ");
+	}
+	printf(v, "[0x%x | %d]", n->chunk->base, n->chunk->len);
+	*first = false;
+	print_nobe(v, n->right, first);
+}
+
+void heap_print(verbosity v, const struct heap *h)
+{
+	bool first = true;
+	print_nobe(v, h->root, &first);
+}
@@ -0,0 +1,59 @@
+/**
+ * @file heap.h
+ * @brief persistent trees of heap chunks, for cheap snapshots
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LS_HEAP_H
+#define __LS_HEAP_H
+
+#include "common.h"
+
+struct chunk;
+struct heap_nobe;
+
+/* A set of allocated chunks, keyed by base address. The tree is persistent:
+ * nobes are immutable and refcounted, and insert/remove copy only the path
+ * from the root, so a snapshot of a heap (as taken at every preemption point)
+ * is just another reference to its root, and the two share all other nobes. */
+struct heap {
+	const struct heap_nobe *root;
+};
+
+#define HEAP_EMPTY(h) ((h)->root == NULL)
+
+void heap_init(struct heap *h);
+void heap_copy(struct heap *dest, const struct heap *src);
+void heap_free(struct heap *h);
+const struct chunk *heap_find(const struct heap *h, unsigned int addr);
+void heap_insert(struct heap *h, struct chunk *c);
+struct chunk *heap_remove(struct heap *h, unsigned int addr);
+void heap_print(verbosity v, const struct heap *h);
+
+#endif
@@ -36,9 +36,11 @@
 #define MODULE_NAME "LANDSLIDE"
 #define MODULE_COLOUR COLOUR_DARK COLOUR_MAGENTA
 
+#include "annotations.h"
 #include "common.h"
 #include "explore.h"
 #include "estimate.h"
+#include "fingerprint.h"
 #include "found_a_bug.h"
 #include "html.h"
 #include "kernel_specifics.h"
@@ -46,9 +48,11 @@
 #include "landslide.h"
 #include "mem.h"
 #include "messaging.h"
+#include "pct.h"
 #include "rand.h"
 #include "save.h"
 #include "simulator.h"
+#include "suspend.h"
 #include "test.h"
 #include "tree.h"
 #include "tsx.h"
@@ -76,7 +80,9 @@ struct ls_state *new_landslide()
 	ls->trigger_count = 0;
 	ls->absolute_trigger_count = 0;
 	ls->last_instr_eip = 0;
+	ls->dispatch_optional = false;
 
+	annotations_init();
 	sched_init(&ls->sched);
 	arbiter_init(&ls->arbiter);
 	save_init(&ls->save);
@@ -84,9 +90,12 @@ struct ls_state *new_landslide()
 	mem_init(ls);
 	user_sync_init(&ls->user_sync);
 	rand_init(&ls->rand);
+	pct_init(&ls->pct);
 	messaging_init(&ls->mess);
 	pps_init(&ls->pps);
 	timetravel_init(&ls->timetravel);
+	/* after the above, which sets up the shared arena */
+	fingerprint_init();
 
 #ifdef ICB
 	ls->icb_bound = ICB_START_BOUND;
@@ -98,6 +107,7 @@ struct ls_state *new_landslide()
 	ls->icb_need_increment_bound = false;
 
 	ls->html_file = NULL;
+	ls->schedule_file = NULL;
 	ls->just_jumped = false;
 	ls->end_branch_early = false;
 
@@ -272,7 +282,8 @@ static void check_exception(struct ls_state *ls, int number)
 #ifdef PREEMPT_EVERYWHERE
 #define TOO_DEEP_0TH_BRANCH (1<<20)
 #else
-#define TOO_DEEP_0TH_BRANCH 4000
+/* only checkpoints hold a forked process each (see timetravel.h) */
+#define TOO_DEEP_0TH_BRANCH (4000 * TIMETRAVEL_CHECKPOINT_INTERVAL)
 #endif
 
 /* Avoid getting owned by DR PPs on e.g. memset which hose the average.
@@ -583,13 +594,35 @@ static void found_no_bug(struct ls_state *ls)
 	lsprintf(ALWAYS, COLOUR_BOLD COLOUR_GREEN
 		 "**** Execution tree explored; you survived! ****\n"
 		 COLOUR_DEFAULT);
+	/* for comparing the two (see pp.h) */
+	lsprintf(ALWAYS, "Tested %" PRIu64 " branches with %s DPOR.\n",
+		 ls->save.stats.total_jumps + 1,
+		 ls->pps.optimal_dpor ? "optimal" : "classic");
+	fingerprint_report();
 	PRINT_TREE_INFO(DEV, ls);
 	QUIT_SIMULATION(LS_NO_KNOWN_BUG);
 }
 
-static void check_should_abort(struct ls_state *ls)
+/* h and the choice there are where the next branch would go (h may be NULL if
+ * there is none), in case the master process wants us to suspend instead. */
+static void check_should_abort(struct ls_state *ls, const struct nobe *h,
+			       unsigned int tid, bool txn,
+			       unsigned int xabort_code,
+			       const struct abort_set *aborts)
 {
-	if (should_abort(&ls->mess)) {
+	bool suspend;
+	if (should_abort(&ls->mess, &suspend)) {
+		if (suspend && h != NULL && ls->pps.suspend_filename != NULL &&
+		    suspend_exploration(ls, ls->pps.suspend_filename, h, tid,
+					txn, xabort_code, aborts)) {
+			message_suspended(&ls->mess);
+			lsprintf(ALWAYS, COLOUR_BOLD COLOUR_YELLOW
+				 "**** Suspended by master process. ****\n"
+				 COLOUR_DEFAULT);
+			PRINT_TREE_INFO(DEV, ls);
+			QUIT_SIMULATION(LS_NO_KNOWN_BUG);
+		}
+		/* otherwise, or if it didn't work, it's as good as killed */
 		lsprintf(ALWAYS, COLOUR_BOLD COLOUR_YELLOW
 			 "**** Abort requested by master process. ****\n"
 			 COLOUR_DEFAULT);
@@ -621,33 +654,52 @@ void landslide_assert_fail(const char *message, const char *file,
 static bool time_travel(struct ls_state *ls)
 {
 	/* find where we want to go in the tree, and choose what to do there */
-	unsigned int tid;
-	bool txn;
+	unsigned int tid = TID_NONE;
+	bool txn = false;
 	unsigned int xabort_code = _XBEGIN_STARTED; /* illegal value */
 	struct abort_set aborts;
-	struct nobe *h = explore(ls, &tid, &txn, &xabort_code, &aborts);
+	struct nobe *h = NULL;
+	timetravel_lock();
+	if (!pct_exploring(ls)) {
+		h = explore(ls, &tid, &txn, &xabort_code, &aborts);
+	}
+	/* count other world lines' branches too, if any */
+	timetravel_share_stats(ls);
 
 	lsprintf(BRANCH, COLOUR_BOLD COLOUR_GREEN "End of branch #%" PRIu64
 		 ".\n" COLOUR_DEFAULT, ls->save.stats.total_jumps + 1);
 	print_estimates(ls);
 	lsprintf(BRANCH, "ICB preemption count this branch = %u\n",
 		 ls->sched.icb_preemption_count);
-	check_should_abort(ls);
+	check_should_abort(ls, h, tid, txn, xabort_code, &aborts);
 
 	// TODO: revamp for boxes
 	if (h != NULL) {
 		assert(!h->all_explored);
+		/* in bochs, the lock is let go of on the way out of the jump */
 		save_longjmp(&ls->save, ls, h, tid, txn, xabort_code, &aborts);
+		timetravel_unlock();
+		return true;
+	} else if (pct_exploring(ls)) {
+		/* never done; each branch just starts over (see pct.h) */
+		save_restart(&ls->save, ls);
+		timetravel_unlock();
 		return true;
-	} else if (ls->icb_need_increment_bound) {
+	}
+
+	/* a parallel world line won't return from here */
+	timetravel_retire(ls);
+	if (ls->icb_need_increment_bound) {
 		lsprintf(ALWAYS, COLOUR_BOLD COLOUR_YELLOW "ICB bound %u "
 			 "wasn't enough: trying again with %u...\n",
 			 ls->icb_bound, ls->icb_bound + 1);
 		ls->icb_bound++;
 		ls->icb_need_increment_bound = false;
 		save_reset_tree(&ls->save, ls);
+		timetravel_unlock();
 		return true;
 	} else {
+		timetravel_unlock();
 		return false;
 	}
 }
@@ -685,6 +737,41 @@ static void check_test_state(struct ls_state *ls)
 	}
 }
 
+/* Once everything eip-keyed is ruled out (by the interesting pages bitmap),
+ * could the next instruction still matter to us? Yes, whenever some scheduler
+ * operation is in flight or some state machine awaits an arbitrary instruction
+ * (e.g. interrupts coming back on), which the per-instruction logic polls. */
+static bool can_skip_dispatch(struct ls_state *ls)
+{
+#if defined(PREEMPT_EVERYWHERE) || \
+	(defined(PURE_HAPPENS_BEFORE) && !defined(PINTOS_KERNEL))
+	/* preempt-everywhere is the antithesis of this optimization; and pathos
+	 * pure-HB mode has an unannotated hack in the kern state machine. */
+	return false;
+#else
+	struct sched_state *s = &ls->sched;
+	struct agent *a = s->cur_agent;
+
+	if (ls->just_jumped || ls->end_branch_early ||
+	    !s->guest_init_done || !ls->kern_mem.guest_init_done ||
+	    !test_state_settled(ls)) {
+		return false;
+	} else if (s->schedule_in_flight != NULL || s->entering_timer ||
+		   s->delayed_in_flight || s->just_finished_reschedule ||
+		   s->delayed_txn_fail) {
+		return false;
+	} else if (a->just_delayed_for_data_race ||
+		   a->just_delayed_for_vr_exit || a->just_delayed_for_xbegin ||
+		   a->action.just_forked || a->action.user_txn ||
+		   a->action.lmm_init || XCHG_BLOCKED(&a->user_yield) ||
+		   a->pre_vanish_trace != NULL) {
+		return false;
+	} else {
+		return true;
+	}
+#endif
+}
+
 /* Main entry point. Called every instruction, data access, and extensible. */
 void landslide_entrypoint(struct ls_state *ls, struct trace_entry *entry)
 {
@@ -715,6 +802,7 @@ void landslide_entrypoint(struct ls_state *ls, struct trace_entry *entry)
 		mem_check_shared_access(ls, entry->pa, entry->va, entry->write);
 	} else if (entry->type == TRACE_EXCEPTION) {
 		check_exception(ls, entry->exn_number);
+		ls->dispatch_optional = false;
 	} else if (entry->type == TRACE_INSTRUCTION) {
 		ls->last_instr_eip = ls->eip;
 		memcpy(ls->instruction_text, entry->instruction_text,
@@ -737,5 +825,6 @@ void landslide_entrypoint(struct ls_state *ls, struct trace_entry *entry)
 		mem_update(ls);
 		sched_update(ls);
 		check_test_state(ls);
+		ls->dispatch_optional = can_skip_dispatch(ls);
 	}
 }
@@ -38,6 +38,7 @@
 #include "arbiter.h"
 #include "mem.h"
 #include "messaging.h"
+#include "pct.h"
 #include "pp.h"
 #include "rand.h"
 #include "save.h"
@@ -49,6 +50,10 @@
 
 #define TRACE_OPCODES_LEN 16
 
+/* Even while instructions are bypassing landslide_entrypoint(), dispatch one
+ * every so often, so the infinite loop check in ensure_progress() runs. */
+#define DISPATCH_INTERVAL 4096
+
 struct ls_state {
 	/* simulator_state_t must be the first thing in the device struct */
 	simulator_state_t log;
@@ -73,6 +78,7 @@ struct ls_state {
 	struct mem_state user_mem;
 	struct user_sync_state user_sync;
 	struct rand_state rand;
+	struct pct_state pct;
 	struct messaging_state mess;
 	struct pp_config pps;
 	struct timetravel_state timetravel;
@@ -82,9 +88,13 @@ struct ls_state {
 	bool icb_need_increment_bound;
 
 	char *html_file;
+	char *schedule_file; /* for replaying a buggy branch; see timetravel.h */
 
 	bool just_jumped;
 	bool end_branch_early;
+	/* may the next instruction bypass landslide_entrypoint(), if it's on
+	 * an uninteresting page? see instrument.cc */
+	bool dispatch_optional;
 };
 
 enum trace_type { TRACE_MEMORY, TRACE_EXCEPTION, TRACE_INSTRUCTION, TRACE_OTHER };
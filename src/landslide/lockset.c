@@ -29,9 +29,13 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdint.h>
+#include <string.h>
+
 #define MODULE_NAME "LOCKSET"
 #define MODULE_COLOUR COLOUR_DARK COLOUR_BLUE
 
+#include "bitset.h"
 #include "common.h"
 #include "landslide.h"
 #include "lockset.h"
@@ -43,6 +47,10 @@
 void lockset_init(struct lockset *l)
 {
 	ARRAY_LIST_INIT(&l->list, 16);
+	l->interned = false;
+	l->nwords = 0;
+	l->exact = NULL;
+	l->match = NULL;
 }
 
 void lockset_free(struct lockset *l)
@@ -50,11 +58,224 @@ void lockset_free(struct lockset *l)
 	ARRAY_LIST_FREE(&l->list);
 }
 
+/* The clone is private even if src is interned; its bitsets are not kept. */
 void lockset_clone(struct lockset *dest, const struct lockset *src)
 {
 	ARRAY_LIST_CLONE(&dest->list, &src->list);
+	dest->interned = false;
+	dest->nwords = 0;
+	dest->exact = NULL;
+	dest->match = NULL;
+}
+
+/******************************************************************************
+ * dense lock ids
+ ******************************************************************************/
+
+#define LOCK_ID_INITIAL_CAPACITY 64
+
+struct lock_id_entry {
+	struct lock lock;
+	unsigned int id;
+	bool used;
+};
+
+/* Open-addressing map from each (addr, type) ever locked to a small id, in
+ * order of first appearance, so the bitsets stay a word or two wide. */
+static struct {
+	struct lock_id_entry *table;
+	unsigned int size;
+	unsigned int capacity; /* power of 2 */
+} lock_ids = { NULL, 0, 0 };
+
+static struct lock_id_entry *lock_id_probe(unsigned int addr, enum lock_type type)
+{
+	for (unsigned int i = ((addr ^ type) * 2654435769U) & (lock_ids.capacity - 1);
+	     true; i = (i + 1) & (lock_ids.capacity - 1)) {
+		struct lock_id_entry *entry = &lock_ids.table[i];
+		if (!entry->used ||
+		    (entry->lock.addr == addr && entry->lock.type == type)) {
+			return entry;
+		}
+	}
+}
+
+static void lock_id_grow()
+{
+	struct lock_id_entry *old_table = lock_ids.table;
+	unsigned int old_capacity = lock_ids.capacity;
+
+	lock_ids.capacity = old_capacity == 0 ?
+		LOCK_ID_INITIAL_CAPACITY : old_capacity * 2;
+	lock_ids.table = MM_XMALLOC(lock_ids.capacity, struct lock_id_entry);
+	memset(lock_ids.table, 0,
+	       lock_ids.capacity * sizeof(struct lock_id_entry));
+
+	for (unsigned int i = 0; i < old_capacity; i++) {
+		if (old_table[i].used) {
+			*lock_id_probe(old_table[i].lock.addr,
+				       old_table[i].lock.type) = old_table[i];
+		}
+	}
+	if (old_table != NULL) {
+		MM_FREE(old_table);
+	}
+}
+
+static unsigned int lock_id(unsigned int addr, enum lock_type type)
+{
+	/* keep the load factor under 1/2 */
+	if (2 * (lock_ids.size + 1) > lock_ids.capacity) {
+		lock_id_grow();
+	}
+
+	struct lock_id_entry *entry = lock_id_probe(addr, type);
+	if (!entry->used) {
+		entry->lock.addr = addr;
+		entry->lock.type = type;
+		entry->id = lock_ids.size++;
+		entry->used = true;
+	}
+	return entry->id;
 }
 
+/* Fills in the bitsets of a lockset about to be interned. */
+static void lockset_compute_bits(struct lockset *l)
+{
+	unsigned int i;
+	struct lock *lock;
+	unsigned int max_id = 0;
+
+	/* assign every id first, so one allocation covers them all */
+	ARRAY_LIST_FOREACH(&l->list, i, lock) {
+		max_id = MAX(max_id, lock_id(lock->addr, lock->type));
+		if (lock->type == LOCK_RWLOCK_READ) {
+			max_id = MAX(max_id, lock_id(lock->addr, LOCK_RWLOCK));
+		}
+	}
+
+	l->interned = true;
+	if (ARRAY_LIST_SIZE(&l->list) == 0) {
+		l->nwords = 0;
+		l->exact = NULL;
+		l->match = NULL;
+		return;
+	}
+
+	l->nwords = BITSET_WORDS(max_id + 1);
+	l->exact = MM_XMALLOC(2 * l->nwords, uint64_t);
+	l->match = l->exact + l->nwords;
+	memset(l->exact, 0, 2 * l->nwords * sizeof(uint64_t));
+
+	ARRAY_LIST_FOREACH(&l->list, i, lock) {
+		bitset_set(l->exact, lock_id(lock->addr, lock->type), true);
+		bitset_set(l->match, lock_id(lock->addr,
+			lock->type == LOCK_RWLOCK_READ ? LOCK_RWLOCK : lock->type),
+			true);
+	}
+}
+
+/******************************************************************************
+ * interning
+ ******************************************************************************/
+
+#define INTERN_INITIAL_CAPACITY 64
+
+/* Open-addressing hash table of every distinct lockset any agent has held. */
+static struct {
+	const struct lockset **table;
+	unsigned int size;
+	unsigned int capacity; /* power of 2 */
+} interned = { NULL, 0, 0 };
+
+static unsigned int lockset_hash(const struct lockset *l)
+{
+	unsigned int hash = 2166136261U; /* FNV-1a */
+	unsigned int i;
+	struct lock *lock;
+	ARRAY_LIST_FOREACH(&l->list, i, lock) {
+		hash = (hash ^ lock->addr) * 16777619U;
+		hash = (hash ^ lock->type) * 16777619U;
+	}
+	return hash;
+}
+
+static bool lockset_equals(const struct lockset *l0, const struct lockset *l1)
+{
+	return ARRAY_LIST_SIZE(&l0->list) == ARRAY_LIST_SIZE(&l1->list) &&
+		memcmp(l0->list.array, l1->list.array,
+		       ARRAY_LIST_SIZE(&l0->list) * sizeof(struct lock)) == 0;
+}
+
+/* Returns the slot holding a lockset equal to l, or the empty slot for it. */
+static const struct lockset **intern_probe(const struct lockset *l)
+{
+	for (unsigned int i = lockset_hash(l) & (interned.capacity - 1); true;
+	     i = (i + 1) & (interned.capacity - 1)) {
+		if (interned.table[i] == NULL ||
+		    lockset_equals(interned.table[i], l)) {
+			return &interned.table[i];
+		}
+	}
+}
+
+static void intern_grow()
+{
+	const struct lockset **old_table = interned.table;
+	unsigned int old_capacity = interned.capacity;
+
+	interned.capacity = old_capacity == 0 ?
+		INTERN_INITIAL_CAPACITY : old_capacity * 2;
+	interned.table = MM_XMALLOC(interned.capacity, const struct lockset *);
+	memset(interned.table, 0,
+	       interned.capacity * sizeof(const struct lockset *));
+
+	for (unsigned int i = 0; i < old_capacity; i++) {
+		if (old_table[i] != NULL) {
+			*intern_probe(old_table[i]) = old_table[i];
+		}
+	}
+	if (old_table != NULL) {
+		MM_FREE(old_table);
+	}
+}
+
+/* Returns the canonical immutable copy of l, which the caller may keep
+ * forever; l itself still belongs to the caller. */
+const struct lockset *lockset_intern(const struct lockset *l)
+{
+	/* keep the load factor under 1/2 */
+	if (2 * (interned.size + 1) > interned.capacity) {
+		intern_grow();
+	}
+
+	const struct lockset **slot = intern_probe(l);
+	if (*slot == NULL) {
+		struct lockset *copy = MM_XMALLOC(1, struct lockset);
+		lockset_clone(copy, l);
+		lockset_compute_bits(copy);
+		*slot = copy;
+		interned.size++;
+	}
+	return *slot;
+}
+
+const struct lockset *lockset_empty()
+{
+	static const struct lockset *empty = NULL;
+	if (empty == NULL) {
+		struct lockset l;
+		lockset_init(&l);
+		empty = lockset_intern(&l);
+		lockset_free(&l);
+	}
+	return empty;
+}
+
+/******************************************************************************
+ * set operations
+ ******************************************************************************/
+
 void lockset_print(verbosity v, const struct lockset *l)
 {
 	unsigned int i;
@@ -72,7 +293,7 @@ void lockset_print(verbosity v, const struct lockset *l)
 	}
 }
 
-static int lock_cmp(struct lock *lock0, struct lock *lock1)
+static int lock_cmp(const struct lock *lock0, const struct lock *lock1)
 {
 	if (lock0->addr < lock1->addr) {
 		return -1;
@@ -87,7 +308,7 @@ static int lock_cmp(struct lock *lock0, struct lock *lock1)
 	}
 }
 
-static bool lockset_contains(struct lockset *set, unsigned int lock_addr, enum lock_type type) {
+static bool lockset_contains(const struct lockset *set, unsigned int lock_addr, enum lock_type type) {
 	struct lock *other;
 	unsigned int i;
 
@@ -101,14 +322,12 @@ static bool lockset_contains(struct lockset *set, unsigned int lock_addr, enum l
 	return false;
 }
 
-bool lockset_intersect(struct lockset *l0, struct lockset *l1)
+bool lockset_intersect(const struct lockset *l0, const struct lockset *l1)
 {
-	// Bad runtime. Oh well.
-	// TODO: can exploit the fact that both are sorted for O(n+m) time
-	struct lock *lock;
-	unsigned int i;
-	ARRAY_LIST_FOREACH(&l0->list, i, lock) {
-		if (lockset_contains(l1, lock->addr, lock->type)) {
+	assert(l0->interned && l1->interned);
+	unsigned int nwords = MIN(l0->nwords, l1->nwords);
+	for (unsigned int i = 0; i < nwords; i++) {
+		if ((l0->match[i] & l1->match[i]) != 0) {
 			return true;
 		}
 	}
@@ -137,7 +356,7 @@ static void _lockset_add(struct lockset *l, unsigned int lock_addr, enum lock_ty
 	}
 }
 
-void lockset_add(struct sched_state *s, struct lockset *l,
+void lockset_add(struct sched_state *s, const struct lockset **l,
 		 unsigned int lock_addr, enum lock_type type)
 {
 	assert(lock_addr != 0);
@@ -153,13 +372,13 @@ void lockset_add(struct sched_state *s, struct lockset *l,
 	}
 
 	lsprintf(INFO, "Adding 0x%x to lockset: ", lock_addr);
-	lockset_print(INFO, l);
+	lockset_print(INFO, *l);
 	printf(INFO, "\n");
 
 	/* Check that the lock is not already held. Make an exception for
 	 * e.g. mutexes and things that can contain them having the same
 	 * address. */
-	if (lockset_contains(l, lock_addr, type)) {
+	if (lockset_contains(*l, lock_addr, type)) {
 #if ALLOW_LOCK_HANDOFF != 0
 		lsprintf(ALWAYS, COLOUR_BOLD COLOUR_YELLOW
 			 "WARNING: Recursively locking lock 0x%x (type %d) -- "
@@ -171,7 +390,11 @@ void lockset_add(struct sched_state *s, struct lockset *l,
 #endif
 	}
 
-	_lockset_add(l, lock_addr, type);
+	struct lockset new_set;
+	lockset_clone(&new_set, *l);
+	_lockset_add(&new_set, lock_addr, type);
+	*l = lockset_intern(&new_set);
+	lockset_free(&new_set);
 }
 
 static bool _lockset_remove(struct lockset *l, unsigned int lock_addr, enum lock_type type)
@@ -193,6 +416,20 @@ static bool _lockset_remove(struct lockset *l, unsigned int lock_addr, enum lock
 	return false;
 }
 
+/* Replaces an agent's interned lockset with one lacking the given lock. */
+static bool lockset_remove_interned(const struct lockset **l,
+				    unsigned int lock_addr, enum lock_type type)
+{
+	struct lockset new_set;
+	lockset_clone(&new_set, *l);
+	bool found = _lockset_remove(&new_set, lock_addr, type);
+	if (found) {
+		*l = lockset_intern(&new_set);
+	}
+	lockset_free(&new_set);
+	return found;
+}
+
 #define LOCKSET_OF(a, in_kernel) \
 	((in_kernel) ? &(a)->kern_locks_held : &(a)->user_locks_held)
 void lockset_remove(struct sched_state *s, unsigned int lock_addr,
@@ -205,7 +442,7 @@ void lockset_remove(struct sched_state *s, unsigned int lock_addr,
 		return;
 	}
 
-	if (_lockset_remove(LOCKSET_OF(s->cur_agent, in_kernel), lock_addr, type))
+	if (lockset_remove_interned(LOCKSET_OF(s->cur_agent, in_kernel), lock_addr, type))
 		return;
 
 	char lock_name[BUF_SIZE];
@@ -217,13 +454,13 @@ void lockset_remove(struct sched_state *s, unsigned int lock_addr,
 #if ALLOW_LOCK_HANDOFF != 0
 	struct agent *a;
 	Q_FOREACH(a, &s->rq, nobe) {
-		if (_lockset_remove(LOCKSET_OF(a, in_kernel), lock_addr, type)) return;
+		if (lockset_remove_interned(LOCKSET_OF(a, in_kernel), lock_addr, type)) return;
 	}
 	Q_FOREACH(a, &s->sq, nobe) {
-		if (_lockset_remove(LOCKSET_OF(a, in_kernel), lock_addr, type)) return;
+		if (lockset_remove_interned(LOCKSET_OF(a, in_kernel), lock_addr, type)) return;
 	}
 	Q_FOREACH(a, &s->rq, nobe) {
-		if (_lockset_remove(LOCKSET_OF(a, in_kernel), lock_addr, type)) return;
+		if (lockset_remove_interned(LOCKSET_OF(a, in_kernel), lock_addr, type)) return;
 	}
 #endif
 
@@ -274,53 +511,32 @@ void lockset_record_semaphore(struct lockset *semaphores, unsigned int lock_addr
 	}
 }
 
-enum lockset_cmp_result lockset_compare(struct lockset *l0, struct lockset *l1)
+enum lockset_cmp_result lockset_compare(const struct lockset *l0,
+					const struct lockset *l1)
 {
-	enum lockset_cmp_result result = LOCKSETS_EQ;
-	int i = 0, j = 0;
-
-	while (i < ARRAY_LIST_SIZE(&l0->list) || j < ARRAY_LIST_SIZE(&l1->list)) {
-		/* check termination condition */
-		if (i == ARRAY_LIST_SIZE(&l0->list)) {
-			/* j's set has extra elements */
-			if (result == LOCKSETS_SUPSET) {
-				return LOCKSETS_DIFF;
-			} else {
-				return LOCKSETS_SUBSET;
-			}
-		} else if (j == ARRAY_LIST_SIZE(&l1->list)) {
-			/* i's set has extra elements */
-			if (result == LOCKSETS_SUBSET) {
-				return LOCKSETS_DIFF;
-			} else {
-				return LOCKSETS_SUPSET;
-			}
-		}
+	/* interned locksets are unique */
+	if (l0 == l1) {
+		return LOCKSETS_EQ;
+	}
+	assert(l0->interned && l1->interned);
 
-		/* check elements */
-		int cmp = lock_cmp(ARRAY_LIST_GET(&l0->list, i),
-				   ARRAY_LIST_GET(&l1->list, j));
-		if (cmp < 0) {
-			/* this lock is missing in j's set */
-			if (result == LOCKSETS_SUBSET) {
-				return LOCKSETS_DIFF;
-			} else {
-				result = LOCKSETS_SUPSET;
-				i++;
-			}
-		} else if (cmp > 0) {
-			/* this lock is missing in i's set */
-			if (result == LOCKSETS_SUPSET) {
-				return LOCKSETS_DIFF;
-			} else {
-				result = LOCKSETS_SUBSET;
-				j++;
-			}
-		} else {
-			i++;
-			j++;
-		}
+	uint64_t extra0 = 0; /* locks only l0 holds */
+	uint64_t extra1 = 0; /* locks only l1 holds */
+	unsigned int nwords = MAX(l0->nwords, l1->nwords);
+	for (unsigned int i = 0; i < nwords; i++) {
+		uint64_t w0 = i < l0->nwords ? l0->exact[i] : 0;
+		uint64_t w1 = i < l1->nwords ? l1->exact[i] : 0;
+		extra0 |= w0 & ~w1;
+		extra1 |= w1 & ~w0;
 	}
 
-	return result;
+	if (extra0 != 0 && extra1 != 0) {
+		return LOCKSETS_DIFF;
+	} else if (extra0 != 0) {
+		return LOCKSETS_SUPSET;
+	} else if (extra1 != 0) {
+		return LOCKSETS_SUBSET;
+	} else {
+		return LOCKSETS_EQ;
+	}
 }
@@ -54,9 +54,22 @@ struct lock {
 	enum lock_type type;
 };
 
-/* Tracks the locks held by a given thread, for data race detection. */
+/* Tracks the locks held by a given thread, for data race detection. The sets
+ * agents hold (and memory accesses record) are interned: immutable, never
+ * freed, and unique per contents, so they can be shared and compared by
+ * pointer. Locksets built with lockset_init() are private and mutable.
+ *
+ * Interned sets also carry bitsets over small dense lock ids, assigned per
+ * run as new locks are seen, so intersect and compare are a few word ops.
+ * 'exact' has one bit per (addr, type); 'match' folds read-mode rwlocks
+ * onto the write-mode id, per SAME_LOCK_TYPE. Sets whose ids don't fit in
+ * the first word spill into more words rather than a fixed-size map. */
 struct lockset {
 	ARRAY_LIST(struct lock) list;
+	bool interned;
+	unsigned int nwords; /* of each bitset; trailing zero words omitted */
+	uint64_t *exact;
+	uint64_t *match;
 };
 
 /* For efficient storage of locksets on memory accesses. */
@@ -71,13 +84,16 @@ void lockset_init(struct lockset *l);
 void lockset_free(struct lockset *l);
 void lockset_print(verbosity v, const struct lockset *l);
 void lockset_clone(struct lockset *dest, const struct lockset *src);
+const struct lockset *lockset_intern(const struct lockset *l);
+const struct lockset *lockset_empty(void);
 void lockset_record_semaphore(struct lockset *semaphores, unsigned int lock_addr,
 			      bool is_semaphore);
-void lockset_add(struct sched_state *s, struct lockset *l,
+void lockset_add(struct sched_state *s, const struct lockset **l,
 		 unsigned int lock_addr, enum lock_type type);
 void lockset_remove(struct sched_state *s, unsigned int lock_addr,
 		    enum lock_type type, bool in_kernel);
-bool lockset_intersect(struct lockset *l0, struct lockset *l1);
-enum lockset_cmp_result lockset_compare(struct lockset *l0, struct lockset *l1);
+bool lockset_intersect(const struct lockset *l0, const struct lockset *l1);
+enum lockset_cmp_result lockset_compare(const struct lockset *l0,
+					const struct lockset *l1);
 
 #endif
@@ -34,7 +34,9 @@
 
 #include <stdbool.h>
 
+#include "arena.h"
 #include "array_list.h"
+#include "heap.h"
 #include "lockset.h"
 #include "rbtree.h"
 #include "vector_clock.h"
@@ -65,7 +67,7 @@ struct mem_lockset {
 	 * ids may appear; if so, we fall back to false-positiving. */
 	enum chunk_id_info any_chunk_ids;
 	unsigned int chunk_id;
-	struct lockset locks_held;
+	const struct lockset *locks_held; /* interned */
 #ifdef PURE_HAPPENS_BEFORE
 	struct vector_clock clock;
 #endif
@@ -86,9 +88,26 @@ struct mem_access {
 	int count;         /* how many times accessed? (stats) */
 	bool conflict;     /* does this conflict with another transition? (stats) */
 	struct mem_locksets locksets; /* distinct locksets used while accessing */
-	struct rb_node nobe;
 };
 
+/* The set of shared addresses accessed during one transition. While the
+ * transition runs, it's an open-addressing hash table keyed by address (empty
+ * slots have count 0). At the save point, shm_sort() compacts it into an array
+ * sorted by address, for merge-walking against other transitions' sets.
+ * The mem_locksets, and the sorted array, are allocated from the set's arena,
+ * so freeing a whole transition's worth is just freeing the arena. */
+struct shm_set {
+	struct mem_access *table;
+	unsigned int size;     /* number of distinct addresses */
+	unsigned int capacity; /* power of 2 while hashed; == size once sorted */
+	bool sorted;
+	struct arena arena;
+};
+
+#define SHM_FOREACH(s, i, ma)						\
+	for ((i) = 0; (i) < (s)->capacity; (i)++)			\
+		if (((ma) = &(s)->table[(i)])->count != 0)
+
 /* represents two instructions by different threads which accessed the same
  * memory location, where both threads did not hold the same lock and there was
  * not a happens-before relation between them [insert citation here]. the
@@ -128,18 +147,14 @@ struct chunk {
 	unsigned int base;
 	unsigned int len;
 	unsigned int id; /* distinguishes chunks in same-space-different-time */
-	struct rb_node nobe;
+	struct rb_node nobe; /* for the freed tree only */
+	unsigned int refcount; /* for heaps only; see heap.h */
 	/* for use-after-free reporting */
 	const struct stack_trace *malloc_trace;
 	const struct stack_trace *free_trace;
 	bool pages_reserved_for_malloc;
 };
 
-static inline struct stack_trace *mutable_malloc_trace(struct chunk *c)
-	{ return (struct stack_trace *)c->malloc_trace; }
-static inline struct stack_trace *mutable_free_trace(struct chunk *c)
-	{ return (struct stack_trace *)c->free_trace; }
-
 struct malloc_actions {
 	bool in_alloc;
 	bool in_realloc;
@@ -152,7 +167,7 @@ struct malloc_actions {
 
 struct mem_state {
 	/**** heap state tracking ****/
-	struct rb_root malloc_heap;
+	struct heap malloc_heap;
 	unsigned int heap_size;
 	unsigned int heap_next_id; /* generation counter for chunks */
 
@@ -161,7 +176,7 @@ struct mem_state {
 	 * The above fields for size and generation counter are shared for
 	 * simplicity of code, but others need to be duplicated. In pebbles
 	 * this is deadcode. */
-	struct rb_root palloc_heap;
+	struct heap palloc_heap;
 
 	/* dynamic allocation request state */
 	bool guest_init_done;
@@ -185,7 +200,7 @@ struct mem_state {
 	/**** shared memory conflict detection ****/
 	/* set of all shared accesses that happened during this transition;
 	 * cleared after each save point - done in save.c */
-	struct rb_root shm;
+	struct shm_set shm;
 	/* set of all chunks that were freed during this transition; cleared
 	 * after each save point just like the shared memory one above */
 	struct rb_root freed;
@@ -211,8 +226,11 @@ bool mem_shm_intersect(struct ls_state *ls,
 		       const struct nobe *h0, const struct nobe *h2,
                        bool in_kernel);
 
+void shm_init(struct shm_set *s);
+void shm_sort(struct shm_set *s);
 bool shm_contains_addr(const struct mem_state *m, unsigned int addr);
 
 bool check_user_address_space(struct ls_state *ls);
+void mem_restore_data_race(struct mem_state *m, const struct data_race *dr);
 
 #endif
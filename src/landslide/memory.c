@@ -29,9 +29,13 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdlib.h>
+#include <string.h>
+
 #define MODULE_NAME "MEMORY"
 #define MODULE_COLOUR COLOUR_DARK COLOUR_YELLOW
 
+#include "annotations.h"
 #include "common.h"
 #include "compiler.h"
 #include "found_a_bug.h"
@@ -82,12 +86,12 @@ void init_malloc_actions(struct malloc_actions *flags)
 
 static void mem_heap_init(struct mem_state *m)
 {
-	m->malloc_heap.rb_node = NULL;
+	heap_init(&m->malloc_heap);
 	m->heap_size = 0;
 	m->heap_next_id = 0;
 	m->guest_init_done = false;
 	m->in_mm_init = false;
-	m->palloc_heap.rb_node = NULL;
+	heap_init(&m->palloc_heap);
 #ifndef ALLOW_REENTRANT_MALLOC_FREE
 	init_malloc_actions(&m->flags);
 #endif
@@ -96,7 +100,7 @@ static void mem_heap_init(struct mem_state *m)
 	m->user_mutex_size = 0;
 	m->during_xchg = false;
 	ARRAY_LIST_INIT(&m->newpageses, 8);
-	m->shm.rb_node = NULL;
+	shm_init(&m->shm);
 	m->freed.rb_node = NULL;
 	m->data_races.rb_node = NULL;
 	m->data_races_suspected = 0;
@@ -219,9 +223,9 @@ static const struct chunk *find_containing_chunk(const struct rb_root *root, uns
 /* As above, but searches both the malloc and palloc heap (if it exists). */
 static const struct chunk *find_alloced_chunk(const struct mem_state *m, unsigned int addr)
 {
-	const struct chunk *c = find_containing_chunk(&m->malloc_heap, addr);
+	const struct chunk *c = heap_find(&m->malloc_heap, addr);
 	if (c == NULL) {
-		c = find_containing_chunk(&m->palloc_heap, addr);
+		c = heap_find(&m->palloc_heap, addr);
 		/* Pages used to back malloc are still illegal. */
 		if (c != NULL && c->pages_reserved_for_malloc) {
 			c = NULL;
@@ -253,37 +257,6 @@ static void insert_chunk(struct rb_root *root, struct chunk *c, bool coalesce)
 	rb_insert_color(&c->nobe, root);
 }
 
-static struct chunk *remove_chunk(struct rb_root *root, unsigned int addr)
-{
-	struct chunk *target = NULL;
-	struct rb_node **p = find_insert_location(root, addr, &target);
-
-	if (p == NULL) {
-		assert(target != NULL);
-		rb_erase(&target->nobe, root);
-		return target;
-	} else {
-		/* no containing block found */
-		return NULL;
-	}
-}
-
-static void print_heap(verbosity v, struct rb_node *nobe, bool rightmost)
-{
-	if (nobe == NULL) {
-		return;
-	}
-
-	struct chunk *c = rb_entry(nobe, struct chunk, nobe);
-
-	print_heap(v, c->nobe.rb_left, false);
-	printf(v, "[0x%x | %d]", c->base, c->len);
-	if (!rightmost || c->nobe.rb_right != NULL) {
-		printf(v, ", ");
-	}
-	print_heap(v, c->nobe.rb_right, rightmost);
-}
-
 /* Attempt to find a freed chunk among all transitions */
 static const struct chunk *find_freed_chunk(
 	struct ls_state *ls, unsigned int addr, bool in_kernel,
@@ -375,7 +348,7 @@ static void print_freed_chunk_info(void *env, struct fab_html_env *html_env)
  * and flags depending on which heap (kmalloc, kpalloc, umalloc) is used. */
 #define INIT_PTRS(m, heap, init, alloc, free, reqsize)				\
 	struct mem_state *m = in_kernel ? &ls->kern_mem : &ls->user_mem;	\
-	MAYBE_UNUSED struct rb_root *heap =					\
+	MAYBE_UNUSED struct heap *heap =					\
 		is_palloc ? &m->palloc_heap : &m->malloc_heap;			\
 	MAYBE_UNUSED bool *init  = &m->in_mm_init; /* gross, but harmless. */	\
 	MAYBE_UNUSED bool *alloc = is_palloc ?					\
@@ -444,7 +417,7 @@ static void mem_exit_bad_place(struct ls_state *ls, bool in_kernel, bool is_pall
 		m->heap_size += *request_size;
 		assert(m->heap_next_id != INT_MAX && "need a wider type");
 		m->heap_next_id++;
-		insert_chunk(heap, chunk, false);
+		heap_insert(heap, chunk);
 	}
 
 	*in_alloc = false;
@@ -462,7 +435,7 @@ static void mem_enter_free(struct ls_state *ls, bool in_kernel, bool is_palloc,
 			    *in_alloc ? "Malloc" : "Free");
 	}
 
-	chunk = remove_chunk(heap, base);
+	chunk = heap_remove(heap, base);
 
 	if (base == 0) {
 		assert(chunk == NULL);
@@ -537,8 +510,11 @@ void mem_update(struct ls_state *ls)
 	}
 
 	if (KERNEL_MEMORY(ls->eip)) {
+		/* All the cases below are keyed on exact eips. */
+		if (!annotated_eip(ls->eip)) {
+			return;
 		/* Normal malloc */
-		if (kern_lmm_alloc_entering(ls->cpu0, ls->eip, &size)) {
+		} else if (kern_lmm_alloc_entering(ls->cpu0, ls->eip, &size)) {
 			mem_enter_bad_place(ls, true, false, size);
 		} else if (kern_lmm_alloc_exiting(ls->cpu0, ls->eip, &base)) {
 			mem_exit_bad_place(ls, true, false, base);
@@ -565,7 +541,7 @@ void mem_update(struct ls_state *ls)
 			}
 		}
 	} else {
-		if (ignore_user_access(ls)) {
+		if (ignore_user_access(ls) || !annotated_eip(ls->eip)) {
 			return;
 		} else if (user_mm_malloc_entering(ls->cpu0, ls->eip, &size)) {
 			mem_enter_bad_place(ls, false, false, size);
@@ -643,12 +619,13 @@ static bool was_freed_remalloced(const struct mem_lockset *l0, const struct mem_
 
 /* Actually looking for data races cannot happen until we know the
  * happens-before relationship to previous transitions, in save.c. */
-static void add_lockset_to_shm(struct ls_state *ls, struct mem_access *ma,
-			       const struct chunk *c, bool write, bool in_kernel)
+static void add_lockset_to_shm(struct ls_state *ls, struct arena *arena,
+			       struct mem_access *ma, const struct chunk *c,
+			       bool write, bool in_kernel)
 {
-	struct lockset *current_locks =
-		in_kernel ? &ls->sched.cur_agent->kern_locks_held :
-		            &ls->sched.cur_agent->user_locks_held;
+	const struct lockset *current_locks =
+		in_kernel ? ls->sched.cur_agent->kern_locks_held :
+		            ls->sched.cur_agent->user_locks_held;
 	struct mem_lockset *l_old;
 	unsigned int current_syscall = ls->sched.cur_agent->most_recent_syscall;
 	unsigned int called_from     = ls->sched.cur_agent->last_call;
@@ -676,11 +653,11 @@ static void add_lockset_to_shm(struct ls_state *ls, struct mem_access *ma,
 			/* union ITS old chunk id info into OUR current one */
 			merge_chunk_id_info(&any_cids, &cid, l_prev->any_chunk_ids,
 					    l_prev->chunk_id);
-			lockset_free(&l_prev->locks_held);
+			/* its storage stays in the arena until the transition
+			 * is freed; it's replaced by one new lockset below. */
 #ifdef PURE_HAPPENS_BEFORE
 			vc_destroy(&l_prev->clock);
 #endif
-			MM_FREE(l_prev);
 			remove_prev = false;
 		}
 
@@ -721,7 +698,7 @@ static void add_lockset_to_shm(struct ls_state *ls, struct mem_access *ma,
 #endif
 
 		enum lockset_cmp_result r =
-			lockset_compare(current_locks, &l_old->locks_held);
+			lockset_compare(current_locks, l_old->locks_held);
 		if (r == LOCKSETS_SUPSET && write && !l_old->write) {
 			/* e.g. current = L1 + L2; past = L2... BUT, current
 			 * access is a write. while the old one with fewer locks
@@ -757,15 +734,13 @@ static void add_lockset_to_shm(struct ls_state *ls, struct mem_access *ma,
 		assert(need_add);
 		l_old = Q_GET_TAIL(&ma->locksets);
 		Q_REMOVE(&ma->locksets, l_old, nobe);
-		lockset_free(&l_old->locks_held);
 #ifdef PURE_HAPPENS_BEFORE
 		vc_destroy(&l_old->clock);
 #endif
-		MM_FREE(l_old);
 	}
 
 	if (need_add) {
-		struct mem_lockset *l_new = MM_XMALLOC(1, struct mem_lockset);
+		struct mem_lockset *l_new = ARENA_XMALLOC(arena, 1, struct mem_lockset);
 		l_new->eip = ls->eip;
 		l_new->write = write;
 		l_new->during_init = during_init;
@@ -776,53 +751,133 @@ static void add_lockset_to_shm(struct ls_state *ls, struct mem_access *ma,
 		l_new->most_recent_syscall = current_syscall;
 		l_new->any_chunk_ids = any_cids;
 		l_new->chunk_id = cid;
-		lockset_clone(&l_new->locks_held, current_locks);
+		l_new->locks_held = current_locks;
 #ifdef PURE_HAPPENS_BEFORE
+		VC_EMPTY(&l_new->clock);
 		vc_copy(&l_new->clock, &ls->sched.cur_agent->clock);
 #endif
 		Q_INSERT_FRONT(&ma->locksets, l_new, nobe);
 	}
 }
 
-#define MEM_ENTRY(rb) \
-	((rb) == NULL ? NULL : rb_entry(rb, struct mem_access, nobe))
+#define SHM_INITIAL_CAPACITY 64
+
+static unsigned int shm_hash(const struct shm_set *s, unsigned int addr)
+{
+	/* fibonacci hashing; the high bits of the product are well mixed */
+	return (addr * 2654435769U) >> (32 - __builtin_ctz(s->capacity));
+}
+
+/* Returns the slot holding addr, or the empty slot where it would go. */
+static struct mem_access *shm_probe(const struct shm_set *s, unsigned int addr)
+{
+	assert(!s->sorted && s->capacity != 0);
+	for (unsigned int i = shm_hash(s, addr); true;
+	     i = (i + 1) & (s->capacity - 1)) {
+		struct mem_access *ma = &s->table[i];
+		if (ma->count == 0 || ma->addr == addr) {
+			return ma;
+		}
+	}
+}
+
+static void shm_grow(struct shm_set *s)
+{
+	struct mem_access *old_table = s->table;
+	unsigned int old_capacity = s->capacity;
+	unsigned int i;
+	struct mem_access *ma;
+
+	s->capacity = old_capacity == 0 ? SHM_INITIAL_CAPACITY : old_capacity * 2;
+	assert(s->capacity > old_capacity && "shm table overflow");
+	s->table = MM_XMALLOC(s->capacity, struct mem_access);
+	memset(s->table, 0, s->capacity * sizeof(struct mem_access));
+
+	for (i = 0; i < old_capacity; i++) {
+		if ((ma = &old_table[i])->count != 0) {
+			struct mem_access *dest = shm_probe(s, ma->addr);
+			assert(dest->count == 0);
+			*dest = *ma; /* nb. moving a Q head is fine */
+		}
+	}
+	if (old_table != NULL) {
+		MM_FREE(old_table);
+	}
+}
+
+void shm_init(struct shm_set *s)
+{
+	s->table = NULL;
+	s->size = 0;
+	s->capacity = 0;
+	s->sorted = false;
+	arena_init(&s->arena);
+}
+
+static int shm_cmp(const void *a, const void *b)
+{
+	unsigned int addr_a = ((const struct mem_access *)a)->addr;
+	unsigned int addr_b = ((const struct mem_access *)b)->addr;
+	return addr_a < addr_b ? -1 : addr_a > addr_b ? 1 : 0;
+}
+
+/* Done once per transition, when it's stored in the tree (see save.c). */
+void shm_sort(struct shm_set *s)
+{
+	assert(!s->sorted);
+	if (s->size == 0) {
+		if (s->table != NULL) {
+			MM_FREE(s->table);
+		}
+		s->table = NULL;
+		s->capacity = 0;
+	} else {
+		/* copy into an exactly-sized array, as this gets kept around */
+		struct mem_access *table =
+			ARENA_XMALLOC(&s->arena, s->size, struct mem_access);
+		unsigned int i, j = 0;
+		struct mem_access *ma;
+		SHM_FOREACH(s, i, ma) {
+			table[j++] = *ma;
+		}
+		assert(j == s->size);
+		qsort(table, s->size, sizeof(struct mem_access), shm_cmp);
+		MM_FREE(s->table);
+		s->table = table;
+		s->capacity = s->size;
+	}
+	s->sorted = true;
+}
 
 static void add_shm(struct ls_state *ls, struct mem_state *m, const struct chunk *c,
 		    unsigned int addr, bool write, bool in_kernel)
 {
-	struct rb_node **p = &m->shm.rb_node;
-	struct rb_node *parent = NULL;
+	struct shm_set *s = &m->shm;
 	struct mem_access *ma;
 
-	while (*p != NULL) {
-		parent = *p;
-		ma = MEM_ENTRY(parent);
+	/* keep the load factor under 3/4 */
+	if (4 * (s->size + 1) > 3 * s->capacity) {
+		shm_grow(s);
+	}
 
-		if (addr < ma->addr) {
-			p = &(*p)->rb_left;
-		} else if (addr > ma->addr) {
-			p = &(*p)->rb_right;
-		} else {
-			/* access already exists */
-			ma->count++;
-			ma->any_writes = ma->any_writes || write;
-			add_lockset_to_shm(ls, ma, c, write, in_kernel);
-			return;
-		}
+	ma = shm_probe(s, addr);
+	if (ma->count != 0) {
+		/* access already exists */
+		ma->count++;
+		ma->any_writes = ma->any_writes || write;
+		add_lockset_to_shm(ls, &s->arena, ma, c, write, in_kernel);
+		return;
 	}
 
 	/* doesn't exist; create a new one */
-	ma = MM_XMALLOC(1, struct mem_access);
 	ma->addr       = addr;
 	ma->any_writes = write;
 	ma->count      = 1;
 	ma->conflict   = false;
 	ma->other_tid  = 0;
 	Q_INIT_HEAD(&ma->locksets);
-	add_lockset_to_shm(ls, ma, c, write, in_kernel);
-
-	rb_link_node(&ma->nobe, parent, p);
-	rb_insert_color(&ma->nobe, &m->shm);
+	add_lockset_to_shm(ls, &s->arena, ma, c, write, in_kernel);
+	s->size++;
 }
 
 static void use_after_free(struct ls_state *ls, unsigned int addr,
@@ -842,11 +897,11 @@ static void use_after_free(struct ls_state *ls, unsigned int addr,
 
 	// TODO: do something analogous to a wrong_panic() assert here
 	lsprintf(BUG, "Malloc() heap contents: {");
-	print_heap(BUG, m->malloc_heap.rb_node, true);
+	heap_print(BUG, &m->malloc_heap);
 	printf(BUG, "}\n");
-	if (m->palloc_heap.rb_node != NULL) {
+	if (!HEAP_EMPTY(&m->palloc_heap)) {
 		lsprintf(BUG, "Palloc() heap contents: {");
-		print_heap(BUG, m->palloc_heap.rb_node, true);
+		heap_print(BUG, &m->palloc_heap);
 		printf(BUG, "}\n");
 	}
 
@@ -892,7 +947,7 @@ static unsigned int lowest_user_newpage(struct ls_state *ls) {
  * this allows thread_fork misbehave preemption point without DPOR necessarily
  * always needing to run the other thread. see thesis section 3.1.4.2. */
 static bool ignore_syscall_from_thrlib_function(struct ls_state *ls) {
-	struct stack_trace *st = stack_trace(ls);
+	const struct stack_trace *st = stack_trace(ls);
 	const struct stack_frame *f;
 	bool result = false;
 	unsigned int i;
@@ -1175,15 +1230,24 @@ void mem_check_shared_access(struct ls_state *ls, unsigned int phys_addr,
 
 bool shm_contains_addr(const struct mem_state *m, unsigned int addr)
 {
-	struct mem_access *ma = MEM_ENTRY(m->shm.rb_node);
+	const struct shm_set *s = &m->shm;
 
-	while (ma != NULL) {
-		if (addr == ma->addr) {
+	if (s->size == 0) {
+		return false;
+	} else if (!s->sorted) {
+		return shm_probe(s, addr)->count != 0;
+	}
+
+	unsigned int lo = 0;
+	unsigned int hi = s->size;
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+		if (s->table[mid].addr == addr) {
 			return true;
-		} else if (addr < ma->addr) {
-			ma = MEM_ENTRY(ma->nobe.rb_left);
+		} else if (s->table[mid].addr < addr) {
+			lo = mid + 1;
 		} else {
-			ma = MEM_ENTRY(ma->nobe.rb_right);
+			hi = mid;
 		}
 	}
 	return false;
@@ -1322,14 +1386,14 @@ static void print_data_race(struct ls_state *ls,
 	print_eip(v, l0->eip);
 
 	printf(v, " [locks: ");
-	lockset_print(v, &l0->locks_held);
+	lockset_print(v, l0->locks_held);
 	printf(v, "]%s and \n", l0->interrupce_enabled ? "" : " (cli'd)");
 
 	lsprintf(v, "%s", colour);
 	printf(v, "#%d/tid%d at ", h1->depth, h1->chosen_thread);
 	print_eip(v, l1->eip);
 	printf(v, " [locks: ");
-	lockset_print(v, &l1->locks_held);
+	lockset_print(v, l1->locks_held);
 	printf(v, "]%s\n", l1->interrupce_enabled ? "" : " (cli'd)");
 
 	lsprintf(DEV, "Num data races suspected: %d; confirmed: %d\n",
@@ -1462,6 +1526,18 @@ static bool check_data_race(struct mem_state *m, unsigned int eip0, unsigned int
 	return false;
 }
 
+/* re-enters a data race remembered by a previous run (see suspend.c) into the
+ * table, observing it in each order the original had, so counts match too */
+void mem_restore_data_race(struct mem_state *m, const struct data_race *dr)
+{
+	if (dr->first_before_other) {
+		check_data_race(m, dr->first_eip, dr->other_eip);
+	}
+	if (dr->other_before_first) {
+		check_data_race(m, dr->other_eip, dr->first_eip);
+	}
+}
+
 static void update_pp_set_speculative_pp(struct nobe *h, int *unused)
 	{ h->is_preemption_point = true; }
 
@@ -1513,7 +1589,7 @@ static void check_locksets(struct ls_state *ls,
 			    && !vc_happens_before(&l1->clock, &l0->clock)
 #endif
 			    /* with pure HB, the above check subsumes this one */
-			    && !lockset_intersect(&l0->locks_held, &l1->locks_held)
+			    && !lockset_intersect(l0->locks_held, l1->locks_held)
 			    && (l0->interrupce_enabled || l1->interrupce_enabled)
 			    /* with pure HB, this likewise subsumed */
 			    && !(l0->during_txn && l1->during_txn)
@@ -1542,31 +1618,35 @@ bool mem_shm_intersect(struct ls_state *ls,
 	unsigned int tid0 = h0->chosen_thread;
 	unsigned int tid1 = h1->chosen_thread;
 
-	struct mem_access *ma0 = MEM_ENTRY(rb_first(&m0->shm));
-	struct mem_access *ma1 = MEM_ENTRY(rb_first(&m1->shm));
+	/* both sorted by address (see shm_sort) */
+	struct mem_access *ma0 = m0->shm.table;
+	struct mem_access *ma1 = m1->shm.table;
+	struct mem_access *end0 = ma0 + m0->shm.size;
+	struct mem_access *end1 = ma1 + m1->shm.size;
 	unsigned int conflicts = 0;
 
 	assert(h0->depth > h1->depth);
-	assert(!h0->happens_before[h1->depth]);
+	assert(!get_happens_before(h0, h1));
 	assert(h0->chosen_thread != h1->chosen_thread);
 
 	/* Should not even be called for the -space not being tested. */
 	assert(in_kernel != testing_userspace());
+	assert(m0->shm.sorted && m1->shm.sorted);
 
 	lsprintf(DEV, "Intersecting transition %d (TID %d) with %d (TID %d): {",
 		 h0->depth, tid0, h1->depth, tid1);
 
-	while (ma0 != NULL && ma1 != NULL) {
+	while (ma0 != end0 && ma1 != end1) {
 		if (ma0->addr < ma1->addr) {
 			check_stack_conflict(ma0, tid1, &conflicts);
 			check_freed_conflict(ma0, m1, tid1, &conflicts);
 			/* advance ma0 */
-			ma0 = MEM_ENTRY(rb_next(&ma0->nobe));
+			ma0++;
 		} else if (ma0->addr > ma1->addr) {
 			check_stack_conflict(ma1, tid0, &conflicts);
 			check_freed_conflict(ma1, m0, tid0, &conflicts);
 			/* advance ma1 */
-			ma1 = MEM_ENTRY(rb_next(&ma1->nobe));
+			ma1++;
 		} else {
 			/* found a match; advance both */
 			if (ma0->any_writes || ma1->any_writes) {
@@ -1588,22 +1668,20 @@ bool mem_shm_intersect(struct ls_state *ls,
 				check_locksets(ls, h0, h1, ma0, ma1, c0, c1, in_kernel);
 #endif
 			}
-			ma0 = MEM_ENTRY(rb_next(&ma0->nobe));
-			ma1 = MEM_ENTRY(rb_next(&ma1->nobe));
+			ma0++;
+			ma1++;
 		}
 	}
 
 	/* even if one transition runs out of recorded accesses, we still need
 	 * to check the other one's remaining accesses for the one's stack. */
-	while (ma0 != NULL) {
+	for (; ma0 != end0; ma0++) {
 		check_stack_conflict(ma0, tid1, &conflicts);
 		check_freed_conflict(ma0, m1, tid1, &conflicts);
-		ma0 = MEM_ENTRY(rb_next(&ma0->nobe));
 	}
-	while (ma1 != NULL) {
+	for (; ma1 != end1; ma1++) {
 		check_stack_conflict(ma1, tid0, &conflicts);
 		check_freed_conflict(ma1, m0, tid0, &conflicts);
-		ma1 = MEM_ENTRY(rb_next(&ma1->nobe));
 	}
 
 	if (conflicts > MAX_CONFLICTS) {
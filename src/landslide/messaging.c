@@ -55,6 +55,7 @@ enum output_message_tag {
 	FOUND_A_BUG = 3,
 	SHOULD_CONTINUE = 4,
 	ASSERT_FAILED = 5,
+	SUSPENDED = 6,
 };
 
 struct output_message {
@@ -79,6 +80,7 @@ struct output_message {
 			long double total_usecs;
 			long double elapsed_usecs;
 			unsigned int icb_cur_bound;
+			unsigned long memory_kb; /* all world lines' */
 		} estimate;
 
 		struct {
@@ -96,6 +98,7 @@ enum input_message_tag {
 	SHOULD_CONTINUE_REPLY = 0,
 	SUSPEND_TIME = 1,
 	RESUME_TIME = 2,
+	SHOULD_SUSPEND_REPLY = 3,
 };
 
 struct input_message {
@@ -208,14 +211,12 @@ void message_data_race(struct messaging_state *state, unsigned int eip,
 
 	eip_to_frame(eip, &f);
 	pos += sprint_frame(buf + pos, MESSAGE_BUF_SIZE - pos, &f, false);
-	destroy_frame(&f);
 
 	if (last_call != 0) {
 		eip_to_frame(last_call, &f);
 		pos += scnprintf(buf + pos, MESSAGE_BUF_SIZE - pos, " [called @ ");
 		pos += sprint_frame(buf + pos, MESSAGE_BUF_SIZE - pos, &f, false);
 		pos += scnprintf(buf + pos, MESSAGE_BUF_SIZE - pos, "]");
-		destroy_frame(&f);
 	}
 
 	send(state, &m);
@@ -224,7 +225,8 @@ void message_data_race(struct messaging_state *state, unsigned int eip,
 uint64_t message_estimate(struct messaging_state *state, long double proportion,
 			  unsigned int elapsed_branches, long double total_usecs,
 			  unsigned long elapsed_usecs,
-			  unsigned int icb_preemptions, unsigned int icb_bound)
+			  unsigned int icb_preemptions, unsigned int icb_bound,
+			  unsigned long memory_kb)
 {
 	struct output_message m;
 	m.tag = ESTIMATE;
@@ -234,6 +236,7 @@ uint64_t message_estimate(struct messaging_state *state, long double proportion,
 	m.content.estimate.elapsed_usecs = elapsed_usecs;
 	//m.content.estimate.icb_preemption_count = icb_preemptions; // not needed
 	m.content.estimate.icb_cur_bound = icb_bound;
+	m.content.estimate.memory_kb = memory_kb;
 	send(state, &m);
 
 	/* Ask whether or not our execution is being suspended. If so we must
@@ -274,7 +277,7 @@ void message_found_a_bug(struct messaging_state *state, const char *trace_filena
 	send(state, &m);
 }
 
-bool should_abort(struct messaging_state *state)
+bool should_abort(struct messaging_state *state, bool *suspend)
 {
 	struct output_message m;
 	m.tag = SHOULD_CONTINUE;
@@ -282,10 +285,19 @@ bool should_abort(struct messaging_state *state)
 
 	struct input_message result;
 	recv(state, &result);
-	assert(result.tag == SHOULD_CONTINUE_REPLY);
+	assert(result.tag == SHOULD_CONTINUE_REPLY ||
+	       result.tag == SHOULD_SUSPEND_REPLY);
+	*suspend = result.tag == SHOULD_SUSPEND_REPLY;
 	return result.value;
 }
 
+void message_suspended(struct messaging_state *state)
+{
+	struct output_message m;
+	m.tag = SUSPENDED;
+	send(state, &m);
+}
+
 void message_assert_fail(struct messaging_state *state, const char *message,
 			 const char *file, unsigned int line, const char *function)
 {
@@ -51,12 +51,16 @@ void message_data_race(struct messaging_state *m, unsigned int eip,
 uint64_t message_estimate(struct messaging_state *m, long double proportion,
 			  unsigned int elapsed_branches, long double total_usecs,
 			  unsigned long elapsed_usecs,
-			  unsigned int icb_preemptions, unsigned int icb_bound);
+			  unsigned int icb_preemptions, unsigned int icb_bound,
+			  unsigned long memory_kb);
 
 void message_found_a_bug(struct messaging_state *m, const char *trace_filename,
 			 unsigned int icb_preemptions, unsigned int icb_bound);
 
-bool should_abort(struct messaging_state *m);
+/* if the answer is yes, the master process may also want us to suspend the
+ * exploration to disk (see suspend.h), and say so when done */
+bool should_abort(struct messaging_state *m, bool *suspend);
+void message_suspended(struct messaging_state *m);
 
 void message_assert_fail(struct messaging_state *state, const char *message,
 			 const char *file, unsigned int line, const char *function);
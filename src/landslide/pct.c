@@ -0,0 +1,240 @@
+/**
+ * @file arena.c
+ * @brief randomized exploration: probabilistic concurrency testing and delay bounding
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MODULE_NAME "PCT"
+#define MODULE_COLOUR COLOUR_DARK COLOUR_MAGENTA
+
+#include "array_list.h"
+#include "common.h"
+#include "landslide.h"
+#include "pct.h"
+#include "rand.h"
+#include "save.h"
+
+/* for the first branch, with nothing to go by yet */
+#define PCT_DEFAULT_HORIZON 64
+
+static const char *strategy_name(enum pct_strategy strategy)
+{
+	return strategy == PCT_PRIORITIES ? "pct" :
+		strategy == PCT_DELAYS ? "delay" : "off";
+}
+
+void pct_config_init(struct pct_config *c)
+{
+	c->strategy = PCT_OFF;
+	c->depth = 0;
+	c->seed = 0;
+	c->horizon = 0;
+}
+
+/* "pct <depth> [seed [horizon]]" or "delay <depth> [seed [horizon]]" */
+bool pct_parse_config(struct pct_config *c, struct rand_state *r,
+		      const char *str)
+{
+	char name[16];
+	unsigned int depth;
+	uint64_t seed;
+	unsigned int horizon;
+
+	int ret = sscanf(str, "%15s %u %" SCNx64 " %u",
+			 name, &depth, &seed, &horizon);
+	if (ret < 2 || depth == 0) {
+		return false;
+	} else if (strcmp(name, strategy_name(PCT_PRIORITIES)) == 0) {
+		c->strategy = PCT_PRIORITIES;
+	} else if (strcmp(name, strategy_name(PCT_DELAYS)) == 0) {
+		c->strategy = PCT_DELAYS;
+	} else {
+		return false;
+	}
+	c->depth = depth;
+	c->seed = ret >= 3 ? seed : rand64(r);
+	c->horizon = ret >= 4 ? horizon : 0;
+	return true;
+}
+
+void pct_init(struct pct_state *p)
+{
+	p->started = false;
+	p->branch = 0;
+	p->seed = 0;
+	p->horizon = 0;
+	p->steps = 0;
+	p->demotions = 0;
+	ARRAY_LIST_INIT(&p->change_points, 8);
+	ARRAY_LIST_INIT(&p->priorities, 8);
+}
+
+bool pct_exploring(const struct ls_state *ls)
+{
+	return ls->pps.pct.strategy != PCT_OFF;
+}
+
+/* The branch number glows green (see timetravel.c), as do the stats to guess
+ * the horizon from, so these are the same whether this process just woke up
+ * or has been running all along. */
+static void branch_params(const struct ls_state *ls, uint64_t branch,
+			  uint64_t *seed, unsigned int *horizon)
+{
+	const struct pct_config *c = &ls->pps.pct;
+	*seed = branch == 0 ? c->seed : rand_derive_seed(c->seed, branch);
+	if (c->horizon != 0) {
+		*horizon = c->horizon;
+	} else if (branch == 0) {
+		*horizon = PCT_DEFAULT_HORIZON;
+	} else {
+		*horizon = MAX((unsigned int)
+			       (ls->save.stats.depth_total / branch), 1U);
+	}
+}
+
+static void begin_branch(struct ls_state *ls)
+{
+	struct pct_state *p = &ls->pct;
+	const struct pct_config *c = &ls->pps.pct;
+	char buf[BUF_SIZE];
+
+	p->branch = ls->save.stats.total_jumps;
+	branch_params(ls, p->branch, &p->seed, &p->horizon);
+	rand_seed(&ls->rand, p->seed);
+
+	p->steps = 0;
+	p->demotions = 0;
+	p->change_points.size = 0;
+	p->priorities.size = 0;
+	/* PCT's first priority "change" is the initial assignment */
+	unsigned int num_changes =
+		c->strategy == PCT_PRIORITIES ? c->depth - 1 : c->depth;
+	for (unsigned int i = 0; i < num_changes; i++) {
+		unsigned int step = 1 + (unsigned int)(rand64(&ls->rand) % p->horizon);
+		ARRAY_LIST_APPEND(&p->change_points, step);
+	}
+	p->started = true;
+
+	pct_describe_branch(ls, buf, BUF_SIZE);
+	lsprintf(DEV, "random branch #%" PRIu64 ": %s\n", p->branch + 1, buf);
+}
+
+static uint64_t *priority(struct ls_state *ls, unsigned int tid)
+{
+	struct pct_priority *pri;
+	unsigned int i;
+	ARRAY_LIST_FOREACH(&ls->pct.priorities, i, pri) {
+		if (pri->tid == tid) {
+			return &pri->priority;
+		}
+	}
+	/* a thread not seen before; all of these rank above any demoted one */
+	struct pct_priority new_pri = { .tid = tid, .priority =
+		(uint64_t)ls->pps.pct.depth + 1 + rand32(&ls->rand) };
+	ARRAY_LIST_APPEND(&ls->pct.priorities, new_pri);
+	return &ARRAY_LIST_GET(&ls->pct.priorities,
+			       ARRAY_LIST_SIZE(&ls->pct.priorities) - 1)->priority;
+}
+
+unsigned int pct_choose(struct ls_state *ls, unsigned int current_tid,
+			const unsigned int *tids, unsigned int num_tids)
+{
+	struct pct_state *p = &ls->pct;
+	const unsigned int *step;
+	unsigned int i;
+
+	assert(pct_exploring(ls));
+	assert(num_tids > 0);
+	if (ls->save.root == NULL) {
+		/* every branch starts over from after this choice, so it may
+		 * as well be the usual one (and a seed can retrace a branch
+		 * without knowing how the first one went) */
+		return 0;
+	} else if (!p->started || p->branch != ls->save.stats.total_jumps) {
+		begin_branch(ls);
+	}
+
+	p->steps++;
+	unsigned int changes = 0;
+	ARRAY_LIST_FOREACH(&p->change_points, i, step) {
+		if (*step == p->steps) {
+			changes++;
+		}
+	}
+
+	if (ls->pps.pct.strategy == PCT_DELAYS) {
+		if (changes > 0) {
+			lsprintf(DEV, "delaying %u time%s at step %u\n", changes,
+				 changes == 1 ? "" : "s", p->steps);
+		}
+		/* skip over the usual choice (the first), and then some */
+		return changes % num_tids;
+	}
+
+	/* PCT; first, the threads' priorities must all be known */
+	for (i = 0; i < num_tids; i++) {
+		priority(ls, tids[i]);
+	}
+	if (changes > 0 && current_tid != TID_NONE) {
+		p->demotions += changes;
+		assert(p->demotions < ls->pps.pct.depth);
+		*priority(ls, current_tid) = ls->pps.pct.depth - p->demotions;
+		lsprintf(DEV, "demoting TID %d at step %u\n", current_tid,
+			 p->steps);
+	}
+	unsigned int best = 0;
+	for (i = 1; i < num_tids; i++) {
+		if (*priority(ls, tids[i]) > *priority(ls, tids[best])) {
+			best = i;
+		}
+	}
+	return best;
+}
+
+void pct_describe_branch(const struct ls_state *ls, char *buf, unsigned int len)
+{
+	const struct pct_state *p = &ls->pct;
+	uint64_t seed;
+	unsigned int horizon;
+
+	if (p->started && p->branch == ls->save.stats.total_jumps) {
+		seed = p->seed;
+		horizon = p->horizon;
+	} else {
+		/* no choices made yet this branch */
+		branch_params(ls, ls->save.stats.total_jumps, &seed, &horizon);
+	}
+	scnprintf(buf, len, "%s %u 0x%" PRIx64 " %u",
+		  strategy_name(ls->pps.pct.strategy), ls->pps.pct.depth,
+		  seed, horizon);
+}
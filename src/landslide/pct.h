@@ -0,0 +1,99 @@
+/**
+ * @file pct.h
+ * @brief randomized exploration: probabilistic concurrency testing and delay bounding
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LS_PCT_H
+#define __LS_PCT_H
+
+#include <stdint.h>
+
+#include "array_list.h"
+
+struct ls_state;
+struct rand_state;
+
+/* For state spaces too big to finish, instead of DPOR: randomized bug-finding,
+ * where each branch starts over from the root and the arbiter makes up its
+ * choices as it goes. Either the way of PCT [Burckhardt et al., ASPLOS 2010],
+ * in which each thread gets a random priority, the highest-priority runnable
+ * one always runs, and at d-1 randomly chosen PPs the one that was running gets
+ * demoted below all others (finding any bug of depth d with probability at
+ * least 1/(nk^(d-1)), for n threads and k PPs); or that of delay bounding
+ * [Emmi et al., POPL 2011], in which the arbiter's usual choice gets skipped
+ * over in favour of the next thread at d randomly chosen PPs. Neither needs to
+ * go back anywhere besides the root, so no other PP gets a save point, and no
+ * DPOR is done (nor can it be suspended); so neither are transitions compared
+ * for conflicts, which means no data races get found this way. It runs until a bug is found or it's
+ * stopped. Each branch's choices come from its own seed, which is reported if
+ * it finds a bug; starting anew with that seed retraces it from the root. */
+enum pct_strategy { PCT_OFF, PCT_PRIORITIES, PCT_DELAYS };
+
+struct pct_config {
+	enum pct_strategy strategy;
+	unsigned int depth; /* d, above */
+	uint64_t seed; /* the first branch's; later ones' are derived from it */
+	/* how many PPs a branch is expected to have (k, above), for choosing
+	 * where to demote or delay; 0 to guess from the branches so far */
+	unsigned int horizon;
+};
+
+struct pct_priority {
+	unsigned int tid;
+	uint64_t priority;
+};
+
+/* per branch; not glowing green, as each branch starts afresh */
+struct pct_state {
+	bool started;
+	uint64_t branch; /* whose the rest is */
+	uint64_t seed;
+	unsigned int horizon;
+	unsigned int steps; /* choices made so far */
+	unsigned int demotions; /* PCT only */
+	ARRAY_LIST(unsigned int) change_points; /* steps to demote or delay at */
+	ARRAY_LIST(struct pct_priority) priorities; /* PCT only */
+};
+
+void pct_config_init(struct pct_config *c);
+/* from a dynamic config directive; false if malformed */
+bool pct_parse_config(struct pct_config *c, struct rand_state *r,
+		      const char *str);
+void pct_init(struct pct_state *p);
+bool pct_exploring(const struct ls_state *ls);
+/* For the arbiter: which among the threads it could run to run (as an index
+ * into the given tids), the current thread being the one whose transition
+ * just ended (whether or not it can go on). */
+unsigned int pct_choose(struct ls_state *ls, unsigned int current_tid,
+			const unsigned int *tids, unsigned int num_tids);
+/* the config directive to retrace the current branch with */
+void pct_describe_branch(const struct ls_state *ls, char *buf, unsigned int len);
+
+#endif
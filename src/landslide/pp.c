@@ -34,6 +34,7 @@
 
 #define MODULE_NAME "PP"
 
+#include "annotations.h"
 #include "common.h"
 #include "kspec.h"
 #include "landslide.h"
@@ -50,6 +51,10 @@ void pps_init(struct pp_config *p)
 	ARRAY_LIST_INIT(&p->data_races,   16);
 	p->output_pipe_filename = NULL;
 	p->input_pipe_filename  = NULL;
+	p->suspend_filename     = NULL;
+	p->resume_filename      = NULL;
+	p->optimal_dpor         = false;
+	pct_config_init(&p->pct);
 
 	/* Load PPs from static config (e.g. if not running under quicksand) */
 
@@ -80,6 +85,7 @@ void pps_init(struct pp_config *p)
 		                           .last_call           = drs[i][2],
 		                           .most_recent_syscall = drs[i][3] };
 		ARRAY_LIST_APPEND(&p->data_races, pp);
+		mark_interesting_page(pp.addr);
 #ifdef PREEMPT_EVERYWHERE
 		assert(0 && "DR PPs incompatible with preempt-everywhere mode.");
 #endif
@@ -117,6 +123,41 @@ bool load_dynamic_pps(struct ls_state *ls, const char *filename)
 			assert(p->input_pipe_filename == NULL);
 			p->input_pipe_filename = MM_XSTRDUP(buf + 2);
 			lsprintf(DEV, "input %s\n", p->input_pipe_filename);
+		} else if (buf[0] == 'S' || buf[0] == 'R') {
+			/* likewise */
+			assert(buf[1] == ' ');
+			assert(buf[2] != ' ' && buf[2] != '\0');
+			char **name = buf[0] == 'S' ? &p->suspend_filename :
+				&p->resume_filename;
+			assert(*name == NULL);
+			*name = MM_XSTRDUP(buf + 2);
+			lsprintf(DEV, "%s %s\n", buf[0] == 'S' ? "suspend to" :
+				 "resume from", *name);
+		} else if (buf[0] == 'E') {
+			/* exploration strategy, by name (and parameters, if random) */
+			assert(buf[1] == ' ');
+			if (strcmp(buf + 2, "optimal") == 0) {
+#if defined(ICB) || defined(HTM)
+				assert(0 && "optimal DPOR is incompatible "
+				       "with ICB and transactions");
+#endif
+				p->optimal_dpor = true;
+				lsprintf(DEV, "using optimal DPOR\n");
+			} else if (strcmp(buf + 2, "classic") == 0) {
+				p->optimal_dpor = false;
+				lsprintf(DEV, "using classic DPOR\n");
+			} else {
+				bool ok = pct_parse_config(&p->pct, &ls->rand,
+							   buf + 2);
+				assert(ok && "unknown exploration strategy");
+#if defined(ICB) || defined(HTM)
+				assert(0 && "randomized exploration is "
+				       "incompatible with ICB and transactions");
+#endif
+				char desc[BUF_SIZE];
+				pct_describe_branch(ls, desc, BUF_SIZE);
+				lsprintf(ALWAYS, "exploring randomly: %s\n", desc);
+			}
 		} else if ((ret = sscanf(buf, "K %x %x %i", &x, &y, &z)) != 0) {
 			/* kernel within function directive */
 			assert(ret == 3 && "invalid kernel within PP");
@@ -139,6 +180,7 @@ bool load_dynamic_pps(struct ls_state *ls, const char *filename)
 				{ .addr = x, .tid = y, .last_call = z,
 				  .most_recent_syscall = w };
 			ARRAY_LIST_APPEND(&p->data_races, pp);
+			mark_interesting_page(pp.addr);
 #ifdef PREEMPT_EVERYWHERE
 			assert(0 && "DR PPs incompatible with preempt-everywhere mode.");
 #endif
@@ -173,7 +215,7 @@ static bool check_withins(struct ls_state *ls, pp_within_list_t *pps)
 	unsigned int i;
 	struct pp_within *pp;
 
-	struct stack_trace *st = stack_trace(ls);
+	const struct stack_trace *st = stack_trace(ls);
 
 	ARRAY_LIST_FOREACH(pps, i, pp) {
 		bool in = within_function_st(st, pp->func_start, pp->func_end);
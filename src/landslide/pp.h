@@ -33,6 +33,7 @@
 #define __LS_PP_H
 
 #include "array_list.h"
+#include "pct.h"
 #include "student_specifics.h"
 
 struct ls_state;
@@ -62,6 +63,15 @@ struct pp_config {
 	ARRAY_LIST(struct pp_data_race) data_races;
 	char *output_pipe_filename;
 	char *input_pipe_filename;
+	/* where to suspend exploration to if asked, and to resume it from if
+	 * this is a suspended job's comeback (see suspend.h) */
+	char *suspend_filename;
+	char *resume_filename;
+	/* explore with optimal DPOR instead of the classic kind (see
+	 * wakeup_tree.h); a run-time choice, for comparing the two */
+	bool optimal_dpor;
+	/* or, not to explore exhaustively at all (see pct.h) */
+	struct pct_config pct;
 };
 
 void pps_init(struct pp_config *p);
@@ -29,24 +29,65 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <sys/time.h>
+#include <unistd.h>
+
 #define MODULE_NAME "RAND"
 
 #include "common.h"
 #include "rand.h"
 
+#define GOLDEN_GAMMA 0x9e3779b97f4a7c15ULL
+
+/* splitmix64, to spread a seed out over the whole state (xoroshiro mustn't
+ * start with it all zeroes, and does poorly with mostly-zero states) */
+static uint64_t splitmix64(uint64_t *x)
+{
+	uint64_t z = (*x += GOLDEN_GAMMA);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static inline uint64_t rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
 void rand_init(struct rand_state *r)
 {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	rand_seed(r, ((uint64_t)tv.tv_sec << 32) ^ (uint64_t)tv.tv_usec ^
+		  ((uint64_t)getpid() << 16));
 }
 
-uint32_t rand32(struct rand_state *r)
+void rand_seed(struct rand_state *r, uint64_t seed)
 {
-	assert(0 && "the faint smell of randomness long gone wafts upon the air.");
-	return 42;
+	r->s[0] = splitmix64(&seed);
+	r->s[1] = splitmix64(&seed);
 }
 
 uint64_t rand64(struct rand_state *r)
 {
-	uint64_t a = rand32(r);
-	uint64_t b = rand32(r);
-	return a | (b << 32);
+	uint64_t s0 = r->s[0];
+	uint64_t s1 = r->s[1];
+	uint64_t result = s0 + s1;
+
+	s1 ^= s0;
+	r->s[0] = rotl(s0, 24) ^ s1 ^ (s1 << 16);
+	r->s[1] = rotl(s1, 37);
+	return result;
+}
+
+uint32_t rand32(struct rand_state *r)
+{
+	/* the low bits of xoroshiro128+ are its weakest */
+	return (uint32_t)(rand64(r) >> 32);
+}
+
+uint64_t rand_derive_seed(uint64_t seed, uint64_t i)
+{
+	uint64_t x = seed + i * GOLDEN_GAMMA;
+	return splitmix64(&x);
 }
@@ -1,8 +1,6 @@
 /**
  * @file rand.h
  * @brief Random number generation
- * FIXME: find a bsd licensed prng for this;
- * but it's not like it's used in any non deprecated features though so
  *
  * Copyright (c) 2018, Ben Blum
  * All rights reserved.
@@ -33,11 +31,19 @@
 #ifndef __LS_RAND_H
 #define __LS_RAND_H
 
+/* xoroshiro128+ [Blackman & Vigna], which is public domain. Not for anything
+ * cryptographic, just for making up schedules reproducibly (see pct.h). */
 struct rand_state {
+	uint64_t s[2];
 };
 
+/* seeds from the time and pid; different every run */
 void rand_init(struct rand_state *r);
+/* the same seed always gives the same numbers */
+void rand_seed(struct rand_state *r, uint64_t seed);
 uint32_t rand32(struct rand_state *r);
 uint64_t rand64(struct rand_state *r);
+/* the i-th seed derived from a given one, e.g. for the i-th of many runs */
+uint64_t rand_derive_seed(uint64_t seed, uint64_t i);
 
 #endif
@@ -30,7 +30,7 @@
  */
 
 #include <inttypes.h>
-#include <string.h> /* for memcmp, strlen */
+#include <string.h> /* for memcmp, memcpy, strlen */
 
 #define MODULE_NAME "SAVE"
 #define MODULE_COLOUR COLOUR_MAGENTA
@@ -39,13 +39,17 @@
 #include "common.h"
 #include "compiler.h"
 #include "estimate.h"
+#include "fingerprint.h"
 #include "found_a_bug.h"
 #include "landslide.h"
 #include "lockset.h"
 #include "mem.h"
+#include "pct.h"
 #include "save.h"
 #include "schedule.h"
+#include "shared_arena.h"
 #include "stack.h"
+#include "suspend.h"
 #include "symtable.h"
 #include "test.h"
 #include "timetravel.h"
@@ -60,13 +64,6 @@
  * helpers
  ******************************************************************************/
 
-static void copy_user_yield_state(struct user_yield_state *dest,
-				  struct user_yield_state *src)
-{
-	dest->loop_count = src->loop_count;
-	dest->blocked    = src->blocked;
-}
-
 static void copy_malloc_actions(struct malloc_actions *dest, const struct malloc_actions *src)
 {
 	dest->in_alloc            = src->in_alloc;
@@ -78,12 +75,34 @@ static void copy_malloc_actions(struct malloc_actions *dest, const struct malloc
 	dest->palloc_request_size = src->palloc_request_size;
 }
 
-#define COPY_FIELD(name) do { a_dest->name = a_src->name; } while (0)
-static struct agent *copy_agent(struct agent *a_src)
+/* Snapshots kept in the tree put their agents in the shared arena, so that
+ * tags set by DPOR and friends (see explore.c) are seen by every world line.
+ * Their pointers into private memory (clocks, stack traces, locksets) remain
+ * valid only in processes forked after the snapshot was taken. An agent
+ * unchanged since the parent PP's snapshot is shared with it rather than
+ * copied (see save_agent), so the tree holds only as many agents as each
+ * transition changed; agents shared thus are copied on write when tagged (see
+ * mutable_saved_agent). */
+#define COPY_FIELD(name) do {						\
+		if (!cmp) {						\
+			a_dest->name = a_src->name;			\
+		} else if (a_dest->name != a_src->name) {		\
+			return false;					\
+		}							\
+	} while (0)
+#define COPY_MALLOC_ACTIONS(flags) do {					\
+		COPY_FIELD(flags.in_alloc);				\
+		COPY_FIELD(flags.in_realloc);				\
+		COPY_FIELD(flags.in_free);				\
+		COPY_FIELD(flags.alloc_request_size);			\
+		COPY_FIELD(flags.in_page_alloc);			\
+		COPY_FIELD(flags.in_page_free);				\
+		COPY_FIELD(flags.palloc_request_size);			\
+	} while (0)
+/* Copies all but the pointees (clock, pre-vanish trace) and tree bookkeeping;
+ * or, if 'cmp', instead returns whether doing so would change anything. */
+static bool fill_agent(struct agent *a_dest, const struct agent *a_src, bool cmp)
 {
-	struct agent *a_dest = MM_XMALLOC(1, struct agent);
-	assert(a_src != NULL && "cannot copy null agent");
-
 	COPY_FIELD(tid);
 
 	COPY_FIELD(action.handling_timer);
@@ -121,10 +140,13 @@ static struct agent *copy_agent(struct agent *a_src)
 	COPY_FIELD(action.user_wants_txn);
 	COPY_FIELD(action.user_txn);
 	COPY_FIELD(action.schedule_target);
-	assert(memcmp(&a_dest->action, &a_src->action, sizeof(a_dest->action)) == 0 &&
+	assert((cmp || memcmp(&a_dest->action, &a_src->action,
+			      sizeof(a_dest->action)) == 0) &&
 	       "Did you update agent->action without updating save.c?");
 
-	a_dest->kern_blocked_on = NULL; /* Will be recomputed later if needed */
+	if (!cmp) {
+		a_dest->kern_blocked_on = NULL; /* Will be recomputed later if needed */
+	}
 	COPY_FIELD(kern_blocked_on_tid);
 	COPY_FIELD(kern_blocked_on_addr);
 	COPY_FIELD(kern_mutex_unlocking_addr);
@@ -148,49 +170,134 @@ static struct agent *copy_agent(struct agent *a_src)
 	COPY_FIELD(delayed_xbegin_eip);
 	COPY_FIELD(most_recent_syscall);
 	COPY_FIELD(last_call);
-	lockset_clone(&a_dest->kern_locks_held, &a_src->kern_locks_held);
-	lockset_clone(&a_dest->user_locks_held, &a_src->user_locks_held);
-#ifdef PURE_HAPPENS_BEFORE
-	vc_copy(&a_dest->clock, &a_src->clock);
-#endif
-	copy_user_yield_state(&a_dest->user_yield, &a_src->user_yield);
+	COPY_FIELD(kern_locks_held); /* interned */
+	COPY_FIELD(user_locks_held);
+	COPY_FIELD(user_yield.loop_count);
+	COPY_FIELD(user_yield.blocked);
 #ifdef ALLOW_REENTRANT_MALLOC_FREE
-	copy_malloc_actions(&a_dest->kern_malloc_flags, &a_src->kern_malloc_flags);
-	copy_malloc_actions(&a_dest->user_malloc_flags, &a_src->user_malloc_flags);
+	COPY_MALLOC_ACTIONS(kern_malloc_flags);
+	COPY_MALLOC_ACTIONS(user_malloc_flags);
 #endif
+	if (!cmp) {
+		a_dest->do_explore = false;
+	}
+	return true;
+}
+#undef COPY_MALLOC_ACTIONS
+#undef COPY_FIELD
+
+static struct agent *copy_agent(struct agent *a_src, bool in_tree)
+{
+	struct agent *a_dest = in_tree ? SHARED_XMALLOC(1, struct agent)
+	                               : MM_XMALLOC(1, struct agent);
+	assert(a_src != NULL && "cannot copy null agent");
+
+	fill_agent(a_dest, a_src, false);
+#ifdef PURE_HAPPENS_BEFORE
+	VC_EMPTY(&a_dest->clock);
+	vc_copy(&a_dest->clock, &a_src->clock); /* copy-on-write */
+#endif
+	/* interned, so the same pointer as a_src's */
 	a_dest->pre_vanish_trace = (a_src->pre_vanish_trace == NULL) ?
 		NULL : copy_stack_trace(a_src->pre_vanish_trace);
-
-	a_dest->do_explore = false;
+	a_dest->saved_refs = in_tree ? 1 : 0;
+	a_dest->saved_base = NULL;
 
 	return a_dest;
 }
-#undef COPY_FIELD
+
+/* Would copying a_src into the tree make just the same agent as 'saved'? */
+static bool same_agent(struct agent *saved, struct agent *a_src)
+{
+	/* a copy would have no tag, nor different pointees */
+	if (saved->do_explore ||
+	    saved->pre_vanish_trace != a_src->pre_vanish_trace) {
+		return false;
+	}
+#ifdef PURE_HAPPENS_BEFORE
+	if (!vc_eq(&saved->clock, &a_src->clock)) {
+		return false;
+	}
+#endif
+	return fill_agent(saved, a_src, true);
+}
+
+/* Puts a_src into the tree: the agent in the parent PP's snapshot at the same
+ * place, if it's the same, or else a copy. */
+static struct agent *save_agent(struct agent *a_src,
+				const saved_agent_q *parent_q, unsigned int hint)
+{
+	struct agent *const *p;
+	struct agent *a = NULL;
+	unsigned int i;
+
+	if (parent_q != NULL && hint < ARRAY_LIST_SIZE(parent_q) &&
+	    parent_q->array[hint]->tid == a_src->tid) {
+		/* queues mostly stay the same from one PP to the next */
+		a = parent_q->array[hint];
+	} else if (parent_q != NULL) {
+		ARRAY_LIST_FOREACH(parent_q, i, p) {
+			if ((*p)->tid == a_src->tid) {
+				a = *p;
+				break;
+			}
+		}
+	}
+	if (a != NULL && same_agent(a, a_src)) {
+		assert(timetravel_locked());
+		a->saved_refs++;
+		return a;
+	}
+	return copy_agent(a_src, true);
+}
 
 /* Updates the cur_agent and schedule_in_flight pointers upon finding the
  * corresponding agence in the s_src. */
-static void copy_sched_q(struct agent_q *q_dest, const struct agent_q *q_src,
-			 struct sched_state *dest,
-			 const struct sched_state *src)
+static void copy_agent_ptrs(struct agent *a_dest, const struct agent *a_src,
+			    struct sched_state *dest,
+			    const struct sched_state *src)
+{
+	if (src->cur_agent == a_src)
+		dest->cur_agent = a_dest;
+	if (src->last_agent != NULL && src->last_agent == a_src)
+		dest->last_agent = a_dest;
+	if (src->schedule_in_flight == a_src)
+		dest->schedule_in_flight = a_dest;
+}
+/* From a snapshot or the live state, to the live state (see restore_ls). */
+#define COPY_SCHED_Q(dest, src, q) do {					\
+		struct agent *a_src;					\
+		assert(Q_GET_SIZE(&(dest)->q) == 0);			\
+		SCHED_Q_FOREACH(a_src, src, q) {			\
+			struct agent *a_dest = copy_agent(a_src, false); \
+			/* XXX: Q_INSERT_TAIL causes an assert to trip. ??? */ \
+			Q_INSERT_HEAD(&(dest)->q, a_dest, nobe);	\
+			copy_agent_ptrs(a_dest, a_src, dest, src);	\
+		}							\
+	} while (0)
+/* From the live state to a snapshot, reversed as the above would (which then
+ * undoes that when restoring it). */
+static void save_sched_q(saved_agent_q *q_dest, const struct agent_q *q_src,
+			 const saved_agent_q *parent_q,
+			 struct sched_state *dest, const struct sched_state *src)
 {
+	unsigned int i = Q_GET_SIZE(q_src);
 	struct agent *a_src;
 
-	assert(Q_GET_SIZE(q_dest) == 0);
-
+	/* an empty queue gets no array */
+	q_dest->size = i;
+	q_dest->capacity = i;
+	q_dest->array = i == 0 ? NULL : SHARED_XMALLOC(i, struct agent *);
 	Q_FOREACH(a_src, q_src, nobe) {
-		struct agent *a_dest = copy_agent(a_src);
-
-		// XXX: Q_INSERT_TAIL causes an assert to trip. ???
-		Q_INSERT_HEAD(q_dest, a_dest, nobe);
-		if (src->cur_agent == a_src)
-			dest->cur_agent = a_dest;
-		if (src->last_agent != NULL && src->last_agent == a_src)
-			dest->last_agent = a_dest;
-		if (src->schedule_in_flight == a_src)
-			dest->schedule_in_flight = a_dest;
+		i--;
+		q_dest->array[i] = save_agent(a_src, parent_q, i);
+		copy_agent_ptrs(q_dest->array[i], a_src, dest, src);
 	}
 }
-static void copy_sched(struct sched_state *dest, const struct sched_state *src)
+/* 'parent' is the snapshot at the parent PP, if saving one to the tree, for
+ * the new one to share what agents it can with. */
+static void copy_sched(struct sched_state *dest, const struct sched_state *src,
+		       bool in_tree, const struct sched_state *parent)
 {
 	dest->cur_agent           = NULL;
 	dest->last_agent          = NULL;
@@ -199,9 +306,20 @@ static void copy_sched(struct sched_state *dest, const struct sched_state *src)
 	Q_INIT_HEAD(&dest->rq);
 	Q_INIT_HEAD(&dest->dq);
 	Q_INIT_HEAD(&dest->sq);
-	copy_sched_q(&dest->rq, &src->rq, dest, src);
-	copy_sched_q(&dest->dq, &src->dq, dest, src);
-	copy_sched_q(&dest->sq, &src->sq, dest, src);
+	dest->saved = in_tree;
+	if (in_tree) {
+		assert(!src->saved);
+		save_sched_q(&dest->saved_rq, &src->rq,
+			     parent == NULL ? NULL : &parent->saved_rq, dest, src);
+		save_sched_q(&dest->saved_dq, &src->dq,
+			     parent == NULL ? NULL : &parent->saved_dq, dest, src);
+		save_sched_q(&dest->saved_sq, &src->sq,
+			     parent == NULL ? NULL : &parent->saved_sq, dest, src);
+	} else {
+		COPY_SCHED_Q(dest, src, rq);
+		COPY_SCHED_Q(dest, src, dq);
+		COPY_SCHED_Q(dest, src, sq);
+	}
 	assert((src->cur_agent == NULL || dest->cur_agent != NULL) &&
 	       "copy_sched couldn't set cur_agent!");
 	assert((src->schedule_in_flight == NULL ||
@@ -210,8 +328,17 @@ static void copy_sched(struct sched_state *dest, const struct sched_state *src)
 
 	/* The last_vanished agent is not on any queues. */
 	if (src->last_vanished_agent != NULL) {
-		dest->last_vanished_agent =
-			copy_agent(src->last_vanished_agent);
+		if (in_tree && parent != NULL &&
+		    parent->last_vanished_agent != NULL &&
+		    same_agent(parent->last_vanished_agent,
+			       src->last_vanished_agent)) {
+			assert(timetravel_locked());
+			dest->last_vanished_agent = parent->last_vanished_agent;
+			dest->last_vanished_agent->saved_refs++;
+		} else {
+			dest->last_vanished_agent =
+				copy_agent(src->last_vanished_agent, in_tree);
+		}
 		if (src->last_agent == src->last_vanished_agent) {
 			assert(dest->last_agent == NULL &&
 			       "but last_agent was already found!");
@@ -240,6 +367,7 @@ static void copy_sched(struct sched_state *dest, const struct sched_state *src)
 	lockset_clone(&dest->known_semaphores, &src->known_semaphores);
 #ifdef PURE_HAPPENS_BEFORE
 	lock_clocks_copy(&dest->lock_clocks, &src->lock_clocks);
+	VC_EMPTY(&dest->scheduler_lock_clock);
 	vc_copy(&dest->scheduler_lock_clock, &src->scheduler_lock_clock);
 	dest->scheduler_lock_held = src->scheduler_lock_held;
 #endif
@@ -266,48 +394,12 @@ static void copy_test(struct test_state *dest, const struct test_state *src)
 		dest->current_test = MM_XSTRDUP(src->current_test);
 	}
 }
-static struct rb_node *dup_chunk(const struct rb_node *nobe,
-				 const struct rb_node *parent)
-{
-	if (nobe == NULL)
-		return NULL;
-
-	struct chunk *src = rb_entry(nobe, struct chunk, nobe);
-	struct chunk *dest = MM_XMALLOC(1, struct chunk);
-
-	/* dup rb node contents */
-	int colour_flag = src->nobe.rb_parent_color & 1;
-
-	assert(((unsigned long)parent & 1) == 0);
-	dest->nobe.rb_parent_color = (unsigned long)parent | colour_flag;
-	dest->nobe.rb_right = dup_chunk(src->nobe.rb_right, &dest->nobe);
-	dest->nobe.rb_left  = dup_chunk(src->nobe.rb_left, &dest->nobe);
-
-	dest->base = src->base;
-	dest->len  = src->len;
-	dest->id   = src->id;
-
-	if (src->malloc_trace == NULL) {
-		dest->malloc_trace = NULL;
-	} else {
-		dest->malloc_trace = copy_stack_trace(src->malloc_trace);
-	}
-	if (src->free_trace == NULL) {
-		dest->free_trace = NULL;
-	} else {
-		dest->free_trace = copy_stack_trace(src->free_trace);
-	}
-
-	dest->pages_reserved_for_malloc = src->pages_reserved_for_malloc;
-
-	return &dest->nobe;
-}
 static void copy_mem(struct mem_state *dest, const struct mem_state *src, bool in_tree)
 {
 	dest->guest_init_done     = src->guest_init_done;
 	dest->in_mm_init          = src->in_mm_init;
-	dest->malloc_heap.rb_node = dup_chunk(src->malloc_heap.rb_node, NULL);
-	dest->palloc_heap.rb_node = dup_chunk(src->palloc_heap.rb_node, NULL);
+	heap_copy(&dest->malloc_heap, &src->malloc_heap); /* O(1); see heap.h */
+	heap_copy(&dest->palloc_heap, &src->palloc_heap);
 	dest->heap_size           = src->heap_size;
 	dest->heap_next_id        = src->heap_next_id;
 #ifndef ALLOW_REENTRANT_MALLOC_FREE
@@ -324,7 +416,7 @@ static void copy_mem(struct mem_state *dest, const struct mem_state *src, bool i
 	 * and we want it to reset the shm and freed heap to empty. But,
 	 * depending whether we're testing user or kernel, we might skip
 	 * the shimsham_shm call, so we at least must initialize them here. */
-	dest->shm.rb_node         = NULL;
+	shm_init(&dest->shm);
 	dest->freed.rb_node       = NULL;
 	/* do NOT copy data_races! */
 	if (in_tree) {
@@ -374,28 +466,74 @@ static void copy_user_sync(struct user_sync_state *dest,
 }
 
 /* To free copied state data structures. None of these free the arg pointer. */
+static void free_agent_pointees(struct agent *a)
+{
+#ifdef PURE_HAPPENS_BEFORE
+	vc_destroy(&a->clock);
+#endif
+	if (a->pre_vanish_trace != NULL) {
+		free_stack_trace(a->pre_vanish_trace);
+	}
+}
 static void free_sched_q(struct agent_q *q)
 {
 	while (Q_GET_SIZE(q) > 0) {
 		struct agent *a = Q_GET_HEAD(q);
 		assert(a != NULL);
 		Q_REMOVE(q, a, nobe);
-		lockset_free(&a->kern_locks_held);
-		lockset_free(&a->user_locks_held);
-#ifdef PURE_HAPPENS_BEFORE
-		vc_destroy(&a->clock);
-#endif
-		if (a->pre_vanish_trace != NULL) {
-			free_stack_trace(mutable_pre_vanish_trace(a));
-		}
+		free_agent_pointees(a);
 		MM_FREE(a);
 	}
 }
-static void free_sched(struct sched_state *s)
+/* A snapshot's agents go only when no other snapshot has them any more; and
+ * those copied to be tagged had no pointees of their own. Whether to free the
+ * pointees, see drop_shared_sched. As the refcounts are shared between world
+ * lines, call with the lock held (as for mutable_saved_agent). */
+static void drop_saved_agent(struct agent *a, bool free_pointees)
+{
+	assert(a->saved_refs > 0);
+	assert(timetravel_locked());
+	if (--a->saved_refs > 0) {
+		return;
+	}
+	if (a->saved_base != NULL) {
+		drop_saved_agent(a->saved_base, free_pointees);
+	} else if (free_pointees) {
+		free_agent_pointees(a);
+	}
+	SHARED_FREE(a);
+}
+static void drop_saved_sched_q(saved_agent_q *q, bool free_pointees)
+{
+	unsigned int i;
+	struct agent **a;
+	ARRAY_LIST_FOREACH(q, i, a) {
+		drop_saved_agent(*a, free_pointees);
+	}
+	if (q->array != NULL) {
+		SHARED_ARRAY_LIST_FREE(q);
+	}
+}
+static void drop_saved_agents(struct sched_state *s, bool free_pointees)
 {
-	free_sched_q(&s->rq);
-	free_sched_q(&s->dq);
-	free_sched_q(&s->sq);
+	assert(s->saved);
+	drop_saved_sched_q(&s->saved_rq, free_pointees);
+	drop_saved_sched_q(&s->saved_dq, free_pointees);
+	drop_saved_sched_q(&s->saved_sq, free_pointees);
+	/* not on any queue; nor does the arena get reclaimed on exit */
+	if (s->last_vanished_agent != NULL) {
+		drop_saved_agent(s->last_vanished_agent, free_pointees);
+	}
+}
+static void free_sched(struct sched_state *s, bool in_tree)
+{
+	if (in_tree) {
+		drop_saved_agents(s, true);
+	} else {
+		free_sched_q(&s->rq);
+		free_sched_q(&s->dq);
+		free_sched_q(&s->sq);
+	}
 	lockset_free(&s->known_semaphores);
 #ifdef PURE_HAPPENS_BEFORE
 	lock_clocks_destroy(&s->lock_clocks);
@@ -403,6 +541,13 @@ static void free_sched(struct sched_state *s)
 #endif
 	ARRAY_LIST_FREE(&s->dpor_preferred_tids);
 }
+/* For tree snapshots whose private pointees don't belong to this process, or
+ * soon won't matter (see save_longjmp), frees just what's in the arena. */
+static void drop_shared_sched(struct sched_state *s)
+{
+	drop_saved_agents(s, false);
+	SHARED_FREE(s);
+}
 static void free_test(const struct test_state *t)
 {
 	MM_FREE(t->current_test);
@@ -416,39 +561,36 @@ static void free_heap(struct rb_node *nobe)
 	free_heap(nobe->rb_right);
 
 	struct chunk *c = rb_entry(nobe, struct chunk, nobe);
-	if (c->malloc_trace != NULL) free_stack_trace(mutable_malloc_trace(c));
-	if (c->free_trace   != NULL) free_stack_trace(mutable_free_trace(c));
+	if (c->malloc_trace != NULL) free_stack_trace(c->malloc_trace);
+	if (c->free_trace   != NULL) free_stack_trace(c->free_trace);
 	MM_FREE(c);
 }
 
-static void free_shm(struct rb_node *nobe)
+static void free_shm(struct shm_set *s)
 {
-	if (nobe == NULL)
-		return;
-	free_shm(nobe->rb_left);
-	free_shm(nobe->rb_right);
-	struct mem_access *ma = rb_entry(nobe, struct mem_access, nobe);
-	while (Q_GET_SIZE(&ma->locksets) > 0) {
-		struct mem_lockset *l = Q_GET_HEAD(&ma->locksets);
-		assert(l != NULL);
-		Q_REMOVE(&ma->locksets, l, nobe);
-		lockset_free(&l->locks_held);
 #ifdef PURE_HAPPENS_BEFORE
-		vc_destroy(&l->clock);
+	unsigned int i;
+	struct mem_access *ma;
+	struct mem_lockset *l;
+	SHM_FOREACH(s, i, ma) {
+		Q_FOREACH(l, &ma->locksets, nobe) {
+			vc_destroy(&l->clock);
+		}
+	}
 #endif
-		MM_FREE(l);
+	/* the locksets (and the table, once sorted) live in the arena */
+	if (!s->sorted && s->table != NULL) {
+		MM_FREE(s->table);
 	}
-	MM_FREE(ma);
+	arena_free(&s->arena);
+	shm_init(s);
 }
 
 static void free_mem(struct mem_state *m, bool in_tree)
 {
-	free_heap(m->malloc_heap.rb_node);
-	m->malloc_heap.rb_node = NULL;
-	free_heap(m->palloc_heap.rb_node);
-	m->palloc_heap.rb_node = NULL;
-	free_shm(m->shm.rb_node);
-	m->shm.rb_node = NULL;
+	heap_free(&m->malloc_heap);
+	heap_free(&m->palloc_heap);
+	free_shm(&m->shm);
 	free_heap(m->freed.rb_node);
 	m->freed.rb_node = NULL;
 	if (in_tree) {
@@ -486,10 +628,28 @@ static void free_arbiter_choices(struct arbiter_state *a)
 	}
 }
 
+static void free_pp_shared(struct nobe *h)
+{
+	if (h->oldsched != NULL) {
+		drop_shared_sched(mutable_oldsched(h));
+		h->oldsched = NULL;
+	}
+	SHARED_ARRAY_LIST_FREE(mutable_children(h));
+	if (h->xbegin) {
+		SHARED_ARRAY_LIST_FREE(mutable_xabort_codes_todo(h));
+		SHARED_ARRAY_LIST_FREE(mutable_xabort_codes_ever(h));
+	}
+	SHARED_ARRAY_LIST_FREE(mutable_abort_sets_ever(h));
+	SHARED_ARRAY_LIST_FREE(mutable_abort_sets_todo(h));
+	sleep_set_free(h);
+	wakeup_tree_free(h);
+	fingerprint_pp_free(h);
+}
+
 static void free_pp(struct nobe *h)
 {
-	free_sched(mutable_oldsched(h));
-	MM_FREE(mutable_oldsched(h));
+	free_sched(mutable_oldsched(h), true);
+	SHARED_FREE(mutable_oldsched(h));
 	free_test(mutable_oldtest(h));
 	MM_FREE(mutable_oldtest(h));
 	free_mem(mutable_old_kern_mem(h), true);
@@ -504,16 +664,18 @@ static void free_pp(struct nobe *h)
 	h->old_user_mem = NULL;
 	MM_FREE(mutable_conflicts(h));
 	MM_FREE(mutable_happens_before(h));
+	MM_FREE(mutable_branch_hb(h));
 	h->conflicts = NULL;
 	h->happens_before = NULL;
-	free_stack_trace(mutable_stack_trace(h));
-	ARRAY_LIST_FREE(mutable_children(h));
-	if (h->xbegin) {
-		ARRAY_LIST_FREE(mutable_xabort_codes_todo(h));
-		ARRAY_LIST_FREE(mutable_xabort_codes_ever(h));
+	h->branch_hb = NULL;
+	unsigned int i;
+	struct thread_hb *th;
+	ARRAY_LIST_FOREACH(&h->next_hb, i, th) {
+		MM_FREE(th->happens_before);
 	}
-	ARRAY_LIST_FREE(mutable_abort_sets_ever(h));
-	ARRAY_LIST_FREE(mutable_abort_sets_todo(h));
+	ARRAY_LIST_FREE(&h->next_hb);
+	free_stack_trace(h->stack_trace);
+	free_pp_shared(h);
 }
 
 /* Reverse that which is not glowing green. */
@@ -528,8 +690,8 @@ static void restore_ls(struct ls_state *ls, const struct nobe *h)
 	ls->trigger_count = h->trigger_count;
 
 	// TODO: can have "move" instead of "copy" for these
-	free_sched(&ls->sched);
-	copy_sched(&ls->sched, h->oldsched);
+	free_sched(&ls->sched, false);
+	copy_sched(&ls->sched, h->oldsched, false, NULL);
 	free_test(&ls->test);
 	copy_test(&ls->test, h->oldtest);
 	free_mem(&ls->kern_mem, false);
@@ -549,94 +711,155 @@ static void restore_ls(struct ls_state *ls, const struct nobe *h)
  * Independence and happens-before computation
  ******************************************************************************/
 
-static void inherit_happens_before(struct nobe *h, const struct nobe *old)
+/* Was the given thread able to run at the start of h's transition? */
+static bool runnable_before(const struct nobe *h, unsigned int tid)
 {
-	for (int i = 0; i < old->depth; i++) {
-		set_happens_before(h, i, h->happens_before[i] || old->happens_before[i]);
+	const struct agent *a;
+	CONST_FOR_EACH_RUNNABLE_AGENT(a, h->parent->oldsched,
+		if (a->tid == tid && !BLOCKED(a)) {
+			return true;
+		}
+	);
+	return false;
+}
+
+static struct thread_hb *next_hb(const struct nobe *h, unsigned int tid)
+{
+	unsigned int i;
+	struct thread_hb *th;
+	ARRAY_LIST_FOREACH(&h->next_hb, i, th) {
+		if (th->tid == tid) {
+			return th;
+		}
 	}
+	return NULL;
 }
 
-static bool enabled_by(struct nobe *h, const struct nobe *old)
+/* Adds an entry for a thread which has none yet in h->next_hb; i.e., all of
+ * h's ancestors (and the root in particular) enabled it. */
+static struct thread_hb *new_next_hb(struct nobe *h, unsigned int tid)
 {
-	if (old->parent == NULL) {
-		lsprintf(INFO, "#%d/tid%d has no parent\n",
-			 old->depth, old->chosen_thread);
-		return true;
-	} else {
-		const struct agent *a;
-		lsprintf(INFO, "Searching for #%d/tid%d among siblings of "
-			 "#%d/tid%d: ", h->depth, h->chosen_thread, old->depth,
-			 old->chosen_thread);
-		print_qs(INFO, old->parent->oldsched);
-		CONST_FOR_EACH_RUNNABLE_AGENT(a, old->parent->oldsched,
-			if (a->tid == h->chosen_thread && !BLOCKED(a)) {
-				printf(INFO, "not enabled_by\n");
-				return false;
-			}
-		);
-		/* Transition A enables transition B if B was not a sibling of
-		 * A; i.e., if before A was run B could not have been chosen. */
-		printf(INFO, "yes enabled_by\n");
-		return true;
+	struct thread_hb th = { .tid = tid, .last = NULL, .enabled = true,
+				 .happens_before = NULL };
+	th.happens_before = MM_XMALLOC(BITSET_WORDS(h->depth + 1), uint64_t);
+	bitset_clear(th.happens_before, h->depth + 1);
+	for (unsigned int i = 0; i < h->depth; i++) {
+		bitset_set(th.happens_before, i, true);
+	}
+	ARRAY_LIST_APPEND(&h->next_hb, th);
+	return ARRAY_LIST_GET(&h->next_hb, ARRAY_LIST_SIZE(&h->next_hb) - 1);
+}
+
+static void inherit_happens_before(uint64_t *dest, const struct nobe *old)
+{
+	bitset_set(dest, old->depth, true);
+	if (old->depth > 0) {
+		bitset_or(dest, old->happens_before, old->depth);
 	}
 }
 
+/* Between two transitions of a thread X, X_0 before X_1, while there may be
+ * many transitions Y that for which enabled_by(X_1, Y), only the earliest
+ * such Y (the one soonest after X_0) is the actual enabler. Transition A
+ * enables transition B if B's thread could not have been chosen to run
+ * before A; i.e., it was blocked or didn't exist yet.
+ *
+ * So X_1 happens-after X_0 and all that happens-before it, each of its
+ * enablers, and all that happens-before the true one. Rather than search
+ * X_1's ancestors for those, every transition adds itself to the pending
+ * next_hb of the threads that couldn't run during it, so X_1 finds its set
+ * already computed in its parent's. */
 static void compute_happens_before(struct nobe *h, unsigned int joined_tid)
 {
 	unsigned int i;
+	struct thread_hb *th;
+	const struct thread_hb *th_parent;
 
-	/* Between two transitions of a thread X, X_0 before X_1, while there
-	 * may be many transitions Y that for which enabled_by(X_1, Y), only the
-	 * earliest such Y (the one soonest after X_0) is the actual enabler. */
-	const struct nobe *enabler = NULL;
+	ARRAY_LIST_INIT(&h->next_hb, 8);
 
-	for (i = 0; i < h->depth; i++) {
-		set_happens_before(h, i, false);
-	}
-
-	for (const struct nobe *old = h->parent; old != NULL; old = old->parent) {
-		assert(--i == old->depth); /* sanity check */
-		assert(old->depth >= 0 && old->depth < h->depth);
-		if (h->chosen_thread == old->chosen_thread) {
-			set_happens_before(h, old->depth, true);
-			inherit_happens_before(h, old);
-			/* Computing any further would be redundant, and would
-			 * break the true-enabler finding alg. */
-			break;
-		} else if (enabled_by(h, old)) {
-			enabler = old;
-			set_happens_before(h, enabler->depth, true);
+	if (h->parent == NULL) {
+		h->happens_before = NULL;
+	} else {
+		h->happens_before = MM_XMALLOC(BITSET_WORDS(h->depth), uint64_t);
+		th_parent = next_hb(h->parent, h->chosen_thread);
+		if (th_parent != NULL) {
+			memcpy(mutable_happens_before(h), th_parent->happens_before,
+			       BITSET_WORDS(h->depth) * sizeof(uint64_t));
+		} else {
+			bitset_clear(mutable_happens_before(h), h->depth);
+			for (i = 0; i < h->depth; i++) {
+				set_happens_before(h, i, true);
+			}
 		}
 	}
 
-	/* Take the happens-before set of the oldest enabler. */
-	if (enabler != NULL) {
-		set_happens_before(h, enabler->depth, true);
-		inherit_happens_before(h, enabler);
-	}
-
 #ifdef TRUSTED_THR_JOIN
-	if (joined_tid != TID_NONE) {
+	if (joined_tid != TID_NONE && h->parent != NULL) {
 		/* because this pp is at the *end* of join; it doesn't actually
 		 * matter if the joinee is still alive or not -- if it is, they
 		 * will be in vanish or close nearby, past the exit signal step
 		 * at least. just find the last thing it did before us. */
-		for (const struct nobe *old = h->parent; old != NULL;
-		     old = old->parent) {
-			if (joined_tid == old->chosen_thread) {
-				set_happens_before(h, old->depth, true);
-				inherit_happens_before(h, old);
-				break;
+		th_parent = h->parent == NULL ? NULL :
+			next_hb(h->parent, joined_tid);
+		assert(th_parent != NULL && th_parent->last != NULL &&
+		       "trusted thr join not so trusted...");
+		inherit_happens_before(mutable_happens_before(h), th_parent->last);
+	}
+#endif
+
+	/* carry the parent's pending sets forward past this transition */
+	if (h->parent != NULL) {
+		ARRAY_LIST_FOREACH(&h->parent->next_hb, i, th_parent) {
+			struct thread_hb copy = *th_parent;
+			copy.happens_before =
+				MM_XMALLOC(BITSET_WORDS(h->depth + 1), uint64_t);
+			bitset_clear(copy.happens_before, h->depth + 1);
+			bitset_or(copy.happens_before, th_parent->happens_before,
+				  h->depth);
+			ARRAY_LIST_APPEND(&h->next_hb, copy);
+		}
+		/* runnable here for the first time, so this transition doesn't
+		 * enable it, unlike all before */
+		const struct agent *a;
+		CONST_FOR_EACH_RUNNABLE_AGENT(a, h->parent->oldsched,
+			if (!BLOCKED(a) && next_hb(h->parent, a->tid) == NULL &&
+			    a->tid != (unsigned int)h->chosen_thread) {
+				new_next_hb(h, a->tid);
+			}
+		);
+	}
+
+	ARRAY_LIST_FOREACH(&h->next_hb, i, th) {
+		if (th->tid == (unsigned int)h->chosen_thread) {
+			/* its next transition follows this one, and that's all */
+			bitset_clear(th->happens_before, h->depth + 1);
+			inherit_happens_before(th->happens_before, h);
+			th->last = h;
+			th->enabled = false;
+		} else if (h->parent == NULL || !runnable_before(h, th->tid)) {
+			/* this transition enables its next one */
+			bitset_set(th->happens_before, h->depth, true);
+			if (!th->enabled) {
+				/* the first since its last to do so */
+				if (h->depth > 0) {
+					bitset_or(th->happens_before,
+						  h->happens_before, h->depth);
+				}
+				th->enabled = true;
 			}
-			assert(old->parent != NULL &&
-			       "trusted thr join not so trusted...");
 		}
 	}
-#endif
+	if (next_hb(h, h->chosen_thread) == NULL) {
+		th = new_next_hb(h, h->chosen_thread);
+		bitset_clear(th->happens_before, h->depth + 1);
+		inherit_happens_before(th->happens_before, h);
+		th->last = h;
+		th->enabled = false;
+	}
 
 	lsprintf(DEV, "Transitions { ");
 	for (i = 0; i < h->depth; i++) {
-		if (h->happens_before[i]) {
+		if (bitset_get(h->happens_before, i)) {
 			printf(DEV, "#%d ", i);
 		}
 	}
@@ -657,8 +880,8 @@ static void add_xabort_code(struct nobe *h, unsigned int *code)
 			return;
 		}
 	}
-	ARRAY_LIST_APPEND(mutable_xabort_codes_ever(h), *code);
-	ARRAY_LIST_APPEND(mutable_xabort_codes_todo(h), *code);
+	SHARED_ARRAY_LIST_APPEND(mutable_xabort_codes_ever(h), *code);
+	SHARED_ARRAY_LIST_APPEND(mutable_xabort_codes_todo(h), *code);
 }
 
 
@@ -709,9 +932,11 @@ static void shimsham_shm(struct ls_state *ls, struct nobe *h, bool in_kernel)
 	                                     : mutable_old_user_mem(h);
 	struct mem_state *newmem = in_kernel ? &ls->kern_mem   : &ls->user_mem;
 
-	/* store shared memory accesses from this transition; reset to empty */
-	oldmem->shm.rb_node = newmem->shm.rb_node;
-	newmem->shm.rb_node = NULL;
+	/* store shared memory accesses from this transition; reset to empty.
+	 * sort them by address now, for mem_shm_intersect to merge-walk. */
+	oldmem->shm = newmem->shm;
+	shm_init(&newmem->shm);
+	shm_sort(&oldmem->shm);
 
 	/* do the same for the list of freed chunks in this transition */
 	oldmem->freed.rb_node = newmem->freed.rb_node;
@@ -720,15 +945,21 @@ static void shimsham_shm(struct ls_state *ls, struct nobe *h, bool in_kernel)
 	/* ensure that memory tracking kept the shm heap totally empty for the
 	 * space (kernel or user) that we're NOT testing. */
 	if (in_kernel && testing_userspace()) {
-		assert(oldmem->shm.rb_node == NULL &&
+		assert(oldmem->shm.size == 0 &&
 		       "kernel shm nonempty when testing userspace");
 		return;
 	} else if (!in_kernel && !testing_userspace()) {
-		assert(oldmem->shm.rb_node == NULL &&
+		assert(oldmem->shm.size == 0 &&
 		       "user shm nonempty when testing kernelspace");
 		return;
 	}
 
+	/* randomized exploration does no DPOR to need these for, and throws
+	 * the branch away at the end anyway (see pct.h) */
+	if (pct_exploring(ls)) {
+		return;
+	}
+
 	/* compute newly-completed transition's conflicts with previous ones */
 	for (const struct nobe *old = h->parent; old != NULL; old = old->parent) {
 		assert(old->depth >= 0 && old->depth < h->depth);
@@ -742,14 +973,14 @@ static void shimsham_shm(struct ls_state *ls, struct nobe *h, bool in_kernel)
 		} else if (old->depth == 0) {
 			/* Basically guaranteed, and irrelevant. Suppress printing. */
 			set_conflicts(h, 0, true);
-		} else if (h->happens_before[old->depth]) {
+		} else if (get_happens_before(h, old)) {
 			/* No conflict if reordering is impossible */
 			set_conflicts(h, old->depth, false);
 		} else {
 			/* The nobes are independent if there was no intersection. */
 			set_conflicts(h, old->depth,
 				      mem_shm_intersect(ls, h, old, in_kernel));
-			if (h->conflicts[old->depth]) {
+			if (get_conflicts(h, old->depth)) {
 				abort_transaction(h->chosen_thread, h->parent,
 						  _XABORT_CONFLICT);
 				/* no!!!!!!! (see htm_causality.c) */
@@ -760,6 +991,33 @@ static void shimsham_shm(struct ls_state *ls, struct nobe *h, bool in_kernel)
 	}
 }
 
+/* Which ancestors happen-before the newly-completed transition, either way;
+ * fixed once its conflicts are, so computed just the once (see tree.h). */
+static void compute_branch_happens_before(struct ls_state *ls, struct nobe *h)
+{
+	if (h->depth == 0 || !ls->pps.optimal_dpor || pct_exploring(ls)) {
+		h->branch_hb = NULL;
+		return;
+	}
+
+	uint64_t *hb = MM_XMALLOC(BITSET_WORDS(h->depth), uint64_t);
+	bitset_clear(hb, h->depth);
+	for (const struct nobe *old = h->parent; old->depth > 0; old = old->parent) {
+		if (bitset_get(hb, old->depth)) {
+			/* and all that's before it, already */
+			continue;
+		} else if (get_happens_before(h, old) ||
+			   get_conflicts(h, old->depth)) {
+			assert(old->branch_hb != NULL);
+			bitset_set(hb, old->depth, true);
+			bitset_or(hb, old->branch_hb, old->depth);
+		}
+	}
+	/* the root precedes all */
+	bitset_set(hb, 0, true);
+	h->branch_hb = hb;
+}
+
 /******************************************************************************
  * interface
  ******************************************************************************/
@@ -798,6 +1056,15 @@ static void add_pp_child(struct nobe *h, int tid, bool xabort, unsigned int xabo
 {
 	const struct nobe_child *other;
 	unsigned int i;
+	if (TIMETRAVEL_PARALLEL_LINES > 1) {
+		/* already claimed by whoever picked it (see explore.c) */
+		ARRAY_LIST_FOREACH(&h->children, i, other) {
+			if (other->chosen_thread == tid && other->xabort == xabort &&
+			    (!xabort || other->xabort_code == xabort_code)) {
+				return;
+			}
+		}
+	}
 	/* with abort sets, duplicate children differentiated only by those sets
 	 * can get added here; tracking them (e.g. to ensure no duplicates with
 	 * even identical abort sets get added) would be too much of a pain */
@@ -812,7 +1079,8 @@ static void add_pp_child(struct nobe *h, int tid, bool xabort, unsigned int xabo
 	child.all_explored  = false;
 	child.xabort        = xabort;
 	child.xabort_code   = xabort_code;
-	ARRAY_LIST_APPEND(mutable_children(h), child);
+	footprint_init(&child.footprint);
+	SHARED_ARRAY_LIST_APPEND(mutable_children(h), child);
 }
 
 static void add_pp_child_preempt(struct nobe *h, int *chosen_thread)
@@ -822,6 +1090,89 @@ static void add_pp_child_preempt(struct nobe *h, int *chosen_thread)
 static void add_pp_child_xabort(struct nobe *h, unsigned int *xabort_code)
 	{ add_pp_child(h, h->chosen_thread, true, *xabort_code); }
 
+static const struct stack_trace *pp_stack_trace(struct ls_state *ls,
+					       const struct nobe *h,
+					       bool voluntary,
+					       unsigned int data_race_eip)
+{
+	if (voluntary) {
+#ifndef PINTOS_KERNEL
+		assert(h->chosen_thread == TID_NONE || h->chosen_thread ==
+		       ls->sched.voluntary_resched_tid);
+#endif
+		assert(ls->sched.voluntary_resched_stack != NULL);
+		assert(data_race_eip == ADDR_NONE);
+		const struct stack_trace *st = ls->sched.voluntary_resched_stack;
+		ls->sched.voluntary_resched_stack = NULL;
+		return st;
+	} else {
+		const struct stack_trace *st = stack_trace(ls);
+
+		// FIXME: make this happen for xbegin delayed-eip pps
+		// as well (prob requires another argument to setjmp)
+		// i mean, it's not like any studence will need it tho?
+		if (data_race_eip != ADDR_NONE) {
+			/* first frame of stack will be bogus, due to
+			 * the technique for delaying the access (in
+			 * x86.c). fix it up with the proper eip. */
+			assert(ARRAY_LIST_SIZE(&st->frames) > 0);
+			st = stack_trace_with_top(st, data_race_eip);
+		}
+		return st;
+	}
+}
+
+/* Replaying forward from a checkpoint (see timetravel.c) revisits PPs which
+ * are already in the shared tree, with everything DPOR and estimation did to
+ * them since; but their snapshots point into the memory of a world line which
+ * has since ended. Returns such a PP, if any, with the private parts of it
+ * not yet retaken by setjmp (which doesn't free the stale ones) retaken. */
+static struct nobe *replayed_pp(struct save_state *ss, struct ls_state *ls,
+				bool voluntary, unsigned int data_race_eip)
+{
+	if (ss->current == NULL) {
+		return NULL;
+	}
+	struct nobe *h = (struct nobe *)timetravel_replay_pp(ss->current->depth + 1);
+	if (h == NULL) {
+		return NULL;
+	}
+	assert(h->parent == ss->current);
+	assert(h->eip == ls->eip && h->chosen_thread == ss->next_tid &&
+	       h->xaborted == ss->next_xabort &&
+	       "checkpoint replay diverged from the original branch!");
+
+	/* the stats will be overwritten with the jumper's at the end anyway */
+	update_time(&ss->stats.last_save_time);
+	h->stack_trace = pp_stack_trace(ls, h, voluntary, data_race_eip);
+	return h;
+}
+
+/* Copies the tags explore.c and friends put on a replayed PP's snapshot. */
+static void keep_tag(struct sched_state *dest, struct agent *a,
+		     const struct sched_state *src)
+{
+	const struct agent *a_src;
+	CONST_FOR_EACH_RUNNABLE_AGENT(a_src, src,
+		if (a_src->tid == a->tid) {
+			if (a->do_explore != a_src->do_explore ||
+			    a->user_yield.blocked != a_src->user_yield.blocked) {
+				a = mutable_saved_agent(dest, a);
+				a->do_explore = a_src->do_explore;
+				a->user_yield.blocked = a_src->user_yield.blocked;
+			}
+			return;
+		}
+	);
+}
+static void keep_tags(struct sched_state *dest, const struct sched_state *src)
+{
+	struct agent *a;
+	FOR_EACH_RUNNABLE_AGENT(a, dest,
+		keep_tag(dest, a, src);
+	);
+}
+
 /* In the typical case, this signifies that we have reached a new decision
  * point. We:
  *  - Add a new choice node to signify this
@@ -836,17 +1187,25 @@ void save_setjmp(struct save_state *ss, struct ls_state *ls,
 		 bool prune_aborts, bool check_retry)
 {
 	struct nobe *h;
+	bool replayed = false;
 
 	lsprintf(INFO, "tid %d to eip 0x%x, where we %s tid %d\n", ss->next_tid,
 		 ls->eip, our_choice ? "choose" : "follow", new_tid);
 
+	/* other world lines may be at work on our ancestors */
+	timetravel_lock();
+
 	/* Whether there should be a choice node in the tree is dependent on
 	 * whether the current pending choice was our decision or not. The
 	 * explorer's choice (!ours) will be in anticipation of a new node, but
 	 * at that point we won't have the info to create the node until we go
 	 * one step further. */
-	if (our_choice) {
-		h = MM_XMALLOC(1, struct nobe);
+	if (our_choice && (h = replayed_pp(ss, ls, voluntary, data_race_eip))) {
+		lsprintf(DEV, "#%d/tid%d: replayed from checkpoint\n",
+			 h->depth, h->chosen_thread);
+		replayed = true;
+	} else if (our_choice) {
+		h = SHARED_XMALLOC(1, struct nobe);
 
 		h->eip           = ls->eip;
 		h->trigger_count = ls->trigger_count;
@@ -892,8 +1251,9 @@ void save_setjmp(struct save_state *ss, struct ls_state *ls,
 			lsprintf(DEV, "elapsed usecs %" PRIu64 "\n", h->usecs);
 		}
 
-		ARRAY_LIST_INIT(&h->children, HAX_CHILDREN_INIT_SIZE);
+		SHARED_ARRAY_LIST_INIT(&h->children, HAX_CHILDREN_INIT_SIZE);
 		h->all_explored = end_of_test;
+		h->dpor_analyzed = false;
 
 		h->data_race_eip = data_race_eip;
 #ifdef PREEMPT_EVERYWHERE
@@ -910,8 +1270,8 @@ void save_setjmp(struct save_state *ss, struct ls_state *ls,
 		h->estimate_computed = false;
 		h->voluntary = voluntary;
 		if ((h->xbegin = xbegin)) {
-			ARRAY_LIST_INIT(&h->xabort_codes_ever, 8);
-			ARRAY_LIST_INIT(&h->xabort_codes_todo, 8);
+			SHARED_ARRAY_LIST_INIT(&h->xabort_codes_ever, 8);
+			SHARED_ARRAY_LIST_INIT(&h->xabort_codes_todo, 8);
 #ifndef HTM_DONT_RETRY
 			/* e.g. mario's htm data structures may supply -A -S to
 			 * disable this code, since they wrap these in a retry
@@ -919,7 +1279,7 @@ void save_setjmp(struct save_state *ss, struct ls_state *ls,
 			if (prune_aborts) {
 				/* suppress the other xbegin outcome */
 				if (check_retry) {
-					ARRAY_LIST_APPEND(
+					SHARED_ARRAY_LIST_APPEND(
 						mutable_xabort_codes_ever(h),
 						_XABORT_RETRY);
 				}
@@ -930,44 +1290,29 @@ void save_setjmp(struct save_state *ss, struct ls_state *ls,
 			}
 #endif
 		}
-		ARRAY_LIST_INIT(&h->abort_sets_ever, 8);
-		ARRAY_LIST_INIT(&h->abort_sets_todo, 8);
+		SHARED_ARRAY_LIST_INIT(&h->abort_sets_ever, 8);
+		SHARED_ARRAY_LIST_INIT(&h->abort_sets_todo, 8);
 
 		timetravel_pp_init(&h->time_machine);
+		sleep_set_init(h);
+		wakeup_tree_init(h);
+		fingerprint_pp_init(h);
 
-		if (voluntary) {
-#ifndef PINTOS_KERNEL
-			assert(h->chosen_thread == TID_NONE || h->chosen_thread ==
-			       ls->sched.voluntary_resched_tid);
-#endif
-			assert(ls->sched.voluntary_resched_stack != NULL);
-			assert(data_race_eip == ADDR_NONE);
-			h->stack_trace = ls->sched.voluntary_resched_stack;
-			ls->sched.voluntary_resched_stack = NULL;
-		} else {
-			struct stack_trace *st = stack_trace(ls);
-			h->stack_trace = st;
-
-			// FIXME: make this happen for xbegin delayed-eip pps
-			// as well (prob requires another argument to setjmp)
-			// i mean, it's not like any studence will need it tho?
-			if (data_race_eip != ADDR_NONE) {
-				/* first frame of stack will be bogus, due to
-				 * the technique for delaying the access (in
-				 * x86.c). fix it up with the proper eip. */
-				struct stack_frame *first_frame =
-					ARRAY_LIST_GET(mutable_stack_frames(st), 0);
-				assert(first_frame != NULL);
-				destroy_frame(first_frame);
-				eip_to_frame(data_race_eip, first_frame);
-			}
-		}
+		h->stack_trace = pp_stack_trace(ls, h, voluntary, data_race_eip);
+		h->oldsched = NULL;
 	} else {
 		assert(0 && "Not our_choice deprecated.");
 	}
 
-	h->oldsched = MM_XMALLOC(1, struct sched_state);
-	copy_sched(mutable_oldsched(h), &ls->sched);
+	struct sched_state *oldsched = SHARED_XMALLOC(1, struct sched_state);
+	copy_sched(oldsched, &ls->sched, true,
+		   h->parent == NULL ? NULL : h->parent->oldsched);
+	if (h->oldsched != NULL) {
+		/* replayed; the old snapshot's tags still glow green */
+		keep_tags(oldsched, h->oldsched);
+		drop_shared_sched(mutable_oldsched(h));
+	}
+	h->oldsched = oldsched;
 
 	h->oldtest = MM_XMALLOC(1, struct test_state);
 	copy_test(mutable_oldtest(h), &ls->test);
@@ -984,14 +1329,13 @@ void save_setjmp(struct save_state *ss, struct ls_state *ls,
 	h->old_symtable = get_symtable();
 
 	if (h->depth > 0) {
-		h->conflicts      = MM_XMALLOC(h->depth, bool);
-		h->happens_before = MM_XMALLOC(h->depth, bool);
+		h->conflicts = MM_XMALLOC(BITSET_WORDS(h->depth), uint64_t);
+		bitset_clear(mutable_conflicts(h), h->depth);
 		/* For progress sense. */
 		ss->stats.total_triggers +=
 			ls->trigger_count - h->parent->trigger_count;
 	} else {
-		h->conflicts      = NULL;
-		h->happens_before = NULL;
+		h->conflicts = NULL;
 	}
 	compute_happens_before(h, joined_tid);
 	/* Compute independence relation for both kernel and user mems. Whether
@@ -1000,6 +1344,17 @@ void save_setjmp(struct save_state *ss, struct ls_state *ls,
 	 * at all (e.g., running in user mode, the kernel shm will be empty). */
 	shimsham_shm(ls, h, true);
 	shimsham_shm(ls, h, false);
+	compute_branch_happens_before(ls, h);
+	if (!replayed && h->parent != NULL) {
+		sleep_set_inherit(h);
+		if (ls->pps.optimal_dpor) {
+			wakeup_tree_inherit(h);
+		}
+	}
+	if (!replayed && !end_of_test && !pct_exploring(ls)) {
+		/* may end the branch here, so, after the sleep set is known */
+		fingerprint_pp(ls, h);
+	}
 
 	ss->current  = h;
 	ss->next_tid = new_tid;
@@ -1038,6 +1393,11 @@ void save_setjmp(struct save_state *ss, struct ls_state *ls,
 	}
 
 	ss->stats.total_choices++;
+	/* a suspended exploration (see suspend.h) comes back one PP at a time */
+	resume_pp(ls, h);
+	/* not to be held while dormant, and to be taken anew by whoever is
+	 * woken up, or spawned, from here */
+	timetravel_unlock();
 	unsigned int tid;
 	bool txn;
 	unsigned int xabort_code;
@@ -1058,45 +1418,42 @@ void save_setjmp(struct save_state *ss, struct ls_state *ls,
 			arbiter_append_choice(&ls->arbiter, tid, txn,
 					      xabort_code, &aborts);
 		}
+		timetravel_lock();
 		restore_ls(ls, h);
+		timetravel_unlock();
 #else
 		assert(0 && "in simics timetravel-set should only return once");
 #endif
 	}
 }
 
-void save_longjmp(struct save_state *ss, struct ls_state *ls, const struct nobe *h,
-		  unsigned int tid, bool txn, unsigned int xabort_code,
-		  struct abort_set *aborts)
+/* Reclaims the nobes from the current one up to (not including) the given
+ * ancestor, which becomes the current one. */
+static void abandon_branch(struct save_state *ss, struct ls_state *ls,
+			   const struct nobe *h)
 {
 	const struct nobe *rabbit = ss->current;
 
-	assert(ss->root != NULL && "Can't longjmp with no decision tree!");
-	assert(ss->current != NULL);
-	assert(ss->current->estimate_computed);
-
-	ss->stats.depth_total += ss->current->depth;
-
-	/* The caller is allowed to say NULL, which means jump to the root. */
-	if (h == NULL)
-		h = ss->root;
-
 	/* Find the target choice point from among our ancestors. */
 	while (ss->current != h) {
-		timetravel_delete(ls, &ss->current->time_machine);
-#ifndef BOCHS
-		/* This nobe will soon be in the future. Reclaim memory.
-		 * (Bochs, ofc, will reclaim the memory upon process exit.) */
 		struct nobe *old_current = (struct nobe *)ss->current;
+		timetravel_delete(ls, old_current);
+		/* This nobe will soon be in the future. Reclaim memory.
+		 * (Forked bochs, ofc, will reclaim the private memory upon
+		 * process exit, but the shared arena outlives every world
+		 * line. In-place snapshots have only the one process.) */
+#ifdef TIMETRAVEL_FORKS
+		free_pp_shared(old_current);
+#else
 		free_pp(old_current);
 #endif
 		ss->current = ss->current->parent;
-		/* allow for empty children iff ICB just reset the tree */
+		/* allow for empty children iff ICB, or randomized
+		 * exploration, just reset the tree */
 		assert(ARRAY_LIST_SIZE(&ss->current->children) > 0 ||
-		       (ss->current == ss->root && ss->stats.total_jumps == -1));
-#ifndef BOCHS
-		MM_FREE(old_current);
-#endif
+		       (ss->current == ss->root &&
+			(ss->stats.total_jumps == -1 || pct_exploring(ls))));
+		SHARED_FREE(old_current);
 
 		/* We won't have simics bookmarks, or indeed some saved state,
 		 * for non-ancestor choice points. */
@@ -1107,35 +1464,70 @@ void save_longjmp(struct save_state *ss, struct ls_state *ls, const struct nobe
 		if (rabbit) rabbit = rabbit->parent;
 		assert(rabbit != ss->current && "somehow, a cycle?!?");
 	}
+}
 
-#ifndef BOCHS
-	/* In simics, timetravel-jump will return and this process will have
-	 * properties of my wayward son; so prepare state for the new branch.
-	 * In bochs, it will not return; rather timetravel_set returns twice.
-	 * These ifndefs just skip whatever the next process will never see. */
-	arbiter_append_choice(&ls->arbiter, tid, txn, xabort_code, aborts);
+void save_longjmp(struct save_state *ss, struct ls_state *ls, const struct nobe *h,
+		  unsigned int tid, bool txn, unsigned int xabort_code,
+		  struct abort_set *aborts)
+{
+	assert(ss->root != NULL && "Can't longjmp with no decision tree!");
+	assert(ss->current != NULL);
+	assert(ss->current->estimate_computed);
+
+	ss->stats.depth_total += ss->current->depth;
+
+	/* The caller is allowed to say NULL, which means jump to the root. */
+	if (h == NULL)
+		h = ss->root;
+
+	abandon_branch(ss, ls, h);
+
+#ifndef TIMETRAVEL_FORKS
+	/* In simics, or bochs with in-place snapshots, timetravel-jump will
+	 * return and this process will have properties of my wayward son; so
+	 * prepare state for the new branch. Forking bochs, it will not return;
+	 * rather timetravel_set returns twice. These ifndefs just skip whatever
+	 * the next process will never see. */
+	if (tid != TID_NONE) {
+		/* (none for an ICB tree reset; see save_setjmp) */
+		arbiter_append_choice(&ls->arbiter, tid, txn, xabort_code, aborts);
+	}
 	restore_ls(ls, h);
 #endif
 
 	ss->stats.total_jumps++;
-	timetravel_jump(ls, &h->time_machine, tid, txn, xabort_code, aborts);
-#ifdef BOCHS
+	timetravel_jump(ls, h, tid, txn, xabort_code, aborts);
+#ifdef TIMETRAVEL_FORKS
 	assert(0 && "returned from time leap somehow");
 #endif
 }
 
-#ifdef ICB
+/* Marks a child as taken by some world line before it actually gets there. */
+void save_claim_child(const struct nobe *h, unsigned int tid)
+{
+	modify_pp(add_pp_child_preempt, h, (int)tid);
+}
+
+/* Used by a spawned world line which is about to exit instead of jumping. */
+void save_abandon(struct save_state *ss, struct ls_state *ls, const struct nobe *h)
+{
+	abandon_branch(ss, ls, h);
+}
+
 static void reset_root(struct nobe *root, int *unused)
 {
 	assert(root->parent == NULL);
 	struct agent *a;
 	FOR_EACH_RUNNABLE_AGENT(a, mutable_oldsched(root),
-		a->do_explore = false;
+		if (a->do_explore) {
+			mutable_saved_agent(mutable_oldsched(root), a)
+				->do_explore = false;
+		}
 	);
 
 	/* Need to reset tree state as if this is the 1st time we came here. */
-	ARRAY_LIST_FREE(mutable_children(root));
-	ARRAY_LIST_INIT(mutable_children(root), HAX_CHILDREN_INIT_SIZE);
+	SHARED_ARRAY_LIST_FREE(mutable_children(root));
+	SHARED_ARRAY_LIST_INIT(mutable_children(root), HAX_CHILDREN_INIT_SIZE);
 	root->all_explored = false;
 	root->marked_children = 0;
 	root->proportion = 0.0L;
@@ -1143,6 +1535,18 @@ static void reset_root(struct nobe *root, int *unused)
 	root->estimate_computed = false;
 }
 
+/* For randomized exploration (see pct.h), which keeps no tree besides the
+ * current branch, and goes back only to the root to start a new one. The
+ * choice there stays the same. */
+void save_restart(struct save_state *ss, struct ls_state *ls)
+{
+	modify_pp(reset_root, ss->root, 0);
+	struct abort_set aborts;
+	ABORT_SET_INIT_INACTIVE(&aborts);
+	save_longjmp(ss, ls, ss->root, TID_NONE, false, -1, &aborts);
+}
+
+#ifdef ICB
 void save_reset_tree(struct save_state *ss, struct ls_state *ls)
 {
 	/* Do this before longjmp so the change gets copied into ls->sched. */
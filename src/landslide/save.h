@@ -88,5 +88,11 @@ void save_longjmp(struct save_state *, struct ls_state *, const struct nobe *,
 		  struct abort_set *aborts);
 
 void save_reset_tree(struct save_state *ss, struct ls_state *ls);
+void save_restart(struct save_state *ss, struct ls_state *ls);
+
+/* For parallel world lines (see timetravel.h). A claimed child counts as
+ * searched (so no other line will take it) even before any nobe exists. */
+void save_claim_child(const struct nobe *h, unsigned int tid);
+void save_abandon(struct save_state *ss, struct ls_state *ls, const struct nobe *h);
 
 #endif
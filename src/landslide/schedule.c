@@ -32,6 +32,7 @@
 #define MODULE_NAME "SCHEDULE"
 #define MODULE_COLOUR COLOUR_GREEN
 
+#include "annotations.h"
 #include "arbiter.h"
 #include "common.h"
 #include "found_a_bug.h"
@@ -41,8 +42,10 @@
 #include "kspec.h"
 #include "mem.h"
 #include "schedule.h"
+#include "shared_arena.h"
 #include "simulator.h"
 #include "stack.h"
+#include "timetravel.h"
 #include "tree.h"
 #include "tsx.h"
 #include "user_specifics.h"
@@ -154,8 +157,8 @@ static void agent_fork(struct sched_state *s, unsigned int tid, bool on_runqueue
 	init_malloc_actions(&a->user_malloc_flags);
 #endif
 
-	lockset_init(&a->kern_locks_held);
-	lockset_init(&a->user_locks_held);
+	a->kern_locks_held = lockset_empty();
+	a->user_locks_held = lockset_empty();
 #ifdef PURE_HAPPENS_BEFORE
 	vc_init(&a->clock);
 	/* start child clock at a non-bottom value - not quite sure if needed,
@@ -173,6 +176,8 @@ static void agent_fork(struct sched_state *s, unsigned int tid, bool on_runqueue
 	user_yield_state_init(&a->user_yield);
 
 	a->pre_vanish_trace = NULL;
+	a->saved_refs = 0;
+	a->saved_base = NULL;
 
 	if (on_runqueue) {
 		Q_INSERT_FRONT(&s->rq, a, nobe);
@@ -256,13 +261,11 @@ static void agent_vanish(struct sched_state *s)
 	if (s->last_vanished_agent) {
 		assert(!s->last_vanished_agent->action.handling_timer);
 		assert(s->last_vanished_agent->action.context_switch);
-		lockset_free(&s->last_vanished_agent->kern_locks_held);
-		lockset_free(&s->last_vanished_agent->user_locks_held);
 #ifdef PURE_HAPPENS_BEFORE
 		vc_destroy(&s->last_vanished_agent->clock);
 #endif
 		if (s->last_vanished_agent->pre_vanish_trace != NULL) {
-			free_stack_trace(mutable_pre_vanish_trace(s->last_vanished_agent));
+			free_stack_trace(s->last_vanished_agent->pre_vanish_trace);
 		}
 		MM_FREE(s->last_vanished_agent);
 	}
@@ -400,6 +403,7 @@ void sched_init(struct sched_state *s)
 	Q_INIT_HEAD(&s->rq);
 	Q_INIT_HEAD(&s->dq);
 	Q_INIT_HEAD(&s->sq);
+	s->saved = false;
 	s->num_agents = 0;
 	s->most_agents_ever = 0;
 	s->guest_init_done = false; /* must be before kern_init_threads */
@@ -463,6 +467,17 @@ void print_agent(verbosity v, const struct agent *a)
 	}
 }
 
+static void print_q_agent(verbosity v, const struct agent *a, bool *first,
+			  unsigned int dont_print_tid)
+{
+	if (a->tid != dont_print_tid) {
+		if (*first)
+			*first = false;
+		else
+			printf(v, ", ");
+		print_agent(v, a);
+	}
+}
 static void print_q(verbosity v, const char *start, const struct agent_q *q,
 		    const char *end, unsigned int dont_print_tid)
 {
@@ -471,24 +486,28 @@ static void print_q(verbosity v, const char *start, const struct agent_q *q,
 
 	printf(v, "%s", start);
 	Q_FOREACH(a, q, nobe) {
-		if (a->tid != dont_print_tid) {
-			if (first)
-				first = false;
-			else
-				printf(v, ", ");
-			print_agent(v, a);
-		}
+		print_q_agent(v, a, &first, dont_print_tid);
 	}
 	printf(v, "%s", end);
 }
+/* as above, but for any of a scheduler's queues, even in the tree */
+#define PRINT_SCHED_Q(v, start, s, q, end, dont_print_tid) do {	\
+		const struct agent *__a;				\
+		bool __first = true;					\
+		printf(v, "%s", start);					\
+		SCHED_Q_FOREACH(__a, s, q) {				\
+			print_q_agent(v, __a, &__first, dont_print_tid); \
+		}							\
+		printf(v, "%s", end);					\
+	} while (0)
 void print_qs(verbosity v, const struct sched_state *s)
 {
 	printf(v, "current ");
 	print_agent(v, s->cur_agent);
 	printf(v, " ");
-	print_q(v, " RQ [", &s->rq, "] ", TID_NONE);
-	print_q(v, " SQ {", &s->sq, "} ", TID_NONE);
-	print_q(v, " DQ (", &s->dq, ") ", TID_NONE);
+	PRINT_SCHED_Q(v, " RQ [", s, rq, "] ", TID_NONE);
+	PRINT_SCHED_Q(v, " SQ {", s, sq, "} ", TID_NONE);
+	PRINT_SCHED_Q(v, " DQ (", s, dq, ") ", TID_NONE);
 }
 
 /* like print_qs, but human-friendly. */
@@ -499,23 +518,24 @@ void print_scheduler_state(verbosity v, const struct sched_state *s)
 	if (s->current_extra_runnable) {
 		print_agent(v, s->cur_agent);
 		dont_print_tid = s->cur_agent->tid;
-		if (Q_GET_SIZE(&s->rq) != 0) {
+		if (SCHED_Q_SIZE(s, rq) != 0) {
 			printf(v, ", ");
 		}
 	}
-	print_q(v, "", &s->rq, "", dont_print_tid);
-	if (Q_GET_SIZE(&s->sq) != 0) {
-		print_q(v, "; sleeping", &s->sq, "", dont_print_tid);
+	PRINT_SCHED_Q(v, "", s, rq, "", dont_print_tid);
+	if (SCHED_Q_SIZE(s, sq) != 0) {
+		PRINT_SCHED_Q(v, "; sleeping", s, sq, "", dont_print_tid);
 	}
-	print_q(v, "; descheduled ", &s->dq, "", dont_print_tid);
+	PRINT_SCHED_Q(v, "; descheduled ", s, dq, "", dont_print_tid);
 }
+#undef PRINT_SCHED_Q
 
 struct agent *find_agent(struct sched_state *s, unsigned int tid)
 {
 	struct agent *a;
-	if ((a = agent_by_tid_or_null(&s->rq, tid)) == NULL) {
-		if ((a = agent_by_tid_or_null(&s->sq, tid)) == NULL) {
-			a = agent_by_tid_or_null(&s->dq, tid);
+	if ((a = SCHED_Q_AGENT_BY_TID(s, rq, tid)) == NULL) {
+		if ((a = SCHED_Q_AGENT_BY_TID(s, sq, tid)) == NULL) {
+			a = SCHED_Q_AGENT_BY_TID(s, dq, tid);
 		}
 	}
 	return a;
@@ -532,6 +552,56 @@ const struct agent *find_runnable_agent(const struct sched_state *s, unsigned in
 	return NULL;
 }
 
+static void replace_saved_agent(saved_agent_q *q, struct agent *a,
+				struct agent *copy)
+{
+	unsigned int i;
+	struct agent **ap;
+	ARRAY_LIST_FOREACH(q, i, ap) {
+		if (*ap == a) {
+			*ap = copy;
+		}
+	}
+}
+
+/* Agents in the tree may be shared by many snapshots (see save.c), so before
+ * tagging one, a snapshot needs its own copy of it. Returns the agent to tag,
+ * which is 'a' if it was the snapshot's own already. Call with the nobe this
+ * snapshot belongs to being modified (see modify_pp); the refcounts are seen
+ * by all world lines, so need the lock. */
+struct agent *mutable_saved_agent(struct sched_state *s, struct agent *a)
+{
+	assert(s->saved && a->saved_refs > 0);
+	assert(timetravel_locked());
+	if (a->saved_refs == 1) {
+		return a;
+	}
+
+	struct agent *copy = SHARED_XMALLOC(1, struct agent);
+	*copy = *a;
+	copy->saved_refs = 1;
+	copy->saved_base = a->saved_base == NULL ? a : a->saved_base;
+	copy->saved_base->saved_refs++;
+	a->saved_refs--;
+
+	replace_saved_agent(&s->saved_rq, a, copy);
+	replace_saved_agent(&s->saved_dq, a, copy);
+	replace_saved_agent(&s->saved_sq, a, copy);
+	if (s->cur_agent == a) {
+		s->cur_agent = copy;
+	}
+	if (s->last_agent == a) {
+		s->last_agent = copy;
+	}
+	if (s->last_vanished_agent == a) {
+		s->last_vanished_agent = copy;
+	}
+	if (s->schedule_in_flight == a) {
+		s->schedule_in_flight = copy;
+	}
+	return copy;
+}
+
 /******************************************************************************
  * Kernelspace lifecycle events
  ******************************************************************************/
@@ -769,6 +839,22 @@ static void handle_kern_mutex_unlocking_done(struct sched_state *s)
 	lskprintf(DEV, "mutex: unlocking done by tid %d\n", CURRENT(s, tid));
 }
 
+#ifndef HTM_WEAK_ATOMICITY
+/* strong atomicity: syscalls will always abort transactions
+ * weak atomicity: allow switching to other threads during txns
+ * (nb: this also allows system calls in general, as a STM
+ * system would do; to accurately model HTM with weak atomicity
+ * you'd need to distinguish timer-driven context switches vs
+ * intentional system calls, and allow only the former) */
+static void abort_user_txn_in_kernel(struct ls_state *ls)
+{
+	struct sched_state *s = &ls->sched;
+	check_user_yield_activity(&ls->user_sync, s->cur_agent);
+	abort_transaction(CURRENT(s, tid), ls->save.current, _XABORT_CAPACITY);
+	ls->end_branch_early = true;
+}
+#endif
+
 static void sched_update_kern_state_machine(struct ls_state *ls)
 {
 	struct sched_state *s = &ls->sched;
@@ -777,8 +863,16 @@ static void sched_update_kern_state_machine(struct ls_state *ls)
 	bool succeeded;
 	bool is_sema;
 
+	/* Nearly every instruction is at no annotated address at all, in which
+	 * case none of the eip predicates below can match; skip them all. */
+	if (!annotated_eip(ls->eip)) {
+#ifndef HTM_WEAK_ATOMICITY
+		if (ACTION(s, user_txn)) {
+			abort_user_txn_in_kernel(ls);
+		}
+#endif
 	/* Timer interrupt handling. */
-	if (kern_timer_entering(ls->eip)) {
+	} else if (kern_timer_entering(ls->eip)) {
 		// XXX: same as the comment in the below condition.
 		if (!kern_timer_exiting(READ_STACK(ls->cpu0, 0))) {
 			assert(!ACTION(s, handling_timer));
@@ -1041,16 +1135,7 @@ static void sched_update_kern_state_machine(struct ls_state *ls)
 		ACTION(s, disk_io) = false;
 #ifndef HTM_WEAK_ATOMICITY
 	} else if (ACTION(s, user_txn)) {
-		/* strong atomicity: syscalls will always abort transactions
-		 * weak atomicity: allow switching to other threads during txns
-		 * (nb: this also allows system calls in general, as a STM
-		 * system would do; to accurately model HTM with weak atomicity
-		 * you'd need to distinguish timer-driven context switches vs
-		 * intentional system calls, and allow only the former) */
-		check_user_yield_activity(&ls->user_sync, s->cur_agent);
-		abort_transaction(CURRENT(s, tid), ls->save.current,
-				  _XABORT_CAPACITY);
-		ls->end_branch_early = true;
+		abort_user_txn_in_kernel(ls);
 #endif
 	} else {
 		sched_check_lmm_init(ls);
@@ -1168,6 +1253,12 @@ static void sched_update_user_state_machine(struct ls_state *ls)
 		s->delayed_txn_fail = false;
 	}
 
+	/* Other than ad-hoc yield()s (see user_yielding), all the cases below
+	 * are keyed on exact eips, which most instructions are not at. */
+	if (!annotated_eip(ls->eip) && !user_yielding(ls)) {
+		return;
+	}
+
 	/* mutexes (and yielding) */
 	if (user_mutex_init_entering(ls->cpu0, ls->eip, &lock_addr)) {
 		assert(!ACTION(s, user_mutex_initing));
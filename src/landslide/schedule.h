@@ -155,8 +155,8 @@ struct agent {
 	unsigned int most_recent_syscall;
 	unsigned int last_call; /* like a mini (much faster) stack trace */
 	/* locks held for data race detection */
-	struct lockset kern_locks_held;
-	struct lockset user_locks_held;
+	const struct lockset *kern_locks_held; /* interned */
+	const struct lockset *user_locks_held;
 #ifdef PURE_HAPPENS_BEFORE
 	struct vector_clock clock;
 #endif
@@ -166,12 +166,16 @@ struct agent {
 	const struct stack_trace *pre_vanish_trace;
 	/* Used by partial order reduction, only in "oldsched"s in the tree. */
 	bool do_explore;
+	/* Agents in the tree never change, but for the tags above, and are
+	 * shared by every snapshot they'd be the same in (see save.c). A copy
+	 * made to tag one (see mutable_saved_agent) borrows the pointees of the
+	 * original it's based on, which outlives it. Unused outside the tree. */
+	unsigned int saved_refs;
+	struct agent *saved_base;
 };
 
 Q_NEW_HEAD(struct agent_q, struct agent);
 
-static struct stack_trace *mutable_pre_vanish_trace(struct agent *a)
-	{ return (struct stack_trace *)a->pre_vanish_trace; }
 static struct agent *mutable_kern_blocked_on_agent(struct agent *a)
 	{ return (struct agent *)a->kern_blocked_on; }
 
@@ -212,6 +216,8 @@ static struct agent *mutable_kern_blocked_on_agent(struct agent *a)
 	 (a)->action.user_rwlock_unlocking  ? "rwlock_unlock" :		\
 	 "<unknown>")
 
+typedef ARRAY_LIST(struct agent *) saved_agent_q;
+
 /* Internal state for the scheduler.
  * If you change this, make sure to update save.c! */
 struct sched_state {
@@ -221,6 +227,12 @@ struct sched_state {
 	struct agent_q dq;
 	/* Reflection of threads which will become runnable on their own time */
 	struct agent_q sq;
+	/* Snapshots in the tree can't link agents they share into their own
+	 * queues, so keep the above as arrays instead (use SCHED_Q_FOREACH). */
+	bool saved;
+	saved_agent_q saved_rq;
+	saved_agent_q saved_dq;
+	saved_agent_q saved_sq;
 	/* Currently active thread */
 	struct agent *cur_agent;
 	struct agent *last_agent;
@@ -272,7 +284,7 @@ struct sched_state {
 	 * save.c, when voluntary resched decision points are too late to get
 	 * a useful stack trace. Set at context switch entry. */
 	unsigned int voluntary_resched_tid;
-	struct stack_trace *voluntary_resched_stack;
+	const struct stack_trace *voluntary_resched_stack;
 	/* TODO: have a scheduler-global schedule_landing to assert against the
 	 * per-agent flag (only violated by interrupts we don't control) */
 };
@@ -291,6 +303,26 @@ struct sched_state {
 	       "Illegal 'break' in nested loop macro");			\
 	} while (0)
 
+/* Iterates over one of the queues of s, whether it's in the tree or not. */
+#define SCHED_Q_FOREACH(a, s, q)					\
+	for (unsigned int __sched_q_i = 0;				\
+	     ((a) = !(s)->saved ?					\
+	      (__sched_q_i == 0 ? Q_GET_HEAD(&(s)->q) : (a)->nobe.next) :	\
+	      __sched_q_i < ARRAY_LIST_SIZE(&(s)->saved_##q) ?		\
+	      (s)->saved_##q.array[__sched_q_i] : NULL) != NULL;	\
+	     __sched_q_i++)
+
+#define SCHED_Q_SIZE(s, q) \
+	((s)->saved ? ARRAY_LIST_SIZE(&(s)->saved_##q) : Q_GET_SIZE(&(s)->q))
+
+#define SCHED_Q_AGENT_BY_TID(s, q, wanted_tid) ({			\
+	struct agent *__sched_q_a;					\
+	SCHED_Q_FOREACH(__sched_q_a, s, q) {				\
+		if (__sched_q_a->tid == (wanted_tid))			\
+			break;						\
+	}								\
+	__sched_q_a; })
+
 /* Can't be used with 'break' or 'continue', though 'return' is fine. */
 #define FOR_EACH_RUNNABLE_AGENT(a, s, code) do {	\
 	bool __idle_is_runnable = true;			\
@@ -301,22 +333,22 @@ struct sched_state {
 		__idle_is_runnable = false;		\
 		EVAPORATE_FLOW_CONTROL(code);		\
 	}						\
-	Q_FOREACH(a, &(s)->rq, nobe) {			\
+	SCHED_Q_FOREACH(a, s, rq) {			\
 		if (TID_IS_IDLE(a->tid))		\
 			continue;			\
 		__idle_is_runnable = false;		\
 		EVAPORATE_FLOW_CONTROL(code);		\
 	}						\
-	Q_FOREACH(a, &(s)->sq, nobe) {			\
+	SCHED_Q_FOREACH(a, s, sq) {			\
 		if (TID_IS_IDLE(a->tid))		\
 			continue; /* why it sleep?? */	\
 		__idle_is_runnable = false;		\
 		EVAPORATE_FLOW_CONTROL(code);		\
 	}						\
 	if (__idle_is_runnable && kern_has_idle()) {	\
-		a = agent_by_tid_or_null(&(s)->dq, kern_get_idle_tid()); \
+		a = SCHED_Q_AGENT_BY_TID(s, dq, kern_get_idle_tid()); \
 		if (a == NULL)				\
-			a = agent_by_tid_or_null(&(s)->rq, kern_get_idle_tid()); \
+			a = SCHED_Q_AGENT_BY_TID(s, rq, kern_get_idle_tid()); \
 		assert(a != NULL && "couldn't find idle in FOR_EACH");	\
 		EVAPORATE_FLOW_CONTROL(code);		\
 	}						\
@@ -363,6 +395,7 @@ struct agent *find_agent(struct sched_state *s, unsigned int tid);
 static inline const struct agent *const_find_agent(const struct sched_state *s, unsigned int tid)
 	{ return (const struct agent *)find_agent((struct sched_state *)s, tid); }
 const struct agent *find_runnable_agent(const struct sched_state *s, unsigned int tid);
+struct agent *mutable_saved_agent(struct sched_state *s, struct agent *a);
 
 /* called at every "interesting" point ... */
 void sched_update(struct ls_state *);
@@ -0,0 +1,257 @@
+/**
+ * @file schedule_trace.c
+ * @brief compact binary record of the choices that make up a branch
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define MODULE_NAME "SCHEDULE TRACE"
+
+#include "common.h"
+#include "schedule_trace.h"
+#include "simulator.h"
+#include "tsx.h"
+
+/* File layout, all as host-endian 32-bit words (a trace is only meaningful to
+ * the same build of the same kernel anyway): magic, version, ICB bound, number
+ * of choices; then per choice its depth, tid, xabort code, and flags, followed
+ * (only if it has an active abort set) by that set's two halves, each as tid,
+ * check-success, and check-retry. Choices the arbiter made by default are not
+ * recorded at all, so a typical branch takes a few dozen bytes. */
+#define SCHEDULE_TRACE_MAGIC   0x4c535354 /* "LSST" */
+#define SCHEDULE_TRACE_VERSION 1
+
+#define CHOICE_FLAG_TXN    0x1
+#define CHOICE_FLAG_ABORTS 0x2
+
+void schedule_trace_init(struct schedule_trace *st, unsigned int icb_bound)
+{
+	st->icb_bound = icb_bound;
+	ARRAY_LIST_INIT(&st->choices, 16);
+	st->next = 0;
+}
+
+void schedule_trace_free(struct schedule_trace *st)
+{
+	ARRAY_LIST_FREE(&st->choices);
+}
+
+void schedule_trace_append(struct schedule_trace *st, unsigned int depth,
+			   unsigned int tid, bool txn, unsigned int xabort_code,
+			   const struct abort_set *aborts)
+{
+	struct schedule_choice c;
+	assert(ARRAY_LIST_SIZE(&st->choices) == 0 ||
+	       ARRAY_LIST_GET(&st->choices,
+			      ARRAY_LIST_SIZE(&st->choices) - 1)->depth < depth);
+	c.depth       = depth;
+	c.tid         = tid;
+	c.txn         = txn;
+	c.xabort_code = xabort_code;
+	c.aborts      = *aborts;
+	ARRAY_LIST_APPEND(&st->choices, c);
+}
+
+/******************************************************************************
+ * file i/o
+ ******************************************************************************/
+
+bool put_word(FILE *f, unsigned int word)
+{
+	uint32_t w = word;
+	return fwrite(&w, sizeof(w), 1, f) == 1;
+}
+
+bool get_word(FILE *f, unsigned int *word)
+{
+	uint32_t w;
+	if (fread(&w, sizeof(w), 1, f) != 1) {
+		return false;
+	}
+	*word = w;
+	return true;
+}
+
+#ifdef HTM_ABORT_SETS
+static bool put_noob(FILE *f, const struct abort_noob *n)
+{
+	return put_word(f, n->tid) && put_word(f, n->check_success) &&
+		put_word(f, n->check_retry);
+}
+
+static bool get_noob(FILE *f, struct abort_noob *n)
+{
+	unsigned int check_success, check_retry;
+	if (!get_word(f, &n->tid) || !get_word(f, &check_success) ||
+	    !get_word(f, &check_retry)) {
+		return false;
+	}
+	n->check_success = check_success != 0;
+	n->check_retry   = check_retry != 0;
+	return true;
+}
+#endif
+
+bool trace_put_aborts(FILE *f, const struct abort_set *aborts)
+{
+	bool active = ABORT_SET_ACTIVE(aborts);
+	if (!put_word(f, active ? 1 : 0)) {
+		return false;
+	}
+#ifdef HTM_ABORT_SETS
+	if (active) {
+		return put_noob(f, &aborts->reordered_subtree_child) &&
+			put_noob(f, &aborts->preempted_evil_ancestor);
+	}
+#endif
+	return true;
+}
+
+bool trace_get_aborts(FILE *f, struct abort_set *aborts)
+{
+	unsigned int active;
+	if (!get_word(f, &active)) {
+		return false;
+	} else if (active == 0) {
+		ABORT_SET_INIT_INACTIVE(aborts);
+		return true;
+	}
+#ifdef HTM_ABORT_SETS
+	return get_noob(f, &aborts->reordered_subtree_child) &&
+		get_noob(f, &aborts->preempted_evil_ancestor);
+#else
+	/* written by a build with abort sets */
+	return false;
+#endif
+}
+
+bool schedule_trace_fwrite(const struct schedule_trace *st, FILE *f)
+{
+	bool ok = put_word(f, SCHEDULE_TRACE_MAGIC) &&
+		put_word(f, SCHEDULE_TRACE_VERSION) &&
+		put_word(f, st->icb_bound) &&
+		put_word(f, ARRAY_LIST_SIZE(&st->choices));
+
+	const struct schedule_choice *c;
+	unsigned int i;
+	ARRAY_LIST_FOREACH(&st->choices, i, c) {
+		bool aborts = ABORT_SET_ACTIVE(&c->aborts);
+		ok = ok && put_word(f, c->depth) && put_word(f, c->tid) &&
+			put_word(f, c->xabort_code) &&
+			put_word(f, (c->txn ? CHOICE_FLAG_TXN : 0) |
+				    (aborts ? CHOICE_FLAG_ABORTS : 0));
+#ifdef HTM_ABORT_SETS
+		if (aborts) {
+			ok = ok && put_noob(f, &c->aborts.reordered_subtree_child) &&
+				put_noob(f, &c->aborts.preempted_evil_ancestor);
+		}
+#endif
+	}
+	return ok;
+}
+
+bool schedule_trace_write(const struct schedule_trace *st, const char *filename)
+{
+	FILE *f = fopen(filename, "w");
+	if (f == NULL) {
+		lsprintf(DEV, "couldn't open %s to write schedule\n", filename);
+		return false;
+	}
+	bool ok = schedule_trace_fwrite(st, f);
+	if (fclose(f) != 0) {
+		ok = false;
+	}
+	return ok;
+}
+
+/* On failure, leaves the trace empty. */
+bool schedule_trace_fread(struct schedule_trace *st, FILE *f)
+{
+	unsigned int magic, version, icb_bound, num_choices;
+
+	schedule_trace_init(st, 0);
+	bool ok = get_word(f, &magic) && magic == SCHEDULE_TRACE_MAGIC &&
+		get_word(f, &version) && version == SCHEDULE_TRACE_VERSION &&
+		get_word(f, &icb_bound) && get_word(f, &num_choices);
+	if (ok) {
+		st->icb_bound = icb_bound;
+	}
+
+	for (unsigned int i = 0; ok && i < num_choices; i++) {
+		struct schedule_choice c;
+		unsigned int flags;
+		ok = get_word(f, &c.depth) && get_word(f, &c.tid) &&
+			get_word(f, &c.xabort_code) && get_word(f, &flags);
+		if (!ok) {
+			break;
+		}
+		c.txn = (flags & CHOICE_FLAG_TXN) != 0;
+		if (flags & CHOICE_FLAG_ABORTS) {
+#ifdef HTM_ABORT_SETS
+			ok = get_noob(f, &c.aborts.reordered_subtree_child) &&
+				get_noob(f, &c.aborts.preempted_evil_ancestor);
+#else
+			/* recorded by a build with abort sets; can't replay */
+			ok = false;
+#endif
+		} else {
+			ABORT_SET_INIT_INACTIVE(&c.aborts);
+		}
+		/* each PP makes at most one choice */
+		ok = ok && (i == 0 || ARRAY_LIST_GET(&st->choices, i - 1)->depth
+				      < c.depth);
+		if (ok) {
+			ARRAY_LIST_APPEND(&st->choices, c);
+		}
+	}
+
+	if (!ok) {
+		ARRAY_LIST_FREE(&st->choices);
+		schedule_trace_init(st, 0);
+	}
+	return ok;
+}
+
+bool schedule_trace_read(struct schedule_trace *st, const char *filename)
+{
+	FILE *f = fopen(filename, "r");
+	if (f == NULL) {
+		lsprintf(DEV, "couldn't open schedule %s\n", filename);
+		schedule_trace_init(st, 0);
+		return false;
+	}
+	bool ok = schedule_trace_fread(st, f);
+	fclose(f);
+	if (!ok) {
+		lsprintf(DEV, "%s is not a valid schedule\n", filename);
+	}
+	return ok;
+}
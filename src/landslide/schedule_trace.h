@@ -0,0 +1,77 @@
+/**
+ * @file schedule_trace.h
+ * @brief compact binary record of the choices that make up a branch
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LS_SCHEDULE_TRACE_H
+#define __LS_SCHEDULE_TRACE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "array_list.h"
+#include "tsx.h"
+
+/* One choice on a branch that wasn't the arbiter's default, i.e., one that a
+ * time leap injected at the PP of the given depth. Given the same test and PP
+ * config, a branch is fully determined by the list of these, so booting the
+ * guest and injecting each one when its PP comes around reproduces it without
+ * needing any forked process to have been kept alive. */
+struct schedule_choice {
+	unsigned int depth;
+	unsigned int tid;
+	bool txn;
+	unsigned int xabort_code;
+	struct abort_set aborts;
+};
+
+struct schedule_trace {
+	unsigned int icb_bound; /* the branch may need this many preemptions */
+	ARRAY_LIST(struct schedule_choice) choices; /* by increasing depth */
+	unsigned int next; /* when replaying, the first choice not yet injected */
+};
+
+void schedule_trace_init(struct schedule_trace *st, unsigned int icb_bound);
+void schedule_trace_free(struct schedule_trace *st);
+void schedule_trace_append(struct schedule_trace *st, unsigned int depth,
+			   unsigned int tid, bool txn, unsigned int xabort_code,
+			   const struct abort_set *aborts);
+bool schedule_trace_write(const struct schedule_trace *st, const char *filename);
+bool schedule_trace_read(struct schedule_trace *st, const char *filename);
+
+/* For file formats that embed a trace among other things (see suspend.h). */
+bool schedule_trace_fwrite(const struct schedule_trace *st, FILE *f);
+bool schedule_trace_fread(struct schedule_trace *st, FILE *f);
+bool put_word(FILE *f, unsigned int word);
+bool get_word(FILE *f, unsigned int *word);
+bool trace_put_aborts(FILE *f, const struct abort_set *aborts);
+bool trace_get_aborts(FILE *f, struct abort_set *aborts);
+
+#endif
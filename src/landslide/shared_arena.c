@@ -0,0 +1,129 @@
+/**
+ * @file shared_arena.c
+ * @brief allocation for state seen by every timetravel process
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+#define MODULE_NAME "SHARED ARENA"
+
+#include "common.h"
+#include "compiler.h"
+#include "shared_arena.h"
+
+/* Address space reserved up front; pages are only backed once touched. Can't
+ * be grown later, as processes forked before then wouldn't see the growth. */
+#define SHARED_ARENA_SIZE ((size_t)16 << 30)
+
+/* Freed blocks are recycled by power-of-two size class. The header keeps
+ * allocations 16-aligned, as malloc's are (nobes contain long doubles). */
+#define SHARED_MIN_CLASS 4 /* 16 bytes */
+#define SHARED_NUM_CLASSES 40
+
+struct shared_block {
+	union {
+		unsigned int size_class;
+		struct shared_block *next_free;
+	};
+	char pad[8];
+	char data[];
+};
+
+/* lives at the start of the mapping itself, so all processes agree on it */
+struct shared_arena {
+	volatile int lock;
+	char *next;
+	char *end;
+	struct shared_block *free_lists[SHARED_NUM_CLASSES];
+};
+
+static struct shared_arena *arena = NULL;
+
+void shared_arena_init()
+{
+	STATIC_ASSERT(sizeof(struct shared_block) == 16);
+	assert(arena == NULL && "can't be called twice");
+	void *base = mmap(NULL, SHARED_ARENA_SIZE, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	assert(base != MAP_FAILED && "couldn't map shared arena");
+
+	arena = (struct shared_arena *)base;
+	arena->lock = 0;
+	arena->next = (char *)base + sizeof(struct shared_arena);
+	arena->next += (16 - (uintptr_t)arena->next % 16) % 16;
+	arena->end = (char *)base + SHARED_ARENA_SIZE;
+	for (unsigned int i = 0; i < SHARED_NUM_CLASSES; i++) {
+		arena->free_lists[i] = NULL;
+	}
+}
+
+void *shared_alloc(size_t size)
+{
+	unsigned int size_class = SHARED_MIN_CLASS;
+	struct shared_block *b;
+
+	assert(arena != NULL && "shared arena not initialized");
+	while (((size_t)1 << size_class) < size) {
+		size_class++;
+	}
+	assert(size_class - SHARED_MIN_CLASS < SHARED_NUM_CLASSES);
+
+	shared_lock(&arena->lock);
+	b = arena->free_lists[size_class - SHARED_MIN_CLASS];
+	if (b != NULL) {
+		arena->free_lists[size_class - SHARED_MIN_CLASS] = b->next_free;
+	} else {
+		size_t block_size = sizeof(struct shared_block) +
+			((size_t)1 << size_class);
+		assert((size_t)(arena->end - arena->next) >= block_size &&
+		       "shared arena exhausted");
+		b = (struct shared_block *)arena->next;
+		arena->next += block_size;
+	}
+	shared_unlock(&arena->lock);
+	b->size_class = size_class;
+	return b->data;
+}
+
+void shared_free(const void *p)
+{
+	if (p == NULL) {
+		return;
+	}
+	struct shared_block *b = (struct shared_block *)
+		((char *)p - offsetof(struct shared_block, data));
+	unsigned int i = b->size_class - SHARED_MIN_CLASS;
+	assert(i < SHARED_NUM_CLASSES && "bad shared free");
+	shared_lock(&arena->lock);
+	b->next_free = arena->free_lists[i];
+	arena->free_lists[i] = b;
+	shared_unlock(&arena->lock);
+}
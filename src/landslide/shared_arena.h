@@ -0,0 +1,74 @@
+/**
+ * @file shared_arena.h
+ * @brief allocation for state seen by every timetravel process
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LS_SHARED_ARENA_H
+#define __LS_SHARED_ARENA_H
+
+#include <sched.h>
+#include <stddef.h>
+
+#include "array_list.h"
+
+/* Memory from here lives in one MAP_SHARED mapping, made before the first
+ * timetravel fork, so every world line sees the same contents at the same
+ * address. The decision tree's "glowing green" state goes here, so updates
+ * to it need not be sent to each dormant process (see timetravel.h).
+ * Pointers from shared objects into ordinary (private) memory are fine as
+ * long as the pointee is never changed after any process forks from the one
+ * that made it. Parallel world lines (see timetravel.h) may allocate at once. */
+
+/* A spinlock that works across processes, when placed in shared memory. */
+static inline void shared_lock(volatile int *lock)
+{
+	while (__sync_lock_test_and_set(lock, 1)) {
+		sched_yield();
+	}
+}
+static inline void shared_unlock(volatile int *lock)
+{
+	__sync_lock_release(lock);
+}
+
+void shared_arena_init(void);
+void *shared_alloc(size_t size);
+void shared_free(const void *p);
+
+#define SHARED_XMALLOC(x, t) ((t *)shared_alloc((x) * sizeof(t)))
+#define SHARED_FREE(p) shared_free(p)
+
+#define SHARED_ARRAY_LIST_INIT(a, initial_capacity) \
+	__ARRAY_LIST_INIT(a, initial_capacity, SHARED_XMALLOC)
+#define SHARED_ARRAY_LIST_APPEND(a, val) \
+	__ARRAY_LIST_APPEND(a, val, SHARED_XMALLOC, SHARED_FREE)
+#define SHARED_ARRAY_LIST_FREE(a) SHARED_FREE((a)->array)
+
+#endif
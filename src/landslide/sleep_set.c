@@ -0,0 +1,288 @@
+/**
+ * @file sleep_set.c
+ * @brief sleep sets, to not run threads whose next move was already explored
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#define MODULE_NAME "SLEEP"
+#define MODULE_COLOUR COLOUR_DARK COLOUR_MAGENTA
+
+#include "array_list.h"
+#include "bitset.h"
+#include "common.h"
+#include "kernel_specifics.h"
+#include "landslide.h"
+#include "mem.h"
+#include "schedule.h"
+#include "shared_arena.h"
+#include "sleep_set.h"
+#include "timetravel.h"
+#include "tree.h"
+
+#ifdef SLEEP_SETS
+
+typedef ARRAY_LIST(struct sleeper) mutable_sleepers_t;
+static inline mutable_sleepers_t *mutable_sleep_set(struct nobe *h)
+	{ return (mutable_sleepers_t *)&h->sleep_set; }
+
+/******************************************************************************
+ * footprints
+ ******************************************************************************/
+
+void footprint_init(struct footprint *fp)
+{
+	memset(fp, 0, sizeof(*fp));
+	fp->known = false;
+}
+
+/* fibonacci hashing; accesses are byte-granular, so neighbours must spread */
+static unsigned int footprint_bit(unsigned int addr)
+{
+	return (unsigned int)(((uint64_t)addr * 0x9E3779B97F4A7C15ULL) >> 32)
+		% FOOTPRINT_BITS;
+}
+
+/* Summarises the accesses mem_shm_intersect() would compare, from either a
+ * finished transition's sorted set or the ongoing one's hash table. */
+static void footprint_compute(struct footprint *fp, const struct mem_state *m)
+{
+	struct mem_access *ma;
+	unsigned int i;
+
+	footprint_init(fp);
+	if (m->freed.rb_node != NULL) {
+		/* conflicts with any access inside the freed chunk, which we'd
+		 * need the chunk's bounds, not just addresses, to check */
+		return;
+	}
+	SHM_FOREACH(&m->shm, i, ma) {
+		unsigned int bit = footprint_bit(ma->addr);
+		bitset_set(fp->touched, bit, true);
+		if (ma->any_writes) {
+			bitset_set(fp->written, bit, true);
+		}
+		if (ma->other_tid != 0) {
+			/* see check_stack_conflict() */
+			fp->other_stacks |= (uint64_t)1 << (ma->other_tid % 64);
+		}
+	}
+	fp->known = true;
+}
+
+void footprint_merge(struct footprint *dest, const struct footprint *src)
+{
+	dest->known = dest->known && src->known;
+	dest->other_stacks |= src->other_stacks;
+	for (unsigned int i = 0; i < FOOTPRINT_WORDS; i++) {
+		dest->touched[i] |= src->touched[i];
+		dest->written[i] |= src->written[i];
+	}
+}
+
+bool footprints_independent(const struct footprint *fp0, unsigned int tid0,
+			    const struct footprint *fp1, unsigned int tid1)
+{
+	if (!fp0->known || !fp1->known || tid0 == tid1 ||
+	    TID_IS_IDLE(tid0) || TID_IS_IDLE(tid1) ||
+	    (fp0->other_stacks & ((uint64_t)1 << (tid1 % 64))) != 0 ||
+	    (fp1->other_stacks & ((uint64_t)1 << (tid0 % 64))) != 0) {
+		return false;
+	}
+	for (unsigned int i = 0; i < FOOTPRINT_WORDS; i++) {
+		if ((fp0->written[i] & fp1->touched[i]) != 0 ||
+		    (fp0->touched[i] & fp1->written[i]) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static const struct mem_state *tested_mem(const struct mem_state *kern_mem,
+					  const struct mem_state *user_mem)
+{
+	return testing_userspace() ? user_mem : kern_mem;
+}
+
+/******************************************************************************
+ * sleep sets
+ ******************************************************************************/
+
+void sleep_set_init(struct nobe *h)
+{
+	/* most PPs have nobody asleep; don't allocate until somebody is */
+	h->sleep_set.size = 0;
+	h->sleep_set.capacity = 0;
+	h->sleep_set.array = NULL;
+}
+
+void sleep_set_free(struct nobe *h)
+{
+	if (h->sleep_set.array != NULL) {
+		SHARED_ARRAY_LIST_FREE(mutable_sleep_set(h));
+	}
+}
+
+bool sleep_set_contains(const struct nobe *h, unsigned int tid)
+{
+	const struct sleeper *z;
+	unsigned int i;
+	ARRAY_LIST_FOREACH(&h->sleep_set, i, z) {
+		if (z->tid == tid) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Does a thread asleep at (or explored from) the parent stay asleep after
+ * 'tid' runs, with the given footprint, into the state 's'? Running it must
+ * neither conflict with its transition, nor have blocked it. */
+static bool stays_asleep(const struct sleeper *z, unsigned int tid,
+			 const struct footprint *fp, const struct sched_state *s)
+{
+	const struct agent *a = find_runnable_agent(s, z->tid);
+	return a != NULL && !BLOCKED(a) &&
+		footprints_independent(&z->footprint, z->tid, fp, tid);
+}
+
+static void add_sleeper(struct nobe *h, const struct sleeper *z)
+{
+	if (!sleep_set_contains(h, z->tid)) {
+		SHARED_ARRAY_LIST_APPEND(mutable_sleep_set(h), *z);
+		lsprintf(INFO, "#%d/tid%d: tid %d asleep\n",
+			 h->depth, h->chosen_thread, z->tid);
+	}
+}
+
+/* Finds the threads which will be asleep at the parent's child via 'tid': its
+ * own sleepers, and the threads of its children before that one, in order (or
+ * all of them, if that child isn't there yet), which both stay asleep through
+ * the child's transition. Either adds them all to the new nobe 'dest', or, if
+ * that's NULL, returns whether 'wanted_tid' is one of them. */
+static bool next_sleepers(const struct nobe *parent, unsigned int tid,
+			  bool xabort, const struct footprint *fp,
+			  const struct sched_state *s, struct nobe *dest,
+			  unsigned int wanted_tid)
+{
+	const struct sleeper *z;
+	const struct nobe_child *c;
+	unsigned int i;
+
+	if (xabort || parent->xbegin) {
+		/* an injected failure is no ordinary transition */
+		return false;
+	}
+	ARRAY_LIST_FOREACH(&parent->sleep_set, i, z) {
+		if (stays_asleep(z, tid, fp, s)) {
+			if (dest != NULL) {
+				add_sleeper(dest, z);
+			} else if (z->tid == wanted_tid) {
+				return true;
+			}
+		}
+	}
+	ARRAY_LIST_FOREACH(&parent->children, i, c) {
+		if (c->xabort) {
+			continue;
+		} else if (c->chosen_thread == (int)tid) {
+			break;
+		}
+		struct sleeper sibling;
+		sibling.tid = c->chosen_thread;
+		sibling.footprint = c->footprint;
+		if (stays_asleep(&sibling, tid, fp, s)) {
+			if (dest != NULL) {
+				add_sleeper(dest, &sibling);
+			} else if (sibling.tid == wanted_tid) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+struct child_footprint {
+	unsigned int tid;
+	struct footprint footprint;
+};
+
+static void update_pp_child_footprint(struct nobe *h, struct child_footprint *cf)
+{
+	struct nobe_child *c;
+	unsigned int i;
+	ARRAY_LIST_FOREACH(mutable_children(h), i, c) {
+		if (c->chosen_thread == (int)cf->tid && !c->xabort) {
+			c->footprint = cf->footprint;
+			return;
+		}
+	}
+}
+
+void sleep_set_inherit(struct nobe *h)
+{
+	assert(h->parent != NULL);
+	assert(ARRAY_LIST_SIZE(&h->sleep_set) == 0);
+
+	struct child_footprint cf;
+	cf.tid = h->chosen_thread;
+	footprint_compute(&cf.footprint, tested_mem(h->old_kern_mem,
+						    h->old_user_mem));
+	if (!h->xaborted) {
+		/* for later siblings to put this thread to sleep with */
+		modify_pp(update_pp_child_footprint, h->parent, cf);
+	}
+	next_sleepers(h->parent, h->chosen_thread, h->xaborted, &cf.footprint,
+		      h->oldsched, h, TID_NONE);
+}
+
+bool sleep_set_upcoming(struct ls_state *ls, struct footprint *fp)
+{
+	if (ls->save.current == NULL || timetravel_replaying()) {
+		/* during replay, the arbiter's choices aren't its own; and any
+		 * siblings since explored mustn't make this branch diverge */
+		return false;
+	}
+	footprint_compute(fp, tested_mem(&ls->kern_mem, &ls->user_mem));
+	return true;
+}
+
+bool sleep_set_upcoming_contains(struct ls_state *ls,
+				 const struct footprint *fp, unsigned int tid)
+{
+	/* the parent's children may be changed by other world lines */
+	timetravel_lock();
+	bool asleep = next_sleepers(ls->save.current, ls->save.next_tid,
+				    ls->save.next_xabort, fp, &ls->sched, NULL, tid);
+	timetravel_unlock();
+	return asleep;
+}
+
+#endif
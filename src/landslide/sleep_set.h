@@ -0,0 +1,117 @@
+/**
+ * @file sleep_set.h
+ * @brief sleep sets, to not run threads whose next move was already explored
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LS_SLEEP_SET_H
+#define __LS_SLEEP_SET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "array_list.h"
+#include "student_specifics.h" /* for SLEEP_SETS */
+
+struct ls_state;
+struct mem_state;
+struct nobe;
+
+/* Sleep sets [Godefroid, 1996]. Once the subtree of some PP's child where
+ * thread A ran has been (or is being) explored, then in the subtree of each
+ * later child, where B ran instead, A's transition is sure to come out the
+ * same as it did there for as long as nothing dependent with it runs, and
+ * any interleaving that ran it in that time would be equivalent to one found
+ * under A's child. So A "sleeps" in B's subtree (it's in the sleep set of
+ * each PP there) until a transition conflicts with the one it made, and is
+ * neither chosen by the arbiter nor tagged by DPOR meanwhile. If nobody but
+ * sleeping threads could run, the branch is ended then and there.
+ *
+ * The order the children come in is their order in the parent's list, so
+ * parallel world lines exploring siblings at once don't put each other to
+ * sleep. Since the transitions' memory accesses don't outlive their branch,
+ * each child is summarised by a footprint: a bloom filter of the addresses it
+ * touched and wrote, plus whose stacks it accessed; a false positive there
+ * just means a thread wakes up too early. Transitions that freed memory, and
+ * transaction failure injections, are never put to sleep. Sleep sets are
+ * unsound with ICB's preemption bound, and blind to abort sets' constraints
+ * on what a subtree explores, so they're incompatible with both. */
+#ifdef SLEEP_SETS
+
+#if defined(ICB) || defined(HTM_ABORT_SETS)
+#error "sleep sets are incompatible with ICB and HTM abort sets"
+#endif
+
+#define FOOTPRINT_BITS 512
+#define FOOTPRINT_WORDS (FOOTPRINT_BITS / 64)
+
+struct footprint {
+	bool known; /* false if never run, or if it freed memory */
+	uint64_t other_stacks; /* tids mod 64 */
+	uint64_t touched[FOOTPRINT_WORDS];
+	uint64_t written[FOOTPRINT_WORDS];
+};
+
+struct sleeper {
+	unsigned int tid;
+	struct footprint footprint; /* of its next transition */
+};
+
+void footprint_init(struct footprint *fp);
+/* into 'dest': as if one transition had made both's accesses */
+void footprint_merge(struct footprint *dest, const struct footprint *src);
+bool footprints_independent(const struct footprint *fp0, unsigned int tid0,
+			    const struct footprint *fp1, unsigned int tid1);
+void sleep_set_init(struct nobe *h);
+void sleep_set_free(struct nobe *h);
+/* for a new nobe, whose transition's memory accesses are already stored in its
+ * old mem states: records its footprint in the parent, and inherits sleepers */
+void sleep_set_inherit(struct nobe *h);
+bool sleep_set_contains(const struct nobe *h, unsigned int tid);
+/* for the arbiter, before the PP is made: which threads will be asleep there
+ * (having computed the ongoing transition's footprint in advance) */
+bool sleep_set_upcoming(struct ls_state *ls, struct footprint *fp);
+bool sleep_set_upcoming_contains(struct ls_state *ls,
+				 const struct footprint *fp, unsigned int tid);
+
+#else
+
+struct footprint { };
+
+#define footprint_init(fp) do { } while (0)
+#define sleep_set_init(h) do { } while (0)
+#define sleep_set_free(h) do { } while (0)
+#define sleep_set_inherit(h) do { } while (0)
+#define sleep_set_contains(h, tid) false
+#define sleep_set_upcoming(ls, fp) ((void)(fp), false)
+#define sleep_set_upcoming_contains(ls, fp, tid) false
+
+#endif
+
+#endif /* __LS_SLEEP_SET_H */
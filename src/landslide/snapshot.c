@@ -0,0 +1,318 @@
+/**
+ * @file snapshot.c
+ * @brief in-place incremental snapshots of the simulated machine
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#define MODULE_NAME "SNAPSHOT"
+#define MODULE_COLOUR COLOUR_DARK COLOUR_CYAN
+
+#include "array_list.h"
+#include "bitset.h"
+#include "common.h"
+#include "fingerprint.h"
+#include "simulator.h"
+#include "snapshot.h"
+#include "x86.h"
+
+#if defined(BOCHS) && defined(TIMETRAVEL_SNAPSHOTS)
+
+/* bochs's own way of finishing up after restoring its state (see main.cc),
+ * and of forgetting decoded instructions (see cpu/icache.cc) */
+void bx_sr_after_restore_state(void);
+void flushICaches(void);
+
+/* A device's opaque state (e.g., VGA memory). Shared by consecutive snapshots
+ * for as long as it doesn't change. */
+struct blob {
+	unsigned int refcount;
+	unsigned int size;
+	Bit8u *data;
+};
+
+/* A page's contents as of some snapshot. Each page's versions are linked from
+ * the newest snapshot's on back; there's always at least the first one's. */
+struct page_version {
+	unsigned int depth;
+	struct page_version *older;
+	Bit8u data[PAGE_SIZE];
+};
+
+struct snapshot {
+	unsigned int depth;
+	struct snapshot *older;
+	Bit64s *values; /* one per numeric param */
+	struct blob **blobs; /* one per data param */
+	ARRAY_LIST(unsigned int) pages; /* whose versions belong to us */
+};
+
+static struct {
+	bool inited;
+	/* everything in bochs's save/restore param tree, flattened */
+	ARRAY_LIST(bx_param_num_c *) nums;
+	ARRAY_LIST(bx_shadow_data_c *) datas;
+	/* guest RAM */
+	unsigned int num_pages;
+	struct page_version **versions; /* newest first, per page */
+	uint64_t *dirty; /* bitset: pages written since the newest snapshot */
+	ARRAY_LIST(unsigned int) dirty_list; /* same, for iterating */
+	struct snapshot *newest;
+} snap;
+
+/******************************************************************************
+ * setup
+ ******************************************************************************/
+
+static void flatten_params(bx_list_c *list, bool root)
+{
+	for (int i = 0; i < list->get_size(); i++) {
+		bx_param_c *param = list->get(i);
+		switch (param->get_type()) {
+		case BXT_LIST:
+			/* RAM is handled page-wise, below */
+			if (!root || strcmp(param->get_name(), "memory") != 0) {
+				flatten_params((bx_list_c *)param, false);
+			}
+			break;
+		case BXT_PARAM_NUM:
+		case BXT_PARAM_BOOL:
+		case BXT_PARAM_ENUM:
+			ARRAY_LIST_APPEND(&snap.nums, (bx_param_num_c *)param);
+			break;
+		case BXT_PARAM_DATA:
+			ARRAY_LIST_APPEND(&snap.datas, (bx_shadow_data_c *)param);
+			break;
+		default:
+			/* strings are config, not state; and file-backed data
+			 * (disk images) are left alone, as noted in the header */
+			break;
+		}
+	}
+}
+
+static void snapshot_init()
+{
+	ARRAY_LIST_INIT(&snap.nums, 1024);
+	ARRAY_LIST_INIT(&snap.datas, 16);
+	flatten_params(SIM->get_bochs_root(), true);
+
+	Bit64u ram_len = BX_MEM(0)->get_memory_len();
+	assert(ram_len % PAGE_SIZE == 0);
+	snap.num_pages = ram_len / PAGE_SIZE;
+	snap.versions = MM_XMALLOC(snap.num_pages, struct page_version *);
+	snap.dirty = MM_XMALLOC(BITSET_WORDS(snap.num_pages), uint64_t);
+	bitset_clear(snap.dirty, snap.num_pages);
+	ARRAY_LIST_INIT(&snap.dirty_list, 1024);
+
+	/* with no older snapshot to go by, the first must save every page */
+	for (unsigned int page = 0; page < snap.num_pages; page++) {
+		snap.versions[page] = NULL;
+		bitset_set(snap.dirty, page, true);
+		ARRAY_LIST_APPEND(&snap.dirty_list, page);
+	}
+	snap.newest = NULL;
+	snap.inited = true;
+
+	lsprintf(DEV, "snapshotting %u params, %u blobs, and %u pages of RAM\n",
+		 ARRAY_LIST_SIZE(&snap.nums), ARRAY_LIST_SIZE(&snap.datas),
+		 snap.num_pages);
+}
+
+/******************************************************************************
+ * dirty tracking
+ ******************************************************************************/
+
+static void note_dirty_page(unsigned int page)
+{
+	if (page < snap.num_pages && !bitset_get(snap.dirty, page)) {
+		bitset_set(snap.dirty, page, true);
+		ARRAY_LIST_APPEND(&snap.dirty_list, page);
+	}
+}
+
+/* Called for every guest memory write, so keep it cheap. Before the first
+ * snapshot, there's nothing to be dirty with respect to. */
+void snapshot_note_write(uint64_t pa, unsigned int len)
+{
+	if (!snap.inited || len == 0) {
+		return;
+	}
+	note_dirty_page(pa / PAGE_SIZE);
+	if ((pa + len - 1) / PAGE_SIZE != pa / PAGE_SIZE) {
+		note_dirty_page((pa + len - 1) / PAGE_SIZE);
+	}
+}
+
+/******************************************************************************
+ * snapshots
+ ******************************************************************************/
+
+static Bit8u *page_addr(unsigned int page)
+{
+	return BX_MEM(0)->get_vector((bx_phy_address)page * PAGE_SIZE);
+}
+
+static struct blob *save_blob(bx_shadow_data_c *param, struct blob *older)
+{
+	if (older != NULL && older->size == param->get_size() &&
+	    memcmp(older->data, param->getptr(), older->size) == 0) {
+		older->refcount++;
+		return older;
+	}
+	struct blob *b = MM_XMALLOC(1, struct blob);
+	b->refcount = 1;
+	b->size = param->get_size();
+	b->data = MM_XMALLOC(b->size, Bit8u);
+	memcpy(b->data, param->getptr(), b->size);
+	return b;
+}
+
+static void drop_blob(struct blob *b)
+{
+	assert(b->refcount > 0);
+	if (--b->refcount == 0) {
+		MM_FREE(b->data);
+		MM_FREE(b);
+	}
+}
+
+struct snapshot *snapshot_take(unsigned int depth)
+{
+	if (!snap.inited) {
+		snapshot_init();
+	}
+	assert(snap.newest == NULL || snap.newest->depth < depth);
+
+	struct snapshot *s = MM_XMALLOC(1, struct snapshot);
+	s->depth = depth;
+	s->older = snap.newest;
+
+	unsigned int i;
+	bx_param_num_c **num;
+	s->values = MM_XMALLOC(MAX(ARRAY_LIST_SIZE(&snap.nums), 1U), Bit64s);
+	ARRAY_LIST_FOREACH(&snap.nums, i, num) {
+		s->values[i] = (*num)->get64();
+	}
+	bx_shadow_data_c **data;
+	s->blobs = MM_XMALLOC(MAX(ARRAY_LIST_SIZE(&snap.datas), 1U),
+			      struct blob *);
+	ARRAY_LIST_FOREACH(&snap.datas, i, data) {
+		s->blobs[i] = save_blob(*data, s->older == NULL ? NULL :
+					s->older->blobs[i]);
+	}
+
+	/* the pages written since the last snapshot become this one's */
+	unsigned int *page;
+	ARRAY_LIST_INIT(&s->pages, MAX(ARRAY_LIST_SIZE(&snap.dirty_list), 1U));
+	ARRAY_LIST_FOREACH(&snap.dirty_list, i, page) {
+		struct page_version *v = MM_XMALLOC(1, struct page_version);
+		v->depth = depth;
+		v->older = snap.versions[*page];
+		memcpy(v->data, page_addr(*page), PAGE_SIZE);
+		snap.versions[*page] = v;
+		bitset_set(snap.dirty, *page, false);
+		ARRAY_LIST_APPEND(&s->pages, *page);
+	}
+	snap.dirty_list.size = 0;
+
+	lsprintf(INFO, "#%d: snapshot saved %u pages\n", depth,
+		 ARRAY_LIST_SIZE(&s->pages));
+	snap.newest = s;
+	return s;
+}
+
+/* Rewinds the machine to the newest snapshot, from wherever it's got to. */
+void snapshot_restore(const struct snapshot *s)
+{
+	assert(snap.inited);
+	assert(s == snap.newest && "may only restore to the newest snapshot");
+
+	/* RAM first, so devices' after-restore hooks see it as it was */
+	unsigned int i;
+	unsigned int *page;
+	ARRAY_LIST_FOREACH(&snap.dirty_list, i, page) {
+		struct page_version *v = snap.versions[*page];
+		assert(v != NULL && v->depth <= s->depth);
+		memcpy(page_addr(*page), v->data, PAGE_SIZE);
+		bitset_set(snap.dirty, *page, false);
+		/* its hash, if any, is now of some other version */
+		fingerprint_note_write((uint64_t)*page * PAGE_SIZE, PAGE_SIZE);
+	}
+	lsprintf(DEV, "#%d: rewound %u pages\n", s->depth,
+		 ARRAY_LIST_SIZE(&snap.dirty_list));
+	snap.dirty_list.size = 0;
+
+	bx_param_num_c **num;
+	ARRAY_LIST_FOREACH(&snap.nums, i, num) {
+		(*num)->set(s->values[i]);
+	}
+	bx_shadow_data_c **data;
+	ARRAY_LIST_FOREACH(&snap.datas, i, data) {
+		assert(s->blobs[i]->size == (*data)->get_size());
+		memcpy((*data)->getptr(), s->blobs[i]->data, s->blobs[i]->size);
+	}
+
+	/* recompute whatever bochs derives from its registered state (TLBs,
+	 * timers, etc.); and code may have changed under the icache */
+	bx_sr_after_restore_state();
+	flushICaches();
+}
+
+void snapshot_discard(struct snapshot *s)
+{
+	assert(snap.inited);
+	assert(s == snap.newest && "snapshots must be discarded newest first");
+
+	/* RAM now differs from the next older snapshot in these pages, as far
+	 * as anyone knows, so they're dirty again */
+	unsigned int i;
+	unsigned int *page;
+	ARRAY_LIST_FOREACH(&s->pages, i, page) {
+		struct page_version *v = snap.versions[*page];
+		assert(v != NULL && v->depth == s->depth);
+		snap.versions[*page] = v->older;
+		MM_FREE(v);
+		note_dirty_page(*page);
+	}
+	ARRAY_LIST_FREE(&s->pages);
+
+	for (i = 0; i < ARRAY_LIST_SIZE(&snap.datas); i++) {
+		drop_blob(s->blobs[i]);
+	}
+	MM_FREE(s->blobs);
+	MM_FREE(s->values);
+
+	snap.newest = s->older;
+	MM_FREE(s);
+}
+
+#endif
@@ -0,0 +1,67 @@
+/**
+ * @file snapshot.h
+ * @brief in-place incremental snapshots of the simulated machine
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LS_SNAPSHOT_H
+#define __LS_SNAPSHOT_H
+
+#include <stdint.h>
+
+#include "student_specifics.h" /* for TIMETRAVEL_SNAPSHOTS */
+
+/* An alternative to forking a process per PP (see timetravel.h). A snapshot
+ * holds the CPU and device state -- everything bochs registers for its own
+ * save/restore, but RAM -- and only those pages of guest RAM written since the
+ * previous snapshot. Restoring one rewinds the machine in place, copying back
+ * only the pages written since then, so that both taking and restoring cost
+ * about as much as the transition's write set (plus the fixed-size device
+ * state). The very first snapshot copies all of RAM, once.
+ *
+ * Snapshots form a stack, like the PPs on a branch: each new one is taken
+ * after the last, only the newest may be restored to, and they're discarded
+ * newest first. Writes to RAM get noted through snapshot_note_write(), called
+ * by the instrumentation hooks for CPU memory accesses and by landslide's own
+ * guest memory writes; DMA by devices isn't noticed, so the guest had better
+ * be done with the disk by the time the first PP comes around. */
+
+struct snapshot;
+
+#ifdef TIMETRAVEL_SNAPSHOTS
+void snapshot_note_write(uint64_t pa, unsigned int len);
+#else
+#define snapshot_note_write(pa, len) do { } while (0)
+#endif
+
+struct snapshot *snapshot_take(unsigned int depth);
+void snapshot_restore(const struct snapshot *s);
+void snapshot_discard(struct snapshot *s);
+
+#endif
@@ -29,6 +29,8 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <string.h>
+
 #define MODULE_NAME "STACK"
 #define MODULE_COLOUR COLOUR_DARK COLOUR_BLUE
 
@@ -44,6 +46,80 @@
 
 #define FRAME_LIST_INITIAL_SIZE 16
 
+/******************************************************************************
+ * string pool
+ ******************************************************************************/
+
+#define STRING_POOL_INITIAL_CAPACITY 256
+
+/* Open-addressing set of every function and file name any frame has named.
+ * Strings in it are never freed, so frames can share them freely. */
+static struct {
+	const char **table;
+	unsigned int size;
+	unsigned int capacity; /* power of 2 */
+} string_pool = { NULL, 0, 0 };
+
+static unsigned int string_hash(const char *s)
+{
+	unsigned int hash = 2166136261U; /* FNV-1a */
+	for (; *s != '\0'; s++) {
+		hash = (hash ^ (unsigned char)*s) * 16777619U;
+	}
+	return hash;
+}
+
+/* Returns the slot holding a string equal to s, or the empty slot for it. */
+static const char **string_pool_probe(const char *s)
+{
+	for (unsigned int i = string_hash(s) & (string_pool.capacity - 1); true;
+	     i = (i + 1) & (string_pool.capacity - 1)) {
+		if (string_pool.table[i] == NULL ||
+		    strcmp(string_pool.table[i], s) == 0) {
+			return &string_pool.table[i];
+		}
+	}
+}
+
+static void string_pool_grow()
+{
+	const char **old_table = string_pool.table;
+	unsigned int old_capacity = string_pool.capacity;
+
+	string_pool.capacity = old_capacity == 0 ?
+		STRING_POOL_INITIAL_CAPACITY : old_capacity * 2;
+	string_pool.table = MM_XMALLOC(string_pool.capacity, const char *);
+	memset(string_pool.table, 0,
+	       string_pool.capacity * sizeof(const char *));
+
+	for (unsigned int i = 0; i < old_capacity; i++) {
+		if (old_table[i] != NULL) {
+			*string_pool_probe(old_table[i]) = old_table[i];
+		}
+	}
+	if (old_table != NULL) {
+		MM_FREE(old_table);
+	}
+}
+
+/* Takes ownership of the malloced string s; returns the pooled copy. */
+static const char *string_pool_intern(char *s)
+{
+	/* keep the load factor under 1/2 */
+	if (2 * (string_pool.size + 1) > string_pool.capacity) {
+		string_pool_grow();
+	}
+
+	const char **slot = string_pool_probe(s);
+	if (*slot == NULL) {
+		*slot = s;
+		string_pool.size++;
+	} else {
+		MM_FREE(s);
+	}
+	return *slot;
+}
+
 /******************************************************************************
  * printing utilities / glue
  ******************************************************************************/
@@ -53,17 +129,18 @@
 /* guaranteed not to clobber nobe. */
 bool eip_to_frame(unsigned int eip, struct stack_frame *f)
 {
+	char *name;
+	char *file;
 	f->eip = eip;
 	f->actual_eip = eip;
 	f->name = NULL;
 	f->file = NULL;
-	return symtable_lookup(eip, &f->name, &f->file, &f->line);
-}
-
-void destroy_frame(struct stack_frame *f)
-{
-	if (f->name != NULL) MM_FREE(f->name);
-	if (f->file != NULL) MM_FREE(f->file);
+	if (!symtable_lookup(eip, &name, &file, &f->line)) {
+		return false;
+	}
+	f->name = string_pool_intern(name);
+	f->file = string_pool_intern(file);
+	return true;
 }
 
 /* Emits a "0xADDR in NAME (FILE:LINE)" line with optional pretty colours. */
@@ -125,7 +202,6 @@ void print_eip(verbosity v, unsigned int eip)
 	struct stack_frame f;
 	eip_to_frame(eip, &f);
 	print_stack_frame(v, &f);
-	destroy_frame(&f);
 }
 
 /* Prints a stack trace to the console. Uses printf, not lsprintf, separates
@@ -190,60 +266,186 @@ unsigned int html_stack_trace(char *buf, unsigned int maxlen, const struct stack
 #undef PRINT
 }
 
-struct stack_trace *copy_stack_trace(const struct stack_trace *src)
+/******************************************************************************
+ * interning
+ ******************************************************************************/
+
+#define INTERN_INITIAL_CAPACITY 256
+
+/* Chained hash table of every live stack trace, keyed on tid and frame eips.
+ * Names needn't be compared, being a function of the eips. Traces unlink
+ * themselves when their last reference is freed. */
+static struct {
+	struct stack_trace **buckets;
+	unsigned int size;
+	unsigned int capacity; /* power of 2 */
+} interned = { NULL, 0, 0 };
+
+static struct stack_trace *new_stack_trace(unsigned int tid)
+{
+	struct stack_trace *st = MM_XMALLOC(1, struct stack_trace);
+	st->tid = tid;
+	ARRAY_LIST_INIT(&st->frames, FRAME_LIST_INITIAL_SIZE);
+	st->refcount = 0;
+	st->hash = 0;
+	st->hash_next = NULL;
+	return st;
+}
+
+static void destroy_stack_trace(struct stack_trace *st)
 {
-	struct stack_trace *dest = MM_XMALLOC(1, struct stack_trace);
-	const struct stack_frame *f_src;
+	ARRAY_LIST_FREE(mutable_stack_frames(st));
+	MM_FREE(st);
+}
+
+static unsigned int stack_trace_hash(const struct stack_trace *st)
+{
+	unsigned int hash = 2166136261U; /* FNV-1a */
+	const struct stack_frame *f;
 	unsigned int i;
-	dest->tid = src->tid;
-	ARRAY_LIST_INIT(&dest->frames, FRAME_LIST_INITIAL_SIZE);
-
-	ARRAY_LIST_FOREACH(&src->frames, i, f_src) {
-		struct stack_frame f_dest;
-		f_dest.eip  = f_src->eip;
-		f_dest.actual_eip  = f_src->actual_eip;
-		f_dest.name = f_src->name == NULL ? NULL : MM_XSTRDUP(f_src->name);
-		f_dest.file = f_src->file == NULL ? NULL : MM_XSTRDUP(f_src->file);
-		f_dest.line = f_src->line;
-		ARRAY_LIST_APPEND(mutable_stack_frames(dest), f_dest);
+	hash = (hash ^ st->tid) * 16777619U;
+	ARRAY_LIST_FOREACH(&st->frames, i, f) {
+		hash = (hash ^ f->eip) * 16777619U;
+		hash = (hash ^ f->actual_eip) * 16777619U;
+	}
+	return hash;
+}
+
+static bool stack_trace_equals(const struct stack_trace *st0,
+			       const struct stack_trace *st1)
+{
+	if (st0->hash != st1->hash || st0->tid != st1->tid ||
+	    ARRAY_LIST_SIZE(&st0->frames) != ARRAY_LIST_SIZE(&st1->frames)) {
+		return false;
+	}
+	for (unsigned int i = 0; i < ARRAY_LIST_SIZE(&st0->frames); i++) {
+		const struct stack_frame *f0 = ARRAY_LIST_GET(&st0->frames, i);
+		const struct stack_frame *f1 = ARRAY_LIST_GET(&st1->frames, i);
+		if (f0->eip != f1->eip || f0->actual_eip != f1->actual_eip) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void intern_grow()
+{
+	struct stack_trace **old_buckets = interned.buckets;
+	unsigned int old_capacity = interned.capacity;
+
+	interned.capacity = old_capacity == 0 ?
+		INTERN_INITIAL_CAPACITY : old_capacity * 2;
+	interned.buckets = MM_XMALLOC(interned.capacity, struct stack_trace *);
+	memset(interned.buckets, 0,
+	       interned.capacity * sizeof(struct stack_trace *));
+
+	for (unsigned int i = 0; i < old_capacity; i++) {
+		struct stack_trace *st = old_buckets[i];
+		while (st != NULL) {
+			struct stack_trace *next = st->hash_next;
+			struct stack_trace **bucket =
+				&interned.buckets[st->hash & (interned.capacity - 1)];
+			st->hash_next = *bucket;
+			*bucket = st;
+			st = next;
+		}
+	}
+	if (old_buckets != NULL) {
+		MM_FREE(old_buckets);
+	}
+}
+
+/* Takes a freshly built trace; returns a reference to the canonical one. */
+static const struct stack_trace *intern_stack_trace(struct stack_trace *st)
+{
+	/* keep the load factor under 1 */
+	if (interned.size + 1 > interned.capacity) {
+		intern_grow();
+	}
+
+	st->hash = stack_trace_hash(st);
+	struct stack_trace **bucket =
+		&interned.buckets[st->hash & (interned.capacity - 1)];
+	for (struct stack_trace *other = *bucket; other != NULL;
+	     other = other->hash_next) {
+		if (stack_trace_equals(st, other)) {
+			destroy_stack_trace(st);
+			other->refcount++;
+			return other;
+		}
+	}
+
+	st->refcount = 1;
+	st->hash_next = *bucket;
+	*bucket = st;
+	interned.size++;
+	return st;
+}
+
+/* O(1): returns another reference to the same trace. */
+const struct stack_trace *copy_stack_trace(const struct stack_trace *src)
+{
+	((struct stack_trace *)src)->refcount++;
+	return src;
+}
+
+void free_stack_trace(const struct stack_trace *st)
+{
+	struct stack_trace *st_mut = (struct stack_trace *)st;
+	assert(st_mut->refcount > 0);
+	if (--st_mut->refcount > 0) {
+		return;
+	}
+
+	struct stack_trace **p =
+		&interned.buckets[st->hash & (interned.capacity - 1)];
+	while (*p != st_mut) {
+		assert(*p != NULL && "freed stack trace wasn't interned");
+		p = &(*p)->hash_next;
 	}
-	return dest;
+	*p = st_mut->hash_next;
+	interned.size--;
+	destroy_stack_trace(st_mut);
 }
 
-void free_stack_trace(struct stack_trace *st)
+/* Returns a trace like st but whose first frame is at eip instead. Consumes
+ * the caller's reference to st. */
+const struct stack_trace *stack_trace_with_top(const struct stack_trace *st,
+					       unsigned int eip)
 {
-	struct stack_frame *f;
+	struct stack_trace *result = new_stack_trace(st->tid);
+	const struct stack_frame *f;
 	unsigned int i;
-	ARRAY_LIST_FOREACH(mutable_stack_frames(st), i, f) {
-		destroy_frame(f);
+
+	ARRAY_LIST_FOREACH(&st->frames, i, f) {
+		struct stack_frame newf = *f;
+		if (i == 0) {
+			eip_to_frame(eip, &newf);
+		}
+		ARRAY_LIST_APPEND(mutable_stack_frames(result), newf);
 	}
-	ARRAY_LIST_FREE(mutable_stack_frames(st));
-	MM_FREE(st);
+	free_stack_trace(st);
+	return intern_stack_trace(result);
 }
 
 static bool splice_pre_vanish_trace(struct ls_state *ls, struct stack_trace *st,
 				    unsigned int eip)
 {
-	struct stack_trace *pvt = mutable_pre_vanish_trace(ls->sched.cur_agent);
+	const struct stack_trace *pvt = ls->sched.cur_agent->pre_vanish_trace;
 	bool found_eip = false;
 
 	if (pvt == NULL || KERNEL_MEMORY(eip)) {
 		return false;
 	}
 
-	struct stack_frame *f;
+	const struct stack_frame *f;
 	unsigned int i;
-	ARRAY_LIST_FOREACH(mutable_stack_frames(pvt), i, f) {
+	ARRAY_LIST_FOREACH(&pvt->frames, i, f) {
 		if (f->eip == eip || f->actual_eip == eip) {
 			found_eip = true;
 		}
 		if (found_eip) {
-			struct stack_frame newf;
-			newf.eip  = f->eip;
-			newf.name = f->name == NULL ? NULL : MM_XSTRDUP(f->name);
-			newf.file = f->file == NULL ? NULL : MM_XSTRDUP(f->file);
-			newf.line = f->line;
-			ARRAY_LIST_APPEND(mutable_stack_frames(st), newf);
+			ARRAY_LIST_APPEND(mutable_stack_frames(st), *f);
 		}
 	}
 	return found_eip;
@@ -300,7 +502,7 @@ static bool add_frame(struct stack_trace *st, unsigned int eip,
 #define CHECK_JUNK_EBP_BELOW_TEXT(ebp) ((unsigned)(ebp) < GUEST_DATA_START)
 #endif
 
-struct stack_trace *stack_trace(struct ls_state *ls)
+static struct stack_trace *build_stack_trace(struct ls_state *ls)
 {
 	cpu_t *cpu = ls->cpu0;
 	unsigned int eip = ls->eip;
@@ -308,9 +510,7 @@ struct stack_trace *stack_trace(struct ls_state *ls)
 
 	unsigned int stack_ptr = GET_CPU_ATTR(cpu, esp);
 
-	struct stack_trace *st = MM_XMALLOC(1, struct stack_trace);
-	st->tid = tid;
-	ARRAY_LIST_INIT(&st->frames, FRAME_LIST_INITIAL_SIZE);
+	struct stack_trace *st = new_stack_trace(tid);
 
 	/* Add current frame, even if it's in kernel and we're in user. */
 	add_frame(st, eip, eip);
@@ -508,6 +708,11 @@ struct stack_trace *stack_trace(struct ls_state *ls)
 	return st;
 }
 
+const struct stack_trace *stack_trace(struct ls_state *ls)
+{
+	return intern_stack_trace(build_stack_trace(ls));
+}
+
 /* As below but doesn't require duplicating the work of making a fresh stack
  * trace if you already have one. .*/
 bool within_function_st(const struct stack_trace *st, unsigned int func,
@@ -532,14 +737,14 @@ bool within_function(struct ls_state *ls, unsigned int func, unsigned int func_e
 	/* Note while it may seem wasteful to malloc a bunch of times to make
 	 * the stack trace, many (not all) of the mallocs are actually needed
 	 * because the 'wrong cr3' end condition requires a symtable lookup. */
-	struct stack_trace *st = stack_trace(ls);
+	const struct stack_trace *st = stack_trace(ls);
 	bool result = within_function_st(st, func, func_end);
 	free_stack_trace(st);
 	return result;
 }
 
 void dump_stack() {
-	struct stack_trace *st = stack_trace(GET_LANDSLIDE());
+	const struct stack_trace *st = stack_trace(GET_LANDSLIDE());
 	lsprintf(ALWAYS, "Stack trace: ");
 	print_stack_trace(ALWAYS, st);
 	printf(ALWAYS, "\n");
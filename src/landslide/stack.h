@@ -42,14 +42,19 @@ struct ls_state;
 struct stack_frame {
 	unsigned int eip;
 	unsigned int actual_eip; /* not corrected for noreturn funcs */
-	char *name; /* may be null if symtable lookup failed */
-	char *file; /* may be null, as above */
+	const char *name; /* may be null if symtable lookup failed */
+	const char *file; /* may be null, as above; both in the string pool */
 	int line;   /* valid iff above fields are not null */
 };
 
+/* Stack traces are immutable once made, and interned by their tid and frame
+ * eips, so that keeping another copy of one only bumps its refcount. */
 struct stack_trace {
 	unsigned int tid;
 	ARRAY_LIST(const struct stack_frame) frames;
+	unsigned int refcount;
+	unsigned int hash;
+	struct stack_trace *hash_next;
 };
 
 typedef ARRAY_LIST(struct stack_frame) mutable_stack_frames_t;
@@ -61,16 +66,17 @@ static inline mutable_stack_frames_t *mutable_stack_frames(struct stack_trace *s
 /* utilities / glue */
 unsigned int sprint_frame(char *buf, unsigned int maxlen, const struct stack_frame *f, bool colours);
 bool eip_to_frame(unsigned int eip, struct stack_frame *f);
-void destroy_frame(struct stack_frame *f);
 void print_stack_frame(verbosity v, const struct stack_frame *f);
 void print_eip(verbosity v, unsigned int eip);
 void print_stack_trace(verbosity v, const struct stack_trace *st);
 unsigned int html_stack_trace(char *buf, unsigned int maxlen, const struct stack_trace *st);
-struct stack_trace *copy_stack_trace(const struct stack_trace *src);
-void free_stack_trace(struct stack_trace *st);
+const struct stack_trace *copy_stack_trace(const struct stack_trace *src);
+void free_stack_trace(const struct stack_trace *st);
 
 /* actual logic */
-struct stack_trace *stack_trace(struct ls_state *ls);
+const struct stack_trace *stack_trace(struct ls_state *ls);
+const struct stack_trace *stack_trace_with_top(const struct stack_trace *st,
+					       unsigned int eip);
 bool within_function_st(const struct stack_trace *st, unsigned int func, unsigned int func_end);
 bool within_function(struct ls_state *ls, unsigned int func, unsigned int func_end);
 
@@ -0,0 +1,607 @@
+/**
+ * @file suspend.c
+ * @brief saving an exploration to disk to be resumed in a later run
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MODULE_NAME "SUSPEND"
+#define MODULE_COLOUR COLOUR_DARK COLOUR_GREEN
+
+#include "common.h"
+#include "landslide.h"
+#include "mem.h"
+#include "save.h"
+#include "schedule.h"
+#include "schedule_trace.h"
+#include "shared_arena.h"
+#include "simulator.h"
+#include "suspend.h"
+#include "timetravel.h"
+#include "tree.h"
+#include "tsx.h"
+#include "wakeup_tree.h"
+
+/* File layout, in the same words as schedule traces (and likewise meaningful
+ * only to the same build): magic, version, the save statistics (as raw bytes,
+ * prefixed with their size), whether ICB needs to increment the bound, and the
+ * schedule trace to the PP to resume from. Then the number of PPs on the way
+ * there, each of which has its eip and chosen thread (to check the resumed run
+ * doesn't diverge), flags, estimation state, children (but the one the branch
+ * continues to), the tids DPOR tagged, xabort codes and abort sets, and wakeup
+ * sequences (each as a list of tids, after the number of them). Last,
+ * the kernel and user data race tables, each as a count and then the pairs. */
+#define SUSPEND_MAGIC   0x4c535355 /* "LSSU" */
+#define SUSPEND_VERSION 2
+
+#define PP_FLAG_ALL_EXPLORED      0x1
+#define PP_FLAG_PREEMPTION_POINT  0x2
+#define PP_FLAG_ESTIMATE_COMPUTED 0x4
+#define PP_FLAG_XBEGIN            0x8
+#define PP_FLAG_DPOR_ANALYZED     0x10
+
+#define CHILD_FLAG_ALL_EXPLORED 0x1
+#define CHILD_FLAG_XABORT       0x2
+
+#define RACE_FLAG_FIRST_BEFORE_OTHER 0x1
+#define RACE_FLAG_OTHER_BEFORE_FIRST 0x2
+
+/* simics doesn't keep the branch's choices to make a schedule out of (see
+ * timetravel.c); and with parallel world lines, one line's branch is not the
+ * whole frontier. */
+#ifdef BOCHS
+#define SUSPEND_SUPPORTED (TIMETRAVEL_PARALLEL_LINES == 1)
+#else
+#define SUSPEND_SUPPORTED false
+#endif
+
+typedef mutable_xabort_codes_t word_list_t;
+
+/* what a PP on the suspended branch had, for its resumed incarnation */
+struct suspended_pp {
+	unsigned int eip;
+	unsigned int chosen_thread;
+	unsigned int flags;
+	unsigned long marked_children;
+	long double proportion;
+	uint64_t usecs;
+	long double subtree_usecs;
+	mutable_children_t children;
+	word_list_t tagged_tids;
+	word_list_t xabort_codes_ever;
+	word_list_t xabort_codes_todo;
+	mutable_abort_sets_t abort_sets_ever;
+	mutable_abort_sets_t abort_sets_todo;
+	ARRAY_LIST(word_list_t) wakeup_tree;
+};
+
+static bool resuming = false;
+static struct {
+	ARRAY_LIST(struct suspended_pp) pps; /* indexed by depth */
+	struct save_statistics stats;
+	bool icb_need_increment_bound;
+} resume;
+
+/******************************************************************************
+ * file i/o
+ ******************************************************************************/
+
+static bool put_raw(FILE *f, const void *p, size_t size)
+{
+	return fwrite(p, size, 1, f) == 1;
+}
+
+static bool get_raw(FILE *f, void *p, size_t size)
+{
+	return fread(p, size, 1, f) == 1;
+}
+
+static bool put_words(FILE *f, const unsigned int *words, unsigned int n)
+{
+	bool ok = put_word(f, n);
+	for (unsigned int i = 0; ok && i < n; i++) {
+		ok = put_word(f, words[i]);
+	}
+	return ok;
+}
+
+static bool get_words(FILE *f, word_list_t *words)
+{
+	unsigned int n, word;
+	if (!get_word(f, &n)) {
+		return false;
+	}
+	ARRAY_LIST_INIT(words, MAX(n, 1U));
+	for (unsigned int i = 0; i < n; i++) {
+		if (!get_word(f, &word)) {
+			return false;
+		}
+		ARRAY_LIST_APPEND(words, word);
+	}
+	return true;
+}
+
+static bool put_abort_sets(FILE *f, const struct abort_set *sets, unsigned int n)
+{
+	bool ok = put_word(f, n);
+	for (unsigned int i = 0; ok && i < n; i++) {
+		ok = trace_put_aborts(f, &sets[i]);
+	}
+	return ok;
+}
+
+static bool get_abort_sets(FILE *f, mutable_abort_sets_t *sets)
+{
+	unsigned int n;
+	struct abort_set aborts;
+	if (!get_word(f, &n)) {
+		return false;
+	}
+	ARRAY_LIST_INIT(sets, MAX(n, 1U));
+	for (unsigned int i = 0; i < n; i++) {
+		if (!trace_get_aborts(f, &aborts)) {
+			return false;
+		}
+		ARRAY_LIST_APPEND(sets, aborts);
+	}
+	return true;
+}
+
+/* The branch's next PP is left out of the children, as the resumed run will add
+ * it back upon getting there, same as for any new child. */
+static bool write_pp(FILE *f, const struct nobe *h, const struct nobe *next)
+{
+	const struct nobe_child *c;
+	const struct agent *a;
+	unsigned int i;
+
+	unsigned int flags = (h->all_explored ? PP_FLAG_ALL_EXPLORED : 0) |
+		(h->is_preemption_point ? PP_FLAG_PREEMPTION_POINT : 0) |
+		(h->estimate_computed ? PP_FLAG_ESTIMATE_COMPUTED : 0) |
+		(h->xbegin ? PP_FLAG_XBEGIN : 0) |
+		(h->dpor_analyzed ? PP_FLAG_DPOR_ANALYZED : 0);
+	bool ok = put_word(f, h->eip) &&
+		put_word(f, h->chosen_thread) && put_word(f, flags) &&
+		put_raw(f, &h->marked_children, sizeof(h->marked_children)) &&
+		put_raw(f, &h->proportion, sizeof(h->proportion)) &&
+		put_raw(f, &h->usecs, sizeof(h->usecs)) &&
+		put_raw(f, &h->subtree_usecs, sizeof(h->subtree_usecs));
+
+	bool skipped = next == NULL;
+	ok = ok && put_word(f, ARRAY_LIST_SIZE(&h->children) -
+			    (skipped ? 0 : 1));
+	ARRAY_LIST_FOREACH(&h->children, i, c) {
+		if (!skipped && c->chosen_thread == next->chosen_thread &&
+		    c->xabort == next->xaborted &&
+		    (!c->xabort || c->xabort_code == next->xabort_code)) {
+			skipped = true;
+		} else {
+			flags = (c->all_explored ? CHILD_FLAG_ALL_EXPLORED : 0) |
+				(c->xabort ? CHILD_FLAG_XABORT : 0);
+			ok = ok && put_word(f, c->chosen_thread) &&
+				put_word(f, flags) &&
+				put_word(f, c->xabort_code);
+		}
+	}
+	assert(skipped && "branch's next PP missing from its parent's children");
+
+	unsigned int num_tagged = 0;
+	CONST_FOR_EACH_RUNNABLE_AGENT(a, h->oldsched,
+		if (a->do_explore) {
+			num_tagged++;
+		}
+	);
+	ok = ok && put_word(f, num_tagged);
+	CONST_FOR_EACH_RUNNABLE_AGENT(a, h->oldsched,
+		if (a->do_explore) {
+			ok = ok && put_word(f, a->tid);
+		}
+	);
+
+	if (h->xbegin) {
+		ok = ok && put_words(f, h->xabort_codes_ever.array,
+				     ARRAY_LIST_SIZE(&h->xabort_codes_ever)) &&
+			put_words(f, h->xabort_codes_todo.array,
+				  ARRAY_LIST_SIZE(&h->xabort_codes_todo));
+	}
+	ok = ok && put_abort_sets(f, h->abort_sets_ever.array,
+				  ARRAY_LIST_SIZE(&h->abort_sets_ever)) &&
+		put_abort_sets(f, h->abort_sets_todo.array,
+			       ARRAY_LIST_SIZE(&h->abort_sets_todo));
+
+	const struct wakeup_sequence *w;
+	ok = ok && put_word(f, ARRAY_LIST_SIZE(&h->wakeup_tree));
+	ARRAY_LIST_FOREACH(&h->wakeup_tree, i, w) {
+		ok = ok && put_words(f, w->tids, w->len);
+	}
+	return ok;
+}
+
+static bool read_pp(FILE *f, struct suspended_pp *p)
+{
+	unsigned int num_children, num_sequences;
+
+	bool ok = get_word(f, &p->eip) &&
+		get_word(f, &p->chosen_thread) &&
+		get_word(f, &p->flags) &&
+		get_raw(f, &p->marked_children, sizeof(p->marked_children)) &&
+		get_raw(f, &p->proportion, sizeof(p->proportion)) &&
+		get_raw(f, &p->usecs, sizeof(p->usecs)) &&
+		get_raw(f, &p->subtree_usecs, sizeof(p->subtree_usecs)) &&
+		get_word(f, &num_children);
+	if (!ok) {
+		return false;
+	}
+
+	ARRAY_LIST_INIT(&p->children, MAX(num_children, 1U));
+	for (unsigned int i = 0; i < num_children; i++) {
+		struct nobe_child c;
+		unsigned int tid, flags;
+		if (!get_word(f, &tid) || !get_word(f, &flags) ||
+		    !get_word(f, &c.xabort_code)) {
+			return false;
+		}
+		c.chosen_thread = tid;
+		c.all_explored  = (flags & CHILD_FLAG_ALL_EXPLORED) != 0;
+		c.xabort        = (flags & CHILD_FLAG_XABORT) != 0;
+		/* not saved; can't put anybody to sleep after resuming */
+		footprint_init(&c.footprint);
+		ARRAY_LIST_APPEND(&p->children, c);
+	}
+
+	if (!get_words(f, &p->tagged_tids)) {
+		return false;
+	}
+	if (p->flags & PP_FLAG_XBEGIN) {
+		ok = get_words(f, &p->xabort_codes_ever) &&
+			get_words(f, &p->xabort_codes_todo);
+	} else {
+		ARRAY_LIST_INIT(&p->xabort_codes_ever, 1);
+		ARRAY_LIST_INIT(&p->xabort_codes_todo, 1);
+	}
+	ok = ok && get_abort_sets(f, &p->abort_sets_ever) &&
+		get_abort_sets(f, &p->abort_sets_todo) &&
+		get_word(f, &num_sequences);
+	if (!ok) {
+		return false;
+	}
+
+	ARRAY_LIST_INIT(&p->wakeup_tree, MAX(num_sequences, 1U));
+	for (unsigned int i = 0; i < num_sequences; i++) {
+		word_list_t tids;
+		if (!get_words(f, &tids)) {
+			return false;
+		}
+		ARRAY_LIST_APPEND(&p->wakeup_tree, tids);
+	}
+	return true;
+}
+
+static bool write_data_races(FILE *f, const struct mem_state *m)
+{
+	const struct rb_node *nobe;
+	unsigned int n = 0;
+
+	for (nobe = rb_first(&m->data_races); nobe != NULL; nobe = rb_next(nobe)) {
+		n++;
+	}
+	bool ok = put_word(f, n);
+	for (nobe = rb_first(&m->data_races); nobe != NULL; nobe = rb_next(nobe)) {
+		const struct data_race *dr =
+			rb_entry(nobe, const struct data_race, nobe);
+		unsigned int flags =
+			(dr->first_before_other ? RACE_FLAG_FIRST_BEFORE_OTHER : 0) |
+			(dr->other_before_first ? RACE_FLAG_OTHER_BEFORE_FIRST : 0);
+		ok = ok && put_word(f, dr->first_eip) &&
+			put_word(f, dr->other_eip) && put_word(f, flags);
+	}
+	return ok;
+}
+
+static bool read_data_races(FILE *f, struct mem_state *m)
+{
+	unsigned int n, first_eip, other_eip, flags;
+
+	if (!get_word(f, &n)) {
+		return false;
+	}
+	for (unsigned int i = 0; i < n; i++) {
+		if (!get_word(f, &first_eip) ||
+		    !get_word(f, &other_eip) || !get_word(f, &flags)) {
+			return false;
+		}
+		struct data_race dr;
+		dr.first_eip = first_eip;
+		dr.other_eip = other_eip;
+		dr.first_before_other = (flags & RACE_FLAG_FIRST_BEFORE_OTHER) != 0;
+		dr.other_before_first = (flags & RACE_FLAG_OTHER_BEFORE_FIRST) != 0;
+		mem_restore_data_race(m, &dr);
+	}
+	return true;
+}
+
+/******************************************************************************
+ * suspending
+ ******************************************************************************/
+
+/* To be called at the end of a branch, in place of jumping to the given PP to
+ * run the given choice there. The caller should quit landslide if it works. */
+bool suspend_exploration(struct ls_state *ls, const char *filename,
+			 const struct nobe *h, unsigned int tid, bool txn,
+			 unsigned int xabort_code, const struct abort_set *aborts)
+{
+	struct save_state *ss = &ls->save;
+	struct save_statistics stats;
+	struct schedule_trace st;
+
+	if (!SUSPEND_SUPPORTED) {
+		lsprintf(DEV, "can't suspend in this configuration\n");
+		return false;
+	}
+
+	FILE *f = fopen(filename, "w");
+	if (f == NULL) {
+		lsprintf(DEV, "couldn't open %s to suspend to\n", filename);
+		return false;
+	}
+
+	/* the statistics as they'd be right after the jump (cf. save_longjmp) */
+	memcpy(&stats, &ss->stats, sizeof(struct save_statistics));
+	stats.depth_total += ss->current->depth;
+	stats.total_jumps++;
+
+	schedule_trace_init(&st, ls->icb_bound);
+	timetravel_branch_schedule(&st, h->depth);
+	schedule_trace_append(&st, h->depth, tid, txn, xabort_code, aborts);
+
+	bool ok = put_word(f, SUSPEND_MAGIC) &&
+		put_word(f, SUSPEND_VERSION) &&
+		put_word(f, sizeof(stats)) &&
+		put_raw(f, &stats, sizeof(stats)) &&
+		put_word(f, ls->icb_need_increment_bound ? 1 : 0) &&
+		schedule_trace_fwrite(&st, f) &&
+		put_word(f, h->depth + 1);
+	schedule_trace_free(&st);
+
+	/* the PPs on the way there, from the root down */
+	const struct nobe **path = MM_XMALLOC(h->depth + 1, const struct nobe *);
+	for (const struct nobe *h2 = h; h2 != NULL; h2 = h2->parent) {
+		path[h2->depth] = h2;
+	}
+	for (unsigned int i = 0; ok && i <= h->depth; i++) {
+		ok = write_pp(f, path[i], i < h->depth ? path[i + 1] : NULL);
+	}
+	MM_FREE(path);
+
+	ok = ok && write_data_races(f, &ls->kern_mem) &&
+		write_data_races(f, &ls->user_mem);
+	if (fclose(f) != 0) {
+		ok = false;
+	}
+	if (!ok) {
+		lsprintf(DEV, "failed to write %s\n", filename);
+		unlink(filename);
+		return false;
+	}
+
+	lsprintf(ALWAYS, "suspended exploration to %s; it'll resume with tid %d "
+		 "at #%d/tid%d\n", filename, tid, h->depth, h->chosen_thread);
+	return true;
+}
+
+/******************************************************************************
+ * resuming
+ ******************************************************************************/
+
+/* To be called at boot, before the first PP. */
+bool resume_exploration(struct ls_state *ls, const char *filename)
+{
+	unsigned int magic, version, stats_size, need_increment, num_pps;
+	struct schedule_trace st;
+
+	assert(!resuming && "resuming twice?");
+	if (!SUSPEND_SUPPORTED) {
+		lsprintf(DEV, "can't resume in this configuration\n");
+		return false;
+	}
+
+	FILE *f = fopen(filename, "r");
+	if (f == NULL) {
+		lsprintf(DEV, "couldn't open suspended exploration %s\n", filename);
+		return false;
+	}
+
+	bool ok = get_word(f, &magic) && magic == SUSPEND_MAGIC &&
+		get_word(f, &version) && version == SUSPEND_VERSION &&
+		get_word(f, &stats_size) &&
+		stats_size == sizeof(resume.stats) &&
+		get_raw(f, &resume.stats, sizeof(resume.stats)) &&
+		get_word(f, &need_increment);
+	/* the trace's last choice is the one at the last PP */
+	ok = ok && schedule_trace_fread(&st, f) &&
+		get_word(f, &num_pps) && num_pps > 0 &&
+		ARRAY_LIST_SIZE(&st.choices) > 0 &&
+		ARRAY_LIST_GET(&st.choices, ARRAY_LIST_SIZE(&st.choices) - 1)
+			->depth == num_pps - 1;
+
+	if (ok) {
+		ARRAY_LIST_INIT(&resume.pps, num_pps);
+	}
+	for (unsigned int i = 0; ok && i < num_pps; i++) {
+		struct suspended_pp p;
+		ok = read_pp(f, &p);
+		if (ok) {
+			ARRAY_LIST_APPEND(&resume.pps, p);
+		}
+	}
+
+	ok = ok && read_data_races(f, &ls->kern_mem) &&
+		read_data_races(f, &ls->user_mem);
+	fclose(f);
+	if (!ok) {
+		/* no use cleaning up; the caller can't go on without this */
+		lsprintf(DEV, "%s is not a valid suspended exploration\n", filename);
+		return false;
+	}
+
+	resume.icb_need_increment_bound = need_increment != 0;
+	timetravel_follow_schedule(ls, &st);
+	resuming = true;
+	/* if suspended again, it'll be written anew */
+	if (unlink(filename) < 0) {
+		lsprintf(DEV, "warning: failed rm suspended exploration %s\n",
+			 filename);
+	}
+	lsprintf(ALWAYS, "resuming suspended exploration from %s, %u PPs deep\n",
+		 filename, num_pps);
+	return true;
+}
+
+static bool is_tagged(const struct suspended_pp *p, unsigned int tid)
+{
+	const unsigned int *tagged_tid;
+	unsigned int i;
+	ARRAY_LIST_FOREACH(&p->tagged_tids, i, tagged_tid) {
+		if (*tagged_tid == tid) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void free_suspended_pp(struct suspended_pp *p)
+{
+	ARRAY_LIST_FREE(&p->children);
+	ARRAY_LIST_FREE(&p->tagged_tids);
+	ARRAY_LIST_FREE(&p->xabort_codes_ever);
+	ARRAY_LIST_FREE(&p->xabort_codes_todo);
+	ARRAY_LIST_FREE(&p->abort_sets_ever);
+	ARRAY_LIST_FREE(&p->abort_sets_todo);
+
+	word_list_t *tids;
+	unsigned int i;
+	ARRAY_LIST_FOREACH(&p->wakeup_tree, i, tids) {
+		ARRAY_LIST_FREE(tids);
+	}
+	ARRAY_LIST_FREE(&p->wakeup_tree);
+}
+
+/* Called as each PP on the first branch is created, with the tree lock held,
+ * before a recorded choice may get injected there (see timetravel_set). */
+void resume_pp(struct ls_state *ls, struct nobe *h)
+{
+	const struct nobe_child *c;
+	const unsigned int *code;
+	const struct abort_set *aborts;
+	const word_list_t *tids;
+	struct agent *a;
+	unsigned int i;
+
+	/* a dormant process woken to go elsewhere mustn't resume any further */
+	if (!resuming || !timetravel_first_branch()) {
+		return;
+	}
+	struct suspended_pp *p = ARRAY_LIST_GET(&resume.pps, h->depth);
+
+	/* the run got here the same way, but so did the guest? */
+	unsigned int num_tagged = 0;
+	FOR_EACH_RUNNABLE_AGENT(a, mutable_oldsched(h),
+		if (is_tagged(p, a->tid)) {
+			num_tagged++;
+		}
+	);
+	if (h->eip != p->eip || (unsigned int)h->chosen_thread !=
+	    p->chosen_thread || h->xbegin != ((p->flags & PP_FLAG_XBEGIN) != 0) ||
+	    num_tagged != ARRAY_LIST_SIZE(&p->tagged_tids)) {
+		char msg[BUF_SIZE];
+		scnprintf(msg, BUF_SIZE, "resumed exploration diverged: expected "
+			  "#%d/tid%d at 0x%x, but got tid%d at 0x%x\n", h->depth,
+			  p->chosen_thread, p->eip, h->chosen_thread, h->eip);
+		landslide_assert_fail(msg, __FILE__, __LINE__, __func__);
+	}
+
+	h->all_explored        = (p->flags & PP_FLAG_ALL_EXPLORED) != 0;
+	h->is_preemption_point = (p->flags & PP_FLAG_PREEMPTION_POINT) != 0;
+	h->estimate_computed   = (p->flags & PP_FLAG_ESTIMATE_COMPUTED) != 0;
+	h->dpor_analyzed       = (p->flags & PP_FLAG_DPOR_ANALYZED) != 0;
+	h->marked_children     = p->marked_children;
+	h->proportion          = p->proportion;
+	h->usecs               = p->usecs;
+	h->subtree_usecs       = p->subtree_usecs;
+
+	ARRAY_LIST_FOREACH(&p->children, i, c) {
+		SHARED_ARRAY_LIST_APPEND(mutable_children(h), *c);
+	}
+	FOR_EACH_RUNNABLE_AGENT(a, mutable_oldsched(h),
+		if (is_tagged(p, a->tid)) {
+			mutable_saved_agent(mutable_oldsched(h), a)
+				->do_explore = true;
+		}
+	);
+	if (h->xbegin) {
+		/* replace what setjmp started them out with */
+		mutable_xabort_codes_ever(h)->size = 0;
+		mutable_xabort_codes_todo(h)->size = 0;
+		ARRAY_LIST_FOREACH(&p->xabort_codes_ever, i, code) {
+			SHARED_ARRAY_LIST_APPEND(mutable_xabort_codes_ever(h), *code);
+		}
+		ARRAY_LIST_FOREACH(&p->xabort_codes_todo, i, code) {
+			SHARED_ARRAY_LIST_APPEND(mutable_xabort_codes_todo(h), *code);
+		}
+	}
+	ARRAY_LIST_FOREACH(&p->abort_sets_ever, i, aborts) {
+		SHARED_ARRAY_LIST_APPEND(mutable_abort_sets_ever(h), *aborts);
+	}
+	ARRAY_LIST_FOREACH(&p->abort_sets_todo, i, aborts) {
+		SHARED_ARRAY_LIST_APPEND(mutable_abort_sets_todo(h), *aborts);
+	}
+	/* after wakeup_tree_inherit(), which got whatever else was its due */
+	ARRAY_LIST_FOREACH(&p->wakeup_tree, i, tids) {
+		wakeup_tree_restore(h, tids->array, ARRAY_LIST_SIZE(tids));
+	}
+	free_suspended_pp(p);
+
+	if (h->depth + 1 == ARRAY_LIST_SIZE(&resume.pps)) {
+		/* the rest of the run takes over as if jumped to here; though
+		 * time spent suspended doesn't count towards this transition */
+		struct timeval last_save_time = ls->save.stats.last_save_time;
+		memcpy(&ls->save.stats, &resume.stats,
+		       sizeof(struct save_statistics));
+		ls->save.stats.last_save_time = last_save_time;
+		ls->icb_need_increment_bound = resume.icb_need_increment_bound;
+		ARRAY_LIST_FREE(&resume.pps);
+		resuming = false;
+		lsprintf(ALWAYS, "resumed suspended exploration at #%d/tid%d\n",
+			 h->depth, h->chosen_thread);
+	}
+}
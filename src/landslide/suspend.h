@@ -0,0 +1,56 @@
+/**
+ * @file suspend.h
+ * @brief saving an exploration to disk to be resumed in a later run
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LS_SUSPEND_H
+#define __LS_SUSPEND_H
+
+#include <stdbool.h>
+
+struct abort_set;
+struct ls_state;
+struct nobe;
+
+/* Instead of being killed to free up memory, a deferred job may be suspended:
+ * at the end of a branch, everything needed to carry on exploring goes to a
+ * file, namely how to get to the PP being jumped to (as a schedule trace; see
+ * schedule_trace.h) and what DPOR, estimation, and the data race detector have
+ * learned about each PP on the way there. A later run resumes by replaying the
+ * branch from boot, and reinstating all of that as it recreates each PP. This
+ * only covers one branch's worth of the tree because that's all there is: the
+ * rest of it was either already explored, or is tagged on one of these PPs. */
+bool suspend_exploration(struct ls_state *ls, const char *filename,
+			 const struct nobe *h, unsigned int tid, bool txn,
+			 unsigned int xabort_code, const struct abort_set *aborts);
+bool resume_exploration(struct ls_state *ls, const char *filename);
+void resume_pp(struct ls_state *ls, struct nobe *h); /* for save_setjmp */
+
+#endif
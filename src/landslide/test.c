@@ -157,6 +157,12 @@ bool test_update_state(struct ls_state *ls)
 	}
 }
 
+/* Is test_update_state() sure to return false until some annotated eip? */
+bool test_state_settled(struct ls_state *ls)
+{
+	return ls->test.test_ever_caused && !ls->test.test_ended;
+}
+
 #else
 
 /******************************************************************************
@@ -296,4 +302,14 @@ bool test_update_state(struct ls_state *ls)
 	return false;
 }
 
+/* Is test_update_state() sure to return false until some annotated eip? */
+bool test_state_settled(struct ls_state *ls)
+{
+	/* anybody_alive() answers these cases without polling the guest */
+	struct test_state *t = &ls->test;
+	return t->test_ever_caused && t->test_is_running &&
+		t->start_population != ls->sched.most_agents_ever &&
+		t->start_population != ls->sched.num_agents;
+}
+
 #endif /* ndef PINTOS_KERNEL */
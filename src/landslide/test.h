@@ -49,6 +49,7 @@ struct test_state {
 
 void test_init(struct test_state *);
 bool test_update_state(struct ls_state *ls);
+bool test_state_settled(struct ls_state *ls);
 bool cause_test(keyboard_t *kbd, struct test_state *, struct ls_state *,
 		const char *test_string);
 
@@ -29,25 +29,41 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <inttypes.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #define MODULE_NAME "D-MAIL"
 #define MODULE_COLOUR COLOUR_DARK COLOUR_RED
 
 #include "common.h"
+#include "estimate.h"
 #include "landslide.h"
+#include "pct.h"
 #include "save.h"
+#include "schedule.h"
+#include "schedule_trace.h"
+#include "shared_arena.h"
 #include "simulator.h"
+#include "snapshot.h"
 #include "timetravel.h"
 #include "tree.h"
 #include "tsx.h"
+#include "x86.h"
 
 #ifdef BOCHS
 
 enum timetravel_message_tag {
-	TIMETRAVEL_MODIFY_HAX,
 	TIMETRAVEL_RUN,
+	TIMETRAVEL_SPAWN, /* run too, but in a new process; keep waiting */
 };
 
 #define TIMETRAVEL_MAGIC 0x44664499
@@ -57,45 +73,160 @@ struct timetravel_global_message {
 	unsigned int exit_code;
 };
 
+/* How a PP's transition was chosen: by default (the arbiter just continuing
+ * past its parent PP), or by a time leap back to the parent which injected
+ * the given choice. Checkpoint replay needs to know which, to reproduce it. */
+struct timetravel_choice {
+	bool jumped;
+	unsigned int tid;
+	bool txn;
+	unsigned int xabort_code;
+	struct abort_set aborts;
+};
+
 struct timetravel_message {
 	enum timetravel_message_tag tag;
 	unsigned int magic;
 
-	/* used for tag modify nobe only */
-	void (*cb)(struct nobe *h_rw, void *arg);
-	const struct nobe *h_ro;
-	unsigned int h_depth;
-	unsigned int arg_size; /* arg will be sent in a separate message */
-
 	/* used for tag run only */
+	const struct nobe *target; /* a descendant, if replaying to it */
 	unsigned int tid;
 	bool txn;
 	unsigned int xabort_code;
 	struct abort_set aborts;
 	struct save_statistics save_stats;
+	struct timeval memory_sampled;
+	unsigned long memory_kb;
 	unsigned int icb_bound;
 	bool icb_need_increment_bound;
+	/* how each PP between us and the target was reached, if replaying;
+	 * they follow this in the same write */
+	unsigned int replay_len;
 };
 
 #define QUIT_BOCHS(v) do { ls_safe_exit = true; BX_EXIT(v); assert(0); } while (0)
 
+/* how stale the memory reported with each estimate is allowed to get */
+#define MEMORY_SAMPLE_INTERVAL_USECS 5000000
+
 static bool timetravel_inited = false;
 bool active_world_line = true;
 bool ls_safe_exit = false;
 
+static struct {
+	/* how each PP on the current branch was reached, indexed by depth */
+	ARRAY_LIST(struct timetravel_choice) path;
+	/* how the next PP to be created will have been reached */
+	struct timetravel_choice next_reached_by;
+	/* write ends of the pipes to each dormant ancestor, indexed by depth.
+	 * these can't go in the nobes, which are shared by all world lines. */
+	ARRAY_LIST(int) pipefds;
+	/* checkpoint mode only: state of an ongoing replay */
+	bool replaying;
+	unsigned int replay_base_depth;
+	unsigned int replay_next_depth; /* each step is taken only once */
+	ARRAY_LIST(struct timetravel_choice) replay_steps;
+	struct timetravel_message replay_run;
+	/* parallel mode only: how many times we've taken the lines' lock */
+	unsigned int lock_depth;
+	/* parallel mode only: spawned lines stay below the PP of this depth */
+	int floor_depth;
+	bool just_spawned;
+	/* parallel mode only: the job's save stats as of this line's last
+	 * timetravel_share_stats(); the rest of ls->save.stats is its own */
+	struct save_statistics stats_shared;
+	/* replay mode only: a recorded branch whose choices are yet to be
+	 * injected on the way down from boot (see timetravel_replay_schedule) */
+	struct schedule_trace schedule;
+	/* not yet jumped to (nor spawned); still on the branch from boot */
+	bool first_branch;
+	/* snapshot mode only: each PP's on the current branch, by depth */
+	ARRAY_LIST(struct snapshot *) snapshots;
+	/* fork mode only: see tune_address_space */
+	bool address_space_tuned;
+	/* fork mode only: each dormant ancestor's process (pid -1 if none), in
+	 * parallel to the pipes; see timetravel_memory_kb */
+	ARRAY_LIST(int) dormant;
+	/* when this world line's memory was last sampled, and what it was */
+	struct timeval memory_sampled;
+	unsigned long memory_kb;
+} tt;
+
+/* Shared by all world lines in parallel mode; NULL otherwise. */
+static struct timetravel_lines {
+	volatile int lock;
+	unsigned int running; /* world lines, counting the original one */
+	bool stop; /* somebody quit landslide (found a bug, e.g.); stop too */
+	bool icb_need_increment_bound; /* from a spawned line, for the root */
+	/* all lines' progress so far (see timetravel_share_stats) */
+	struct save_statistics stats;
+	/* all lines' memory as each last sampled it (see timetravel_memory_kb) */
+	unsigned long memory_kb;
+	/* bumped whenever a line retires or stops; waited on as a futex */
+	volatile unsigned int wakeups;
+} *lines = NULL;
+
+/* Lines waiting for others to finish (see timetravel_await_spawns) sleep on
+ * lines->wakeups, which changes whenever one might be done waiting. */
+static void wait_lines(unsigned int wakeups)
+{
+	syscall(SYS_futex, &lines->wakeups, FUTEX_WAIT, wakeups, NULL, NULL, 0);
+}
+
+static void wake_lines()
+{
+	__sync_fetch_and_add(&lines->wakeups, 1);
+	syscall(SYS_futex, &lines->wakeups, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
 /* because setting up timetravel at each PP involves creating a new process,
  * to manage exit code and wait()ing by any parent process (whether shell or
  * quicksand) we first dedicate the original process to collect said code... */
 void timetravel_init(struct timetravel_state *ts)
 {
+	assert(!timetravel_inited && "can't be called twice");
+	timetravel_inited = true;
+
+	/* the decision tree lives here; must precede any fork */
+	shared_arena_init();
+
+	ARRAY_LIST_INIT(&tt.path, 64);
+	tt.next_reached_by.jumped = false;
+	ARRAY_LIST_INIT(&tt.pipefds, 64);
+	tt.replaying = false;
+	ARRAY_LIST_INIT(&tt.replay_steps, TIMETRAVEL_CHECKPOINT_INTERVAL);
+	tt.lock_depth = 0;
+	tt.floor_depth = -1;
+	tt.just_spawned = false;
+	memset(&tt.stats_shared, 0, sizeof(tt.stats_shared));
+	schedule_trace_init(&tt.schedule, 0);
+	tt.first_branch = true;
+	ARRAY_LIST_INIT(&tt.snapshots, 64);
+	tt.address_space_tuned = false;
+	ARRAY_LIST_INIT(&tt.dormant, 64);
+	memset(&tt.memory_sampled, 0, sizeof(tt.memory_sampled));
+	tt.memory_kb = 0;
+
+	if (TIMETRAVEL_PARALLEL_LINES > 1) {
+		lines = SHARED_XMALLOC(1, struct timetravel_lines);
+		lines->lock = 0;
+		lines->running = 1;
+		lines->stop = false;
+		lines->icb_need_increment_bound = false;
+		memset(&lines->stats, 0, sizeof(lines->stats));
+		lines->memory_kb = 0;
+		lines->wakeups = 0;
+	}
+
+#ifdef TIMETRAVEL_SNAPSHOTS
+	/* ...unless there won't be any new processes, that is */
+	ts->pipefd = -1;
+#else
 	int pipefd[2];
 	int ret = pipe(pipefd);
 	assert(ret == 0 && "failed pipe for global exit status retrieval");
 	ts->pipefd = pipefd[1];
 
-	assert(!timetravel_inited && "can't be called twice");
-	timetravel_inited = true;
-
 	int child_tid = fork();
 	if (child_tid != 0) {
 		/* parent process for collecting the exit code */
@@ -107,12 +238,22 @@ void timetravel_init(struct timetravel_state *ts)
 		assert(gm.magic == TIMETRAVEL_MAGIC && "bad magic");
 		QUIT_BOCHS(gm.exit_code);
 	}
+#endif
 }
 
 /* ...accordingly, any process which "exits" landslide must send the code. */
 void quit_landslide(unsigned int code)
 {
-	if (timetravel_inited) {
+	if (lines != NULL) {
+		/* other lines will see this when they next take the lock */
+		lines->stop = true;
+		if (tt.lock_depth > 0) {
+			tt.lock_depth = 0;
+			shared_unlock(&lines->lock);
+		}
+		wake_lines();
+	}
+	if (timetravel_inited && GET_LANDSLIDE()->timetravel.pipefd != -1) {
 		struct timetravel_state *ts = &GET_LANDSLIDE()->timetravel;
 		struct timetravel_global_message gm;
 		gm.magic     = TIMETRAVEL_MAGIC;
@@ -124,49 +265,358 @@ void quit_landslide(unsigned int code)
 	QUIT_BOCHS(code);
 }
 
-/* called by modify_pp to send changes to the forked processes */
-void __modify_pps(void (*cb)(struct nobe *h_rw, void *), const struct nobe *h_ro,
-		    void *arg, unsigned int arg_size)
+/* pipes may split up big messages like replay steps */
+static void read_fully(int fd, void *buf, unsigned int size)
 {
-	/* prevent recursive calls of this nobe-modification procedure by child
-	 * processes. the actively-landsliding process is alone responsible for
-	 * sending update messages to all dormant timetravel nobes. */
-	assert(active_world_line && "recursive nobe tree changes forbidden");
-	struct timetravel_message tm;
-	tm.tag      = TIMETRAVEL_MODIFY_HAX;
-	tm.magic    = TIMETRAVEL_MAGIC;
-	tm.cb       = cb;
-	tm.h_ro     = h_ro;
-	tm.h_depth  = h_ro->depth;
-	tm.arg_size = arg_size;
-	/* send message to all processes in between current and target nobe; they
-	 * all have a target nobe in their local memory that needs modified. */
-	for (const struct nobe *ancestor = GET_LANDSLIDE()->save.current;
-	     ancestor != h_ro->parent; ancestor = ancestor->parent) {
-		assert(ancestor != NULL && "h_ro not an ancestor of current?");
-		assert(ancestor->time_machine.active);
-		assert(ancestor->time_machine.parent);
-		int ret = write(ancestor->time_machine.pipefd, &tm, sizeof(tm));
-		assert(ret == sizeof(tm) && "failed write to modify nobes");
-		ret = write(ancestor->time_machine.pipefd, arg, arg_size);
-		assert(ret == arg_size && "failed write arg to modify nobes");
+	for (unsigned int done = 0; done < size; ) {
+		int ret = read(fd, (char *)buf + done, size - done);
+		assert(ret > 0 && "failed read from timetravel pipe");
+		done += ret;
 	}
 }
 
-/* returns false if the parent process; true if the (just-jumped-to) child, in
- * which case the output pointers will be set to what thread to run instead,
- * whereupon this must be re-called to refresh the save for another jump. */
-bool timetravel_set(struct ls_state *ls, struct nobe *h,
-		    unsigned int *tid, bool *txn, unsigned int *xabort_code,
-		    struct abort_set *aborts)
+static void write_fully(int fd, const void *buf, unsigned int size)
+{
+	for (unsigned int done = 0; done < size; ) {
+		int ret = write(fd, (const char *)buf + done, size - done);
+		assert(ret > 0 && "failed write to timetravel pipe");
+		done += ret;
+	}
+}
+
+/* modify_pp needn't send anything, as the nobes are in shared memory, but
+ * while replaying forward from a checkpoint, all changes already happened the
+ * first time around, and mustn't happen twice (e.g. adding a child nobe). */
+bool timetravel_replaying()
+{
+	return tt.replaying;
+}
+
+/* If replaying, returns the original nobe at the given depth to be reused. */
+const struct nobe *timetravel_replay_pp(unsigned int depth)
+{
+	if (!tt.replaying || depth <= tt.replay_base_depth) {
+		return NULL;
+	}
+	const struct nobe *h = tt.replay_run.target;
+	assert(h != NULL && depth <= h->depth && "replayed past the target");
+	while (h->depth > depth) {
+		h = h->parent;
+	}
+	return h;
+}
+
+static void receive_glowing_green(struct ls_state *ls, const struct nobe *h,
+				  const struct timetravel_message *tm)
+{
+	memcpy(&ls->save.stats, &tm->save_stats, sizeof(struct save_statistics));
+	/* in parallel mode, the sender shared them just before */
+	tt.stats_shared = tm->save_stats;
+	tt.memory_sampled = tm->memory_sampled;
+	tt.memory_kb = tm->memory_kb;
+	if (ls->icb_bound == tm->icb_bound) {
+		/* normal jump within same ICB bound; expect
+		 * "need increment" flag to be monotonic */
+		assert(!ls->icb_need_increment_bound ||
+		       tm->icb_need_increment_bound);
+		ls->icb_need_increment_bound = tm->icb_need_increment_bound;
+	} else {
+		/* special ICB tree-reset jump */
+		assert(h->depth == 0);
+		assert(!tm->icb_need_increment_bound);
+		assert(!ls->icb_need_increment_bound);
+		ls->icb_bound = tm->icb_bound;
+	}
+}
+
+/* Called at each PP on the first branch, if booted in replay mode. Returns
+ * true at those PPs where the recorded schedule injected a choice, setting
+ * it as though from a time leap (so it gets recorded as one again). */
+static bool schedule_step(struct ls_state *ls, const struct nobe *h,
+			  unsigned int *tid, bool *txn, unsigned int *xabort_code,
+			  struct abort_set *aborts)
+{
+	struct schedule_trace *st = &tt.schedule;
+	const struct agent *a;
+
+	/* a dormant process woken up to go elsewhere is done with it, even if
+	 * it was forked before the recorded choices below it came around */
+	if (!tt.first_branch || st->next == ARRAY_LIST_SIZE(&st->choices)) {
+		return false;
+	}
+	const struct schedule_choice *c = ARRAY_LIST_GET(&st->choices, st->next);
+	if (c->depth > h->depth) {
+		return false;
+	}
+
+	/* the choice must make sense here, or the guest went another way */
+	bool runnable = false;
+	if (c->txn) {
+		runnable = c->tid == h->chosen_thread;
+	} else {
+		CONST_FOR_EACH_RUNNABLE_AGENT(a, h->oldsched,
+			if (a->tid == c->tid) {
+				runnable = true;
+			}
+		);
+	}
+	if (c->depth < h->depth || !runnable) {
+		char msg[BUF_SIZE];
+		scnprintf(msg, BUF_SIZE, "schedule diverged from recording: "
+			  "expected to run tid %d at #%d, but at #%d/tid%d\n",
+			  c->tid, c->depth, h->depth, h->chosen_thread);
+		landslide_assert_fail(msg, __FILE__, __LINE__, __func__);
+	}
+
+	st->next++;
+	lsprintf(DEV, "#%d/tid%d: replaying recorded choice of tid %d\n",
+		 h->depth, h->chosen_thread, c->tid);
+	if (st->next == ARRAY_LIST_SIZE(&st->choices)) {
+		lsprintf(ALWAYS, "replayed all %u recorded choices; exploring "
+			 "onwards from here as usual\n", st->next);
+	}
+
+	tt.next_reached_by.jumped      = true;
+	tt.next_reached_by.tid         = c->tid;
+	tt.next_reached_by.txn         = c->txn;
+	tt.next_reached_by.xabort_code = c->xabort_code;
+	tt.next_reached_by.aborts      = c->aborts;
+	*tid = c->tid;
+	*txn = c->txn;
+	*xabort_code = c->xabort_code;
+	*aborts = c->aborts;
+	return true;
+}
+
+/* Called at each PP while replaying from a checkpoint (the checkpoint itself
+ * included). Returns true if the PP was originally time-leapt to, in which
+ * case sets the output choice to inject, as timetravel_set() does. */
+static bool replay_step(struct ls_state *ls, const struct nobe *h,
+			unsigned int *tid, bool *txn, unsigned int *xabort_code,
+			struct abort_set *aborts)
+{
+	unsigned int len = ARRAY_LIST_SIZE(&tt.replay_steps);
+	unsigned int target_depth = tt.replay_base_depth + len;
+	struct timetravel_choice choice;
+
+	if (!tt.replaying || h->depth < tt.replay_next_depth) {
+		return false;
+	}
+	assert(h->depth == tt.replay_next_depth && h->depth <= target_depth);
+	tt.replay_next_depth++;
+
+	/* save.c reused the original nobe, checking for divergence */
+	assert(h->depth == tt.replay_base_depth ||
+	       h == timetravel_replay_pp(h->depth));
+
+	if (h->depth == target_depth) {
+		/* arrived; the replayed PPs are the very ones jumped from */
+		assert(len == 0 || h == tt.replay_run.target);
+		tt.replaying = false;
+		receive_glowing_green(ls, h, &tt.replay_run);
+		if (len > 0) {
+			lsprintf(DEV, "#%d/tid%d: replayed %u PPs from checkpoint\n",
+				 h->depth, h->chosen_thread, len);
+		}
+		choice.jumped      = true;
+		choice.tid         = tt.replay_run.tid;
+		choice.txn         = tt.replay_run.txn;
+		choice.xabort_code = tt.replay_run.xabort_code;
+		choice.aborts      = tt.replay_run.aborts;
+	} else {
+		choice = *ARRAY_LIST_GET(&tt.replay_steps,
+					 h->depth - tt.replay_base_depth);
+		if (!choice.jumped) {
+			/* originally the default choice; just keep running */
+			return false;
+		}
+	}
+
+	/* this PP's next child must remember being reached by a time leap
+	 * (unless it wasn't told to do anything different; see save_restart) */
+	tt.next_reached_by = choice;
+	tt.next_reached_by.jumped = choice.tid != TID_NONE;
+	*tid = choice.tid;
+	*txn = choice.txn;
+	*xabort_code = choice.xabort_code;
+	*aborts = choice.aborts;
+	return true;
+}
+
+/* Forking copies the page tables for all of our private memory (but not the
+ * shared arena's, being MAP_SHARED), so its cost grows with the address space.
+ * Guest RAM, with the ROM images tacked on the end of the same allocation, is
+ * the biggest part of that; it and landslide's own heap are all needed by a
+ * woken process, so nothing can be left out, but backing RAM with transparent
+ * huge pages makes it 512x fewer entries to copy. By now the RAM is already
+ * faulted in, though, and MADV_HUGEPAGE alone leaves it for khugepaged to
+ * collapse in its own time (maybe never, in a run this short); so where the
+ * kernel has it (6.1 and up), MADV_COLLAPSE does it on the spot. Returns
+ * whether it did, i.e., whether forks are any cheaper for it right now. */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+static bool hugify_guest_ram()
+{
+#ifdef MADV_HUGEPAGE
+	uintptr_t start = (uintptr_t)BX_MEM(0)->get_vector(0);
+	uintptr_t end = start + BX_MEM(0)->get_memory_len();
+	/* only whole, aligned huge pages within it can be huge */
+	start = (start + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+	end &= ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+	if (end <= start) {
+		return false;
+	} else if (madvise((void *)start, end - start, MADV_HUGEPAGE) != 0) {
+		lsprintf(DEV, "couldn't use huge pages for guest RAM: %s\n",
+			 strerror(errno));
+		return false;
+	}
+#ifdef MADV_COLLAPSE
+	if (madvise((void *)start, end - start, MADV_COLLAPSE) == 0) {
+		return true;
+	}
+	lsprintf(DEV, "couldn't collapse guest RAM into huge pages: %s\n",
+		 strerror(errno));
+#endif
+	return false;
+#else
+	lsprintf(DEV, "no huge pages on this system; forks will be slower\n");
+	return false;
+#endif
+}
+
+/* Returns 0 if the field isn't there (e.g., VmPTE on an old kernel). */
+static unsigned long proc_file_kb(const char *filename, const char *field)
+{
+	unsigned long kb = 0;
+	FILE *f = fopen(filename, "r");
+	if (f != NULL) {
+		char buf[BUF_SIZE];
+		unsigned int len = strlen(field);
+		while (fgets(buf, BUF_SIZE, f) != NULL) {
+			if (strncmp(buf, field, len) == 0 && buf[len] == ':' &&
+			    sscanf(buf + len + 1, "%lu", &kb) == 1) {
+				break;
+			}
+		}
+		fclose(f);
+	}
+	return kb;
+}
+
+/* Forks a child which exits straight away, to see what a fork costs. */
+static uint64_t measure_fork_usecs()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	int child_tid = fork();
+	if (child_tid == 0) {
+		_exit(0);
+	} else if (child_tid == -1) {
+		return 0;
+	}
+	uint64_t usecs = update_time(&tv);
+	waitpid(child_tid, NULL, 0);
+	return usecs;
+}
+
+/* Called before the first fork of all. Prints a report on what each fork
+ * will cost, which caps how many PPs per second we can hope to make. The
+ * latency before huge pages is only worth comparing if they took effect right
+ * away; otherwise the page table size is the thing to watch. */
+static void tune_address_space()
+{
+	uint64_t before = measure_fork_usecs();
+	bool collapsed = hugify_guest_ram();
+	uint64_t after = collapsed ? measure_fork_usecs() : before;
+	tt.address_space_tuned = true;
+
+	char compared[BUF_SIZE];
+	if (collapsed) {
+		scnprintf(compared, BUF_SIZE, " (%" PRIu64 " us before huge "
+			  "pages)", before);
+	} else {
+		compared[0] = '\0';
+	}
+	lsprintf(ALWAYS, "fork latency %" PRIu64 " us%s; page tables %lu kB "
+		 "for %lu kB mapped, %lu kB resident, %lu kB heap\n",
+		 after, compared,
+		 proc_file_kb("/proc/self/status", "VmPTE"),
+		 proc_file_kb("/proc/self/status", "VmSize"),
+		 proc_file_kb("/proc/self/status", "VmRSS"),
+		 proc_file_kb("/proc/self/status", "VmData"));
+}
+
+static void set_pipefd(unsigned int depth, int fd, int pid)
+{
+	while (ARRAY_LIST_SIZE(&tt.pipefds) <= depth) {
+		ARRAY_LIST_APPEND(&tt.pipefds, -1);
+		ARRAY_LIST_APPEND(&tt.dormant, -1);
+	}
+	*ARRAY_LIST_GET(&tt.pipefds, depth) = fd;
+	*ARRAY_LIST_GET(&tt.dormant, depth) = pid;
+}
+
+/* Memory accounting, for quicksand to know which jobs are worth suspending
+ * when RAM runs low. What each process of ours costs is its proportional set
+ * size: its private pages (those it or its relatives have since written to,
+ * breaking copy-on-write), plus its share of the rest; summed over all of a
+ * job's processes, this counts every page they hold exactly once. Reading it
+ * walks the process's page tables, about as costly as a fork, so it's done
+ * only when an estimate is about to be reported, and at most every so often;
+ * the numbers in between are allowed to go a little stale. */
+static unsigned long process_memory_kb(int pid)
+{
+	char filename[BUF_SIZE];
+	scnprintf(filename, BUF_SIZE, "/proc/%d/smaps_rollup", pid);
+	/* zero on kernels older than 4.14, where this file doesn't exist */
+	return proc_file_kb(filename, "Pss");
+}
+
+/* This world line's own memory plus its dormant ancestors' (in parallel mode,
+ * those below its floor only, and the result is all lines' together). */
+unsigned long timetravel_memory_kb()
+{
+	struct timeval now = tt.memory_sampled;
+	if (update_time(&now) >= MEMORY_SAMPLE_INTERVAL_USECS) {
+		unsigned long kb = process_memory_kb(getpid());
+		unsigned int i;
+		int *pid;
+		ARRAY_LIST_FOREACH(&tt.dormant, i, pid) {
+			if (*pid != -1) {
+				kb += process_memory_kb(*pid);
+			}
+		}
+		if (lines != NULL) {
+			timetravel_lock();
+			lines->memory_kb += kb - tt.memory_kb;
+			timetravel_unlock();
+		}
+		tt.memory_sampled = now;
+		tt.memory_kb = kb;
+	}
+	if (lines == NULL) {
+		return tt.memory_kb;
+	}
+	timetravel_lock();
+	unsigned long total_kb = lines->memory_kb;
+	timetravel_unlock();
+	return total_kb;
+}
+
+/* returns true in the parent process, false in the (dormant) child, which
+ * gets the read end of the pipe its parent can wake it up with */
+static bool fork_checkpoint(struct ls_state *ls, struct nobe *h, int *readfd)
 {
 	struct timetravel_pp *th = &h->time_machine;
 	int pipefd[2];
 
 	assert(!th->active);
-	assert(active_world_line && "not to be called from a timetravel child!");
 	th->active = true;
 
+	if (!tt.address_space_tuned) {
+		tune_address_space();
+	}
+
 	int ret = pipe(pipefd);
 	if (ret != 0) {
 		if (errno == EMFILE) {
@@ -180,7 +630,9 @@ bool timetravel_set(struct ls_state *ls, struct nobe *h,
 					  "is implemented?\n", h->depth);
 			} else {
 				scnprintf(msg, BUF_SIZE, "ran out of file "
-					  "descriptors at %dth PP\n", h->depth);
+					  "descriptors at %dth PP (try a bigger "
+					  "TIMETRAVEL_CHECKPOINT_INTERVAL)\n",
+					  h->depth);
 			}
 			landslide_assert_fail(msg, __FILE__, __LINE__, __func__);
 		} else {
@@ -196,65 +648,119 @@ bool timetravel_set(struct ls_state *ls, struct nobe *h,
 		landslide_assert_fail(msg, __FILE__, __LINE__, __func__);
 	} else if (child_tid != 0) {
 		/* parence process */
-		th->parent = true;
-		th->pipefd = pipefd[1];
+		set_pipefd(h->depth, pipefd[1], child_tid);
 		close(pipefd[0]);
-		return false;
+		return true;
 	}
 
 	/* child process */
-	th->parent = false;
-	th->pipefd = pipefd[0];
+	set_pipefd(h->depth, -1, -1);
+	*readfd = pipefd[0];
 	close(pipefd[1]);
 	active_world_line = false;
+	return false;
+}
 
+/* In parallel mode, a dormant process asked to spawn a line forks it off, and
+ * returns true in the child, which becomes an active world line confined to
+ * the subtree below us; or false in the parent, which keeps waiting. */
+static bool spawn_line(struct ls_state *ls, const struct nobe *h, int readfd,
+		       const struct timetravel_message *tm)
+{
+	assert(lines != NULL && tm->replay_len == 0);
+	int child_tid = fork();
+	if (child_tid == -1) {
+		char msg[BUF_SIZE];
+		scnprintf(msg, BUF_SIZE, "spawn failed at #%d/tid%d: errno %d (%s)",
+			  h->depth, h->chosen_thread, errno, strerror(errno));
+		landslide_assert_fail(msg, __FILE__, __LINE__, __func__);
+	} else if (child_tid != 0) {
+		return false;
+	}
+
+	/* the pipe is still our parent's to be woken up with; and dormant
+	 * ancestors' are whoever spawned us's to jump to, not ours */
+	close(readfd);
+	unsigned int i;
+	int *fd;
+	ARRAY_LIST_FOREACH(&tt.pipefds, i, fd) {
+		if (i < h->depth && *fd != -1) {
+			close(*fd);
+		}
+	}
+	tt.pipefds.size = 0;
+	tt.dormant.size = 0;
+	/* and we have no memory to our name yet, until sampling some */
+	memset(&tt.memory_sampled, 0, sizeof(tt.memory_sampled));
+	tt.memory_kb = 0;
+
+	active_world_line = true;
+	tt.first_branch = false;
+	memcpy(&ls->save.stats, &tm->save_stats, sizeof(struct save_statistics));
+	tt.stats_shared = tm->save_stats;
+	/* the root's process may predate an ICB reset; and whether to
+	 * increment the bound gets reported back by each line separately */
+	ls->icb_bound = tm->icb_bound;
+	ls->icb_need_increment_bound = false;
+	tt.floor_depth = h->depth;
+	tt.just_spawned = true;
+	tt.next_reached_by.jumped      = true;
+	tt.next_reached_by.tid         = tm->tid;
+	tt.next_reached_by.txn         = tm->txn;
+	tt.next_reached_by.xabort_code = tm->xabort_code;
+	tt.next_reached_by.aborts      = tm->aborts;
+	lsprintf(DEV, "#%d/tid%d: spawned a parallel line to run tid %d\n",
+		 h->depth, h->chosen_thread, tm->tid);
+	return true;
+}
+
+/* a dormant child process waits here until it's time to run again; returns
+ * true if jumped to, as timetravel_set(), or false if woken up only to replay
+ * past this checkpoint, needing a refresh of the save point. */
+static bool wait_checkpoint(struct ls_state *ls, struct nobe *h, int readfd,
+			    unsigned int *tid, bool *txn,
+			    unsigned int *xabort_code, struct abort_set *aborts)
+{
 	struct timetravel_message tm;
-	while ((ret = read(th->pipefd, &tm, sizeof(tm))) == sizeof(tm)) {
+	int ret;
+
+	/* nobe changes by other world lines appear in the shared tree by
+	 * themselves; the only thing to wait for is a message to run again. */
+	while ((ret = read(readfd, &tm, sizeof(tm))) > 0) {
+		/* the steps came in the same write; a big one may be split */
+		read_fully(readfd, (char *)&tm + ret, sizeof(tm) - ret);
 		assert(tm.magic == TIMETRAVEL_MAGIC && "bad magic");
-		if (tm.tag == TIMETRAVEL_RUN) {
-			active_world_line = true;
-			/* receive "glowing green" state from previous line */
-			memcpy(&ls->save.stats, &tm.save_stats,
-			       sizeof(struct save_statistics));
-			if (ls->icb_bound == tm.icb_bound) {
-				/* normal jump within same ICB bound; expect
-				 * "need increment" flag to be monotonic */
-				assert(!ls->icb_need_increment_bound ||
-				       tm.icb_need_increment_bound);
-				ls->icb_need_increment_bound =
-					tm.icb_need_increment_bound;
-			} else {
-				/* special ICB tree-reset jump */
-				assert(h->depth == 0);
-				assert(!tm.icb_need_increment_bound);
-				assert(!ls->icb_need_increment_bound);
-				ls->icb_bound = tm.icb_bound;
+		if (tm.tag == TIMETRAVEL_SPAWN) {
+			if (spawn_line(ls, h, readfd, &tm)) {
+				*tid = tm.tid;
+				*txn = tm.txn;
+				*xabort_code = tm.xabort_code;
+				*aborts = tm.aborts;
+				return true;
 			}
-			/* refresh for a future jump from this process */
-			th->active = false;
-			close(th->pipefd);
-			/* indicate what to do */
-			*tid = tm.tid;
-			*txn = tm.txn;
-			*xabort_code = tm.xabort_code;
-			*aborts = tm.aborts;
-			return true;
-		} else if (tm.tag == TIMETRAVEL_MODIFY_HAX) {
-			/* check sanity of the nobe we're asked to modify */
-			assert(tm.h_depth <= h->depth && "nobe from the future");
-			for (const struct nobe *h2 = h; h2 != tm.h_ro;
-			     h2 = h2->parent) {
-				assert(h2 != NULL && "h_ro not an ancestor?");
-			}
-			/* get the argument */
-			char arg[tm.arg_size];
-			ret = read(th->pipefd, arg, tm.arg_size);
-			assert(ret == tm.arg_size && "failed read arg");
-			/* update our local version of this nobe */
-			tm.cb((struct nobe *)tm.h_ro, arg);
-		} else {
-			assert(0 && "bad message tag");
+			continue;
 		}
+		assert(tm.tag == TIMETRAVEL_RUN && "bad message tag");
+		active_world_line = true;
+		tt.first_branch = false;
+		/* receive "glowing green" state from previous line */
+		receive_glowing_green(ls, h, &tm);
+		/* get the path to replay, if the target isn't us */
+		ARRAY_LIST_FREE(&tt.replay_steps);
+		ARRAY_LIST_INIT(&tt.replay_steps, MAX(tm.replay_len, 1U));
+		tt.replay_steps.size = tm.replay_len;
+		read_fully(readfd, tt.replay_steps.array,
+			   tm.replay_len * sizeof(struct timetravel_choice));
+		tt.replaying = true;
+		tt.replay_base_depth = h->depth;
+		tt.replay_next_depth = h->depth;
+		tt.replay_run = tm;
+		tt.next_reached_by.jumped = false;
+		/* refresh for a future jump from this process */
+		h->time_machine.active = false;
+		close(readfd);
+		/* indicate what to do */
+		return replay_step(ls, h, tid, txn, xabort_code, aborts);
 	}
 
 	/* got here? expect pipe closed; delete this timetravel nobe */
@@ -263,12 +769,123 @@ bool timetravel_set(struct ls_state *ls, struct nobe *h,
 	QUIT_BOCHS(LS_NO_KNOWN_BUG);
 }
 
-void timetravel_jump(struct ls_state *ls, const struct timetravel_pp *th,
+/* returns false if the parent process; true if the (just-jumped-to) child, in
+ * which case the output pointers will be set to what thread to run instead,
+ * whereupon this must be re-called to refresh the save for another jump. */
+bool timetravel_set(struct ls_state *ls, struct nobe *h,
+		    unsigned int *tid, bool *txn, unsigned int *xabort_code,
+		    struct abort_set *aborts)
+{
+	if (tt.just_spawned) {
+		/* our floor's dormant process is still there to be jumped to,
+		 * though not by us; nothing to refresh */
+		assert(h->depth == tt.floor_depth);
+		tt.just_spawned = false;
+		return false;
+	}
+	assert(!h->time_machine.active);
+	assert(active_world_line && "not to be called from a timetravel child!");
+
+	/* first time seeing this nobe (not a refresh)? record how it was made */
+	if (ARRAY_LIST_SIZE(&tt.path) == h->depth) {
+		ARRAY_LIST_APPEND(&tt.path, tt.next_reached_by);
+		tt.next_reached_by.jumped = false;
+	}
+	assert(ARRAY_LIST_SIZE(&tt.path) == h->depth + 1);
+
+	if (schedule_step(ls, h, tid, txn, xabort_code, aborts)) {
+		/* save.c will hand it to the arbiter, then call us again */
+		return true;
+	}
+
+#ifdef TIMETRAVEL_SNAPSHOTS
+	if (pct_exploring(ls) && h->depth > 0) {
+		/* randomized exploration only ever goes back to the root */
+		return false;
+	}
+	/* a jump here will come back to this very process; see below */
+	h->time_machine.active = true;
+	while (ARRAY_LIST_SIZE(&tt.snapshots) <= h->depth) {
+		ARRAY_LIST_APPEND(&tt.snapshots, NULL);
+	}
+	*ARRAY_LIST_GET(&tt.snapshots, h->depth) = snapshot_take(h->depth);
+	return false;
+#else
+	/* a spawned line can't replay from its floor, which isn't its own, so
+	 * the first PP under it always gets a process to replay from instead;
+	 * and randomized exploration only ever goes back to the root */
+	if ((!TIMETRAVEL_CHECKPOINT(h) || (pct_exploring(ls) && h->depth > 0)) &&
+	    (int)h->depth != tt.floor_depth + 1) {
+		/* no process to save here; may be passing through in replay */
+		return replay_step(ls, h, tid, txn, xabort_code, aborts);
+	}
+
+	int readfd;
+	do {
+		if (fork_checkpoint(ls, h, &readfd)) {
+			return false;
+		}
+	} while (!wait_checkpoint(ls, h, readfd, tid, txn, xabort_code, aborts));
+	return true;
+#endif
+}
+
+#ifdef TIMETRAVEL_SNAPSHOTS
+/* Unlike with processes, this returns, and the machine carries on from the
+ * target PP once we get out of the way (save.c has already rewound our own
+ * state and told the arbiter what to do). */
+void timetravel_jump(struct ls_state *ls, const struct nobe *h,
+		     unsigned int tid, bool txn, unsigned int xabort_code,
+		     struct abort_set *aborts)
+{
+	assert(h->time_machine.active && "no snapshot to jump to");
+	lsprintf(CHOICE, "tt'ing to tid %d txn %d code %d\n", tid, txn, xabort_code);
+	if (ABORT_SET_ACTIVE(aborts)) {
+		lsprintf(CHOICE, "tt'ing abort set: ");
+		print_abort_set(CHOICE, aborts);
+		printf(CHOICE, "\n");
+	}
+
+	snapshot_restore(*ARRAY_LIST_GET(&tt.snapshots, h->depth));
+
+	/* as wait_checkpoint() would have set up in the jumped-to process */
+	tt.first_branch = false;
+	tt.path.size = h->depth + 1;
+	tt.next_reached_by.jumped      = tid != TID_NONE;
+	tt.next_reached_by.tid         = tid;
+	tt.next_reached_by.txn         = txn;
+	tt.next_reached_by.xabort_code = xabort_code;
+	tt.next_reached_by.aborts      = *aborts;
+}
+
+void timetravel_delete(struct ls_state *ls, const struct nobe *h)
+{
+	if (!h->time_machine.active) {
+		/* passed over by randomized exploration; see timetravel_set */
+		return;
+	}
+	struct snapshot **s = ARRAY_LIST_GET(&tt.snapshots, h->depth);
+	snapshot_discard(*s);
+	*s = NULL;
+	((struct nobe *)h)->time_machine.active = false;
+}
+#else
+
+void timetravel_jump(struct ls_state *ls, const struct nobe *h,
 		     unsigned int tid, bool txn, unsigned int xabort_code,
 		     struct abort_set *aborts)
 {
-	assert(th->active);
-	assert(th->parent);
+	/* find the nearest checkpoint to wake up and replay from */
+	const struct nobe *checkpoint = h;
+	while (!checkpoint->time_machine.active) {
+		assert(!TIMETRAVEL_CHECKPOINT(checkpoint));
+		checkpoint = checkpoint->parent;
+		assert(checkpoint != NULL && "no checkpoint to replay from");
+	}
+	int pipefd = *ARRAY_LIST_GET(&tt.pipefds, checkpoint->depth);
+
+	assert(pipefd != -1);
+	assert((int)checkpoint->depth > tt.floor_depth && "jumped out of bounds");
 	assert(active_world_line && "not to be called from a timetravel child!");
 	lsprintf(CHOICE, "tt'ing to tid %d txn %d code %d\n", tid, txn, xabort_code);
 	if (ABORT_SET_ACTIVE(aborts)) {
@@ -281,26 +898,304 @@ void timetravel_jump(struct ls_state *ls, const struct timetravel_pp *th,
 	tm.tag         = TIMETRAVEL_RUN;
 	tm.magic       = TIMETRAVEL_MAGIC;
 	/* info about what to do */
+	tm.target      = h;
 	tm.tid         = tid;
 	tm.txn         = txn;
 	tm.xabort_code = xabort_code;
 	tm.aborts      = *aborts;
+	tm.replay_len  = h->depth - checkpoint->depth;
 	/* anything else that needs to "glow green" */
+	timetravel_share_stats(ls);
 	memcpy(&tm.save_stats, &ls->save.stats, sizeof(struct save_statistics));
+	tm.memory_sampled = tt.memory_sampled;
+	tm.memory_kb = tt.memory_kb;
 	tm.icb_bound = ls->icb_bound;
 	tm.icb_need_increment_bound = ls->icb_need_increment_bound;
-	/* send the message */
-	int ret = write(th->pipefd, &tm, sizeof(tm));
-	assert(ret == sizeof(tm) && "write failed");
+
+	/* the message and how to get from the checkpoint to the target all go
+	 * in one batch, the only thing the resumed process has to receive */
+	unsigned int size = sizeof(tm) +
+		tm.replay_len * sizeof(struct timetravel_choice);
+	char *batch = MM_XMALLOC(size, char);
+	memcpy(batch, &tm, sizeof(tm));
+	if (tm.replay_len > 0) {
+		lsprintf(DEV, "replaying %u PPs from checkpoint #%d/tid%d\n",
+			 tm.replay_len, checkpoint->depth,
+			 checkpoint->chosen_thread);
+		struct timetravel_choice *steps =
+			(struct timetravel_choice *)(batch + sizeof(tm));
+		for (const struct nobe *h2 = h; h2 != checkpoint; h2 = h2->parent) {
+			memcpy(&steps[h2->depth - checkpoint->depth - 1],
+			       ARRAY_LIST_GET(&tt.path, h2->depth),
+			       sizeof(struct timetravel_choice));
+		}
+	}
+	/* others may have the tree while we go; the new line takes it anew */
+	if (lines != NULL) {
+		assert(tt.lock_depth == 1 && "jumping from within modify_pp?");
+		timetravel_unlock();
+	}
+	write_fully(pipefd, batch, size);
+	MM_FREE(batch);
 	QUIT_BOCHS(LS_NO_KNOWN_BUG);
 }
 
-void timetravel_delete(struct ls_state *ls, const struct timetravel_pp *th)
+void timetravel_delete(struct ls_state *ls, const struct nobe *h)
 {
-	assert(th->active);
-	assert(th->parent);
 	assert(active_world_line && "not to be called from a timetravel child!");
-	close(th->pipefd);
+	if (!h->time_machine.active) {
+		/* not a checkpoint; nothing to clean up */
+		return;
+	}
+	int *pipefd = ARRAY_LIST_GET(&tt.pipefds, h->depth);
+	assert(*pipefd != -1);
+	close(*pipefd);
+	*pipefd = -1;
+	*ARRAY_LIST_GET(&tt.dormant, h->depth) = -1;
+}
+#endif
+
+/******************************************************************************
+ * schedule recording and replay
+ ******************************************************************************/
+
+bool timetravel_first_branch()
+{
+	return tt.first_branch;
+}
+
+/* Appends the choices made on the current branch at the PPs above the given
+ * depth (i.e., how the PP at that depth was reached) to the given trace. */
+void timetravel_branch_schedule(struct schedule_trace *st, unsigned int depth)
+{
+	const struct timetravel_choice *c;
+	unsigned int i;
+
+	assert(depth < ARRAY_LIST_SIZE(&tt.path));
+	/* each PP's entry says how the choice at its parent was made */
+	ARRAY_LIST_FOREACH(&tt.path, i, c) {
+		if (i <= depth && c->jumped) {
+			assert(i > 0 && "root PP can't have been jumped to");
+			schedule_trace_append(st, i - 1, c->tid, c->txn,
+					      c->xabort_code, &c->aborts);
+		}
+	}
+}
+
+/* Records the current branch, as far as it's gotten, to the given file. */
+bool timetravel_save_schedule(struct ls_state *ls, const char *filename)
+{
+	struct schedule_trace st;
+	const struct timetravel_choice *c;
+
+	schedule_trace_init(&st, ls->icb_bound);
+	if (ARRAY_LIST_SIZE(&tt.path) > 0) {
+		timetravel_branch_schedule(&st, ARRAY_LIST_SIZE(&tt.path) - 1);
+	}
+	/* the last PP's choice is still pending */
+	c = &tt.next_reached_by;
+	if (c->jumped && ARRAY_LIST_SIZE(&tt.path) > 0) {
+		schedule_trace_append(&st, ARRAY_LIST_SIZE(&tt.path) - 1, c->tid,
+				      c->txn, c->xabort_code, &c->aborts);
+	}
+
+	bool ok = schedule_trace_write(&st, filename);
+	schedule_trace_free(&st);
+	return ok;
+}
+
+/* To be called at boot, before the first PP. Makes the first branch follow
+ * the recorded one (to reproduce a bug, e.g.), then explores as usual. */
+bool timetravel_replay_schedule(struct ls_state *ls, const char *filename)
+{
+	struct schedule_trace st;
+	if (!schedule_trace_read(&st, filename)) {
+		return false;
+	}
+	lsprintf(ALWAYS, "replaying %u recorded choices from %s\n",
+		 ARRAY_LIST_SIZE(&st.choices), filename);
+	timetravel_follow_schedule(ls, &st);
+	return true;
+}
+
+/* As above, but with a trace already in hand, which this takes over. */
+void timetravel_follow_schedule(struct ls_state *ls, struct schedule_trace *st)
+{
+	assert(ARRAY_LIST_SIZE(&tt.path) == 0 && "too late to replay");
+	schedule_trace_free(&tt.schedule);
+	tt.schedule = *st;
+#ifdef ICB
+	/* enough to allow the recorded preemptions (the arbiter checks) */
+	ls->icb_bound = tt.schedule.icb_bound;
+#endif
+}
+
+/******************************************************************************
+ * parallel world lines
+ ******************************************************************************/
+
+void timetravel_lock()
+{
+	if (lines == NULL) {
+		return;
+	}
+	if (tt.lock_depth++ == 0) {
+		shared_lock(&lines->lock);
+		if (lines->stop) {
+			/* whoever stopped reports the result; not our business */
+			tt.lock_depth = 0;
+			shared_unlock(&lines->lock);
+			QUIT_BOCHS(LS_NO_KNOWN_BUG);
+		}
+	}
+}
+
+void timetravel_unlock()
+{
+	if (lines == NULL) {
+		return;
+	}
+	assert(tt.lock_depth > 0);
+	if (--tt.lock_depth == 0) {
+		shared_unlock(&lines->lock);
+	}
+}
+
+/* For asserting on: whether this line may touch state shared between lines
+ * (trivially so when there's only the one). */
+bool timetravel_locked()
+{
+	return lines == NULL || tt.lock_depth > 0;
+}
+
+/* may this line explore (i.e., set all-explored, or jump to) the given PP? */
+bool timetravel_may_explore(const struct nobe *h)
+{
+	return (int)h->depth > tt.floor_depth;
+}
+
+bool timetravel_can_spawn(const struct nobe *h)
+{
+	return lines != NULL && lines->running < TIMETRAVEL_PARALLEL_LINES &&
+		timetravel_may_explore(h) && h->time_machine.active &&
+		*ARRAY_LIST_GET(&tt.pipefds, h->depth) != -1;
+}
+
+/* Has the given PP's dormant process spawn a new line to explore the given
+ * tid from there, which the caller should already have claimed as a child
+ * (so that nobody else does). Call with the lock held. */
+void timetravel_spawn(struct ls_state *ls, const struct nobe *h, unsigned int tid)
+{
+	assert(tt.lock_depth > 0);
+	assert(timetravel_can_spawn(h));
+
+	struct timetravel_message tm;
+	tm.tag         = TIMETRAVEL_SPAWN;
+	tm.magic       = TIMETRAVEL_MAGIC;
+	tm.target      = h;
+	tm.tid         = tid;
+	tm.txn         = false;
+	tm.xabort_code = _XBEGIN_STARTED;
+	ABORT_SET_INIT_INACTIVE(&tm.aborts);
+	tm.replay_len  = 0;
+	timetravel_share_stats(ls);
+	memcpy(&tm.save_stats, &ls->save.stats, sizeof(struct save_statistics));
+	tm.memory_sampled = tt.memory_sampled;
+	tm.memory_kb = tt.memory_kb;
+	tm.icb_bound = ls->icb_bound;
+	tm.icb_need_increment_bound = false;
+
+	((struct nobe *)h)->time_machine.spawned++;
+	lines->running++;
+	lsprintf(BRANCH, "spawning a parallel line for tid %d, child of "
+		 "#%d/tid%d (%u lines running)\n", tid, h->depth,
+		 h->chosen_thread, lines->running);
+	write_fully(*ARRAY_LIST_GET(&tt.pipefds, h->depth), &tm, sizeof(tm));
+}
+
+/* Before exploring upwards past a PP, its subtrees explored by other lines
+ * must be finished, as they may yet tag its siblings, or use it as parent.
+ * Call with the lock held (once); it's let go of while waiting. */
+void timetravel_await_spawns(struct ls_state *ls, const struct nobe *h)
+{
+	if (lines == NULL || h->time_machine.spawned == 0) {
+		return;
+	}
+	assert(tt.lock_depth == 1);
+	lsprintf(DEV, "waiting for %u parallel lines below #%d/tid%d\n",
+		 h->time_machine.spawned, h->depth, h->chosen_thread);
+	while (h->time_machine.spawned > 0) {
+		/* if a line retires between letting go and sleeping, the
+		 * futex won't match, and this won't sleep at all */
+		unsigned int wakeups = lines->wakeups;
+		timetravel_unlock();
+		wait_lines(wakeups);
+		timetravel_lock();
+	}
+}
+
+/* In parallel mode, makes each line's save statistics cover all lines' work,
+ * not just its own (for estimates and the final count): adds its progress
+ * since last time to the job's, and takes the job's as its own. Call with
+ * the lock held. Each line must share before handing its stats to another
+ * process (see timetravel_jump and _spawn), which takes them as shared. */
+void timetravel_share_stats(struct ls_state *ls)
+{
+	if (lines == NULL) {
+		return;
+	}
+	assert(tt.lock_depth > 0);
+	struct save_statistics *mine = &ls->save.stats;
+#define SHARE(field) do {						\
+		lines->stats.field += mine->field - tt.stats_shared.field;	\
+		mine->field = lines->stats.field;			\
+	} while (0)
+	SHARE(total_choices);
+	SHARE(total_jumps);
+	SHARE(total_triggers);
+	SHARE(depth_total);
+	SHARE(total_usecs);
+#undef SHARE
+	/* but last_save_time is this line's own */
+	tt.stats_shared = *mine;
+}
+
+/* Called when explore() finds nothing left to do that this line may do. For a
+ * spawned line, which was only responsible for its own subtree, cleans up and
+ * quits (without ending landslide); for the original, just returns. */
+void timetravel_retire(struct ls_state *ls)
+{
+	if (lines == NULL) {
+		return;
+	} else if (tt.floor_depth == -1) {
+		/* the original line; all others have finished by now */
+		assert(lines->running == 1);
+		if (lines->icb_need_increment_bound) {
+			ls->icb_need_increment_bound = true;
+			lines->icb_need_increment_bound = false;
+		}
+		return;
+	}
+
+	assert(tt.lock_depth == 1);
+	const struct nobe *floor = ls->save.current;
+	while ((int)floor->depth > tt.floor_depth) {
+		floor = floor->parent;
+	}
+	save_abandon(&ls->save, ls, floor);
+	((struct nobe *)floor)->time_machine.spawned--;
+	lines->running--;
+	if (ls->icb_need_increment_bound) {
+		lines->icb_need_increment_bound = true;
+	}
+	lsprintf(BRANCH, "parallel line below #%d/tid%d done\n",
+		 floor->depth, floor->chosen_thread);
+	timetravel_share_stats(ls);
+	lines->memory_kb -= tt.memory_kb;
+	tt.lock_depth = 0;
+	shared_unlock(&lines->lock);
+	wake_lines();
+	QUIT_BOCHS(LS_NO_KNOWN_BUG);
 }
 
 #else
@@ -38,6 +38,7 @@
 
 struct nobe;
 struct abort_set;
+struct schedule_trace;
 
 #ifdef BOCHS
 
@@ -45,36 +46,89 @@ struct timetravel_state {
 	int pipefd; /* used to communicate exit status */
 };
 
+/* in the shared tree; per-process pipe ends are kept in timetravel.c */
 struct timetravel_pp {
-	bool active;
-	bool parent;
-	int pipefd;
+	bool active; /* false for PPs skipped by checkpoint mode */
+	unsigned int spawned; /* parallel lines exploring subtrees of this PP */
 };
 
+/* With an interval of k > 1, only every k-th PP on a branch keeps a forked
+ * process around. Jumping to any other PP instead wakes its nearest such
+ * ancestor and replays the recorded choices forward from there, trading some
+ * re-execution for a bounded number of processes (and file descriptors). */
+#ifndef TIMETRAVEL_CHECKPOINT_INTERVAL
+#define TIMETRAVEL_CHECKPOINT_INTERVAL 1
+#endif
+#define TIMETRAVEL_CHECKPOINT(h) ((h)->depth % TIMETRAVEL_CHECKPOINT_INTERVAL == 0)
+
+/* With more than one line, tagged siblings beyond the one explore() picks are
+ * handed to other processes (woken from the same dormant PPs), so that up to
+ * this many world lines run concurrently. Each may not leave the subtree it
+ * was spawned into; its owner waits for it there before exploring upwards.
+ * The shared tree is protected by a lock, which whoever runs landslide code
+ * that reads or changes it must hold (modify_pp takes it by itself). */
+#ifndef TIMETRAVEL_PARALLEL_LINES
+#define TIMETRAVEL_PARALLEL_LINES 1
+#endif
+
+/* With snapshots (see snapshot.h), there are no processes besides this one:
+ * each PP snapshots the machine in place, and a jump rewinds it, whereupon
+ * landslide's own state gets rewound from the nobe as in simics. Otherwise
+ * (TIMETRAVEL_FORKS), the jumped-to process already has all that in hand. */
+#ifdef TIMETRAVEL_SNAPSHOTS
+#if TIMETRAVEL_CHECKPOINT_INTERVAL != 1 || TIMETRAVEL_PARALLEL_LINES != 1
+#error "snapshot timetravel doesn't do checkpoint intervals or parallel lines"
+#endif
+#else
+#define TIMETRAVEL_FORKS
+#endif
+
 void timetravel_init(struct timetravel_state *ts);
-#define timetravel_pp_init(th) do { (th)->active = false; } while (0)
+#define timetravel_pp_init(th) do { (th)->active = false; (th)->spawned = 0; } while (0)
+
+void timetravel_lock();
+void timetravel_unlock();
+bool timetravel_locked();
+bool timetravel_may_explore(const struct nobe *h);
+bool timetravel_can_spawn(const struct nobe *h);
+void timetravel_spawn(struct ls_state *ls, const struct nobe *h, unsigned int tid);
+void timetravel_await_spawns(struct ls_state *ls, const struct nobe *h);
+void timetravel_share_stats(struct ls_state *ls);
+void timetravel_retire(struct ls_state *ls);
+
+/* Schedule traces (see schedule_trace.h): the current branch may be saved,
+ * and a saved one replayed from boot in place of the first branch. */
+bool timetravel_save_schedule(struct ls_state *ls, const char *filename);
+bool timetravel_replay_schedule(struct ls_state *ls, const char *filename);
+void timetravel_branch_schedule(struct schedule_trace *st, unsigned int depth);
+void timetravel_follow_schedule(struct ls_state *ls, struct schedule_trace *st);
+bool timetravel_first_branch();
+
+/* All the memory this job's world lines and their dormant processes hold, in
+ * kB, as of a recent sample (see timetravel.c). */
+unsigned long timetravel_memory_kb();
+
+/* While replaying forward from a checkpoint (see above), the nobes passed
+ * through are the original ones, and already changed the first time around. */
+bool timetravel_replaying();
+const struct nobe *timetravel_replay_pp(unsigned int depth);
 
 /* Time travel is implemented by fork()ing the simulation at each PP.
  * Accordingly, any landslide state which should "glow green" must be updated
  * very carefully -- i.e., the forked processes must see all changes by DPOR/
- * estimation/etc. To accomplish this, all nobes are protected by const, and
- * in order to change them, you need to go through this function. */
-#include <type_traits>
-void __modify_pps(void (*cb)(struct nobe *h_rw, void *), const struct nobe *h_ro,
-		    void *arg, unsigned int arg_size);
+ * estimation/etc. To accomplish this, all nobes live in the shared arena (see
+ * shared_arena.h), and are protected by const; in order to change them, you
+ * need to go through this function. Any memory the callback allocates for the
+ * nobe must come from the shared arena too. */
 template <typename T> inline void modify_pp(void (*cb)(struct nobe *h_rw, T *),
 					     const struct nobe *h_ro, T arg)
 {
 	assert(h_ro != NULL);
-#ifndef HTM_ABORT_SETS
-	/* prevent sending pointers which might be invalid in another process;
-	 * abort sets unfortunately needs to send a struct of 4 ints through
-	 * (see explore.c), which is legal, but is-fundamental can't check */
-	STATIC_ASSERT(std::is_fundamental<T>::value && "no pointers allowed!");
-#endif
-	__modify_pps((void (*)(struct nobe *, void *))cb, h_ro, &arg, sizeof(arg));
-	/* also update the version in our local memory, of course */
-	cb((struct nobe *)h_ro, &arg);
+	if (!timetravel_replaying()) {
+		timetravel_lock();
+		cb((struct nobe *)h_ro, &arg);
+		timetravel_unlock();
+	}
 }
 
 #else /* SIMICS */
@@ -85,15 +139,32 @@ struct timetravel_pp { };
 #define timetravel_init(ts)     do { (ts)->cmd_file = NULL; } while (0)
 #define timetravel_pp_init(th) do { } while (0)
 #define modify_pp(cb, h_ro, arg) ((cb)((struct nobe *)(h_ro), (arg)))
+#define timetravel_replay_pp(depth) ((const struct nobe *)NULL)
+#define TIMETRAVEL_PARALLEL_LINES 1
+#define timetravel_lock() do { } while (0)
+#define timetravel_unlock() do { } while (0)
+#define timetravel_locked() true
+#define timetravel_may_explore(h) true
+#define timetravel_can_spawn(h) false
+#define timetravel_spawn(ls, h, tid) do { } while (0)
+#define timetravel_await_spawns(ls, h) do { } while (0)
+#define timetravel_share_stats(ls) do { } while (0)
+#define timetravel_retire(ls) do { } while (0)
+#define timetravel_save_schedule(ls, filename) false
+#define timetravel_replay_schedule(ls, filename) false
+#define timetravel_branch_schedule(st, depth) do { } while (0)
+#define timetravel_follow_schedule(ls, st) do { } while (0)
+#define timetravel_first_branch() false
+#define timetravel_memory_kb() 0UL
 
 #endif
 
 bool timetravel_set(struct ls_state *ls, struct nobe *h,
 		    unsigned int *tid, bool *txn, unsigned int *xabort_code,
 		    struct abort_set *aborts);
-void timetravel_jump(struct ls_state *ls, const struct timetravel_pp *tt,
+void timetravel_jump(struct ls_state *ls, const struct nobe *h,
 		     unsigned int tid, bool txn, unsigned int xabort_code,
 		     struct abort_set *aborts);
-void timetravel_delete(struct ls_state *ls, const struct timetravel_pp *tt);
+void timetravel_delete(struct ls_state *ls, const struct nobe *h);
 
 #endif /* __LS_TIMETRAVEL_H */
@@ -35,9 +35,13 @@
 #include <stdbool.h>
 
 #include "array_list.h"
+#include "bitset.h"
+#include "fingerprint.h"
 #include "simulator.h"
+#include "sleep_set.h"
 #include "timetravel.h"
 #include "variable_queue.h"
+#include "wakeup_tree.h"
 
 struct ls_state;
 struct mem_state;
@@ -46,12 +50,27 @@ struct stack_trace;
 struct test_state;
 struct abort_set;
 
+/* see nobe's next_hb */
+struct thread_hb {
+	unsigned int tid;
+	/* this thread's most recent transition, if any */
+	const struct nobe *last;
+	/* whether any transition since then enabled it */
+	bool enabled;
+	/* 'depth + 1' bits, for the thread's next transition as h's child */
+	uint64_t *happens_before;
+};
+
 struct nobe_child {
 	int chosen_thread;
 	bool all_explored;
 	/* if xabort, then (h->)child->chosen_thread == h->chosen_thread */
 	bool xabort;
 	unsigned int xabort_code;
+#ifdef SLEEP_SETS
+	/* of the transition to the child, once it's been made */
+	struct footprint footprint;
+#endif
 };
 
 /* Represents a single preemption point in the decision tree.
@@ -93,10 +112,35 @@ struct nobe {
 
 	/**** DPOR state ****/
 
-	/* Other transitions (ancestors) that conflict with or happen-before
-	 * this one. The length of each array is given by 'depth'. */
-	const bool *conflicts;      /* if true, then they aren't independent. */
-	const bool *happens_before; /* "happens_after", really. */
+	/* Other transitions (ancestors) that conflict with this one. Packed
+	 * bitset (see bitset.h) of 'depth' bits; if set, they aren't independent. */
+	const uint64_t *conflicts;
+	/* Other transitions (ancestors) that happen-before this one. Likewise
+	 * a bitset of 'depth' bits; "happens_after", really. */
+	const uint64_t *happens_before;
+	/* What each thread's next transition as a child of this one would get
+	 * as its happens_before, kept up to date as transitions enable it (see
+	 * compute_happens_before()). Threads that never ran nor were runnable
+	 * yet have no entry: everything so far enabled them. */
+	ARRAY_LIST(struct thread_hb) next_hb;
+	/* For optimal DPOR: likewise, but counting conflicts too, which fix the
+	 * order of two transitions in this interleaving's class; transitively
+	 * closed, and NULL unless that's what explore() does. */
+	const uint64_t *branch_hb;
+	/* Was this transition already compared against its ancestors, at the
+	 * end of the first branch through it? None of what that looks at
+	 * changes afterwards in a way that could call for more tags, so
+	 * explore() stops at the first such transition up a branch. */
+	bool dpor_analyzed;
+#ifdef SLEEP_SETS
+	/* Threads not to be run here (see sleep_set.h). */
+	ARRAY_LIST(const struct sleeper) sleep_set;
+#endif
+	/* The rest of each sequence optimal DPOR wants run from here, in order
+	 * (see wakeup_tree.h). Unused by classic DPOR. */
+	ARRAY_LIST(const struct wakeup_sequence) wakeup_tree;
+	/* Of the guest state here, for stateful pruning (see fingerprint.h). */
+	struct fingerprint_pp fingerprint;
 
 	/* All branches of the subtree rooted here executed already? */
 	bool all_explored;
@@ -160,12 +204,12 @@ struct nobe {
 		{ return (type *)h->fieldname; }
 MUTABLE_FN(struct sched_state, oldsched)
 MUTABLE_FN(struct test_state, oldtest)
-MUTABLE_FN(struct stack_trace, stack_trace)
 MUTABLE_FN(struct mem_state, old_kern_mem)
 MUTABLE_FN(struct mem_state, old_user_mem)
 MUTABLE_FN(struct user_sync_state, old_user_sync)
-MUTABLE_FN(bool, conflicts)
-MUTABLE_FN(bool, happens_before)
+MUTABLE_FN(uint64_t, conflicts)
+MUTABLE_FN(uint64_t, happens_before)
+MUTABLE_FN(uint64_t, branch_hb)
 typedef ARRAY_LIST(struct nobe_child) mutable_children_t;
 static inline mutable_children_t *mutable_children(struct nobe *h)
 	{ return (mutable_children_t *)&h->children; }
@@ -180,9 +224,19 @@ static inline mutable_abort_sets_t *mutable_abort_sets_ever(struct nobe *h)
 static inline mutable_abort_sets_t *mutable_abort_sets_todo(struct nobe *h)
 	{ return (mutable_abort_sets_t *)&h->abort_sets_todo; }
 typedef Q_NEW_HEAD(struct, struct nobe) mutable_pp_children_t;
+/* Does ancestor 'old' happen-before h? */
+static inline bool get_happens_before(const struct nobe *h, const struct nobe *old)
+	{ assert(old->depth < h->depth); return bitset_get(h->happens_before, old->depth); }
+/* Is h where the thread to run next gets chosen? Not so for speculative data
+ * race PPs, nor for xbegins' second halves (see pp_parent() in explore.c),
+ * where the thread that ran before just runs on. */
+static inline bool is_choice_point(const struct nobe *h)
+	{ return h->is_preemption_point && !h->xbegin; }
+static inline bool get_conflicts(const struct nobe *h, unsigned int i)
+	{ assert(i < h->depth); return bitset_get(h->conflicts, i); }
 static inline void set_happens_before(struct nobe *h, unsigned int i, bool val)
-	{ *(bool *)&(h->happens_before[i]) = val; }
+	{ assert(i < h->depth); bitset_set(mutable_happens_before(h), i, val); }
 static inline void set_conflicts(struct nobe *h, unsigned int i, bool val)
-	{ *(bool *)&(h->conflicts[i]) = val; }
+	{ assert(i < h->depth); bitset_set(mutable_conflicts(h), i, val); }
 
 #endif
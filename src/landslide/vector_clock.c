@@ -29,6 +29,8 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <string.h>
+
 #define MODULE_NAME "VC"
 #define MODULE_COLOUR COLOUR_DARK COLOUR_BLUE
 
@@ -49,6 +51,7 @@
 
 void vc_init(struct vector_clock *vc)
 {
+	vc->sharers = NULL;
 	ARRAY_LIST_INIT(&vc->v, VC_INIT_SIZE);
 	for (unsigned int i = 0; i < VC_INIT_SIZE; i++) {
 		struct epoch bottom = { .tid = i, .timestamp = 0 };
@@ -56,15 +59,60 @@ void vc_init(struct vector_clock *vc)
 	}
 }
 
-/* don't pass something already inited for vc_new, or this will leak!  */
+/* Readies a clock to be vc_copy()d from without being written to itself, as
+ * must be the case for those in the shared decision tree (see save.c). */
+void vc_share(struct vector_clock *vc)
+{
+	if (vc->sharers == NULL) {
+		vc->sharers = MM_XMALLOC(1, unsigned int);
+		*vc->sharers = 1;
+	}
+}
+
+/* vc_new must be empty (see VC_EMPTY), or else destroyed first, lest its own
+ * reference leak. The two share storage until either is modified (see
+ * vc_unshare). */
 void vc_copy(struct vector_clock *vc_new, const struct vector_clock *vc_existing)
 {
-	unsigned int i;
-	struct epoch *e;
-	ARRAY_LIST_INIT(&vc_new->v, ARRAY_LIST_SIZE(&vc_existing->v));
-	ARRAY_LIST_FOREACH(&vc_existing->v, i, e) {
-		ARRAY_LIST_APPEND(&vc_new->v, *e);
+	/* the epochs are not changed, just who owns them */
+	struct vector_clock *vc_src = (struct vector_clock *)vc_existing;
+	assert(vc_new->v.array == NULL && vc_new->sharers == NULL &&
+	       "vc_copy would leak the clock it overwrites");
+	vc_share(vc_src);
+	(*vc_src->sharers)++;
+	vc_new->v = vc_src->v;
+	vc_new->sharers = vc_src->sharers;
+}
+
+void vc_destroy(struct vector_clock *vc)
+{
+	if (vc->sharers != NULL && *vc->sharers > 1) {
+		(*vc->sharers)--;
+	} else {
+		if (vc->sharers != NULL) {
+			MM_FREE(vc->sharers);
+		}
+		ARRAY_LIST_FREE(&vc->v);
+	}
+	VC_EMPTY(vc);
+}
+
+/* Must be called before writing to a clock's epochs. */
+static void vc_unshare(struct vector_clock *vc)
+{
+	if (vc->sharers == NULL) {
+		return;
+	} else if (*vc->sharers == 1) {
+		/* everyone else let go already */
+		MM_FREE(vc->sharers);
+	} else {
+		struct epoch *shared = vc->v.array;
+		(*vc->sharers)--;
+		vc->v.array = MM_XMALLOC(vc->v.capacity, struct epoch);
+		memcpy(vc->v.array, shared,
+		       ARRAY_LIST_SIZE(&vc->v) * sizeof(struct epoch));
 	}
+	vc->sharers = NULL;
 }
 
 static bool vc_find(struct vector_clock *vc, unsigned int tid, struct epoch **e)
@@ -93,6 +141,7 @@ static bool vc_find(struct vector_clock *vc, unsigned int tid, struct epoch **e)
 void vc_inc(struct vector_clock *vc, unsigned int tid)
 {
 	struct epoch *e;
+	vc_unshare(vc);
 	if (vc_find(vc, tid, &e)) {
 		e->timestamp++;
 	} else {
@@ -120,6 +169,12 @@ void vc_merge(struct vector_clock *vc_dest, struct vector_clock *vc_src)
 	struct epoch *e_dest;
 	struct epoch *e_src;
 
+	/* nothing new to learn? then stay shared, if we are */
+	if (vc_happens_before(vc_src, vc_dest)) {
+		return;
+	}
+	vc_unshare(vc_dest);
+
 	/* step 1: anything that vc_dest has, find it in vc_src and merge it */
 	ARRAY_LIST_FOREACH(&vc_dest->v, i, e_dest) {
 		if (vc_find(vc_src, e_dest->tid, &e_src)) {
@@ -351,6 +406,7 @@ static struct rb_node *dup_clock(const struct rb_node *nobe,
 	dest->nobe.rb_left  = dup_clock(src->nobe.rb_left,  &dest->nobe);
 
 	dest->lock_addr = src->lock_addr;
+	VC_EMPTY(&dest->c);
 	vc_copy(&dest->c, &src->c);
 
 	return &dest->nobe;
@@ -423,6 +479,7 @@ void lock_clock_set(struct lock_clocks *lc, unsigned int lock_addr,
 		/* insert a fresh one */
 		struct lock_clock *entry = MM_XMALLOC(1, struct lock_clock);
 		entry->lock_addr = lock_addr;
+		VC_EMPTY(&entry->c);
 		vc_copy(&entry->c, vc);
 
 		rb_init_node(&entry->nobe);
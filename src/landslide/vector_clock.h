@@ -41,8 +41,11 @@ struct epoch {
 	unsigned int timestamp;
 };
 
+/* Copies share their epochs until one of them is written (see vc_copy()), so
+ * snapshotting an unchanged clock costs no allocation. */
 struct vector_clock {
 	ARRAY_LIST(struct epoch) v;
+	unsigned int *sharers; /* how many clocks use v; NULL if just this one */
 };
 
 /* The global set of all vector clocks associated with each mutex/xchg.
@@ -53,9 +56,19 @@ struct lock_clocks {
 	unsigned int num_lox;
 };
 
+/* A clock with no storage of its own yet, such as vc_copy() wants to copy
+ * into, and vc_destroy() leaves behind. */
+#define VC_EMPTY(vc) do {					\
+		(vc)->v.size = 0;				\
+		(vc)->v.capacity = 0;				\
+		(vc)->v.array = NULL;				\
+		(vc)->sharers = NULL;				\
+	} while (0)
+
 void vc_init(struct vector_clock *vc);
+void vc_share(struct vector_clock *vc);
 void vc_copy(struct vector_clock *vc_new, const struct vector_clock *vc_existing);
-#define vc_destroy(vc) do { ARRAY_LIST_FREE(&(vc)->v); } while (0)
+void vc_destroy(struct vector_clock *vc);
 void vc_inc(struct vector_clock *vc, unsigned int tid);
 unsigned int vc_get(struct vector_clock *vc, unsigned int tid);
 void vc_merge(struct vector_clock *vc_dest, struct vector_clock *vc_src);
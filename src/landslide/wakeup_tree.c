@@ -0,0 +1,211 @@
+/**
+ * @file wakeup_tree.c
+ * @brief sequences of choices for optimal DPOR to explore
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#define MODULE_NAME "WAKEUP"
+#define MODULE_COLOUR COLOUR_DARK COLOUR_CYAN
+
+#include "array_list.h"
+#include "common.h"
+#include "landslide.h"
+#include "save.h"
+#include "schedule.h"
+#include "shared_arena.h"
+#include "timetravel.h"
+#include "tree.h"
+#include "wakeup_tree.h"
+
+typedef ARRAY_LIST(struct wakeup_sequence) mutable_wakeup_tree_t;
+static inline mutable_wakeup_tree_t *mutable_wakeup_tree(struct nobe *h)
+	{ return (mutable_wakeup_tree_t *)&h->wakeup_tree; }
+
+static bool is_prefix(const unsigned int *tids0, unsigned int len0,
+		      const unsigned int *tids1, unsigned int len1)
+{
+	return len0 <= len1 && memcmp(tids0, tids1, len0 * sizeof(*tids0)) == 0;
+}
+
+static void append_sequence(struct nobe *h, const unsigned int *tids,
+			    unsigned int len)
+{
+	assert(len > 0);
+	unsigned int *copy = SHARED_XMALLOC(len, unsigned int);
+	memcpy(copy, tids, len * sizeof(*tids));
+	struct wakeup_sequence w = { .len = len, .tids = copy };
+	SHARED_ARRAY_LIST_APPEND(mutable_wakeup_tree(h), w);
+}
+
+void wakeup_tree_init(struct nobe *h)
+{
+	/* as with sleep sets, most PPs never get any */
+	h->wakeup_tree.size = 0;
+	h->wakeup_tree.capacity = 0;
+	h->wakeup_tree.array = NULL;
+}
+
+void wakeup_tree_free(struct nobe *h)
+{
+	const struct wakeup_sequence *w;
+	unsigned int i;
+	ARRAY_LIST_FOREACH(&h->wakeup_tree, i, w) {
+		SHARED_FREE((unsigned int *)w->tids);
+	}
+	if (h->wakeup_tree.array != NULL) {
+		SHARED_ARRAY_LIST_FREE(mutable_wakeup_tree(h));
+	}
+}
+
+struct new_sequence {
+	const unsigned int *tids;
+	unsigned int len;
+};
+
+static void update_pp_append_sequence(struct nobe *h, struct new_sequence *ns)
+{
+	append_sequence(h, ns->tids, ns->len);
+}
+
+bool wakeup_tree_insert(const struct nobe *h, const unsigned int *tids,
+			unsigned int len)
+{
+	const struct wakeup_sequence *w;
+	unsigned int i;
+	bool redundant = false;
+
+	assert(is_choice_point(h));
+	/* the check and the insertion mustn't be split by another line's */
+	timetravel_lock();
+	ARRAY_LIST_FOREACH(&h->wakeup_tree, i, w) {
+		if (is_prefix(w->tids, w->len, tids, len) ||
+		    is_prefix(tids, len, w->tids, w->len)) {
+			redundant = true;
+			break;
+		}
+	}
+	if (!redundant) {
+		struct new_sequence ns = { .tids = tids, .len = len };
+		modify_pp(update_pp_append_sequence, h, ns);
+	}
+	timetravel_unlock();
+	return !redundant;
+}
+
+static void update_pp_pass_down(struct nobe *parent, struct nobe **child)
+{
+	struct nobe *h = *child;
+	mutable_wakeup_tree_t *tree = mutable_wakeup_tree(parent);
+	unsigned int i = 0;
+
+	while (i < ARRAY_LIST_SIZE(tree)) {
+		struct wakeup_sequence *w = ARRAY_LIST_GET(tree, i);
+		if (!is_choice_point(parent)) {
+			/* no choice was made here; it's all still to come */
+			SHARED_ARRAY_LIST_APPEND(mutable_wakeup_tree(h), *w);
+		} else if (w->tids[0] == (unsigned int)h->chosen_thread &&
+			   !h->xaborted) {
+			if (w->len > 1) {
+				append_sequence(h, w->tids + 1, w->len - 1);
+			}
+			SHARED_FREE((unsigned int *)w->tids);
+		} else {
+			i++;
+			continue;
+		}
+		ARRAY_LIST_REMOVE(tree, i);
+	}
+}
+
+void wakeup_tree_inherit(struct nobe *h)
+{
+	const struct wakeup_sequence *w;
+	struct agent *a;
+	unsigned int i;
+
+	assert(h->parent != NULL);
+	assert(ARRAY_LIST_SIZE(&h->wakeup_tree) == 0);
+	modify_pp(update_pp_pass_down, h->parent, h);
+	if (ARRAY_LIST_SIZE(&h->wakeup_tree) == 0 || !is_choice_point(h)) {
+		return;
+	}
+	lsprintf(DEV, "#%d/tid%d: following %u wakeup sequence%s\n",
+		 h->depth, h->chosen_thread, ARRAY_LIST_SIZE(&h->wakeup_tree),
+		 ARRAY_LIST_SIZE(&h->wakeup_tree) == 1 ? "" : "s");
+	/* the arbiter will follow the first; the rest need exploring after,
+	 * as does the first, if the arbiter finds it can't after all (and if
+	 * the guest went another way than the race's and can't run them, a
+	 * later branch will find the race again from where it's ended up) */
+	ARRAY_LIST_FOREACH(&h->wakeup_tree, i, w) {
+		FOR_EACH_RUNNABLE_AGENT(a, mutable_oldsched(h),
+			if (a->tid == w->tids[0] && !BLOCKED(a) &&
+			    !a->do_explore) {
+				mutable_saved_agent(mutable_oldsched(h), a)
+					->do_explore = true;
+			}
+		);
+	}
+}
+
+unsigned int wakeup_tree_upcoming(struct ls_state *ls)
+{
+	const struct nobe *h = ls->save.current;
+	const struct wakeup_sequence *w;
+	unsigned int i;
+	unsigned int tid = TID_NONE;
+
+	if (!ls->pps.optimal_dpor || h == NULL || timetravel_replaying() ||
+	    ls->save.next_xabort) {
+		/* see sleep_set_upcoming(); nor is a failure injection ever
+		 * part of a sequence */
+		return TID_NONE;
+	}
+	/* the PP about to be made gets what update_pp_pass_down() gives it */
+	timetravel_lock();
+	ARRAY_LIST_FOREACH(&h->wakeup_tree, i, w) {
+		if (!is_choice_point(h)) {
+			tid = w->tids[0];
+			break;
+		} else if (w->tids[0] == (unsigned int)ls->save.next_tid &&
+			   w->len > 1) {
+			tid = w->tids[1];
+			break;
+		}
+	}
+	timetravel_unlock();
+	return tid;
+}
+
+void wakeup_tree_restore(struct nobe *h, const unsigned int *tids,
+			 unsigned int len)
+{
+	append_sequence(h, tids, len);
+}
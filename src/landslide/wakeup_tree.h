@@ -0,0 +1,76 @@
+/**
+ * @file wakeup_tree.h
+ * @brief sequences of choices for optimal DPOR to explore
+ * @author Ben Blum
+ *
+ *
+ * Copyright (c) 2018, Ben Blum
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LS_WAKEUP_TREE_H
+#define __LS_WAKEUP_TREE_H
+
+#include <stdbool.h>
+
+#include "array_list.h"
+
+struct ls_state;
+struct nobe;
+
+/* Optimal DPOR [Abdulla et al., POPL 2014], which explore.c uses instead of
+ * its classic tagging if so configured (see pp.h). Rather than tag whichever
+ * siblings might reorder a conflicting pair of transitions, then leave it up
+ * to the arbiter what happens after, it reverses each race exactly once: from
+ * the PP before the earlier transition, it runs just those transitions that
+ * didn't depend on it, then the later one, as a "wakeup sequence" of choices
+ * to be made at each PP in turn. The first choice is a DPOR tag like any
+ * other; the rest of the sequence waits in the tagged PP's wakeup tree, and
+ * moves down with each PP made along it, for the arbiter to follow there. A
+ * race needs no new sequence if any thread which could start it is already
+ * explored (or asleep) at that PP ("source sets"), or if one already there is
+ * a prefix of the new one or vice versa (which the wakeup tree would merge).
+ * Only with SLEEP_SETS can whole subtrees be avoided once explored, which the
+ * optimality result depends on; without, it's merely fewer redundant tags. */
+struct wakeup_sequence {
+	unsigned int len;
+	const unsigned int *tids; /* in the shared arena */
+};
+
+void wakeup_tree_init(struct nobe *h);
+void wakeup_tree_free(struct nobe *h);
+/* returns false, changing nothing, if the sequence is redundant */
+bool wakeup_tree_insert(const struct nobe *h, const unsigned int *tids,
+			unsigned int len);
+/* for a new nobe: takes from its parent the rest of any sequences it began */
+void wakeup_tree_inherit(struct nobe *h);
+/* for the arbiter, before the PP is made: whom the sequence being followed
+ * wants to run there, if any */
+unsigned int wakeup_tree_upcoming(struct ls_state *ls);
+/* for resuming a suspended exploration, with the tree lock held */
+void wakeup_tree_restore(struct nobe *h, const unsigned int *tids,
+			 unsigned int len);
+
+#endif
@@ -35,7 +35,9 @@
 #include <stdint.h>
 
 #include "compiler.h"
+#include "fingerprint.h"
 #include "simulator.h"
+#include "snapshot.h"
 
 #ifdef BOCHS
 
@@ -90,6 +92,8 @@
 		unsigned int __v = (val);				\
 		assert((__w) <= 4 && "cant write so much at once");	\
 		BX_MEM(0)->writePhysicalPage((cpu), (addr), __w, &__v);	\
+		snapshot_note_write((addr), __w);			\
+		fingerprint_note_write((addr), __w);			\
 	} while (0)
 
 #else /* SIMICS */
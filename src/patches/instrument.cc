@@ -6,15 +6,24 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 
 #define MODULE_NAME "bochs glue"
 #define MODULE_COLOUR COLOUR_BOLD COLOUR_WHITE
 
+#include "annotations.h"
 #include "common.h"
+#include "fingerprint.h"
+#include "kspec.h"
 #include "landslide.h"
 #include "instrument.h"
 #include "simulator.h"
+#include "snapshot.h"
+#include "student_specifics.h"
+#include "suspend.h"
+#include "timetravel.h"
+#include "x86.h"
 
 #include "cpu/instr.h"
 
@@ -35,16 +44,67 @@ void bx_instr_initialize(unsigned cpu)
 	char buf[BUF_SIZE];
 	scnprintf(buf, BUF_SIZE, "landslide-trace-%lu.%lu.html", tv.tv_sec, tv.tv_usec);
 	ls->html_file = MM_XSTRDUP(buf);
+	scnprintf(buf, BUF_SIZE, "landslide-schedule-%lu.%lu.bin", tv.tv_sec, tv.tv_usec);
+	ls->schedule_file = MM_XSTRDUP(buf);
 
 	char *quicksand_pps = getenv("QUICKSAND_CONFIG_TEMP");
 	if (quicksand_pps != NULL) {
 		bool pps_loaded = load_dynamic_pps(ls, quicksand_pps);
 		assert(pps_loaded && "somehow failed to grok quicksands pps");
+		if (ls->pps.resume_filename != NULL) {
+			bool resumed = resume_exploration(ls, ls->pps.resume_filename);
+			assert(resumed && "failed to resume suspended exploration");
+		}
+	}
+
+	char *replay_schedule = getenv("LANDSLIDE_REPLAY_SCHEDULE");
+	if (replay_schedule != NULL) {
+		bool loaded = timetravel_replay_schedule(ls, replay_schedule);
+		assert(loaded && "failed to load schedule to replay");
 	}
 }
 
+/* Most instructions are of no interest to landslide whatsoever. Rather than
+ * dispatch them all through landslide_entrypoint(), handle those here with
+ * just the bookkeeping the rest of landslide expects, and return true. */
+static inline bool skip_instruction(struct ls_state *ls, bxInstruction_c *i)
+{
+	unsigned int eip = GET_CPU_ATTR(ls->cpu0, eip);
+
+	if (!ls->dispatch_optional || ls->just_jumped ||
+	    eip < 0x100000 || interesting_page(eip) ||
+	    (ls->trigger_count + 1) % DISPATCH_INTERVAL == 0) {
+		return false;
+	}
+	/* the opcode-keyed checks (see check_user_syscall, arbiter_interested,
+	 * and the xchg logic in the user state machine and mem tracking) */
+	if (i->opcode_bytes[0] == OPCODE_INT || i->opcode_bytes[0] == OPCODE_HLT ||
+#ifdef FILTER_DRS_BY_LAST_CALL
+	    i->opcode_bytes[0] == OPCODE_CALL ||
+#endif
+	    opcodes_are_atomic_swap(i->opcode_bytes, NULL)) {
+		return false;
+	}
+	/* a syscall return is checked on the first user instruction after */
+	if (USER_MEMORY(eip) && ls->sched.cur_agent->most_recent_syscall != 0) {
+		return false;
+	}
+
+	/* memory accesses by this instruction still get traced */
+	ls->eip = eip;
+	ls->last_instr_eip = eip;
+	memcpy(ls->instruction_text, i->opcode_bytes, TRACE_OPCODES_LEN);
+	ls->trigger_count++;
+	ls->absolute_trigger_count++;
+	return true;
+}
+
 void bx_instr_before_execution(unsigned cpu, bxInstruction_c *i)
 {
+	if (skip_instruction(GET_LANDSLIDE(), i)) {
+		return;
+	}
+
 	struct trace_entry entry;
 	entry.type = TRACE_INSTRUCTION;
 	entry.instruction_text = i->opcode_bytes;
@@ -58,9 +118,23 @@ void bx_instr_lin_access(unsigned cpu, bx_address lin, bx_address phy, unsigned
 	entry.va = lin;
 	entry.pa = phy;
 	entry.write = rw == BX_WRITE || rw == BX_RW;
+	if (entry.write) {
+		/* whether or not landslide cares about the access itself */
+		snapshot_note_write(phy, len);
+		fingerprint_note_write(phy, len);
+	}
 	landslide_entrypoint(GET_LANDSLIDE(), &entry);
 }
 
+/* e.g. page table walks setting accessed/dirty bits */
+void bx_instr_phy_access(unsigned cpu, bx_address phy, unsigned len, unsigned memtype, unsigned rw)
+{
+	if (rw == BX_WRITE || rw == BX_RW) {
+		snapshot_note_write(phy, len);
+		fingerprint_note_write(phy, len);
+	}
+}
+
 void bx_instr_interrupt(unsigned cpu, unsigned vector)
 {
 	struct trace_entry entry;
@@ -116,8 +190,6 @@ void bx_instr_inp(Bit16u addr, unsigned len) {}
 void bx_instr_inp2(Bit16u addr, unsigned len, unsigned val) {}
 void bx_instr_outp(Bit16u addr, unsigned len, unsigned val) {}
 
-void bx_instr_phy_access(unsigned cpu, bx_address phy, unsigned len, unsigned memtype, unsigned rw) {}
-
 void bx_instr_wrmsr(unsigned cpu, unsigned addr, Bit64u value) {}
 
 void bx_instr_vmexit(unsigned cpu, Bit32u reason, Bit64u qualification) {}